@@ -33,6 +33,8 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <limits.h>
+#include <errno.h>
 #ifdef HAVE_STDLIB_H
 #include <stdlib.h>
 #endif
@@ -40,28 +42,813 @@
 #include <unistd.h>
 #endif
 #include <sys/types.h>
+#include <time.h>
 
 #include <redland.h>
 #include <rdf_storage.h>
 #include <rdf_heuristics.h>
+#include <rdf_query.h>
+#include <rasqal.h>
+
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
 
 #include <cassandra.h>
+#include <cassandra_queue.h>
+#include <cassandra_dict.h>
+#include <cassandra_cache.h>
+#include <cassandra_bloom.h>
+#include <cassandra_lz.h>
+#include <cassandra_writes.h>
+#include <rdf_storage_cassandra.h>
+
+/* Every fixed CQL statement the storage issues.  These are prepared once
+   per session when the storage is opened, and bound against thereafter.
+   The CQL in this file is written for keyspace rdf, and rewritten for
+   the keyspace option by cassandra_keyspace_cql. */
+typedef enum {
+    CASSANDRA_QUERY_,		/* ??? */
+    CASSANDRA_QUERY_S,		/* S?? */
+    CASSANDRA_QUERY_P,		/* ?P? */
+    CASSANDRA_QUERY_SP,		/* SP? */
+    CASSANDRA_QUERY_O,		/* ??O */
+    CASSANDRA_QUERY_SO,		/* S?O */
+    CASSANDRA_QUERY_PO,		/* ?PO */
+    CASSANDRA_QUERY_SPO,	/* SPO */
+    CASSANDRA_INSERT_SPO,
+    CASSANDRA_INSERT_POS,
+    CASSANDRA_INSERT_OSP,
+    CASSANDRA_DELETE_SPO,
+    CASSANDRA_DELETE_POS,
+    CASSANDRA_DELETE_OSP,
+    CASSANDRA_COUNT,
+    CASSANDRA_SCAN,		/* ??? over one token range */
+    CASSANDRA_CONTAINS,
+    CASSANDRA_COUNT_ADD,
+    CASSANDRA_COUNT_READ,
+    CASSANDRA_ESTIMATE,
+    CASSANDRA_RANGE,		/* ?P? over a slice of objects */
+    CASSANDRA_BUCKETS_GET,	/* Bucketed layout only */
+    CASSANDRA_BUCKETS_ADD,
+    CASSANDRA_BUCKETS_ALL,
+    CASSANDRA_BUCKET_ROWS_GET,
+    CASSANDRA_BUCKET_ROWS_ADD,
+    CASSANDRA_NAMESPACES_ALL,	/* With a namespace dictionary only */
+    CASSANDRA_NAMESPACE_PUT,
+    CASSANDRA_NAMESPACE_GET,
+    CASSANDRA_TERM_GET_ID,	/* Dictionary layout only */
+    CASSANDRA_ID_GET_TERM,
+    CASSANDRA_ID_PUT,
+    CASSANDRA_TERM_PUT,
+    CASSANDRA_INSERT_CSPO,	/* Quads layout only */
+    CASSANDRA_DELETE_CSPO,
+    CASSANDRA_CONTAINS_QUAD,
+    CASSANDRA_CONTEXT_READ,
+    CASSANDRA_CONTEXT_PUT,
+    CASSANDRA_CONTEXTS_ALL,
+    CASSANDRA_CONTEXT_CLEAR,
+    CASSANDRA_CONTEXT_DROP,
+    CASSANDRA_REMOVE_,		/* Deletes of the find patterns' rows */
+    CASSANDRA_REMOVE_S,
+    CASSANDRA_REMOVE_P,
+    CASSANDRA_REMOVE_SP,
+    CASSANDRA_REMOVE_O,
+    CASSANDRA_REMOVE_SO,
+    CASSANDRA_REMOVE_PO,
+    CASSANDRA_REMOVE_SPO,
+    CASSANDRA_NUM_STATEMENTS
+} cassandra_statement_id;
+
+/* The find queries, CASSANDRA_QUERY_ to CASSANDRA_QUERY_SPO, and their
+   deletes, CASSANDRA_REMOVE_ to CASSANDRA_REMOVE_SPO, are left out: the
+   planner writes them for each storage. */
+static const char* cassandra_statements[CASSANDRA_NUM_STATEMENTS] = {
+    0, 0, 0, 0, 0, 0, 0, 0,
+    "INSERT INTO rdf.spo (s, p, o) VALUES (?, ?, ?);",
+    "INSERT INTO rdf.pos (s, p, o) VALUES (?, ?, ?);",
+    "INSERT INTO rdf.osp (s, p, o) VALUES (?, ?, ?);",
+    "DELETE FROM rdf.spo WHERE s = ? AND p = ? AND o = ?;",
+    "DELETE FROM rdf.pos WHERE p = ? AND o = ? AND s = ?;",
+    "DELETE FROM rdf.osp WHERE o = ? AND s = ? AND p = ?;",
+    "SELECT count(s) FROM rdf.spo;",
+    "SELECT s, p, o FROM rdf.spo WHERE token(s) > ? AND token(s) <= ?;",
+    "SELECT s FROM rdf.spo WHERE s = ? AND p = ? AND o = ? LIMIT 1;",
+    "UPDATE rdf.counts SET triples = triples + ? WHERE shard = ?;",
+    "SELECT triples FROM rdf.counts;",
+    "SELECT range_start, range_end, partitions_count, mean_partition_size "
+    "FROM system.size_estimates "
+    "WHERE keyspace_name = 'rdf' AND table_name = ?;",
+    "SELECT s, p, o FROM rdf.pos WHERE p = ? AND o >= ? AND o < ?;",
+    "SELECT counts FROM rdf.buckets WHERE tbl = ? AND key = ?;",
+    "UPDATE rdf.buckets SET counts = counts + ? WHERE tbl = ? AND key = ?;",
+    "SELECT tbl, key, counts FROM rdf.buckets;",
+    "SELECT rows FROM rdf.bucket_rows WHERE tbl = ? AND key = ?;",
+    "UPDATE rdf.bucket_rows SET rows = rows + ? WHERE tbl = ? AND key = ?;",
+    "SELECT id, uri FROM rdf.namespaces;",
+    "INSERT INTO rdf.namespaces (id, uri) VALUES (?, ?) IF NOT EXISTS;",
+    "SELECT uri FROM rdf.namespaces WHERE id = ?;",
+    0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0
+};
+
+/* The dictionary-encoded layout.  Terms are stored once, in rdf.terms
+   (term -> id) and rdf.ids (id -> term), and the index tables hold
+   bigint ids. */
+static const char* cassandra_dict_statements[CASSANDRA_NUM_STATEMENTS] = {
+    0, 0, 0, 0, 0, 0, 0, 0,
+    "INSERT INTO rdf.spo_ids (s, p, o) VALUES (?, ?, ?);",
+    "INSERT INTO rdf.pos_ids (s, p, o) VALUES (?, ?, ?);",
+    "INSERT INTO rdf.osp_ids (s, p, o) VALUES (?, ?, ?);",
+    "DELETE FROM rdf.spo_ids WHERE s = ? AND p = ? AND o = ?;",
+    "DELETE FROM rdf.pos_ids WHERE p = ? AND o = ? AND s = ?;",
+    "DELETE FROM rdf.osp_ids WHERE o = ? AND s = ? AND p = ?;",
+    "SELECT count(s) FROM rdf.spo_ids;",
+    "SELECT s, p, o FROM rdf.spo_ids WHERE token(s) > ? AND token(s) <= ?;",
+    "SELECT s FROM rdf.spo_ids WHERE s = ? AND p = ? AND o = ? LIMIT 1;",
+    "UPDATE rdf.counts SET triples = triples + ? WHERE shard = ?;",
+    "SELECT triples FROM rdf.counts;",
+    "SELECT range_start, range_end, partitions_count, mean_partition_size "
+    "FROM system.size_estimates "
+    "WHERE keyspace_name = 'rdf' AND table_name = ?;",
+    0,				/* Ids don't sort by value */
+    "SELECT counts FROM rdf.buckets WHERE tbl = ? AND key = ?;",
+    "UPDATE rdf.buckets SET counts = counts + ? WHERE tbl = ? AND key = ?;",
+    "SELECT tbl, key, counts FROM rdf.buckets;",
+    "SELECT rows FROM rdf.bucket_rows WHERE tbl = ? AND key = ?;",
+    "UPDATE rdf.bucket_rows SET rows = rows + ? WHERE tbl = ? AND key = ?;",
+    "SELECT id, uri FROM rdf.namespaces;",
+    "INSERT INTO rdf.namespaces (id, uri) VALUES (?, ?) IF NOT EXISTS;",
+    "SELECT uri FROM rdf.namespaces WHERE id = ?;",
+    "SELECT id FROM rdf.terms WHERE term = ?;",
+    "SELECT term FROM rdf.ids WHERE id = ?;",
+    "INSERT INTO rdf.ids (id, term) VALUES (?, ?) IF NOT EXISTS;",
+    "INSERT INTO rdf.terms (term, id) VALUES (?, ?);",
+    0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0
+};
+
+/* The quads layout.  The index tables have a context column c after the
+   triple, which is empty for a triple in no context.  rdf.cspo holds the
+   triples of each context in one partition, and rdf.contexts lists the
+   contexts.  Every statement binds s, p and o before c. */
+static const char* cassandra_quad_statements[CASSANDRA_NUM_STATEMENTS] = {
+    0, 0, 0, 0, 0, 0, 0, 0,
+    "INSERT INTO rdf.spoc (s, p, o, c) VALUES (?, ?, ?, ?);",
+    "INSERT INTO rdf.posc (s, p, o, c) VALUES (?, ?, ?, ?);",
+    "INSERT INTO rdf.ospc (s, p, o, c) VALUES (?, ?, ?, ?);",
+    "DELETE FROM rdf.spoc WHERE s = ? AND p = ? AND o = ? AND c = ?;",
+    "DELETE FROM rdf.posc WHERE p = ? AND o = ? AND s = ? AND c = ?;",
+    "DELETE FROM rdf.ospc WHERE o = ? AND s = ? AND p = ? AND c = ?;",
+    "SELECT count(s) FROM rdf.spoc;",
+    "SELECT s, p, o, c FROM rdf.spoc WHERE token(s) > ? AND token(s) <= ?;",
+    "SELECT s FROM rdf.spoc WHERE s = ? AND p = ? AND o = ? LIMIT 1;",
+    "UPDATE rdf.counts SET triples = triples + ? WHERE shard = ?;",
+    "SELECT triples FROM rdf.counts;",
+    "SELECT range_start, range_end, partitions_count, mean_partition_size "
+    "FROM system.size_estimates "
+    "WHERE keyspace_name = 'rdf' AND table_name = ?;",
+    "SELECT s, p, o, c FROM rdf.posc WHERE p = ? AND o >= ? AND o < ?;",
+    0, 0, 0, 0, 0,		/* Not bucketed */
+    "SELECT id, uri FROM rdf.namespaces;",
+    "INSERT INTO rdf.namespaces (id, uri) VALUES (?, ?) IF NOT EXISTS;",
+    "SELECT uri FROM rdf.namespaces WHERE id = ?;",
+    0, 0, 0, 0,
+    "INSERT INTO rdf.cspo (s, p, o, c) VALUES (?, ?, ?, ?);",
+    "DELETE FROM rdf.cspo WHERE s = ? AND p = ? AND o = ? AND c = ?;",
+    "SELECT s FROM rdf.spoc WHERE s = ? AND p = ? AND o = ? AND c = ?;",
+    "SELECT s, p, o, c FROM rdf.cspo WHERE c = ?;",
+    "INSERT INTO rdf.contexts (c) VALUES (?);",
+    "SELECT c FROM rdf.contexts;",
+    "DELETE FROM rdf.cspo WHERE c = ?;",
+    "DELETE FROM rdf.contexts WHERE c = ?;",
+    0, 0, 0, 0, 0, 0, 0, 0
+};
+
+/* The bucketed layout's pos and osp tables, whose partitions are split
+   into buckets: CASSANDRA_INSERT_POS, CASSANDRA_INSERT_OSP,
+   CASSANDRA_RANGE, CASSANDRA_DELETE_POS and CASSANDRA_DELETE_OSP, for
+   the plain and the dictionary layouts.  A delete binds the bucket
+   last, after the terms. */
+static const char* cassandra_bucket_statements[2][5] = {
+    { "INSERT INTO rdf.pos_buckets (s, p, o, b) VALUES (?, ?, ?, ?);",
+      "INSERT INTO rdf.osp_buckets (s, p, o, b) VALUES (?, ?, ?, ?);",
+      "SELECT s, p, o FROM rdf.pos_buckets "
+      "WHERE p = ? AND b = ? AND o >= ? AND o < ?;",
+      "DELETE FROM rdf.pos_buckets WHERE p = ? AND o = ? AND s = ? "
+      "AND b = ?;",
+      "DELETE FROM rdf.osp_buckets WHERE o = ? AND s = ? AND p = ? "
+      "AND b = ?;" },
+    { "INSERT INTO rdf.pos_ids_buckets (s, p, o, b) VALUES (?, ?, ?, ?);",
+      "INSERT INTO rdf.osp_ids_buckets (s, p, o, b) VALUES (?, ?, ?, ?);",
+      0,
+      "DELETE FROM rdf.pos_ids_buckets WHERE p = ? AND o = ? AND s = ? "
+      "AND b = ?;",
+      "DELETE FROM rdf.osp_ids_buckets WHERE o = ? AND s = ? AND p = ? "
+      "AND b = ?;" }
+};
+
+/* Keyspace of the catalog of datasets, which maps each to the keyspace
+   it is published in. */
+#define CASSANDRA_CATALOG "rdf_datasets"
+
+/* Tables of the keyspace, each a bit of a cassandra_schema's tables. */
+typedef enum {
+    CASSANDRA_TABLE_PROPERTIES,
+    CASSANDRA_TABLE_COUNTS,
+    CASSANDRA_TABLE_NAMESPACES,
+    CASSANDRA_TABLE_SPO,
+    CASSANDRA_TABLE_POS,
+    CASSANDRA_TABLE_OSP,
+    CASSANDRA_TABLE_TERMS,
+    CASSANDRA_TABLE_IDS,
+    CASSANDRA_TABLE_SPO_IDS,
+    CASSANDRA_TABLE_POS_IDS,
+    CASSANDRA_TABLE_OSP_IDS,
+    CASSANDRA_TABLE_POS_BUCKETS,
+    CASSANDRA_TABLE_OSP_BUCKETS,
+    CASSANDRA_TABLE_POS_IDS_BUCKETS,
+    CASSANDRA_TABLE_OSP_IDS_BUCKETS,
+    CASSANDRA_TABLE_BUCKETS,
+    CASSANDRA_TABLE_SPOC,
+    CASSANDRA_TABLE_POSC,
+    CASSANDRA_TABLE_OSPC,
+    CASSANDRA_TABLE_CSPO,
+    CASSANDRA_TABLE_CONTEXTS,
+    CASSANDRA_TABLE_BUCKET_ROWS,
+    CASSANDRA_NUM_TABLES
+} cassandra_table_id;
+
+#define CASSANDRA_TABLE_BIT(t) (1UL << (t))
+
+/* Name and CQL of each table, indexed by cassandra_table_id.  Each %s
+   is the type of a column holding terms, and table settings are added
+   as a WITH clause. */
+static const char* const cassandra_tables[CASSANDRA_NUM_TABLES][2] = {
+    { "properties",
+      "CREATE TABLE IF NOT EXISTS rdf.properties ("
+      "  name text primary key, value text"
+      ");" },
+    { "counts",
+      "CREATE TABLE IF NOT EXISTS rdf.counts ("
+      "  shard int primary key, triples counter"
+      ");" },
+    { "namespaces",
+      "CREATE TABLE IF NOT EXISTS rdf.namespaces ("
+      "  id int primary key, uri text"
+      ");" },
+    { "spo",
+      "CREATE TABLE IF NOT EXISTS rdf.spo ("
+      "  s %s, p %s, o %s,"
+      "  primary key(s, p, o)"
+      ");" },
+    { "pos",
+      "CREATE TABLE IF NOT EXISTS rdf.pos ("
+      "  s %s, p %s, o %s,"
+      "  primary key(p, o, s)"
+      ");" },
+    { "osp",
+      "CREATE TABLE IF NOT EXISTS rdf.osp ("
+      "  s %s, p %s, o %s,"
+      "  primary key(o, s, p)"
+      ");" },
+    { "terms",
+      "CREATE TABLE IF NOT EXISTS rdf.terms ("
+      "  term %s primary key, id bigint"
+      ");" },
+    { "ids",
+      "CREATE TABLE IF NOT EXISTS rdf.ids ("
+      "  id bigint primary key, term %s"
+      ");" },
+    { "spo_ids",
+      "CREATE TABLE IF NOT EXISTS rdf.spo_ids ("
+      "  s bigint, p bigint, o bigint,"
+      "  primary key(s, p, o)"
+      ");" },
+    { "pos_ids",
+      "CREATE TABLE IF NOT EXISTS rdf.pos_ids ("
+      "  s bigint, p bigint, o bigint,"
+      "  primary key(p, o, s)"
+      ");" },
+    { "osp_ids",
+      "CREATE TABLE IF NOT EXISTS rdf.osp_ids ("
+      "  s bigint, p bigint, o bigint,"
+      "  primary key(o, s, p)"
+      ");" },
+    { "pos_buckets",
+      "CREATE TABLE IF NOT EXISTS rdf.pos_buckets ("
+      "  s %s, p %s, o %s, b int,"
+      "  primary key((p, b), o, s)"
+      ");" },
+    { "osp_buckets",
+      "CREATE TABLE IF NOT EXISTS rdf.osp_buckets ("
+      "  s %s, p %s, o %s, b int,"
+      "  primary key((o, b), s, p)"
+      ");" },
+    { "pos_ids_buckets",
+      "CREATE TABLE IF NOT EXISTS rdf.pos_ids_buckets ("
+      "  s bigint, p bigint, o bigint, b int,"
+      "  primary key((p, b), o, s)"
+      ");" },
+    { "osp_ids_buckets",
+      "CREATE TABLE IF NOT EXISTS rdf.osp_ids_buckets ("
+      "  s bigint, p bigint, o bigint, b int,"
+      "  primary key((o, b), s, p)"
+      ");" },
+    { "buckets",
+      "CREATE TABLE IF NOT EXISTS rdf.buckets ("
+      "  tbl text, key %s, counts set<int>,"
+      "  primary key((tbl, key))"
+      ");" },
+    { "spoc",
+      "CREATE TABLE IF NOT EXISTS rdf.spoc ("
+      "  s %s, p %s, o %s, c %s,"
+      "  primary key(s, p, o, c)"
+      ");" },
+    { "posc",
+      "CREATE TABLE IF NOT EXISTS rdf.posc ("
+      "  s %s, p %s, o %s, c %s,"
+      "  primary key(p, o, s, c)"
+      ");" },
+    { "ospc",
+      "CREATE TABLE IF NOT EXISTS rdf.ospc ("
+      "  s %s, p %s, o %s, c %s,"
+      "  primary key(o, s, p, c)"
+      ");" },
+    { "cspo",
+      "CREATE TABLE IF NOT EXISTS rdf.cspo ("
+      "  s %s, p %s, o %s, c %s,"
+      "  primary key(c, s, p, o)"
+      ");" },
+    { "contexts",
+      "CREATE TABLE IF NOT EXISTS rdf.contexts ("
+      "  c %s primary key"
+      ");" },
+    { "bucket_rows",
+      "CREATE TABLE IF NOT EXISTS rdf.bucket_rows ("
+      "  tbl text, key %s, rows counter,"
+      "  primary key((tbl, key))"
+      ");" }
+};
+
+/* The three index tables, each holding every triple under a different
+   key order.  The first key column is the partition key and the other
+   two are clustering columns. */
+typedef enum { SPO, POS, OSP } index_type;
+
+static const struct {
+    const char* name;
+    int key[3];			/* Triple positions: s = 0, p = 1, o = 2 */
+} cassandra_indexes[3] = {
+    { "spo", { 0, 1, 2 } },
+    { "pos", { 1, 2, 0 } },
+    { "osp", { 2, 0, 1 } }
+};
+
+/* How a find pattern is read: from which index, with its first bound key
+   columns restricted by equality. */
+typedef struct {
+    index_type index;
+    int bound;
+} cassandra_plan;
+
+/* How size() counts triples: from the counter table maintained by
+   writes, from the server's partition size estimates, or by counting
+   every row. */
+typedef enum {
+    CASSANDRA_SIZE_COUNTER,
+    CASSANDRA_SIZE_ESTIMATE,
+    CASSANDRA_SIZE_SCAN
+} cassandra_size_mode;
+
+/* The parts of a node which its encoding is made from. */
+typedef struct
+{
+    librdf_node_type type;
+    const char* value;
+    const char* datatype;	/* Literal datatype URI, or 0 */
+    const char* language;	/* Literal language, or 0 */
+} cassandra_term;
+
+/* Datatypes the compact term encoding writes as an id: the index here
+   plus one.  The ids are stored, so new datatypes only ever go on the
+   end.  The first three are the types with a sortable encoding. */
+#define CASSANDRA_NUM_DATATYPES 15
+#define CASSANDRA_XSD_INTEGER 0
+#define CASSANDRA_XSD_FLOAT 1
+#define CASSANDRA_XSD_DATETIME 2
+
+static const char* cassandra_datatypes[CASSANDRA_NUM_DATATYPES] = {
+    "http://www.w3.org/2001/XMLSchema#integer",
+    "http://www.w3.org/2001/XMLSchema#float",
+    "http://www.w3.org/2001/XMLSchema#dateTime",
+    "http://www.w3.org/2001/XMLSchema#string",
+    "http://www.w3.org/2001/XMLSchema#boolean",
+    "http://www.w3.org/2001/XMLSchema#decimal",
+    "http://www.w3.org/2001/XMLSchema#double",
+    "http://www.w3.org/2001/XMLSchema#date",
+    "http://www.w3.org/2001/XMLSchema#time",
+    "http://www.w3.org/2001/XMLSchema#long",
+    "http://www.w3.org/2001/XMLSchema#int",
+    "http://www.w3.org/2001/XMLSchema#nonNegativeInteger",
+    "http://www.w3.org/2001/XMLSchema#gYear",
+    "http://www.w3.org/2001/XMLSchema#anyURI",
+    "http://www.w3.org/1999/02/22-rdf-syntax-ns#XMLLiteral"
+};
+
+/* A triple waiting to be written, as encoded terms, and its context in
+   the quads layout, or 0. */
+typedef struct
+{
+    char* s;
+    char* p;
+    char* o;
+    char* c;
+} cassandra_triple;
+
+/* One index row of a pending triple.  The key is the partition key of
+   the row's table: s for spo, p for pos, o for osp, c for cspo, and the
+   bucket within it in the bucketed layout. */
+typedef struct
+{
+    cassandra_statement_id insert;
+    const char* key;
+    int bucket;
+    cassandra_triple* triple;
+} cassandra_pending_row;
+
+/* A write in the write window: its future, and the statement or batch
+   it sent, which is sent again once if the server had forgotten the
+   prepared statement id it was bound from. */
+typedef struct
+{
+    CassFuture* future;
+    cassandra_statement_id id;
+    CassStatement* stmt;
+    CassBatch* batch;
+    int retried;
+} cassandra_write;
+
+/* What is known of the buckets of one pos or osp partition key. */
+typedef struct
+{
+    int buckets;		/* Highest count recorded, at least 1 */
+    time_t checked;		/* When read from rdf.buckets, or 0 */
+    int64_t stored;		/* Rows counted in rdf.bucket_rows */
+    int64_t unsent;		/* Sampled rows not yet added to it */
+    unsigned long written;	/* Rows written since it was last read */
+} cassandra_bucket_info;
+
+/* Driver settings of the connection to the cluster: threads,
+   connections, timeouts and the load balancing and speculative
+   execution policies.  Timeouts and delays are in milliseconds. */
+typedef struct {
+    unsigned port;
+    unsigned io_threads;
+    unsigned connections;
+    unsigned request_timeout;
+    unsigned connect_timeout;
+    int token_aware;
+    int latency_aware;
+    char local_dc[64];		/* DC-aware routing's local DC, or "" */
+    unsigned remote_hosts;	/* Hosts used in each remote DC */
+    unsigned speculative_delay;	/* 0 for no speculative execution */
+    int speculative_executions;
+} cassandra_cluster_config;
+
+/* A statement prepared on a shared session, keyed by its CQL. */
+typedef struct cassandra_shared_statement_
+{
+    char* cql;
+    const CassPrepared* prepared;
+    struct cassandra_shared_statement_* next;
+} cassandra_shared_statement;
+
+/* A session shared by every storage instance in the process connected
+   to the same contact points with the same cluster settings, and the
+   statements prepared on it.  The last instance using it tears it
+   down.  Settings are compared with memcmp, so a config is always
+   copied whole from a preset and its strings padded with zeros. */
+typedef struct cassandra_shared_
+{
+    char* name;
+    cassandra_cluster_config config;
+    CassCluster* cluster;
+    CassSession* session;
+    int references;
+    cassandra_shared_statement* statements;
+#ifdef HAVE_PTHREAD_H
+    pthread_mutex_t lock;	/* Guards statements */
+#endif
+    struct cassandra_shared_* next;
+} cassandra_shared;
 
 typedef struct
 {
     librdf_storage *storage;
 
     int is_new;
-  
+
     char *name;
     size_t name_len;
 
+    /* The shared session, and its driver session. */
+    cassandra_shared* shared;
     CassSession* session;
-    CassCluster* cluster;
+
+    /* Keyspace of the storage's tables, the replication it is created
+       with, and the WITH clause each table is created with, or 0 for
+       the defaults.  cql holds each statement's CQL rewritten for the
+       keyspace. */
+    char* keyspace;
+    char replication[256];
+    char* table_options[CASSANDRA_NUM_TABLES];
+    char* cql[CASSANDRA_NUM_STATEMENTS];
+
+    /* CQL of the storage layout in use, and its prepared statements,
+       which belong to the shared session, both indexed by
+       cassandra_statement_id. */
+    const char* statements[CASSANDRA_NUM_STATEMENTS];
+    const CassPrepared* prepared[CASSANDRA_NUM_STATEMENTS];
+
+    /* The plan of each find pattern, and the CQL written for it and for
+       deleting its rows from the planned table, indexed by pattern bits
+       s = 1, p = 2, o = 4.  last_pattern is the pattern of the latest
+       find, or -1. */
+    cassandra_plan plans[8];
+    char* queries[8];
+    char* removes[8];
+    int last_pattern;
+
+    /* Term <-> id cache, only in the dictionary layout. */
+    cassandra_dict* dict;
+
+    /* Whether the quads layout is in use, in which statements are kept
+       with their context. */
+    int quads;
+
+    /* Open streams of batched lookups, which
+       librdf_storage_cassandra_batch_index looks up. */
+    struct cassandra_scan_stream_str* batches;
+
+    /* Statements which had to be prepared outside of open, and statements
+       prepared again after the server reported them unprepared. */
+    unsigned long prepare_misses;
+    unsigned long reprepares;
+
+    /* Asynchronous write window: up to write_window writes are kept in
+       flight by add_statements. */
+    cassandra_write* writes;
+    int write_window;
+    int writes_pending;
+    int write_errors;
+
+    /* Triples buffered by the write scheduler, and the limits it works
+       to. */
+    cassandra_triple* pending;
+    int pending_count;
+    int write_buffer;
+    size_t batch_bytes;
+
+    /* Write set of the transaction in progress, or 0, and the most bytes
+       it may hold. */
+    cassandra_writes* transaction;
+    size_t transaction_bytes;
+
+    /* Encoder threads used by a pipelined add_statements, 0 to load on
+       the calling thread.  Triples/sec of each stage of the last
+       pipelined load. */
+    int load_threads;
+    double load_rate[3];
+
+    /* Result pages find_statements streams fetch ahead of the reader. */
+    int prefetch;
+
+    /* Token ranges a full scan is split into, and how many of them are
+       read at once.  A parallelism of 1 scans with a single query. */
+    int scan_ranges;
+    int scan_parallelism;
+
+    /* Queries a batched lookup runs at once. */
+    int lookup_parallelism;
+
+    /* Whether integer, float and dateTime literals are written in their
+       sortable encoding.  Fixed by the keyspace at open; sortable_option
+       is what the options asked for, or -1. */
+    int sortable;
+    int sortable_option;
+
+    /* Whether terms are stored in the compact encoding, in blob
+       columns, rather than as text.  Fixed by the keyspace's schema at
+       open; encoding is what the options asked for, or -1. */
+    int compact;
+    int encoding;
+
+    /* Namespaces the compact encoding writes as a short id, or 0 when
+       the keyspace has no rdf.namespaces table; namespaces is whether
+       the options asked for one.  Ids are handed out in order, so
+       namespace_count is the next to claim, and once all are taken the
+       set never changes.  namespace_checked is when rdf.namespaces was
+       last read.  The load pipeline's threads share the dictionary under
+       namespace_lock. */
+    int namespaces;
+    cassandra_dict* namespace_dict;
+    int namespace_count;
+    time_t namespace_checked;
+#ifdef HAVE_PTHREAD_H
+    pthread_mutex_t namespace_lock;
+#endif
+
+    /* Literals whose text is at least this many bytes are stored
+       compressed, or 0 for none.  Fixed by the keyspace at open. */
+    size_t compress_literals;
+
+    /* Most buckets a pos or osp partition is split into, or 0 for
+       unbucketed tables, and the rows this storage writes to a bucket
+       before splitting it.  What is known of each partition key's
+       buckets, keyed by the index's first letter and the key. */
+    int max_buckets;
+    unsigned long bucket_rows;
+    cassandra_cache* buckets;
+
+    /* Whether SPARQL basic graph patterns are evaluated by the storage,
+       and the most distinct bindings a pattern is bind joined with
+       before a hash join is used instead. */
+    int query_pushdown;
+    int bind_join_limit;
+
+    /* How size() counts, and the rdf.counts shard the next write
+       scheduler flush adds its new triples to.  Whether writers keep the
+       counter is fixed by the keyspace at open; size_option is what the
+       options asked for, or -1. */
+    cassandra_size_mode size_mode;
+    int size_option;
+    int count_shard;
+
+    /* Filter of every triple written or seen by a full scan, or 0.  It
+       is only kept for a sole writer, and can only rule triples out once
+       a full scan has completed, as the store may hold triples from
+       before this instance. */
+    cassandra_bloom* bloom;
+    int bloom_ready;
+
+    /* Nodes decoded by find_statements streams, keyed by their encoded
+       term, or 0 if node caching is off.  The URIs of the datatypes in
+       cassandra_datatypes are created once. */
+    cassandra_cache* nodes;
+    librdf_uri* datatypes[CASSANDRA_NUM_DATATYPES];
+
+    /* The BGP supports_query read from a query, kept for the
+       query_execute which follows it, and that query. */
+    struct cassandra_bgp_str* query_bgp;
+    librdf_query* query_bgp_query;
 
 } librdf_storage_cassandra_instance;
 
-typedef enum { SPO, POS, OSP } index_type;
+/* Rows fetched per page by find_statements. */
+#define CASSANDRA_PAGE_SIZE 1000
+
+/* Number of write batches add_statements keeps in flight, unless
+   overridden by the write-window option. */
+#define CASSANDRA_DEFAULT_WRITE_WINDOW 16
+
+/* Number of triples the write scheduler buffers before grouping them by
+   partition, and the size cap of each single-partition batch.  The batch
+   cap matches Cassandra's default batch_size_warn_threshold_in_kb. */
+#define CASSANDRA_DEFAULT_WRITE_BUFFER 1000
+#define CASSANDRA_DEFAULT_BATCH_BYTES 5120
+
+/* Most bytes of terms a transaction buffers before refusing writes. */
+#define CASSANDRA_DEFAULT_TRANSACTION_BYTES (64 * 1024 * 1024)
+
+/* Entries in the dictionary layout's term <-> id cache.  It never holds
+   fewer than the ids of three result pages. */
+#define CASSANDRA_DEFAULT_DICT_CACHE 100000
+#define CASSANDRA_MIN_DICT_CACHE (3 * CASSANDRA_PAGE_SIZE)
+
+/* Ids tried when a new term's hash collides with another term's id, and
+   the number of id lookups kept in flight when resolving a result page. */
+#define CASSANDRA_DICT_PROBES 16
+#define CASSANDRA_RESOLVE_WAVE 256
+
+/* Memory the decoded node cache may hold, in bytes, and the estimate of
+   a node's size over its term's text. */
+#define CASSANDRA_DEFAULT_NODE_CACHE (16 * 1024 * 1024)
+#define CASSANDRA_NODE_COST 96
+
+/* Length of the type, sort key and separators of a sortable literal
+   encoding, before the literal's text. */
+#define CASSANDRA_SORT_PREFIX 19
+
+/* Tags of the compact term encoding.  The high nibble is the version of
+   the encoding, so a tag is never a letter, as the text encoding starts
+   with.  Sortable literals have a tag for each type. */
+#define CASSANDRA_TAG_URI 0x11
+#define CASSANDRA_TAG_BLANK 0x12
+#define CASSANDRA_TAG_PLAIN 0x13
+#define CASSANDRA_TAG_LANGUAGE 0x14
+#define CASSANDRA_TAG_TYPED 0x15
+#define CASSANDRA_TAG_INTEGER 0x16
+#define CASSANDRA_TAG_FLOAT 0x17
+#define CASSANDRA_TAG_DATETIME 0x18
+#define CASSANDRA_TAG_NAMESPACE 0x19
+#define CASSANDRA_TAG_COMPRESSED 0x1a
+#define CASSANDRA_TAG_VERSION(tag) ((unsigned char) (tag) >> 4)
+
+/* Bytes of a sort key in the compact encoding, 7 bits to a byte. */
+#define CASSANDRA_SORT_KEY 10
+
+/* Room for a term encoded on the stack before a buffer is allocated. */
+#define CASSANDRA_TERM_BUFFER 256
+
+/* Rows written to each bucket of a partition before it is split, unless
+   overridden by the bucket-rows option, and the memory the bucket
+   counts of partition keys may take.  Bucket counts read from
+   rdf.buckets are read again after CASSANDRA_BUCKET_TTL seconds. */
+#define CASSANDRA_DEFAULT_BUCKET_ROWS 1000000
+#define CASSANDRA_BUCKET_CACHE (4 * 1024 * 1024)
+#define CASSANDRA_BUCKET_TTL 60
+
+/* One row in CASSANDRA_BUCKET_SAMPLE written to a split partition is
+   added to its count in rdf.bucket_rows, and the count is read again at
+   one row in CASSANDRA_BUCKET_READ_SAMPLE. */
+#define CASSANDRA_BUCKET_SAMPLE 16
+#define CASSANDRA_BUCKET_READ_SAMPLE 256
+
+/* Namespace ids a keyspace hands out, all of which fit a two byte
+   varint.  Writers look for namespaces other clients have added at most
+   once every CASSANDRA_NAMESPACE_TTL seconds. */
+#define CASSANDRA_MAX_NAMESPACES 16000
+#define CASSANDRA_NAMESPACE_TTL 60
+
+/* Token ranges per parallel scan query, unless overridden by the
+   scan-ranges option. */
+#define CASSANDRA_SCAN_RANGES_PER_QUERY 8
+
+/* Queries a batched lookup keeps in flight, unless overridden by the
+   lookup-parallelism option. */
+#define CASSANDRA_DEFAULT_LOOKUP_PARALLELISM 32
+
+/* Limits on the SPARQL queries the storage evaluates itself; larger
+   ones are left to rasqal.  A query fails once it has more than
+   CASSANDRA_BGP_MAX_ROWS partial solutions. */
+#define CASSANDRA_BGP_MAX_TRIPLES 32
+#define CASSANDRA_BGP_MAX_VARIABLES 64
+#define CASSANDRA_BGP_MAX_FILTERS 32
+#define CASSANDRA_BGP_MAX_ROWS 10000000
+
+/* Most distinct bindings a query pattern is bind joined with, unless
+   overridden by the bind-join-limit option. */
+#define CASSANDRA_DEFAULT_BIND_JOIN_LIMIT 10000
+
+/* Rows of rdf.counts the triple count is spread over, so that concurrent
+   writers mostly update different partitions. */
+#define CASSANDRA_COUNT_SHARDS 16
+
+/* Assumed bytes per spo row, for turning the server's partition size
+   estimates into a triple count. */
+#define CASSANDRA_ESTIMATE_ROW_BYTES 64
+
+/* Depth of the queues between the stages of a pipelined load. */
+#define CASSANDRA_LOAD_QUEUE 4096
+
+/* Storage-specific features, readable with librdf_storage_get_feature. */
+#define CASSANDRA_FEATURE_PREPARE_MISSES \
+    "http://feature.librdf.org/cassandra-prepare-misses"
+#define CASSANDRA_FEATURE_REPREPARES \
+    "http://feature.librdf.org/cassandra-reprepares"
+#define CASSANDRA_FEATURE_LOAD_STATS \
+    "http://feature.librdf.org/cassandra-load-stats"
+#define CASSANDRA_FEATURE_EXPLAIN \
+    "http://feature.librdf.org/cassandra-explain"
+
+/* Set with librdf_storage_set_feature to a dataset name literal, to
+   publish the storage's keyspace as that dataset. */
+#define CASSANDRA_FEATURE_PUBLISH \
+    "http://feature.librdf.org/cassandra-publish"
+
+/* Cluster settings: the driver's defaults, and the presets of the
+   profile option.  throughput spreads load over more I/O threads and
+   connections and waits longer for busy nodes; latency routes around
+   slow nodes and speculatively retries idempotent requests. */
+static const cassandra_cluster_config cassandra_cluster_default = {
+    9042, 1, 1, 12000, 5000, 1, 0, "", 0, 0, 0
+};
+
+static const cassandra_cluster_config cassandra_cluster_throughput = {
+    9042, 4, 2, 30000, 5000, 1, 0, "", 0, 0, 0
+};
+
+static const cassandra_cluster_config cassandra_cluster_latency = {
+    9042, 2, 1, 12000, 5000, 1, 1, "", 0, 20, 2
+};
+
+/* Every shared session of the process. */
+static cassandra_shared* cassandra_shared_sessions = 0;
+#ifdef HAVE_PTHREAD_H
+static pthread_mutex_t cassandra_shared_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
 
 /* prototypes for local functions */
 static int librdf_storage_cassandra_init(librdf_storage* storage, const char *name, librdf_hash* options);
@@ -91,1403 +878,10007 @@ static librdf_stream* librdf_storage_cassandra_context_serialise(librdf_storage*
 
 static librdf_iterator* librdf_storage_cassandra_get_contexts(librdf_storage* storage);
 
+/* namespace dictionary */
+static int cassandra_namespaces_load(librdf_storage_cassandra_instance* context);
+static int cassandra_namespaces_changed(librdf_storage_cassandra_instance* context);
+
+/* dataset catalog */
+static int cassandra_dataset_keyspace(librdf_storage_cassandra_instance* context, const char* dataset);
+
 /* transactions */
 static int librdf_storage_cassandra_transaction_start(librdf_storage *storage);
 static int librdf_storage_cassandra_transaction_commit(librdf_storage *storage);
 static int librdf_storage_cassandra_transaction_rollback(librdf_storage *storage);
 
+/* query functions */
+static void cassandra_bgp_free(struct cassandra_bgp_str* bgp);
+static int librdf_storage_cassandra_supports_query(librdf_storage* storage, librdf_query* query);
+static librdf_query_results* librdf_storage_cassandra_query_execute(librdf_storage* storage, librdf_query* query);
+
 static void librdf_storage_cassandra_register_factory(librdf_storage_factory *factory);
 #ifdef MODULAR_LIBRDF
 void librdf_storage_module_register_factory(librdf_world *world);
 #endif
 
 
-/* functions implementing storage api */
+/* Picks the index whose key starts with exactly the bound parts of a
+   pattern, so a find is one partition slice, or a full scan, and never
+   needs ALLOW FILTERING.  Indexes are tried in spo, pos, osp order. */
 static int
-librdf_storage_cassandra_init(librdf_storage* storage, const char *name,
-                           librdf_hash* options)
+cassandra_plan_pattern(int pattern, cassandra_plan* plan)
 {
 
-    char *name_copy;
-    librdf_storage_cassandra_instance* context;
-  
-    if(!name) {
-	if(options)
-	    librdf_free_hash(options);
-	return 1;
-    }
-  
-    context = LIBRDF_CALLOC(librdf_storage_cassandra_instance*, 1,
-			    sizeof(*context));
-    if(!context) {
-	if(options)
-	    librdf_free_hash(options);
-	return 1;
-    }
-
-    librdf_storage_set_instance(storage, context);
-  
-    context->storage = storage;
-    context->name_len = strlen(name);
-//    context->transaction = 0;
-
-    name_copy = LIBRDF_MALLOC(char*, context->name_len + 1);
-    if(!name_copy) {
-	if(options)
-	    librdf_free_hash(options);
-	return 1;
-    }
-
-    strcpy(name_copy, name);
-    context->name = name_copy;
-
-    // Add options here.
-
-    /* no more options, might as well free them now */
-    if(options)
-	librdf_free_hash(options);
+    int bound = ((pattern & 1) != 0) + ((pattern & 2) != 0) +
+	((pattern & 4) != 0);
+    int i, k;
 
-    // FIXME: Hard-coded;
-    context->session = cass_session_new();
-    context->cluster = cass_cluster_new();
+    for(i = SPO; i <= OSP; i++) {
 
-    cass_cluster_set_contact_points(context->cluster, name);
+	for(k = 0; k < bound; k++)
+	    if (!(pattern & (1 << cassandra_indexes[i].key[k])))
+		break;
 
-    CassFuture* future = cass_session_connect(context->session,
-					      context->cluster);
+	if (k == bound) {
+	    plan->index = (index_type) i;
+	    plan->bound = bound;
+	    return 0;
+	}
 
-    CassError rc = cass_future_error_code(future);
-    if (rc != CASS_OK) {
-	fprintf(stderr, "Cassandra: %s\n", cass_error_desc(rc));
-	cass_cluster_free(context->cluster);
-	cass_session_free(context->session);
-	free(context->name);
-	free(context);
-	return 1;
     }
 
-    cass_future_free(future);
-
-    return 0;
+    fprintf(stderr, "Cassandra: no index for pattern %d\n", pattern);
+    return -1;
 
 }
 
+/* Whether an index's partitions are split into buckets. */
+static int
+cassandra_bucketed(librdf_storage_cassandra_instance* context,
+		   index_type index)
+{
+    return context->max_buckets && index != SPO;
+}
 
+/* Writes the name of an index table of the storage's layout. */
 static void
-librdf_storage_cassandra_terminate(librdf_storage* storage)
+cassandra_table_name(librdf_storage_cassandra_instance* context,
+		     index_type index, char* table)
 {
-    librdf_storage_cassandra_instance* context;
-
-    context = (librdf_storage_cassandra_instance*)storage->instance;
-  
-    if (context == NULL)
-	return;
-
-    if(context->name)
-	LIBRDF_FREE(char*, context->name);
-  
-    LIBRDF_FREE(librdf_storage_cassandra_terminate, storage->instance);
+    sprintf(table, "%s%s%s%s", cassandra_indexes[index].name,
+	    context->quads ? "c" : "",
+	    context->dict ? "_ids" : "",
+	    cassandra_bucketed(context, index) ? "_buckets" : "");
 }
 
-static
-char* node_helper(librdf_storage* storage, librdf_node* node)
+/* Plans every find pattern, and writes its query. */
+static int
+cassandra_plan_queries(librdf_storage_cassandra_instance* context)
 {
 
-    librdf_uri* uri;
-    librdf_uri* dt_uri;
-
-    const char* integer_type = "http://www.w3.org/2001/XMLSchema#integer";
-    const char* float_type = "http://www.w3.org/2001/XMLSchema#float";
-    const char* datetime_type = "http://www.w3.org/2001/XMLSchema#dateTime";
+    char table[20];
+    int pattern, k;
 
-    char* name;
-    char data_type;
+    for(pattern = 0; pattern < 8; pattern++) {
 
-    switch(librdf_node_get_type(node)) {
+	cassandra_plan* plan = &context->plans[pattern];
+	if (cassandra_plan_pattern(pattern, plan) < 0)
+	    return -1;
 
-    case LIBRDF_NODE_TYPE_RESOURCE:
-	uri = librdf_node_get_uri(node);
-	name = librdf_uri_as_string(uri);
-	data_type = 'u';
-	break;
-	
-    case LIBRDF_NODE_TYPE_LITERAL:
-	dt_uri = librdf_node_get_literal_value_datatype_uri(node);
-	if (dt_uri == 0)
-	    data_type = 's';
-	else {
-	    const char* type_uri = librdf_uri_as_string(dt_uri);
-	    if (strcmp(type_uri, integer_type) == 0)
-		data_type = 'i';
-	    else if (strcmp(type_uri, float_type) == 0)
-		data_type = 'f';
-	    else if (strcmp(type_uri, datetime_type) == 0)
-		data_type = 'd';
-	    else
-		data_type = 's';
+	/* A bucketed partition is read one bucket at a time. */
+	char where[64];
+	int len = 0;
+	where[0] = 0;
+	for(k = 0; k < plan->bound; k++) {
+	    len += sprintf(where + len, "%s %c = ?", k ? " AND" : " WHERE",
+			   "spo"[cassandra_indexes[plan->index].key[k]]);
+	    if (k == 0 && cassandra_bucketed(context, plan->index))
+		len += sprintf(where + len, " AND b = ?");
 	}
-	name = librdf_node_get_literal_value(node);
-	break;
 
-    case LIBRDF_NODE_TYPE_BLANK:
-	name = librdf_node_get_blank_identifier(node);
-	data_type = 'b';
-	break;
+	char* query = malloc(128);
+	if (query == 0)
+	    return -1;
 
-    case LIBRDF_NODE_TYPE_UNKNOWN:
-	break;
-	
-    }
+	cassandra_table_name(context, plan->index, table);
+	sprintf(query, "SELECT s, p, o%s FROM rdf.%s%s;",
+		context->quads ? ", c" : "", table, where);
+
+	context->queries[pattern] = query;
+	context->statements[CASSANDRA_QUERY_ + pattern] = query;
+
+	/* Everything is removed some other way. */
+	if (plan->bound == 0)
+	    continue;
+
+	char* remove = malloc(128);
+	if (remove == 0)
+	    return -1;
+
+	sprintf(remove, "DELETE FROM rdf.%s%s;", table, where);
+
+	context->removes[pattern] = remove;
+	context->statements[CASSANDRA_REMOVE_ + pattern] = remove;
 
-    char* term = malloc(5 + strlen(name));
-    if (term == 0) {
-	fprintf(stderr, "malloc failed");
-	return 0;
     }
-    
-    sprintf(term, "%c:%s", data_type, name);
 
-    return term;
+    return 0;
 
 }
 
-
+/* functions implementing storage api */
+/* Whether c may be in an unquoted CQL identifier. */
 static int
-statement_helper(librdf_storage* storage,
-		 librdf_statement* statement,
-		 librdf_node* context,
-		 char** s, char** p, char** o, char** c)
+cassandra_identifier_char(char c)
 {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+	(c >= '0' && c <= '9') || c == '_';
+}
 
-    librdf_node* sn = librdf_statement_get_subject(statement);
-    librdf_node* pn = librdf_statement_get_predicate(statement);
-    librdf_node* on = librdf_statement_get_object(statement);
+/* Whether p, in cql, is keyspace rdf: qualifying a table, as in rdf.spo,
+   or quoted, as in 'rdf'. */
+static int
+cassandra_keyspace_at(const char* cql, const char* p)
+{
 
-    if (sn)
-	*s = node_helper(storage, sn);
-    else
-	*s = 0;
-    
-    if (pn)
-	*p = node_helper(storage, pn);
-    else
-	*p = 0;
+    if (strncmp(p, "rdf", 3) != 0)
+	return 0;
 
-    if (on)
-	*o = node_helper(storage, on);
-    else
-	*o = 0;
+    if (p > cql && cassandra_identifier_char(p[-1]))
+	return 0;
 
-    if (context)
-	*c = node_helper(storage, context);
-    else
-	*c = 0;
+    return p[3] == '.' || (p[3] == '\'' && p > cql && p[-1] == '\'');
 
 }
 
-static CassStatement* cassandra_query_(const char* s, const char* p,
-					 const char* o)
+/* Returns a copy of cql, which is written for keyspace rdf, for keyspace
+   instead, or 0 if out of memory. */
+static char*
+cassandra_keyspace_cql(const char* keyspace, const char* cql)
 {
 
-    char* query = "SELECT s, p, o FROM rdf.spo;";
-    CassStatement* statement = cass_statement_new(query, 0);
-    return statement;
+    size_t keyspace_len = strlen(keyspace);
+    size_t len = 0;
+    const char* p;
 
-}
+    for(p = cql; *p; p++)
+	if (cassandra_keyspace_at(cql, p)) {
+	    len += keyspace_len;
+	    p += 2;
+	} else
+	    len++;
 
-static CassStatement* cassandra_query_s(const char* s, const char* p,
-					  const char* o)
-{
+    char* copy = malloc(len + 1);
+    if (copy == 0)
+	return 0;
 
-    char* query = "SELECT s, p, o FROM rdf.spo WHERE s = ?;";
-    CassStatement* statement = cass_statement_new(query, 1);
-    cass_statement_bind_string(statement, 0, s);
-    return statement;
+    char* q = copy;
+    for(p = cql; *p; p++)
+	if (cassandra_keyspace_at(cql, p)) {
+	    memcpy(q, keyspace, keyspace_len);
+	    q += keyspace_len;
+	    p += 2;
+	} else
+	    *q++ = *p;
+    *q = 0;
+
+    return copy;
 
 }
 
-static CassStatement* cassandra_query_p(const char* s, const char* p,
-					  const char* o)
+/* Returns a copy of a keyspace option, folded to lower case as CQL
+   does, or 0 if it isn't a keyspace name. */
+static char*
+cassandra_keyspace_name(const char* value)
 {
 
-    char* query = "SELECT s, p, o FROM rdf.pos WHERE p = ?;";
-    CassStatement* statement = cass_statement_new(query, 1);
-    cass_statement_bind_string(statement, 0, p);
-    return statement;
+    size_t len = strlen(value);
+    size_t i;
 
-}
+    if (len == 0 || len > 48 || value[0] == '_')
+	return 0;
 
-static CassStatement* cassandra_query_o(const char* s, const char* p,
-					  const char* o)
-{
+    for(i = 0; i < len; i++)
+	if (!cassandra_identifier_char(value[i]))
+	    return 0;
+
+    char* name = strdup(value);
+    if (name == 0)
+	return 0;
+
+    for(i = 0; i < len; i++)
+	if (name[i] >= 'A' && name[i] <= 'Z')
+	    name[i] += 'a' - 'A';
 
-    char* query = "SELECT s, p, o FROM rdf.osp WHERE o = ?;";
-    CassStatement* statement = cass_statement_new(query, 1);
-    cass_statement_bind_string(statement, 0, o);
-    return statement;
+    return name;
 
 }
 
-static CassStatement* cassandra_query_sp(const char* s, const char* p,
-					  const char* o)
+/* Writes the replication map of a replication option: a replication
+   factor for SimpleStrategy, as in 3, or factors of data centres for
+   NetworkTopologyStrategy, as in dc1:3,dc2:2. */
+static int
+cassandra_replication(const char* value, char* map, size_t size)
 {
 
-    char* query = "SELECT s, p, o FROM rdf.spo WHERE s = ? AND p = ?;";
-    CassStatement* statement = cass_statement_new(query, 2);
-    cass_statement_bind_string(statement, 0, s);
-    cass_statement_bind_string(statement, 1, p);
-    return statement;
+    size_t digits = strspn(value, "0123456789");
 
-}
+    if (digits > 0 && value[digits] == 0)
+	return (snprintf(map, size, "{'class': 'SimpleStrategy', "
+			 "'replication_factor': '%s'}", value) <
+		(int) size) ? 0 : -1;
 
-static CassStatement* cassandra_query_so(const char* s, const char* p,
-					  const char* o)
-{
+    size_t len = snprintf(map, size, "{'class': 'NetworkTopologyStrategy'");
+    const char* p = value;
 
-    char* query = "SELECT s, p, o FROM rdf.osp WHERE s = ? AND o = ?;";
-    CassStatement* statement = cass_statement_new(query, 2);
-    cass_statement_bind_string(statement, 0, s);
-    cass_statement_bind_string(statement, 1, o);
-    return statement;
+    while (*p && len < size) {
 
-}
+	size_t dc = 0;
+	while (cassandra_identifier_char(p[dc]) || p[dc] == '-' ||
+	       p[dc] == '.')
+	    dc++;
+	if (dc == 0 || p[dc] != ':')
+	    return -1;
 
-static CassStatement* cassandra_query_po(const char* s, const char* p,
-					  const char* o)
-{
+	const char* factor = p + dc + 1;
+	digits = strspn(factor, "0123456789");
+	if (digits == 0 || (factor[digits] != ',' && factor[digits] != 0))
+	    return -1;
 
-    char* query = "SELECT s, p, o FROM rdf.pos WHERE p = ? AND o = ?;";
-    CassStatement* statement = cass_statement_new(query, 2);
-    cass_statement_bind_string(statement, 0, p);
-    cass_statement_bind_string(statement, 1, o);
-    return statement;
+	len += snprintf(map + len, size - len, ", '%.*s': '%.*s'", (int) dc,
+			p, (int) digits, factor);
 
-}
+	p = factor + digits;
+	if (*p == ',')
+	    p++;
 
-static CassStatement* cassandra_query_spo(const char* s, const char* p,
-					  const char* o)
-{
+    }
 
-    char* query =
-	"SELECT s, p, o FROM rdf.pos WHERE s = ? AND p = ? AND o = ?;";
-    CassStatement* statement = cass_statement_new(query, 3);
-    cass_statement_bind_string(statement, 0, s);
-    cass_statement_bind_string(statement, 1, p);
-    cass_statement_bind_string(statement, 2, o);
-    return statement;
+    if (len < size)
+	len += snprintf(map + len, size - len, "}");
+
+    return (*p == 0 && len < size) ? 0 : -1;
 
 }
 
-static int execute(CassSession* session, char* query, int ignore_error)
+/* Shorthands of the table settings, by setting. */
+static const char* const cassandra_table_shorthands[][3] = {
+    { "compaction", "leveled", "{'class': 'LeveledCompactionStrategy'}" },
+    { "compaction", "size-tiered",
+      "{'class': 'SizeTieredCompactionStrategy'}" },
+    { "compaction", "time-window",
+      "{'class': 'TimeWindowCompactionStrategy'}" },
+    { "compression", "none", "{'enabled': 'false'}" },
+    { "compression", "lz4", "{'class': 'LZ4Compressor'}" },
+    { "compression", "zstd", "{'class': 'ZstdCompressor'}" },
+    { "compression", "snappy", "{'class': 'SnappyCompressor'}" },
+    { "compression", "deflate", "{'class': 'DeflateCompressor'}" },
+    { "caching", "keys", "{'keys': 'ALL', 'rows_per_partition': 'NONE'}" },
+    { "caching", "rows", "{'keys': 'ALL', 'rows_per_partition': 'ALL'}" },
+    { "caching", "none", "{'keys': 'NONE', 'rows_per_partition': 'NONE'}" }
+};
+
+#define CASSANDRA_NUM_TABLE_SHORTHANDS \
+    (sizeof(cassandra_table_shorthands) / sizeof(cassandra_table_shorthands[0]))
+
+/* Writes the CQL map of a compaction, compression or caching option: a
+   shorthand, a compaction or compression class, or the rows of each
+   partition to cache. */
+static int
+cassandra_table_setting(const char* setting, const char* value, char* map,
+			size_t size)
 {
 
-    CassStatement* stmt = cass_statement_new(query, 0);
-
-    CassFuture* future = cass_session_execute(session, stmt);
-
-    cass_statement_free(stmt);
+    size_t i;
 
-    CassError rc = cass_future_error_code(future);
- 
-    if (rc != CASS_OK) {
-	if (ignore_error) {
-	    cass_future_free(future);
+    for(i = 0; i < CASSANDRA_NUM_TABLE_SHORTHANDS; i++)
+	if (!strcmp(cassandra_table_shorthands[i][0], setting) &&
+	    !strcmp(cassandra_table_shorthands[i][1], value)) {
+	    snprintf(map, size, "%s", cassandra_table_shorthands[i][2]);
 	    return 0;
 	}
-	
-	fprintf(stderr, "Cassandra error: %s\n", cass_error_desc(rc));
-	cass_future_free(future);
+
+    size_t len = strlen(value);
+    if (len == 0 || len + 64 > size)
 	return -1;
+
+    if (!strcmp(setting, "caching")) {
+	if (strspn(value, "0123456789") != len)
+	    return -1;
+	snprintf(map, size, "{'keys': 'ALL', 'rows_per_partition': '%s'}",
+		 value);
+	return 0;
     }
 
-    cass_future_free(future);
+    for(i = 0; i < len; i++)
+	if (!cassandra_identifier_char(value[i]) && value[i] != '.')
+	    return -1;
+    snprintf(map, size, "{'class': '%s'}", value);
 
     return 0;
-    
+
 }
-  
+
+/* Reads the compaction, compression and caching options of each table
+   into its WITH clause.  An option named for the table, as in
+   spo-compaction, is used before one for every table. */
 static int
-librdf_storage_cassandra_open(librdf_storage* storage, librdf_model* model)
+cassandra_table_options(librdf_storage_cassandra_instance* context,
+			librdf_hash* options)
 {
 
-    librdf_storage_cassandra_instance* context;
+    static const char* const settings[] = {
+	"compaction", "compression", "caching"
+    };
 
-    context = (librdf_storage_cassandra_instance*)storage->instance;
+    int t;
+    for(t = 0; t < CASSANDRA_NUM_TABLES; t++) {
+
+	char clause[512];
+	size_t len = 0;
+	int i;
+
+	clause[0] = 0;
+
+	for(i = 0; i < 3; i++) {
+
+	    char key[64];
+	    snprintf(key, sizeof(key), "%s-%s", cassandra_tables[t][0],
+		     settings[i]);
+
+	    char* value = librdf_hash_get(options, key);
+	    if (value == 0)
+		value = librdf_hash_get(options, settings[i]);
+	    if (value == 0)
+		continue;
+
+	    char map[256];
+	    int ret = cassandra_table_setting(settings[i], value, map,
+					      sizeof(map));
+	    if (ret < 0)
+		fprintf(stderr, "Cassandra: bad %s for %s: %s\n", settings[i],
+			cassandra_tables[t][0], value);
+	    LIBRDF_FREE(char*, value);
+	    if (ret < 0)
+		return -1;
+
+	    len += snprintf(clause + len, sizeof(clause) - len, "%s%s = %s",
+			    len ? " AND " : "", settings[i], map);
+
+	}
 
-    char* statement =
-	"CREATE KEYSPACE rdf WITH replication = {"
-	"  'class': 'SimpleStrategy', 'replication_factor': '1'"
-	"};";
-    int ret = execute(context->session, statement, 1);
-
-    statement =
-	"CREATE TABLE rdf.spo ("
-	"  s text, p text, o text,"
-	"  primary key(s, p, o)"
-	");";
-    ret = execute(context->session, statement, 1);
-
-    statement =
-	"CREATE TABLE rdf.pos ("
-	"  s text, p text, o text,"
-	"  primary key(p, o, s)"
-	");";
-    ret = execute(context->session, statement, 1);
-
-    statement =
-	"CREATE TABLE rdf.osp ("
-	"  s text, p text, o text,"
-	"  primary key(o, s, p)"
-	");";
-    ret = execute(context->session, statement, 1);
+	if (len) {
+	    context->table_options[t] = strdup(clause);
+	    if (context->table_options[t] == 0)
+		return -1;
+	}
+
+    }
 
     return 0;
 
 }
 
-
-/**
- * librdf_storage_cassandra_close:
- * @storage: the storage
- *
- * Close the cassandra storage.
- * 
- * Return value: non 0 on failure
- **/
-static int
-librdf_storage_cassandra_close(librdf_storage* storage)
+/* Reads the cluster settings from the options, on top of the preset of
+   the profile option. */
+static void
+cassandra_cluster_options(librdf_hash* options,
+			  cassandra_cluster_config* config)
 {
 
-    librdf_storage_cassandra_instance* context;
-    context = (librdf_storage_cassandra_instance*)storage->instance;
+    *config = cassandra_cluster_default;
 
-    if (context->session) {
-	cass_session_free(context->session);
-	context->session = 0;
-    }
+    if (options == 0)
+	return;
 
-    if (context->cluster) {
-	cass_cluster_free(context->cluster);
-	context->session = 0;
+    char* profile = librdf_hash_get(options, "profile");
+    if (profile && !strcmp(profile, "throughput"))
+	*config = cassandra_cluster_throughput;
+    else if (profile && !strcmp(profile, "latency"))
+	*config = cassandra_cluster_latency;
+    else if (profile)
+	fprintf(stderr, "Cassandra: unknown profile %s\n", profile);
+    if (profile)
+	LIBRDF_FREE(char*, profile);
+
+    long v = librdf_hash_get_as_long(options, "port");
+    if (v > 0)
+	config->port = (unsigned) v;
+
+    v = librdf_hash_get_as_long(options, "io-threads");
+    if (v > 0)
+	config->io_threads = (unsigned) v;
+
+    v = librdf_hash_get_as_long(options, "connections");
+    if (v > 0)
+	config->connections = (unsigned) v;
+
+    v = librdf_hash_get_as_long(options, "request-timeout");
+    if (v > 0)
+	config->request_timeout = (unsigned) v;
+
+    v = librdf_hash_get_as_long(options, "connect-timeout");
+    if (v > 0)
+	config->connect_timeout = (unsigned) v;
+
+    v = librdf_hash_get_as_long(options, "token-aware");
+    if (v >= 0)
+	config->token_aware = (v != 0);
+
+    v = librdf_hash_get_as_long(options, "latency-aware");
+    if (v >= 0)
+	config->latency_aware = (v != 0);
+
+    v = librdf_hash_get_as_long(options, "remote-dc-hosts");
+    if (v >= 0)
+	config->remote_hosts = (unsigned) v;
+
+    v = librdf_hash_get_as_long(options, "speculative-delay");
+    if (v >= 0)
+	config->speculative_delay = (unsigned) v;
+
+    v = librdf_hash_get_as_long(options, "speculative-executions");
+    if (v >= 0)
+	config->speculative_executions = (int) v;
+
+    char* dc = librdf_hash_get(options, "local-dc");
+    if (dc) {
+	strncpy(config->local_dc, dc, sizeof(config->local_dc) - 1);
+	config->local_dc[sizeof(config->local_dc) - 1] = 0;
+	LIBRDF_FREE(char*, dc);
     }
 
 }
 
+/* Applies cluster settings to the driver's cluster object. */
 static int
-librdf_storage_cassandra_size(librdf_storage* storage)
+cassandra_cluster_configure(CassCluster* cluster,
+			    const cassandra_cluster_config* config)
 {
-    
-    librdf_storage_cassandra_instance* context;
-    context = (librdf_storage_cassandra_instance*)storage->instance;
 
-    char* query = "SELECT count(s) FROM rdf.spo";
-    
-    CassStatement* stmt = cass_statement_new(query, 0);
+    CassError rc = cass_cluster_set_port(cluster, config->port);
 
-    CassFuture* future = cass_session_execute(context->session, stmt);
+    if (rc == CASS_OK)
+	rc = cass_cluster_set_num_threads_io(cluster, config->io_threads);
 
-    cass_statement_free(stmt);
+    /* The most connections defaults to 2, and can't be below the core
+       connections. */
+    if (rc == CASS_OK && config->connections > 2)
+	rc = cass_cluster_set_max_connections_per_host(cluster,
+							config->connections);
+    if (rc == CASS_OK)
+	rc = cass_cluster_set_core_connections_per_host(cluster,
+							 config->connections);
 
-    CassError rc = cass_future_error_code(future);
+    if (rc == CASS_OK && config->local_dc[0])
+	rc = cass_cluster_set_load_balance_dc_aware(cluster, config->local_dc,
+						    config->remote_hosts,
+						    cass_false);
+
+    if (rc == CASS_OK && config->speculative_delay > 0 &&
+	config->speculative_executions > 0)
+	rc = cass_cluster_set_constant_speculative_execution_policy(
+	    cluster, config->speculative_delay,
+	    config->speculative_executions);
 
     if (rc != CASS_OK) {
 	fprintf(stderr, "Cassandra: %s\n", cass_error_desc(rc));
-	const char* msg;
-	size_t msg_len;
-	cass_future_error_message(future, &msg, &msg_len);
-	fprintf(stderr, "Cassandra: %*s\n", msg_len, msg);
-	cass_future_free(future);
-	return 0;
+	return -1;
     }
 
-    const CassResult* result = cass_future_get_result(future);
-
-    cass_future_free(future);
-
-    const CassRow* row = cass_result_first_row(result);
-
-    int64_t count;
-    cass_value_get_int64(cass_row_get_column(row, 0), &count);
+    cass_cluster_set_request_timeout(cluster, config->request_timeout);
+    cass_cluster_set_connect_timeout(cluster, config->connect_timeout);
+    cass_cluster_set_token_aware_routing(cluster,
+					 config->token_aware ? cass_true :
+					 cass_false);
+    cass_cluster_set_latency_aware_routing(cluster,
+					   config->latency_aware ? cass_true :
+					   cass_false);
 
-    cass_result_free(result);
+    return 0;
 
-    return count;
-	
 }
 
-static int
-librdf_storage_cassandra_add_statement(librdf_storage* storage, 
-                                    librdf_statement* statement)
+/* Logs the settings a connection was made with. */
+static void
+cassandra_cluster_log(const char* name, const cassandra_cluster_config* config)
 {
-    return librdf_storage_cassandra_context_add_statement(storage, NULL, statement);
+    fprintf(stderr, "Cassandra: connected to %s port=%u io-threads=%u "
+	    "connections=%u request-timeout=%u connect-timeout=%u "
+	    "token-aware=%d latency-aware=%d local-dc=%s remote-dc-hosts=%u "
+	    "speculative-delay=%u speculative-executions=%d\n",
+	    name, config->port, config->io_threads, config->connections,
+	    config->request_timeout, config->connect_timeout,
+	    config->token_aware, config->latency_aware,
+	    config->local_dc[0] ? config->local_dc : "(from contact points)",
+	    config->remote_hosts, config->speculative_delay,
+	    config->speculative_executions);
 }
 
-
-static int
-librdf_storage_cassandra_add_statements(librdf_storage* storage,
-                                     librdf_stream* statement_stream)
+/* Returns the shared session for contact points name and settings
+   config, connecting one if there is none.  Returns 0 on error. */
+static cassandra_shared*
+cassandra_shared_get(const char* name, const cassandra_cluster_config* config)
 {
 
+#ifdef HAVE_PTHREAD_H
+    pthread_mutex_lock(&cassandra_shared_lock);
+#endif
 
-    librdf_storage_cassandra_instance* context;
-    context = (librdf_storage_cassandra_instance*)storage->instance;
-
-    CassBatch* batch = 0;
-
-    const int batch_size = 10;
-    int rows = 0;
-
-    for(; !librdf_stream_end(statement_stream);
-	librdf_stream_next(statement_stream)) {
-
-	librdf_statement* statement;
-	librdf_node* context_node;
-    
-	statement = librdf_stream_get_object(statement_stream);
-	context_node = librdf_stream_get_context2(statement_stream);
-
-	if(!statement) {
+    cassandra_shared* shared;
+    for(shared = cassandra_shared_sessions; shared; shared = shared->next)
+	if (!strcmp(shared->name, name) &&
+	    !memcmp(&shared->config, config, sizeof(*config)))
 	    break;
-	}
-
-	char* s;
-	char* p;
-	char* o;
-	char* c;
-	statement_helper(storage, statement, context_node, &s, &p, &o, &c);
-
-	if (batch == 0)
-	    batch = cass_batch_new(CASS_BATCH_TYPE_LOGGED);
 
-	char* query = "INSERT INTO rdf.spo (s, p, o) VALUES (?, ?, ?);";
-	CassStatement* stmt = cass_statement_new(query, 3);
-	cass_statement_bind_string(stmt, 0, s);
-	cass_statement_bind_string(stmt, 1, p);
-	cass_statement_bind_string(stmt, 2, o);
-	cass_batch_add_statement(batch, stmt);
-	cass_statement_free(stmt);
-
-	query = "INSERT INTO rdf.pos (s, p, o) VALUES (?, ?, ?);";
-	stmt = cass_statement_new(query, 3);
-	cass_statement_bind_string(stmt, 0, s);
-	cass_statement_bind_string(stmt, 1, p);
-	cass_statement_bind_string(stmt, 2, o);
-	cass_batch_add_statement(batch, stmt);
-	cass_statement_free(stmt);
-
-	query = "INSERT INTO rdf.osp (s, p, o) VALUES (?, ?, ?);";
-	stmt = cass_statement_new(query, 3);
-	cass_statement_bind_string(stmt, 0, s);
-	cass_statement_bind_string(stmt, 1, p);
-	cass_statement_bind_string(stmt, 2, o);
-	cass_batch_add_statement(batch, stmt);
-	cass_statement_free(stmt);
-
-	free(s);
-	free(p);
-	free(o);
+    if (shared) {
+	shared->references++;
+#ifdef HAVE_PTHREAD_H
+	pthread_mutex_unlock(&cassandra_shared_lock);
+#endif
+	return shared;
+    }
 
-	if (++rows > batch_size) {
-	    
-	    CassFuture* future = cass_session_execute_batch(context->session,
-							    batch);
-	    cass_batch_free(batch);
-
-	    CassError rc = cass_future_error_code(future);
-
-	    if (rc != CASS_OK) {
-		fprintf(stderr, "Cassandra: %s\n", cass_error_desc(rc));
-		const char* msg;
-		size_t msg_len;
-		cass_future_error_message(future, &msg, &msg_len);
-		fprintf(stderr, "Cassandra: %*s\n", msg_len, msg);
-		cass_future_free(future);
-		return -1;
-	    }
-    
-	    cass_future_free(future);
+    /* Connecting with the registry locked means another instance asking
+       for the same session waits for this one rather than making its
+       own. */
+    shared = calloc(1, sizeof(*shared));
+    if (shared)
+	shared->name = strdup(name);
+    if (shared == 0 || shared->name == 0) {
+	free(shared);
+#ifdef HAVE_PTHREAD_H
+	pthread_mutex_unlock(&cassandra_shared_lock);
+#endif
+	return 0;
+    }
 
-	    batch = 0;
+    shared->config = *config;
+    shared->session = cass_session_new();
+    shared->cluster = cass_cluster_new();
 
-	}
+    cass_cluster_set_contact_points(shared->cluster, name);
 
-    }
-    
-    if (batch) {
-	    
-	CassFuture* future = cass_session_execute_batch(context->session,
-							batch);
-	cass_batch_free(batch);
-	
-	CassError rc = cass_future_error_code(future);
-	
-	if (rc != CASS_OK) {
+    CassError rc = CASS_OK;
+    if (cassandra_cluster_configure(shared->cluster, config) == 0) {
+	CassFuture* future = cass_session_connect(shared->session,
+						  shared->cluster);
+	rc = cass_future_error_code(future);
+	if (rc != CASS_OK)
 	    fprintf(stderr, "Cassandra: %s\n", cass_error_desc(rc));
-	    const char* msg;
-	    size_t msg_len;
-	    cass_future_error_message(future, &msg, &msg_len);
-	    fprintf(stderr, "Cassandra: %*s\n", msg_len, msg);
-	    cass_future_free(future);
-	    return -1;
-	}
-	
 	cass_future_free(future);
+    } else
+	rc = CASS_ERROR_LIB_BAD_PARAMS;
 
+    if (rc != CASS_OK) {
+	cass_session_free(shared->session);
+	cass_cluster_free(shared->cluster);
+	free(shared->name);
+	free(shared);
+#ifdef HAVE_PTHREAD_H
+	pthread_mutex_unlock(&cassandra_shared_lock);
+#endif
+	return 0;
     }
 
-    return 0;
+    cassandra_cluster_log(name, config);
 
-}
+#ifdef HAVE_PTHREAD_H
+    pthread_mutex_init(&shared->lock, 0);
+#endif
 
+    shared->references = 1;
+    shared->next = cassandra_shared_sessions;
+    cassandra_shared_sessions = shared;
 
-static int
-librdf_storage_cassandra_remove_statement(librdf_storage* storage,
-                                       librdf_statement* statement)
-{
-    return librdf_storage_cassandra_context_remove_statement(storage, NULL, 
-							  statement);
-}
+#ifdef HAVE_PTHREAD_H
+    pthread_mutex_unlock(&cassandra_shared_lock);
+#endif
 
-static int
-librdf_storage_cassandra_contains_statement(librdf_storage* storage, 
-                                         librdf_statement* statement)
-{
-    return librdf_storage_cassandra_context_contains_statement(storage, NULL,
-							    statement);
-}
+    return shared;
 
+}
 
-static int
-librdf_storage_cassandra_context_contains_statement(librdf_storage* storage,
-                                                 librdf_node* context_node,
-                                                 librdf_statement* statement)
+/* Drops a reference to a shared session, closing it and freeing its
+   prepared statements with the last. */
+static void
+cassandra_shared_release(cassandra_shared* shared)
 {
 
-#ifdef BROKEN
-    librdf_storage_cassandra_instance* context;
-    context = (librdf_storage_cassandra_instance*)storage->instance;
+#ifdef HAVE_PTHREAD_H
+    pthread_mutex_lock(&cassandra_shared_lock);
+#endif
 
-    /* librdf_storage_cassandra_instance* context; */
-    cassandra_term terms[4];
+    if (--shared->references > 0) {
+#ifdef HAVE_PTHREAD_H
+	pthread_mutex_unlock(&cassandra_shared_lock);
+#endif
+	return;
+    }
 
-    statement_helper(storage, statement, terms, context_node);
+    cassandra_shared** p = &cassandra_shared_sessions;
+    while (*p != shared)
+	p = &(*p)->next;
+    *p = shared->next;
 
-    int count = cassandra_count(context->comms, terms[0], terms[1], terms[2]);
-    if (count < 0)
-	return -1;
-    
-    return (count > 0);
+#ifdef HAVE_PTHREAD_H
+    pthread_mutex_unlock(&cassandra_shared_lock);
 #endif
-}
 
-typedef struct {
-    
-    librdf_storage *storage;
-    librdf_storage_cassandra_instance* cassandra_context;
+    while (shared->statements) {
+	cassandra_shared_statement* statement = shared->statements;
+	shared->statements = statement->next;
+	cass_prepared_free(statement->prepared);
+	free(statement->cql);
+	free(statement);
+    }
 
-    librdf_statement *statement;
-    librdf_node* context;
+    cass_session_free(shared->session);
+    cass_cluster_free(shared->cluster);
 
-    CassStatement* stmt;
-    const CassResult* result;
-    CassIterator* iter;
+#ifdef HAVE_PTHREAD_H
+    pthread_mutex_destroy(&shared->lock);
+#endif
 
-    int more_pages;
-    int at_end;
+    free(shared->name);
+    free(shared);
 
-} cassandra_results_stream;
+}
 
-static
-librdf_node* node_constructor_helper(librdf_world* world, const char* t,
-				     size_t len)
+static int
+librdf_storage_cassandra_init(librdf_storage* storage, const char *name,
+                           librdf_hash* options)
 {
 
-    librdf_node* o;
+    char *name_copy;
+    librdf_storage_cassandra_instance* context;
+  
+    if(!name) {
+	if(options)
+	    librdf_free_hash(options);
+	return 1;
+    }
+  
+    context = LIBRDF_CALLOC(librdf_storage_cassandra_instance*, 1,
+			    sizeof(*context));
+    if(!context) {
+	if(options)
+	    librdf_free_hash(options);
+	return 1;
+    }
+
+    librdf_storage_set_instance(storage, context);
+  
+    context->storage = storage;
+    context->name_len = strlen(name);
 
-    if ((strlen(t) < 2) || (t[1] != ':')) {
-	fprintf(stderr, "node_constructor_helper called on invalid term\n");
-	return 0;
+    name_copy = LIBRDF_MALLOC(char*, context->name_len + 1);
+    if(!name_copy) {
+	if(options)
+	    librdf_free_hash(options);
+	return 1;
     }
 
-    if (t[0] == 'u') {
- 	o = librdf_new_node_from_counted_uri_string(world,
-						    (unsigned char*) t + 2,
-						    len - 2);
-	return o;
+    strcpy(name_copy, name);
+    context->name = name_copy;
+
+    long window = -1;
+    if (options)
+	window = librdf_hash_get_as_long(options, "write-window");
+    context->write_window =
+	(window > 0) ? (int) window : CASSANDRA_DEFAULT_WRITE_WINDOW;
+
+    long buffer = -1;
+    if (options)
+	buffer = librdf_hash_get_as_long(options, "write-buffer");
+    context->write_buffer =
+	(buffer > 0) ? (int) buffer : CASSANDRA_DEFAULT_WRITE_BUFFER;
+
+    long bytes = -1;
+    if (options)
+	bytes = librdf_hash_get_as_long(options, "batch-bytes");
+    context->batch_bytes =
+	(bytes > 0) ? (size_t) bytes : CASSANDRA_DEFAULT_BATCH_BYTES;
+
+    /* 0 for no limit. */
+    long transaction_bytes = -1;
+    if (options)
+	transaction_bytes = librdf_hash_get_as_long(options,
+						    "transaction-bytes");
+    context->transaction_bytes = (transaction_bytes >= 0) ?
+	(size_t) transaction_bytes : CASSANDRA_DEFAULT_TRANSACTION_BYTES;
+
+    long threads = -1;
+    if (options)
+	threads = librdf_hash_get_as_long(options, "load-threads");
+    context->load_threads = (threads > 0) ? (int) threads : 0;
+
+    long prefetch = -1;
+    if (options)
+	prefetch = librdf_hash_get_as_long(options, "prefetch");
+    context->prefetch = (prefetch >= 0) ? (int) prefetch : 1;
+
+    long parallelism = -1;
+    if (options)
+	parallelism = librdf_hash_get_as_long(options, "scan-parallelism");
+    context->scan_parallelism = (parallelism > 0) ? (int) parallelism : 1;
+
+    long ranges = -1;
+    if (options)
+	ranges = librdf_hash_get_as_long(options, "scan-ranges");
+    if (ranges <= 0)
+	ranges = (long) context->scan_parallelism *
+	    CASSANDRA_SCAN_RANGES_PER_QUERY;
+    if (ranges < context->scan_parallelism)
+	ranges = context->scan_parallelism;
+    context->scan_ranges = (int) ranges;
+
+    long lookups = -1;
+    if (options)
+	lookups = librdf_hash_get_as_long(options, "lookup-parallelism");
+    context->lookup_parallelism =
+	(lookups > 0) ? (int) lookups : CASSANDRA_DEFAULT_LOOKUP_PARALLELISM;
+
+    long sortable = -1;
+    if (options)
+	sortable = librdf_hash_get_as_long(options, "sortable-literals");
+    context->sortable_option = (sortable >= 0) ? (sortable > 0) : -1;
+    context->sortable = (sortable > 0);
+
+    long buckets = 0;
+    if (options)
+	buckets = librdf_hash_get_as_long(options, "buckets");
+    if (buckets > 1) {
+	/* Bucket counts are powers of two. */
+	context->max_buckets = 1;
+	while (context->max_buckets * 2 <= buckets &&
+	       context->max_buckets < (1 << 16))
+	    context->max_buckets *= 2;
+	context->buckets = cassandra_cache_create(CASSANDRA_BUCKET_CACHE,
+						  free);
     }
 
-    if (t[0] == 's') {
-	o = librdf_new_node_from_typed_counted_literal(world,
-						       (unsigned char*) t + 2,
-						       len - 2, 0, 0, 0);
-	return o;
+    long bucket_rows = -1;
+    if (options)
+	bucket_rows = librdf_hash_get_as_long(options, "bucket-rows");
+    context->bucket_rows = (bucket_rows > 0) ? (unsigned long) bucket_rows :
+	CASSANDRA_DEFAULT_BUCKET_ROWS;
+
+    long pushdown = -1;
+    if (options)
+	pushdown = librdf_hash_get_as_long(options, "query-pushdown");
+    context->query_pushdown = (pushdown != 0);
+
+    long bind_limit = -1;
+    if (options)
+	bind_limit = librdf_hash_get_as_long(options, "bind-join-limit");
+    context->bind_join_limit =
+	(bind_limit >= 0) ? (int) bind_limit : CASSANDRA_DEFAULT_BIND_JOIN_LIMIT;
+
+    char* size = 0;
+    if (options)
+	size = librdf_hash_get(options, "size");
+    context->size_option = -1;
+    if (size && !strcmp(size, "counter"))
+	context->size_option = CASSANDRA_SIZE_COUNTER;
+    else if (size && !strcmp(size, "estimate"))
+	context->size_option = CASSANDRA_SIZE_ESTIMATE;
+    else if (size && !strcmp(size, "scan"))
+	context->size_option = CASSANDRA_SIZE_SCAN;
+    else if (size) {
+	fprintf(stderr, "Cassandra: unknown size mode %s\n", size);
+	LIBRDF_FREE(char*, size);
+	if(options)
+	    librdf_free_hash(options);
+	return 1;
+    }
+    if (size)
+	LIBRDF_FREE(char*, size);
+
+    long bloom = 0;
+    if (options)
+	bloom = librdf_hash_get_as_long(options, "bloom-filter");
+    long sole_writer = 0;
+    if (options)
+	sole_writer = librdf_hash_get_as_long(options, "sole-writer");
+
+    /* A miss in the filter is only a miss in the store if nothing else
+       writes to it, and the counter must never miss a stored triple. */
+    if (bloom > 0 && sole_writer <= 0) {
+	fprintf(stderr, "Cassandra: bloom-filter needs sole-writer\n");
+	if(options)
+	    librdf_free_hash(options);
+	return 1;
+    }
+    if (bloom > 0 && context->size_option == CASSANDRA_SIZE_COUNTER) {
+	fprintf(stderr, "Cassandra: bloom-filter can't be used with "
+		"size=counter\n");
+	if(options)
+	    librdf_free_hash(options);
+	return 1;
+    }
+    if (bloom > 0)
+	context->bloom = cassandra_bloom_create((size_t) bloom);
+
+    /* Start different instances on different shards. */
+    context->count_shard =
+	(int) (((uintptr_t) context >> 4) % CASSANDRA_COUNT_SHARDS);
+
+    long node_cache = -1;
+    if (options)
+	node_cache = librdf_hash_get_as_long(options, "node-cache");
+    if (node_cache < 0)
+	node_cache = CASSANDRA_DEFAULT_NODE_CACHE;
+    if (node_cache > 0)
+	context->nodes =
+	    cassandra_cache_create((size_t) node_cache,
+				   (cassandra_cache_free_fn) librdf_free_node);
+
+    int datatypes = 1;
+    int i;
+    for(i = 0; i < CASSANDRA_NUM_DATATYPES; i++) {
+	context->datatypes[i] =
+	    librdf_new_uri(storage->world,
+			   (const unsigned char*) cassandra_datatypes[i]);
+	if (context->datatypes[i] == 0)
+	    datatypes = 0;
     }
 
+    /* The keyspace's schema decides in open, for an existing one. */
+    char* encoding = 0;
+    if (options)
+	encoding = librdf_hash_get(options, "encoding");
+    context->encoding = -1;
+    if (encoding && !strcmp(encoding, "text"))
+	context->encoding = 0;
+    if (encoding && !strcmp(encoding, "compact"))
+	context->encoding = 1;
+    if (encoding)
+	LIBRDF_FREE(char*, encoding);
+
+    /* These two are also decided by the keyspace in open. */
+    long compress = 0;
+    if (options)
+	compress = librdf_hash_get_as_long(options, "compress-literals");
+    context->compress_literals = (compress > 0) ? (size_t) compress : 0;
+
+    long namespaces = 0;
+    if (options)
+	namespaces = librdf_hash_get_as_long(options, "namespaces");
+    context->namespaces = (namespaces > 0);
+
+#ifdef HAVE_PTHREAD_H
+    pthread_mutex_init(&context->namespace_lock, 0);
+#endif
 
-    if (t[0] == 'i') {
-	librdf_uri* dt =
-	    librdf_new_uri(world,
-			   "http://www.w3.org/2001/XMLSchema#integer");
-	if (dt == 0)
-	    return 0;
+    const char** statements = cassandra_statements;
+
+    char* layout = 0;
+    if (options)
+	layout = librdf_hash_get(options, "layout");
+    if (layout && !strcmp(layout, "dictionary")) {
+
+	long cache = librdf_hash_get_as_long(options, "dictionary-cache");
+	if (cache < CASSANDRA_MIN_DICT_CACHE)
+	    cache = (cache > 0) ? CASSANDRA_MIN_DICT_CACHE :
+		CASSANDRA_DEFAULT_DICT_CACHE;
+
+	statements = cassandra_dict_statements;
+	context->dict = cassandra_dict_create(cache);
+	if (context->dict == 0) {
+	    fprintf(stderr, "Cassandra: dictionary cache allocation failed\n");
+	    LIBRDF_FREE(char*, layout);
+	    if(options)
+		librdf_free_hash(options);
+	    return 1;
+	}
 
-	o = librdf_new_node_from_typed_counted_literal(world, t + 2, len - 2,
-						       0, 0, dt);
-	librdf_free_uri(dt);
-	return o;
+    } else if (layout && !strcmp(layout, "quads")) {
+	statements = cassandra_quad_statements;
+	context->quads = 1;
+    } else if (layout && strcmp(layout, "plain")) {
+	fprintf(stderr, "Cassandra: unknown layout %s\n", layout);
+	LIBRDF_FREE(char*, layout);
+	if(options)
+	    librdf_free_hash(options);
+	return 1;
     }
-    
-    if (t[0] == 'f') {
-	librdf_uri* dt =
-	    librdf_new_uri(world,
-			   "http://www.w3.org/2001/XMLSchema#float");
-	if (dt == 0)
-	    return 0;
+    if (layout)
+	LIBRDF_FREE(char*, layout);
 
-	o = librdf_new_node_from_typed_counted_literal(world, t + 2, len - 2,
-						       0, 0, dt);
-	librdf_free_uri(dt);
-	return o;
+    if (context->quads && context->max_buckets) {
+	fprintf(stderr, "Cassandra: the quads layout can't be bucketed\n");
+	if(options)
+	    librdf_free_hash(options);
+	return 1;
     }
 
-    if (t[0] == 'd') {
-	librdf_uri* dt =
-	    librdf_new_uri(world,
-			   "http://www.w3.org/2001/XMLSchema#dateTime");
-	if (dt == 0)
-	    return 0;
+    memcpy(context->statements, statements, sizeof(context->statements));
+
+    if (context->max_buckets) {
+	const char** bucketed = cassandra_bucket_statements[context->dict != 0];
+	context->statements[CASSANDRA_INSERT_POS] = bucketed[0];
+	context->statements[CASSANDRA_INSERT_OSP] = bucketed[1];
+	context->statements[CASSANDRA_RANGE] = bucketed[2];
+	context->statements[CASSANDRA_DELETE_POS] = bucketed[3];
+	context->statements[CASSANDRA_DELETE_OSP] = bucketed[4];
+    } else {
+	context->statements[CASSANDRA_BUCKETS_GET] = 0;
+	context->statements[CASSANDRA_BUCKETS_ADD] = 0;
+	context->statements[CASSANDRA_BUCKETS_ALL] = 0;
+	context->statements[CASSANDRA_BUCKET_ROWS_GET] = 0;
+	context->statements[CASSANDRA_BUCKET_ROWS_ADD] = 0;
+    }
 
-	o = librdf_new_node_from_typed_counted_literal(world, t + 2, len - 2,
-						       0, 0, dt);
-	librdf_free_uri(dt);
-	return o;
-    }    
+    context->last_pattern = -1;
+    if (cassandra_plan_queries(context) < 0) {
+	if(options)
+	    librdf_free_hash(options);
+	return 1;
+    }
 
-    return librdf_new_node_from_typed_counted_literal(world,
-						      (unsigned char*) t + 2,
-						      len - 2, 0, 0, 0);
+    context->writes = LIBRDF_CALLOC(cassandra_write*, context->write_window,
+				    sizeof(cassandra_write));
+    context->pending = LIBRDF_CALLOC(cassandra_triple*, context->write_buffer,
+				     sizeof(cassandra_triple));
+    if (!context->writes || !context->pending || !datatypes ||
+	(context->max_buckets && !context->buckets)) {
+	if(options)
+	    librdf_free_hash(options);
+	return 1;
+    }
 
-}
+    /* The keyspace is the keyspace option, else the one a dataset is
+       published in, read once connected. */
+    char* keyspace = 0;
+    char* dataset = 0;
+    char* replication = 0;
+    if (options) {
+	keyspace = librdf_hash_get(options, "keyspace");
+	dataset = librdf_hash_get(options, "dataset");
+	replication = librdf_hash_get(options, "replication");
+    }
 
-static int
-cassandra_results_stream_end_of_stream(void* context)
-{
+    int bad = 0;
+    if (keyspace) {
+	context->keyspace = cassandra_keyspace_name(keyspace);
+	if (context->keyspace == 0) {
+	    fprintf(stderr, "Cassandra: bad keyspace %s\n", keyspace);
+	    bad = 1;
+	}
+	LIBRDF_FREE(char*, keyspace);
+    }
 
-    cassandra_results_stream* scontext;
-    scontext = (cassandra_results_stream*)context;
+    snprintf(context->replication, sizeof(context->replication),
+	     "{'class': 'SimpleStrategy', 'replication_factor': '1'}");
+    if (replication) {
+	if (cassandra_replication(replication, context->replication,
+				  sizeof(context->replication)) < 0) {
+	    fprintf(stderr, "Cassandra: bad replication %s\n", replication);
+	    bad = 1;
+	}
+	LIBRDF_FREE(char*, replication);
+    }
 
-    if (scontext->at_end) {
+    if (options && cassandra_table_options(context, options) < 0)
+	bad = 1;
 
-	if (scontext->more_pages) {
+    cassandra_cluster_config config;
+    cassandra_cluster_options(options, &config);
 
-	    CassError rc;
-	    rc = cass_statement_set_paging_state(scontext->stmt,
-						 scontext->result);
-	    if (rc != CASS_OK) {
-		fprintf(stderr, "Cassandra: %s\n", cass_error_desc(rc));
-		return -1;
-	    }
-	    
-	    cass_result_free(scontext->result);
-	    scontext->result = 0;
+    /* no more options, might as well free them now */
+    if(options)
+	librdf_free_hash(options);
 
-	    CassFuture* future =
-		cass_session_execute(scontext->cassandra_context->session,
-				     scontext->stmt);
-
-	    rc = cass_future_error_code(future);
-	    
-	    if (rc != CASS_OK) {
-		fprintf(stderr, "Cassandra: %s\n", cass_error_desc(rc));
-		const char* msg;
-		size_t msg_len;
-		cass_future_error_message(future, &msg, &msg_len);
-		fprintf(stderr, "Cassandra: %*s\n", msg_len, msg);
-		cass_future_free(future);
-		return -1;
-	    }
+    if (!bad)
+	context->shared = cassandra_shared_get(name, &config);
 
-	    scontext->result = cass_future_get_result(future);
+    if (context->shared && context->keyspace == 0 && dataset &&
+	cassandra_dataset_keyspace(context, dataset) < 0)
+	bad = 1;
 
-	    cass_future_free(future);
+    if (dataset)
+	LIBRDF_FREE(char*, dataset);
 
-	    scontext->iter = cass_iterator_from_result(scontext->result);
+    if (context->shared == 0 || bad)
+	return 1;
 
-	    scontext->more_pages = cass_result_has_more_pages(scontext->result);
+    context->session = context->shared->session;
 
-	    scontext->at_end = !cass_iterator_next(scontext->iter);
+    if (context->keyspace == 0)
+	context->keyspace = strdup("rdf");
+    if (context->keyspace == 0)
+	return 1;
 
+    for(i = 0; i < CASSANDRA_NUM_STATEMENTS; i++)
+	if (context->statements[i]) {
+	    context->cql[i] = cassandra_keyspace_cql(context->keyspace,
+						     context->statements[i]);
+	    if (context->cql[i] == 0)
+		return 1;
+	    context->statements[i] = context->cql[i];
 	}
-	
-    }
 
-    return (scontext->at_end);
+    return 0;
 
 }
 
 
-static int
-cassandra_results_stream_next_statement(void* context)
+static void
+librdf_storage_cassandra_terminate(librdf_storage* storage)
 {
+    librdf_storage_cassandra_instance* context;
 
-    cassandra_results_stream* scontext;
-    scontext = (cassandra_results_stream*)context;
+    context = (librdf_storage_cassandra_instance*)storage->instance;
+  
+    if (context == NULL)
+	return;
+
+    if(context->name)
+	LIBRDF_FREE(char*, context->name);
 
-    CassIterator* iter = scontext->iter;
+    if(context->writes)
+	LIBRDF_FREE(cassandra_write*, context->writes);
 
+    if(context->pending)
+	LIBRDF_FREE(cassandra_triple*, context->pending);
 
-    if (scontext->at_end) {
+    if(context->transaction)
+	cassandra_writes_free(context->transaction);
 
-	if (scontext->more_pages) {
+    if(context->dict)
+	cassandra_dict_free(context->dict);
 
-	    fprintf(stderr, "Set paging state2\n");
-	    CassError rc;
-	    rc = cass_statement_set_paging_state(scontext->stmt,
-					    scontext->result);
-	    if (rc != CASS_OK) {
-		fprintf(stderr, "Cassandra: %s\n", cass_error_desc(rc));
-		return -1;
-	    }
-	    cass_result_free(scontext->result);
-	    scontext->result = 0;
+    if(context->nodes)
+	cassandra_cache_free(context->nodes);
 
-	    CassFuture* future =
-		cass_session_execute(scontext->cassandra_context->session,
-				     scontext->stmt);
-
-	    rc = cass_future_error_code(future);
-	    
-	    if (rc != CASS_OK) {
-		fprintf(stderr, "Cassandra: %s\n", cass_error_desc(rc));
-		const char* msg;
-		size_t msg_len;
-		cass_future_error_message(future, &msg, &msg_len);
-		fprintf(stderr, "Cassandra: %*s\n", msg_len, msg);
-		cass_future_free(future);
-		return -1;
-	    }
+    if(context->bloom)
+	cassandra_bloom_free(context->bloom);
 
-	    scontext->result = cass_future_get_result(future);
+    if(context->query_bgp)
+	cassandra_bgp_free(context->query_bgp);
 
-	    cass_future_free(future);
+    if(context->buckets)
+	cassandra_cache_free(context->buckets);
 
-	    scontext->iter = cass_iterator_from_result(scontext->result);
+    if(context->namespace_dict)
+	cassandra_dict_free(context->namespace_dict);
 
-	    scontext->more_pages = cass_result_has_more_pages(scontext->result);
+#ifdef HAVE_PTHREAD_H
+    pthread_mutex_destroy(&context->namespace_lock);
+#endif
 
-	    scontext->at_end = !cass_iterator_next(scontext->iter);
+    if(context->shared)
+	cassandra_shared_release(context->shared);
 
-	}
-	
-	if (scontext->at_end)
-	    return -1;
+    if(context->keyspace)
+	free(context->keyspace);
 
-	return 0;
+    int i;
+    for(i = 0; i < CASSANDRA_NUM_TABLES; i++)
+	if(context->table_options[i])
+	    free(context->table_options[i]);
+
+    for(i = 0; i < CASSANDRA_NUM_STATEMENTS; i++)
+	if(context->cql[i])
+	    free(context->cql[i]);
 
+    for(i = 0; i < 8; i++) {
+	if(context->queries[i])
+	    free(context->queries[i]);
+	if(context->removes[i])
+	    free(context->removes[i]);
     }
 
+    for(i = 0; i < CASSANDRA_NUM_DATATYPES; i++)
+	if(context->datatypes[i])
+	    librdf_free_uri(context->datatypes[i]);
+
+    LIBRDF_FREE(librdf_storage_cassandra_terminate, storage->instance);
+}
+
+/* Extracts the parts of a node which go into its encoding.  The strings
+   belong to the node. */
+static void
+term_helper(librdf_node* node, cassandra_term* term)
+{
+
+    librdf_uri* dt_uri;
+
+    term->type = librdf_node_get_type(node);
+    term->value = 0;
+    term->datatype = 0;
+    term->language = 0;
+
+    switch(term->type) {
+
+    case LIBRDF_NODE_TYPE_RESOURCE:
+	term->value = (const char*)
+	    librdf_uri_as_string(librdf_node_get_uri(node));
+	break;
+
+    case LIBRDF_NODE_TYPE_LITERAL:
+	dt_uri = librdf_node_get_literal_value_datatype_uri(node);
+	if (dt_uri)
+	    term->datatype = (const char*) librdf_uri_as_string(dt_uri);
+	term->language = librdf_node_get_literal_value_language(node);
+	term->value = (const char*) librdf_node_get_literal_value(node);
+	break;
+
+    case LIBRDF_NODE_TYPE_BLANK:
+	term->value = (const char*) librdf_node_get_blank_identifier(node);
+	break;
+
+    case LIBRDF_NODE_TYPE_UNKNOWN:
+	break;
+
+    }
+
+}
+
+/* Days from 1970-01-01 to a date of the proleptic Gregorian calendar. */
+static int64_t
+cassandra_days_from_civil(int64_t y, int m, int d)
+{
+
+    y -= (m <= 2);
+    int64_t era = (y >= 0 ? y : y - 399) / 400;
+    int64_t yoe = y - era * 400;
+    int64_t doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+    int64_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+
+    return era * 146097 + doe - 719468;
+
+}
+
+/* Reads count decimal digits, moving p past them.  Returns their value,
+   or -1 if there are fewer. */
+static int
+cassandra_parse_digits(const char** p, int count)
+{
+
+    int v = 0;
+
+    for(; count > 0; count--, (*p)++) {
+	if (**p < '0' || **p > '9')
+	    return -1;
+	v = v * 10 + (**p - '0');
+    }
+
+    return v;
+
+}
+
+/* Reads an xsd:dateTime as microseconds since the epoch, in UTC.  A
+   time without a timezone is taken as UTC.  Years have four or five
+   digits, which keeps the microseconds well within 64 bits. */
+static int
+cassandra_parse_datetime(const char* value, int64_t* micros)
+{
+
+    const char* p = value;
+    int y, mo, d, h, mi, sec;
+    int len;
+
+    int negative = (*p == '-');
+    if (negative)
+	p++;
+
+    for(len = 0; p[len] >= '0' && p[len] <= '9'; len++)
+	;
+    if (len < 4 || len > 5 || (len > 4 && *p == '0'))
+	return -1;
+
+    if ((y = cassandra_parse_digits(&p, len)) < 0 || *p++ != '-' ||
+	(mo = cassandra_parse_digits(&p, 2)) < 0 || *p++ != '-' ||
+	(d = cassandra_parse_digits(&p, 2)) < 0 || *p++ != 'T' ||
+	(h = cassandra_parse_digits(&p, 2)) < 0 || *p++ != ':' ||
+	(mi = cassandra_parse_digits(&p, 2)) < 0 || *p++ != ':' ||
+	(sec = cassandra_parse_digits(&p, 2)) < 0)
+	return -1;
+
+    if (negative)
+	y = -y;
+
+    if (mo < 1 || mo > 12 || d < 1 || d > 31 || h > 24 || mi > 59 ||
+	sec > 60 || (h == 24 && (mi || sec)))
+	return -1;
+
+    int64_t fraction = 0;
+    if (*p == '.') {
+	int digits = 0;
+	for(p++; *p >= '0' && *p <= '9'; p++)
+	    if (digits++ < 6)
+		fraction = fraction * 10 + (*p - '0');
+	if (digits == 0)
+	    return -1;
+	for(; digits < 6; digits++)
+	    fraction *= 10;
+    }
+
+    int64_t offset = 0;
+    if (*p == 'Z') {
+	p++;
+    } else if (*p == '+' || *p == '-') {
+	int sign = (*p++ == '-') ? -1 : 1;
+	int tzh, tzm;
+	if ((tzh = cassandra_parse_digits(&p, 2)) < 0 || *p++ != ':' ||
+	    (tzm = cassandra_parse_digits(&p, 2)) < 0 ||
+	    tzh > 14 || tzm > 59 || (tzh == 14 && tzm))
+	    return -1;
+	offset = sign * (tzh * 60 + tzm) * 60;
+    }
+
+    if (*p || (h == 24 && fraction))
+	return -1;
+
+    int64_t seconds = cassandra_days_from_civil(y, mo, d) * 86400 +
+	h * 3600 + mi * 60 + sec - offset;
+
+    *micros = seconds * 1000000 + fraction;
+
+    return 0;
+
+}
+
+/* Maps an integer or a double to a key which sorts the same way as
+   unsigned. */
+static uint64_t
+cassandra_integer_key(int64_t v)
+{
+    return (uint64_t) v ^ ((uint64_t) 1 << 63);
+}
+
+static uint64_t
+cassandra_double_key(double v)
+{
+
+    uint64_t bits;
+
+    /* -0 and 0 are the same value. */
+    if (v == 0)
+	v = 0;
+
+    memcpy(&bits, &v, sizeof(bits));
+
+    if (bits >> 63)
+	return ~bits;
+
+    return bits | ((uint64_t) 1 << 63);
+
+}
+
+/* Works out the sort key of a literal of type 'i', 'f' or 'd'.  Fails
+   for text which isn't a value of its type. */
+static int
+cassandra_sort_key(char type, const char* value, uint64_t* key)
+{
+
+    char* end;
+
+    if (*value == 0)
+	return -1;
+
+    switch(type) {
+
+    case 'i': {
+	errno = 0;
+	long long v = strtoll(value, &end, 10);
+	if (*end || errno)
+	    return -1;
+	*key = cassandra_integer_key(v);
+	return 0;
+    }
+
+    case 'f': {
+	double v = strtod(value, &end);
+	if (*end || v != v)
+	    return -1;
+	*key = cassandra_double_key(v);
+	return 0;
+    }
+
+    case 'd': {
+	int64_t micros;
+	if (cassandra_parse_datetime(value, &micros) < 0)
+	    return -1;
+	*key = cassandra_integer_key(micros);
+	return 0;
+    }
+
+    }
+
+    return -1;
+
+}
+
+/* Writes n as a varint holding n + 1, 7 bits to a byte, low bits first,
+   returning its length.  None of its bytes are zero. */
+static size_t
+cassandra_varint_put(unsigned char* buf, size_t n)
+{
+
+    size_t len = 0;
+
+    for(n++; n >= 0x80; n >>= 7)
+	buf[len++] = (unsigned char) (n | 0x80);
+    buf[len++] = (unsigned char) n;
+
+    return len;
+
+}
+
+static size_t
+cassandra_varint_size(size_t n)
+{
+
+    size_t len = 1;
+
+    for(n++; n >= 0x80; n >>= 7)
+	len++;
+
+    return len;
+
+}
+
+/* Reads a varint written by cassandra_varint_put, returning the byte
+   after it, or 0 if it is invalid or runs past end. */
+static const unsigned char*
+cassandra_varint_get(const unsigned char* p, const unsigned char* end,
+		     size_t* n)
+{
+
+    size_t v = 0;
+    int shift;
+
+    for(shift = 0; p < end && shift < 64; shift += 7) {
+	unsigned char b = *p++;
+	v |= (size_t) (b & 0x7f) << shift;
+	if (!(b & 0x80)) {
+	    if (v == 0)
+		return 0;
+	    *n = v - 1;
+	    return p;
+	}
+    }
+
+    return 0;
+
+}
+
+/* Writes a sort key as CASSANDRA_SORT_KEY bytes of 7 bits, high bits
+   first, each with its top bit set.  They compare as bytes in the order
+   of the keys, and none are zero. */
+static void
+cassandra_sort_key_put(unsigned char* buf, uint64_t key)
+{
+
+    int i;
+
+    for(i = 0; i < CASSANDRA_SORT_KEY; i++)
+	buf[i] = 0x80 |
+	    ((key >> (7 * (CASSANDRA_SORT_KEY - 1 - i))) & 0x7f);
+
+}
+
+/* Returns the index of a datatype URI in cassandra_datatypes, or -1. */
+static int
+cassandra_datatype_id(const char* datatype)
+{
+
+    int i;
+
+    for(i = 0; i < CASSANDRA_NUM_DATATYPES; i++)
+	if (strcmp(datatype, cassandra_datatypes[i]) == 0)
+	    return i;
+
+    return -1;
+
+}
+
+/* Returns the length of a URI's namespace, or 0 if it has none.  The
+   namespace runs to the last '#', or else to the last '/' not following
+   a path segment with a digit in it, so that per-item paths such as
+   http://example.org/doc/123/ are not taken for namespaces.  It is a
+   function of the URI alone, so every client splits a URI alike. */
+static size_t
+cassandra_namespace_split(const char* uri, size_t len)
+{
+
+    const char* scheme = memchr(uri, ':', len);
+    if (scheme == 0 || (size_t) (uri + len - scheme) < 3 ||
+	scheme[1] != '/' || scheme[2] != '/')
+	return 0;
+
+    /* The namespace includes at least the authority. */
+    const char* start = scheme + 3;
+    const char* authority = memchr(start, '/', uri + len - start);
+    if (authority == 0)
+	return 0;
+
+    const char* end = uri + len;
+    const char* p;
+
+    for(p = end - 1; p > authority; p--)
+	if (*p == '#')
+	    return p + 1 - uri;
+
+    const char* split = 0;
+    const char* segment_end = 0;
+    int digits = 0;
+
+    for(p = end - 1; p >= authority; p--) {
+	if (*p == '/') {
+	    if (segment_end && !digits)
+		break;
+	    split = p;
+	    segment_end = p;
+	    digits = 0;
+	} else if (*p >= '0' && *p <= '9' && segment_end)
+	    digits = 1;
+    }
+
+    if (p < authority)
+	split = authority;
+
+    return split + 1 - uri;
+
+}
+
+/* Encodes a term into buf, which has room for size bytes, and returns
+   the length of the encoding, not counting the NUL written after it.
+   If that isn't less than size nothing is written, and the caller
+   tries again with a buffer big enough.  Returns 0 on failure.
+
+   The text encoding is "c:text", where c is the term's type.  With
+   sortable set, integer, float and dateTime literals are encoded as
+   "I:", "F:" or "D:", 16 hex digits of their sort key, ':' and their
+   text.  Other datatypes and languages are not kept.
+
+   The compact encoding is a tag, a varint of the text's length, the
+   datatype id or the language of a literal which has one, and the
+   text.  A datatype without an id is written as id 0 and the URI's
+   varint length and text.  A sortable literal has its sort key straight
+   after the tag.  A URI in namespace ns, which is its first ns_len
+   bytes, has the namespace's id after the length and only the rest of
+   the URI as its text; ns is -1 for none.
+
+   Either way the columns compare as bytes, so each sortable type's
+   objects cluster in value order in rdf.pos.  Literals whose text isn't
+   a value of their type are encoded as other typed literals. */
+static size_t
+cassandra_term_encode(const cassandra_term* t, int sortable, int compact,
+		      int ns, size_t ns_len, char* buf, size_t size)
+{
+
+    char data_type;
+    int datatype = -1;
+
+    switch(t->type) {
+
+    case LIBRDF_NODE_TYPE_RESOURCE:
+	data_type = 'u';
+	break;
+
+    case LIBRDF_NODE_TYPE_LITERAL:
+	data_type = 's';
+	if (t->datatype)
+	    datatype = cassandra_datatype_id(t->datatype);
+	if (datatype == CASSANDRA_XSD_INTEGER)
+	    data_type = 'i';
+	else if (datatype == CASSANDRA_XSD_FLOAT)
+	    data_type = 'f';
+	else if (datatype == CASSANDRA_XSD_DATETIME)
+	    data_type = 'd';
+	break;
+
+    case LIBRDF_NODE_TYPE_BLANK:
+	data_type = 'b';
+	break;
+
+    default:
+	fprintf(stderr, "term_encode called on unknown node type\n");
+	return 0;
+
+    }
+
+    const char* value = t->value;
+    size_t len = strlen(value);
+
+    uint64_t key;
+    int sorted = sortable &&
+	(data_type == 'i' || data_type == 'f' || data_type == 'd') &&
+	cassandra_sort_key(data_type, t->value, &key) == 0;
+
+    if (!compact) {
+
+	size_t need = (sorted ? CASSANDRA_SORT_PREFIX : 2) + len;
+	if (need >= size)
+	    return need;
+
+	char* p = buf;
+	int i;
+
+	if (sorted) {
+	    *p++ = data_type - 'a' + 'A';
+	    *p++ = ':';
+	    for(i = 15; i >= 0; i--)
+		*p++ = "0123456789abcdef"[(key >> (4 * i)) & 0xf];
+	} else
+	    *p++ = data_type;
+	*p++ = ':';
+
+	memcpy(p, t->value, len + 1);
+
+	return need;
+
+    }
+
+    unsigned char tag;
+    size_t extra = 0;
+    size_t dt_len = 0;
+    size_t lang_len = 0;
+
+    if (sorted)
+	tag = (data_type == 'i') ? CASSANDRA_TAG_INTEGER :
+	    (data_type == 'f') ? CASSANDRA_TAG_FLOAT : CASSANDRA_TAG_DATETIME;
+    else if (data_type == 'u' && ns >= 0) {
+	tag = CASSANDRA_TAG_NAMESPACE;
+	value += ns_len;
+	len -= ns_len;
+	extra = cassandra_varint_size(ns);
+    } else if (data_type == 'u')
+	tag = CASSANDRA_TAG_URI;
+    else if (data_type == 'b')
+	tag = CASSANDRA_TAG_BLANK;
+    else if (t->datatype) {
+	tag = CASSANDRA_TAG_TYPED;
+	extra = cassandra_varint_size(datatype + 1);
+	if (datatype < 0) {
+	    dt_len = strlen(t->datatype);
+	    extra += cassandra_varint_size(dt_len) + dt_len;
+	}
+    } else if (t->language && *t->language) {
+	tag = CASSANDRA_TAG_LANGUAGE;
+	lang_len = strlen(t->language);
+	extra = cassandra_varint_size(lang_len) + lang_len;
+    } else
+	tag = CASSANDRA_TAG_PLAIN;
+
+    size_t need = 1 + (sorted ? CASSANDRA_SORT_KEY : 0) +
+	cassandra_varint_size(len) + extra + len;
+    if (need >= size)
+	return need;
+
+    unsigned char* p = (unsigned char*) buf;
+
+    *p++ = tag;
+
+    if (sorted) {
+	cassandra_sort_key_put(p, key);
+	p += CASSANDRA_SORT_KEY;
+    }
+
+    p += cassandra_varint_put(p, len);
+
+    if (tag == CASSANDRA_TAG_NAMESPACE)
+	p += cassandra_varint_put(p, ns);
+
+    if (tag == CASSANDRA_TAG_TYPED) {
+	p += cassandra_varint_put(p, datatype + 1);
+	if (datatype < 0) {
+	    p += cassandra_varint_put(p, dt_len);
+	    memcpy(p, t->datatype, dt_len);
+	    p += dt_len;
+	}
+    }
+
+    if (tag == CASSANDRA_TAG_LANGUAGE) {
+	p += cassandra_varint_put(p, lang_len);
+	memcpy(p, t->language, lang_len);
+	p += lang_len;
+    }
+
+    memcpy(p, value, len + 1);
+
+    return need;
+
+}
+
+static void
+cassandra_namespace_lock(librdf_storage_cassandra_instance* context)
+{
+#ifdef HAVE_PTHREAD_H
+    pthread_mutex_lock(&context->namespace_lock);
+#endif
+}
+
+static void
+cassandra_namespace_unlock(librdf_storage_cassandra_instance* context)
+{
+#ifdef HAVE_PTHREAD_H
+    pthread_mutex_unlock(&context->namespace_lock);
+#endif
+}
+
+/* Returns the id of a namespace, or -1 if it has none.  A namespace
+   which isn't known may have been added by another client, so unless
+   every id is taken rdf.namespaces is read again.  A term written in
+   full only costs space, so for writes that is at most once every
+   CASSANDRA_NAMESPACE_TTL seconds.  A term looked up in full would miss
+   its stored rows, so for lookups, such as finds and removes, it is
+   whenever the next id has been taken. */
+static int
+cassandra_namespace_find(librdf_storage_cassandra_instance* context,
+			 const char* ns, size_t len, int lookup)
+{
+
+    int64_t id;
+
+    cassandra_namespace_lock(context);
+
+    int found = cassandra_dict_get_id(context->namespace_dict, ns, len, &id);
+    int reload = 0;
+    if (!found && context->namespace_count < CASSANDRA_MAX_NAMESPACES) {
+	if (lookup)
+	    reload = (cassandra_namespaces_changed(context) != 0);
+	else
+	    reload = (time(0) - context->namespace_checked >=
+		      CASSANDRA_NAMESPACE_TTL);
+    }
+    if (reload && cassandra_namespaces_load(context) == 0)
+	found = cassandra_dict_get_id(context->namespace_dict, ns, len, &id);
+
+    cassandra_namespace_unlock(context);
+
+    return found ? (int) id : -1;
+
+}
+
+/* Compressed text is escaped so that an encoded term still has no zero
+   bytes: 0 is written as 1 1, and 1 as 1 2.  Returns the escaped
+   length, writing to dst unless it is 0. */
+static size_t
+cassandra_escape(const unsigned char* src, size_t len, unsigned char* dst)
+{
+
+    size_t i, n = 0;
+
+    for(i = 0; i < len; i++) {
+	if (src[i] <= 1) {
+	    if (dst) {
+		dst[n] = 1;
+		dst[n + 1] = src[i] + 1;
+	    }
+	    n += 2;
+	} else {
+	    if (dst)
+		dst[n] = src[i];
+	    n++;
+	}
+    }
+
+    return n;
+
+}
+
+/* Undoes cassandra_escape into dst, which has room for len bytes.
+   Returns the unescaped length, or 0 if src is not escaped bytes. */
+static size_t
+cassandra_unescape(const unsigned char* src, size_t len, unsigned char* dst)
+{
+
+    size_t i, n = 0;
+
+    for(i = 0; i < len; i++) {
+	if (src[i] == 1) {
+	    if (i + 1 >= len || src[i + 1] < 1 || src[i + 1] > 2)
+		return 0;
+	    dst[n++] = src[++i] - 1;
+	} else
+	    dst[n++] = src[i];
+    }
+
+    return n;
+
+}
+
+/* Replaces a literal's compact encoding, of len bytes ending in text_len
+   bytes of text, by its compressed encoding if that is shorter.  That is
+   the compressed tag, the encoding up to the text, and the compressed
+   text. */
+static void
+cassandra_term_compress(char** term, size_t len, size_t text_len)
+{
+
+    size_t header = len - text_len;
+    const unsigned char* text = (const unsigned char*) *term + header;
+
+    unsigned char* packed = malloc(text_len);
+    if (packed == 0)
+	return;
+
+    size_t packed_len = cassandra_lz_compress(text, text_len, packed,
+					      text_len);
+    size_t escaped = packed_len ? cassandra_escape(packed, packed_len, 0) : 0;
+
+    if (packed_len == 0 || 1 + header + escaped >= len) {
+	free(packed);
+	return;
+    }
+
+    char* out = malloc(1 + header + escaped + 1);
+    if (out == 0) {
+	free(packed);
+	return;
+    }
+
+    out[0] = (char) CASSANDRA_TAG_COMPRESSED;
+    memcpy(out + 1, *term, header);
+    cassandra_escape(packed, packed_len, (unsigned char*) out + 1 + header);
+    out[1 + header + escaped] = 0;
+
+    free(packed);
+    free(*term);
+    *term = out;
+
+}
+
+/* Encodes a term into a new string, in the storage's encoding.  lookup
+   is set when the term is to find stored rows rather than to write
+   them. */
+static
+char* term_encode(librdf_storage_cassandra_instance* context,
+		  const cassandra_term* t, int lookup)
+{
+
+    char buf[CASSANDRA_TERM_BUFFER];
+    int ns = -1;
+    size_t ns_len = 0;
+
+    if (context->namespace_dict && t->type == LIBRDF_NODE_TYPE_RESOURCE) {
+	ns_len = cassandra_namespace_split(t->value, strlen(t->value));
+	if (ns_len > 0)
+	    ns = cassandra_namespace_find(context, t->value, ns_len, lookup);
+    }
+
+    size_t len = cassandra_term_encode(t, context->sortable,
+				       context->compact, ns, ns_len, buf,
+				       sizeof(buf));
+    if (len == 0)
+	return 0;
+
+    char* term = malloc(len + 1);
+    if (term == 0) {
+	fprintf(stderr, "malloc failed");
+	return 0;
+    }
+
+    if (len < sizeof(buf))
+	memcpy(term, buf, len + 1);
+    else
+	cassandra_term_encode(t, context->sortable, context->compact, ns,
+			      ns_len, term, len + 1);
+
+    unsigned char tag = (unsigned char) term[0];
+    size_t text_len = strlen(t->value);
+
+    if (context->compress_literals && text_len >= context->compress_literals &&
+	(tag == CASSANDRA_TAG_PLAIN || tag == CASSANDRA_TAG_LANGUAGE ||
+	 tag == CASSANDRA_TAG_TYPED))
+	cassandra_term_compress(&term, len, text_len);
+
+    return term;
+
+}
+
+static
+char* node_helper(librdf_storage* storage, librdf_node* node, int lookup)
+{
+
+    librdf_storage_cassandra_instance* context =
+	(librdf_storage_cassandra_instance*)storage->instance;
+    cassandra_term term;
+
+    term_helper(node, &term);
+
+    return term_encode(context, &term, lookup);
+
+}
+
+/* Encodes the parts of a statement, each 0 if missing, and its context,
+   which is only kept by the quads layout, to write them or, with lookup
+   set, to find them.  The caller frees them. */
+static void
+statement_helper(librdf_storage* storage,
+		 librdf_statement* statement,
+		 librdf_node* context,
+		 char** s, char** p, char** o, char** c, int lookup)
+{
+
+    librdf_node* sn = librdf_statement_get_subject(statement);
+    librdf_node* pn = librdf_statement_get_predicate(statement);
+    librdf_node* on = librdf_statement_get_object(statement);
+
+    if (sn)
+	*s = node_helper(storage, sn, lookup);
+    else
+	*s = 0;
+    
+    if (pn)
+	*p = node_helper(storage, pn, lookup);
+    else
+	*p = 0;
+
+    if (on)
+	*o = node_helper(storage, on, lookup);
+    else
+	*o = 0;
+
+    librdf_storage_cassandra_instance* instance =
+	(librdf_storage_cassandra_instance*) storage->instance;
+
+    if (context && instance->quads)
+	*c = node_helper(storage, context, lookup);
+    else
+	*c = 0;
+
+}
+
+static void
+cassandra_report_error(CassFuture* future)
+{
+
+    CassError rc = cass_future_error_code(future);
+    fprintf(stderr, "Cassandra: %s\n", cass_error_desc(rc));
+
+    const char* msg;
+    size_t msg_len;
+    cass_future_error_message(future, &msg, &msg_len);
+    fprintf(stderr, "Cassandra: %.*s\n", (int) msg_len, msg);
+
+}
+
+/* Returns the statement prepared from cql on a shared session,
+   preparing it if no instance has yet.  With again, it is prepared
+   again even so, for a server which has forgotten it; the statement
+   already held stays good, as its id is the same.  Returns 0 on
+   error. */
+static const CassPrepared*
+cassandra_shared_prepare(cassandra_shared* shared, const char* cql, int again)
+{
+
+#ifdef HAVE_PTHREAD_H
+    pthread_mutex_lock(&shared->lock);
+#endif
+
+    cassandra_shared_statement* statement;
+    for(statement = shared->statements; statement;
+	statement = statement->next)
+	if (!strcmp(statement->cql, cql))
+	    break;
+
+    const CassPrepared* prepared = statement ? statement->prepared : 0;
+
+    if (prepared == 0 || again) {
+
+	CassFuture* future = cass_session_prepare(shared->session, cql);
+
+	if (cass_future_error_code(future) != CASS_OK) {
+	    cassandra_report_error(future);
+	    prepared = 0;
+	} else if (statement == 0) {
+	    statement = calloc(1, sizeof(*statement));
+	    if (statement)
+		statement->cql = strdup(cql);
+	    if (statement && statement->cql) {
+		statement->prepared = cass_future_get_prepared(future);
+		statement->next = shared->statements;
+		shared->statements = statement;
+		prepared = statement->prepared;
+	    } else
+		free(statement);
+	}
+
+	cass_future_free(future);
+
+    }
+
+#ifdef HAVE_PTHREAD_H
+    pthread_mutex_unlock(&shared->lock);
+#endif
+
+    return prepared;
+
+}
+
+static int
+cassandra_prepare(librdf_storage_cassandra_instance* context,
+		  cassandra_statement_id id)
+{
+
+    context->prepared[id] =
+	cassandra_shared_prepare(context->shared, context->statements[id], 0);
+
+    return context->prepared[id] ? 0 : -1;
+
+}
+
+static int
+cassandra_prepare_all(librdf_storage_cassandra_instance* context)
+{
+
+    int id;
+
+    for(id = 0; id < CASSANDRA_NUM_STATEMENTS; id++)
+	if (context->statements[id] && cassandra_prepare(context, id) < 0)
+	    return -1;
+
+    return 0;
+
+}
+
+/* Forgets the prepared statements, which the shared session frees. */
+static void
+cassandra_free_prepared(librdf_storage_cassandra_instance* context)
+{
+
+    memset(context->prepared, 0, sizeof(context->prepared));
+
+}
+
+/* Returns a new statement bound to the cached prepared statement.  A
+   statement not prepared at open time is prepared here, and counted as a
+   miss. */
+static CassStatement*
+cassandra_bind(librdf_storage_cassandra_instance* context,
+	       cassandra_statement_id id)
+{
+
+    if (context->prepared[id] == 0) {
+	context->prepare_misses++;
+	if (cassandra_prepare(context, id) < 0)
+	    return 0;
+    }
+
+    CassStatement* stmt = cass_prepared_bind(context->prepared[id]);
+
+    /* Only idempotent statements are executed speculatively.  Counter
+       updates and conditional inserts are not. */
+    if (id != CASSANDRA_COUNT_ADD && id != CASSANDRA_BUCKET_ROWS_ADD &&
+	id != CASSANDRA_ID_PUT && id != CASSANDRA_NAMESPACE_PUT)
+	cass_statement_set_is_idempotent(stmt, cass_true);
+
+    return stmt;
+
+}
+
+/* Called when the server rejects a prepared statement as unknown, e.g.
+   after a node restart flushed its statement cache.  Returns non-zero if
+   the statement was prepared again and the request is worth retrying. */
+static int
+cassandra_reprepare(librdf_storage_cassandra_instance* context,
+		    cassandra_statement_id id, CassFuture* future)
+{
+
+    if (cass_future_error_code(future) != CASS_ERROR_SERVER_UNPREPARED)
+	return 0;
+
+    context->reprepares++;
+
+    return (cassandra_shared_prepare(context->shared, context->statements[id],
+				     1) != 0);
+
+}
+
+/* Executes a statement bound from prepared statement id, preparing it
+   again and retrying once if the server has forgotten it. */
+static CassFuture*
+cassandra_execute(librdf_storage_cassandra_instance* context,
+		  cassandra_statement_id id, CassStatement* stmt)
+{
+
+    CassFuture* future = cass_session_execute(context->session, stmt);
+
+    if (cassandra_reprepare(context, id, future)) {
+	cass_future_free(future);
+	future = cass_session_execute(context->session, stmt);
+    }
+
+    return future;
+
+}
+
+/* Runs a single-row dictionary query, returning its result, or 0 on
+   error. */
+static const CassResult*
+cassandra_dict_execute(librdf_storage_cassandra_instance* context,
+		       cassandra_statement_id id, CassStatement* stmt)
+{
+
+    CassFuture* future = cassandra_execute(context, id, stmt);
+    cass_statement_free(stmt);
+
+    if (cass_future_error_code(future) != CASS_OK) {
+	cassandra_report_error(future);
+	cass_future_free(future);
+	return 0;
+    }
+
+    const CassResult* result = cass_future_get_result(future);
+    cass_future_free(future);
+
+    return result;
+
+}
+
+/* Binds the bytes of an encoded term to a column holding terms: text,
+   or blob in the compact encoding. */
+static void
+cassandra_bind_encoded(librdf_storage_cassandra_instance* context,
+		       CassStatement* stmt, size_t i, const char* term,
+		       size_t len)
+{
+
+    if (context->compact)
+	cass_statement_bind_bytes(stmt, i, (const cass_byte_t*) term, len);
+    else
+	cass_statement_bind_string_n(stmt, i, term, len);
+
+}
+
+/* Fetches an encoded term from a column holding terms. */
+static int
+cassandra_value_encoded(librdf_storage_cassandra_instance* context,
+			const CassValue* value, const char** term,
+			size_t* len)
+{
+
+    CassError rc;
+
+    if (context->compact)
+	rc = cass_value_get_bytes(value, (const cass_byte_t**) term, len);
+    else
+	rc = cass_value_get_string(value, term, len);
+
+    return (rc == CASS_OK) ? 0 : -1;
+
+}
+
+/* Returns non-zero if the conditional insert of a term into rdf.ids
+   left the id owned by that term. */
+static int
+cassandra_id_owned(librdf_storage_cassandra_instance* context,
+		   const CassResult* result, const char* term, size_t len)
+{
+
+    const CassRow* row = cass_result_first_row(result);
+    cass_bool_t applied = cass_false;
+    if (row)
+	cass_value_get_bool(cass_row_get_column(row, 0), &applied);
+
+    /* Not applied returns the current owner of the id, which may be this
+       same term, written by another client. */
+    int owned = applied;
+    if (!applied && row) {
+	const char* existing;
+	size_t existing_len;
+	if (cassandra_value_encoded(context,
+				    cass_row_get_column_by_name(row, "term"),
+				    &existing, &existing_len) == 0)
+	    owned = (existing_len == len &&
+		     memcmp(existing, term, len) == 0);
+    }
+
+    return owned;
+
+}
+
+/* Allocates an id for a new term.  The first id tried is a hash of the
+   term, and collisions probe upwards, so every client offers a term the
+   same ids in the same order; the conditional insert into rdf.ids
+   decides which term owns an id. */
+static int
+cassandra_term_allocate(librdf_storage_cassandra_instance* context,
+			const char* term, size_t len, int64_t* id)
+{
+
+    int64_t candidate = cassandra_dict_hash(term, len);
+    int probe;
+
+    for(probe = 0; probe < CASSANDRA_DICT_PROBES; probe++, candidate++) {
+
+	CassStatement* stmt = cassandra_bind(context, CASSANDRA_ID_PUT);
+	if (stmt == 0)
+	    return -1;
+	cass_statement_bind_int64(stmt, 0, candidate);
+	cassandra_bind_encoded(context, stmt, 1, term, len);
+
+	const CassResult* result =
+	    cassandra_dict_execute(context, CASSANDRA_ID_PUT, stmt);
+	if (result == 0)
+	    return -1;
+
+	int owned = cassandra_id_owned(context, result, term, len);
+
+	cass_result_free(result);
+
+	if (owned) {
+	    *id = candidate;
+	    return 0;
+	}
+
+    }
+
+    fprintf(stderr, "Cassandra: no free dictionary id for term %s\n", term);
+    return -1;
+
+}
+
+/* Finds the id of an encoded term: from the cache, then rdf.terms, and
+   lastly by allocating one if create is set.  Returns 0 with the id, 1
+   if the term is not in the dictionary, or -1 on error. */
+static int
+cassandra_term_id(librdf_storage_cassandra_instance* context,
+		  const char* term, int create, int64_t* id)
+{
+
+    size_t len = strlen(term);
+
+    if (cassandra_dict_get_id(context->dict, term, len, id))
+	return 0;
+
+    CassStatement* stmt = cassandra_bind(context, CASSANDRA_TERM_GET_ID);
+    if (stmt == 0)
+	return -1;
+    cassandra_bind_encoded(context, stmt, 0, term, len);
+
+    const CassResult* result =
+	cassandra_dict_execute(context, CASSANDRA_TERM_GET_ID, stmt);
+    if (result == 0)
+	return -1;
+
+    const CassRow* row = cass_result_first_row(result);
+    int found = row &&
+	(cass_value_get_int64(cass_row_get_column(row, 0), id) == CASS_OK);
+
+    cass_result_free(result);
+
+    if (!found) {
+
+	if (!create)
+	    return 1;
+
+	if (cassandra_term_allocate(context, term, len, id) < 0)
+	    return -1;
+
+	stmt = cassandra_bind(context, CASSANDRA_TERM_PUT);
+	if (stmt == 0)
+	    return -1;
+	cassandra_bind_encoded(context, stmt, 0, term, len);
+	cass_statement_bind_int64(stmt, 1, *id);
+
+	result = cassandra_dict_execute(context, CASSANDRA_TERM_PUT, stmt);
+	if (result == 0)
+	    return -1;
+	cass_result_free(result);
+
+    }
+
+    cassandra_dict_put(context->dict, term, len, *id);
+
+    return 0;
+
+}
+
+/* Binds an encoded term to a statement.  In the dictionary layout the
+   term's id is bound, and allocated if create is set.  Returns 0, 1 if
+   the term is not in the dictionary, or -1 on error. */
+static int
+cassandra_bind_term(librdf_storage_cassandra_instance* context,
+		    CassStatement* stmt, size_t i, const char* term,
+		    int create)
+{
+
+    if (context->dict == 0) {
+	cassandra_bind_encoded(context, stmt, i, term, strlen(term));
+	return 0;
+    }
+
+    int64_t id;
+    int ret = cassandra_term_id(context, term, create, &id);
+    if (ret != 0)
+	return ret;
+
+    cass_statement_bind_int64(stmt, i, id);
+    return 0;
+
+}
+
+/* Binds the context column of the quads layout, which is empty for a
+   triple in no context. */
+static void
+cassandra_bind_context(librdf_storage_cassandra_instance* context,
+		       CassStatement* stmt, size_t i, const char* c)
+{
+    cassandra_bind_encoded(context, stmt, i, c ? c : "", c ? strlen(c) : 0);
+}
+
+/* Fetches the terms of a batch of ids from rdf.ids into the cache,
+   keeping up to CASSANDRA_RESOLVE_WAVE lookups in flight. */
+static int
+cassandra_resolve_ids(librdf_storage_cassandra_instance* context,
+		      const int64_t* ids, size_t count)
+{
+
+    CassFuture* futures[CASSANDRA_RESOLVE_WAVE];
+    size_t start, i;
+    int ret = 0;
+
+    for(start = 0; start < count; start += CASSANDRA_RESOLVE_WAVE) {
+
+	size_t n = count - start;
+	if (n > CASSANDRA_RESOLVE_WAVE)
+	    n = CASSANDRA_RESOLVE_WAVE;
+
+	for(i = 0; i < n; i++) {
+	    CassStatement* stmt = cassandra_bind(context, CASSANDRA_ID_GET_TERM);
+	    if (stmt == 0) {
+		futures[i] = 0;
+		ret = -1;
+		continue;
+	    }
+	    cass_statement_bind_int64(stmt, 0, ids[start + i]);
+	    futures[i] = cass_session_execute(context->session, stmt);
+	    cass_statement_free(stmt);
+	}
+
+	for(i = 0; i < n; i++) {
+
+	    if (futures[i] == 0)
+		continue;
+
+	    if (cass_future_error_code(futures[i]) != CASS_OK) {
+		cassandra_report_error(futures[i]);
+		cass_future_free(futures[i]);
+		ret = -1;
+		continue;
+	    }
+
+	    const CassResult* result = cass_future_get_result(futures[i]);
+	    const CassRow* row = cass_result_first_row(result);
+	    const char* term;
+	    size_t len;
+
+	    if (row && cassandra_value_encoded(context,
+					       cass_row_get_column(row, 0),
+					       &term, &len) == 0)
+		cassandra_dict_put(context->dict, term, len, ids[start + i]);
+	    else {
+		fprintf(stderr, "Cassandra: dictionary has no term for id\n");
+		ret = -1;
+	    }
+
+	    cass_result_free(result);
+	    cass_future_free(futures[i]);
+
+	}
+
+    }
+
+    return ret;
+
+}
+
+static int
+cassandra_id_compare(const void* a, const void* b)
+{
+    int64_t x = *(const int64_t*) a;
+    int64_t y = *(const int64_t*) b;
+    return (x < y) ? -1 : (x > y);
+}
+
+/* Resolves, in one batch, every id in a result page which is not
+   already cached, so that rows can be decoded without round-trips. */
+static int
+cassandra_resolve_page(librdf_storage_cassandra_instance* context,
+		       const CassResult* result)
+{
+
+    if (context->dict == 0)
+	return 0;
+
+    size_t rows = cass_result_row_count(result);
+    if (rows == 0)
+	return 0;
+
+    int64_t* ids = LIBRDF_MALLOC(int64_t*, rows * 3 * sizeof(int64_t));
+    if (!ids)
+	return -1;
+
+    size_t count = 0, i, j;
+    CassIterator* iter = cass_iterator_from_result(result);
+
+    while (cass_iterator_next(iter)) {
+	const CassRow* row = cass_iterator_get_row(iter);
+	for(i = 0; i < 3; i++) {
+	    int64_t id;
+	    size_t len;
+	    if (cass_value_get_int64(cass_row_get_column(row, i),
+				     &id) != CASS_OK)
+		continue;
+	    if (cassandra_dict_get_term(context->dict, id, &len) == 0)
+		ids[count++] = id;
+	}
+    }
+
+    cass_iterator_free(iter);
+
+    qsort(ids, count, sizeof(int64_t), &cassandra_id_compare);
+    for(i = 0, j = 0; i < count; i++)
+	if (j == 0 || ids[i] != ids[j - 1])
+	    ids[j++] = ids[i];
+
+    int ret = cassandra_resolve_ids(context, ids, j);
+
+    LIBRDF_FREE(int64_t*, ids);
+
+    return ret;
+
+}
+
+/* Fetches the encoded term in column i of a result row.  In the
+   dictionary layout the term belongs to the cache, and is only valid
+   until the next term is fetched. */
+static int
+cassandra_row_term(librdf_storage_cassandra_instance* context,
+		   const CassRow* row, size_t i, const char** term,
+		   size_t* len)
+{
+
+    const CassValue* value = cass_row_get_column(row, i);
+
+    if (context->dict == 0)
+	return cassandra_value_encoded(context, value, term, len);
+
+    int64_t id;
+    if (cass_value_get_int64(value, &id) != CASS_OK)
+	return -1;
+
+    *term = cassandra_dict_get_term(context->dict, id, len);
+    if (*term)
+	return 0;
+
+    /* Evicted since the page was resolved. */
+    if (cassandra_resolve_ids(context, &id, 1) < 0)
+	return -1;
+
+    *term = cassandra_dict_get_term(context->dict, id, len);
+
+    return (*term) ? 0 : -1;
+
+}
+
+/* Returns the highest bucket count in a set of them, or 1 for none. */
+static int
+cassandra_bucket_max(const CassValue* value)
+{
+
+    int max = 1;
+
+    CassIterator* iter = cass_iterator_from_collection(value);
+    if (iter == 0)
+	return max;
+
+    while (cass_iterator_next(iter)) {
+	cass_int32_t n;
+	if (cass_value_get_int32(cass_iterator_get_value(iter), &n) ==
+	    CASS_OK && n > max)
+	    max = n;
+    }
+
+    cass_iterator_free(iter);
+
+    return max;
+
+}
+
+/* Returns what is known of the buckets of a pos or osp partition key,
+   reading it from rdf.buckets first if check is set and it hasn't been
+   read lately.  The entry belongs to the bucket cache, and is only good
+   until the next call. */
+static cassandra_bucket_info*
+cassandra_bucket_info_get(librdf_storage_cassandra_instance* context,
+			  index_type index, const char* key, int check)
+{
+
+    size_t len = strlen(key);
+    char* k = malloc(len + 1);
+    if (k == 0)
+	return 0;
+
+    k[0] = cassandra_indexes[index].name[0];
+    memcpy(k + 1, key, len);
+
+    cassandra_bucket_info* info = cassandra_cache_get(context->buckets, k,
+						      len + 1);
+    if (info == 0) {
+	info = calloc(1, sizeof(cassandra_bucket_info));
+	if (info == 0 ||
+	    cassandra_cache_put(context->buckets, k, len + 1, info,
+				len + 1 + sizeof(cassandra_bucket_info))) {
+	    free(info);
+	    free(k);
+	    return 0;
+	}
+	info->buckets = 1;
+    }
+
+    free(k);
+
+    time_t now = time(0);
+    if (!check || (info->checked && now - info->checked < CASSANDRA_BUCKET_TTL))
+	return info;
+
+    CassStatement* stmt = cassandra_bind(context, CASSANDRA_BUCKETS_GET);
+    if (stmt == 0)
+	return 0;
+    cass_statement_bind_string(stmt, 0, cassandra_indexes[index].name);
+    cassandra_bind_encoded(context, stmt, 1, key, strlen(key));
+
+    const CassResult* result =
+	cassandra_dict_execute(context, CASSANDRA_BUCKETS_GET, stmt);
+    if (result == 0)
+	return 0;
+
+    const CassRow* row = cass_result_first_row(result);
+    if (row) {
+	int buckets = cassandra_bucket_max(cass_row_get_column(row, 0));
+	if (buckets > info->buckets)
+	    info->buckets = buckets;
+    }
+    info->checked = now;
+
+    cass_result_free(result);
+
+    return info;
+
+}
+
+/* Returns the number of buckets to read a pos or osp partition from, or
+   -1 on failure. */
+static int
+cassandra_bucket_count(librdf_storage_cassandra_instance* context,
+		       index_type index, const char* key)
+{
+
+    if (!cassandra_bucketed(context, index))
+	return 1;
+
+    cassandra_bucket_info* info =
+	cassandra_bucket_info_get(context, index, key, 1);
+
+    return info ? info->buckets : -1;
+
+}
+
+/* Records that a partition key has been split into count buckets. */
+static int
+cassandra_bucket_record(librdf_storage_cassandra_instance* context,
+			index_type index, const char* key, int count)
+{
+
+    CassStatement* stmt = cassandra_bind(context, CASSANDRA_BUCKETS_ADD);
+    if (stmt == 0)
+	return -1;
+
+    /* A set of every count used, so that concurrent writers can't lower
+       the count readers see. */
+    CassCollection* counts = cass_collection_new(CASS_COLLECTION_TYPE_SET, 1);
+    cass_collection_append_int32(counts, count);
+    cass_statement_bind_collection(stmt, 0, counts);
+    cass_collection_free(counts);
+
+    cass_statement_bind_string(stmt, 1, cassandra_indexes[index].name);
+    cassandra_bind_encoded(context, stmt, 2, key, strlen(key));
+
+    const CassResult* result =
+	cassandra_dict_execute(context, CASSANDRA_BUCKETS_ADD, stmt);
+    if (result == 0)
+	return -1;
+
+    cass_result_free(result);
+
+    return 0;
+
+}
+
+/* Reads the rows counted in a partition key's buckets by every writer,
+   and the key's bucket count if it hasn't been read lately.  Returns the
+   key's entry, or 0. */
+static cassandra_bucket_info*
+cassandra_bucket_rows_read(librdf_storage_cassandra_instance* context,
+			   index_type index, const char* key)
+{
+
+    CassStatement* stmt = cassandra_bind(context, CASSANDRA_BUCKET_ROWS_GET);
+    if (stmt == 0)
+	return 0;
+    cass_statement_bind_string(stmt, 0, cassandra_indexes[index].name);
+    cassandra_bind_encoded(context, stmt, 1, key, strlen(key));
+
+    const CassResult* result =
+	cassandra_dict_execute(context, CASSANDRA_BUCKET_ROWS_GET, stmt);
+    if (result == 0)
+	return 0;
+
+    cass_int64_t stored = 0;
+    const CassRow* row = cass_result_first_row(result);
+    if (row)
+	cass_value_get_int64(cass_row_get_column(row, 0), &stored);
+
+    cass_result_free(result);
+
+    cassandra_bucket_info* info =
+	cassandra_bucket_info_get(context, index, key, 1);
+    if (info == 0)
+	return 0;
+
+    info->stored = stored;
+    info->written = 0;
+
+    return info;
+
+}
+
+/* Picks the bucket of a row to be written to a pos or osp partition, by
+   a hash of the rest of its key.  A partition whose stored rows pass
+   bucket_rows for each of its buckets has its bucket count doubled.
+   Rows never move: readers read every bucket up to the highest count,
+   which takes in the buckets of any lower count.
+
+   Every writer adds the rows it writes to rdf.bucket_rows, so the split
+   follows what the partition holds whichever clients wrote it.  Only
+   one row in CASSANDRA_BUCKET_SAMPLE is counted, as that many, and the
+   count is read again at one row in CASSANDRA_BUCKET_READ_SAMPLE, or
+   once this storage has written a sixteenth of the rows the split
+   needs.  A row written again is counted again. */
+static int
+cassandra_bucket_write(librdf_storage_cassandra_instance* context,
+		       index_type index, const char* key,
+		       const char* rest1, const char* rest2)
+{
+
+    uint64_t h = cassandra_bloom_hash(CASSANDRA_BLOOM_HASH_INIT, rest1,
+				      strlen(rest1));
+    h = cassandra_bloom_hash(h, rest2, strlen(rest2));
+
+    /* The low bits pick the bucket, and the high bits the samples. */
+    uint32_t sample = (uint32_t) (h >> 32);
+
+    cassandra_bucket_info* info =
+	cassandra_bucket_info_get(context, index, key, 0);
+    if (info == 0)
+	return -1;
+
+    unsigned long limit = info->buckets * context->bucket_rows;
+
+    info->written++;
+    if (sample % CASSANDRA_BUCKET_SAMPLE == 0)
+	info->unsent += CASSANDRA_BUCKET_SAMPLE;
+
+    if (info->buckets < context->max_buckets &&
+	(sample % CASSANDRA_BUCKET_READ_SAMPLE == 0 ||
+	 info->written > limit / 16)) {
+	info = cassandra_bucket_rows_read(context, index, key);
+	if (info == 0)
+	    return -1;
+	limit = info->buckets * context->bucket_rows;
+    }
+
+    if (info->stored + info->unsent > (int64_t) limit &&
+	info->buckets < context->max_buckets) {
+	int count = info->buckets * 2;
+	if (cassandra_bucket_record(context, index, key, count) < 0)
+	    return -1;
+	/* Recording may have evicted the entry. */
+	info = cassandra_bucket_info_get(context, index, key, 0);
+	if (info == 0)
+	    return -1;
+	if (info->buckets < count)
+	    info->buckets = count;
+    }
+
+    return (int) (h & (uint64_t) (info->buckets - 1));
+
+}
+
+/* Reads the bucket counts of every split partition, so that writers
+   start from them. */
+static int
+cassandra_buckets_load(librdf_storage_cassandra_instance* context)
+{
+
+    CassStatement* stmt = cassandra_bind(context, CASSANDRA_BUCKETS_ALL);
+    if (stmt == 0)
+	return -1;
+
+    cass_statement_set_paging_size(stmt, CASSANDRA_PAGE_SIZE);
+
+    while (1) {
+
+	CassFuture* future =
+	    cassandra_execute(context, CASSANDRA_BUCKETS_ALL, stmt);
+	if (cass_future_error_code(future) != CASS_OK) {
+	    cassandra_report_error(future);
+	    cass_future_free(future);
+	    cass_statement_free(stmt);
+	    return -1;
+	}
+
+	const CassResult* result = cass_future_get_result(future);
+	cass_future_free(future);
+
+	CassIterator* iter = cass_iterator_from_result(result);
+	while (cass_iterator_next(iter)) {
+
+	    const CassRow* row = cass_iterator_get_row(iter);
+	    const char* tbl;
+	    size_t tbl_len;
+	    const char* key;
+	    size_t key_len;
+
+	    if (cass_value_get_string(cass_row_get_column(row, 0), &tbl,
+				      &tbl_len) != CASS_OK ||
+		cassandra_value_encoded(context, cass_row_get_column(row, 1),
+					&key, &key_len) < 0 || tbl_len == 0)
+		continue;
+
+	    char* k = malloc(key_len + 1);
+	    if (k == 0)
+		break;
+	    memcpy(k, key, key_len);
+	    k[key_len] = 0;
+
+	    cassandra_bucket_info* info =
+		cassandra_bucket_info_get(context, (tbl[0] == 'p') ? POS : OSP,
+					  k, 0);
+	    if (info)
+		info->buckets = cassandra_bucket_max(cass_row_get_column(row,
+									 2));
+	    free(k);
+
+	}
+	cass_iterator_free(iter);
+
+	int more = cass_result_has_more_pages(result);
+	if (more)
+	    cass_statement_set_paging_state(stmt, result);
+	cass_result_free(result);
+
+	if (!more)
+	    break;
+
+    }
+
+    cass_statement_free(stmt);
+
+    return 0;
+
+}
+
+/* Adds a namespace read from rdf.namespaces to the dictionary. */
+static void
+cassandra_namespace_add(librdf_storage_cassandra_instance* context,
+			int id, const char* uri, size_t len)
+{
+
+    size_t known_len;
+    int64_t known;
+
+    /* Ids are taken in order, so every lower one is taken too. */
+    if (id >= context->namespace_count)
+	context->namespace_count = id + 1;
+
+    if (cassandra_dict_get_term(context->namespace_dict, id, &known_len) ||
+	cassandra_dict_get_id(context->namespace_dict, uri, len, &known))
+	return;
+
+    cassandra_dict_put(context->namespace_dict, uri, len, id);
+
+}
+
+/* Reads every namespace in rdf.namespaces.  The caller holds the
+   namespace lock. */
+static int
+cassandra_namespaces_load(librdf_storage_cassandra_instance* context)
+{
+
+    context->namespace_checked = time(0);
+
+    CassStatement* stmt = cassandra_bind(context, CASSANDRA_NAMESPACES_ALL);
+    if (stmt == 0)
+	return -1;
+
+    cass_statement_set_paging_size(stmt, CASSANDRA_PAGE_SIZE);
+
+    while (1) {
+
+	CassFuture* future =
+	    cassandra_execute(context, CASSANDRA_NAMESPACES_ALL, stmt);
+	if (cass_future_error_code(future) != CASS_OK) {
+	    cassandra_report_error(future);
+	    cass_future_free(future);
+	    cass_statement_free(stmt);
+	    return -1;
+	}
+
+	const CassResult* result = cass_future_get_result(future);
+	cass_future_free(future);
+
+	CassIterator* iter = cass_iterator_from_result(result);
+	while (cass_iterator_next(iter)) {
+
+	    const CassRow* row = cass_iterator_get_row(iter);
+	    cass_int32_t id;
+	    const char* uri;
+	    size_t len;
+
+	    if (cass_value_get_int32(cass_row_get_column(row, 0), &id) ==
+		CASS_OK &&
+		cass_value_get_string(cass_row_get_column(row, 1), &uri,
+				      &len) == CASS_OK &&
+		id >= 0 && id < CASSANDRA_MAX_NAMESPACES)
+		cassandra_namespace_add(context, id, uri, len);
+
+	}
+	cass_iterator_free(iter);
+
+	int more = cass_result_has_more_pages(result);
+	if (more)
+	    cass_statement_set_paging_state(stmt, result);
+	cass_result_free(result);
+
+	if (!more)
+	    break;
+
+    }
+
+    cass_statement_free(stmt);
+
+    return 0;
+
+}
+
+/* Returns 1 if another client has taken the next namespace id since
+   rdf.namespaces was read, 0 if not, or -1 on error.  Ids are taken in
+   order, so the next id is the only one to check.  The caller holds the
+   namespace lock. */
+static int
+cassandra_namespaces_changed(librdf_storage_cassandra_instance* context)
+{
+
+    CassStatement* stmt = cassandra_bind(context, CASSANDRA_NAMESPACE_GET);
+    if (stmt == 0)
+	return -1;
+    cass_statement_bind_int32(stmt, 0, context->namespace_count);
+
+    const CassResult* result =
+	cassandra_dict_execute(context, CASSANDRA_NAMESPACE_GET, stmt);
+    if (result == 0)
+	return -1;
+
+    int changed = (cass_result_first_row(result) != 0);
+
+    cass_result_free(result);
+
+    return changed;
+
+}
+
+/* Gives a namespace the lowest id not yet taken, or finds the id another
+   client gave it first.  Every client tries the ids in order, so no
+   namespace gets two, and one which finds every id taken can never get
+   one later.  Returns the id, or -1 if the namespace has none.  The
+   caller holds the namespace lock. */
+static int
+cassandra_namespace_claim(librdf_storage_cassandra_instance* context,
+			  const char* ns, size_t len)
+{
+
+    int64_t id;
+
+    while (!cassandra_dict_get_id(context->namespace_dict, ns, len, &id)) {
+
+	if (context->namespace_count >= CASSANDRA_MAX_NAMESPACES)
+	    return -1;
+
+	int candidate = context->namespace_count;
+
+	CassStatement* stmt = cassandra_bind(context, CASSANDRA_NAMESPACE_PUT);
+	if (stmt == 0)
+	    return -1;
+	cass_statement_bind_int32(stmt, 0, candidate);
+	cass_statement_bind_string_n(stmt, 1, ns, len);
+
+	const CassResult* result =
+	    cassandra_dict_execute(context, CASSANDRA_NAMESPACE_PUT, stmt);
+	if (result == 0)
+	    return -1;
+
+	const CassRow* row = cass_result_first_row(result);
+	cass_bool_t applied = cass_false;
+	const char* owner = 0;
+	size_t owner_len = 0;
+
+	/* Not applied returns the namespace which has the id. */
+	if (row) {
+	    cass_value_get_bool(cass_row_get_column(row, 0), &applied);
+	    if (applied) {
+		owner = ns;
+		owner_len = len;
+	    } else if (cass_value_get_string(cass_row_get_column_by_name(row,
+									"uri"),
+					     &owner, &owner_len) != CASS_OK)
+		owner = 0;
+	}
+
+	if (owner)
+	    cassandra_namespace_add(context, candidate, owner, owner_len);
+
+	cass_result_free(result);
+
+	if (owner == 0) {
+	    fprintf(stderr, "Cassandra: couldn't claim a namespace id\n");
+	    return -1;
+	}
+
+    }
+
+    return (int) id;
+
+}
+
+/* Binds a find pattern's terms to statement id, which the planner
+   wrote for the pattern, in the key order of its planned index, and the
+   bucket if the index is bucketed. */
+static CassStatement*
+cassandra_bind_pattern(librdf_storage_cassandra_instance* context,
+		       cassandra_statement_id id, int pattern,
+		       const char* s, const char* p, const char* o,
+		       int bucket)
+{
+
+    const char* terms[3] = { s, p, o };
+    const cassandra_plan* plan = &context->plans[pattern];
+    int bucketed = cassandra_bucketed(context, plan->index);
+    int k;
+
+    CassStatement* stmt = cassandra_bind(context, id);
+    if (stmt == 0) return 0;
+
+    for(k = 0; k < plan->bound; k++)
+	if (cassandra_bind_term(context, stmt, (bucketed && k) ? k + 1 : k,
+				terms[cassandra_indexes[plan->index].key[k]],
+				0)) {
+	    cass_statement_free(stmt);
+	    return 0;
+	}
+
+    if (bucketed)
+	cass_statement_bind_int32(stmt, 1, bucket);
+
+    return stmt;
+
+}
+
+/* Binds a find pattern's query, reading the given bucket. */
+static CassStatement*
+cassandra_query(librdf_storage_cassandra_instance* context, int pattern,
+		const char* s, const char* p, const char* o, int bucket)
+{
+    return cassandra_bind_pattern(context,
+				  (cassandra_statement_id)
+				  (CASSANDRA_QUERY_ + pattern),
+				  pattern, s, p, o, bucket);
+}
+
+static CassStatement*
+cassandra_insert(librdf_storage_cassandra_instance* c,
+		 cassandra_statement_id id,
+		 const cassandra_triple* t, int bucket)
+{
+
+    CassStatement* stmt = cassandra_bind(c, id);
+    if (stmt == 0) return 0;
+    if (cassandra_bind_term(c, stmt, 0, t->s, 1) ||
+	cassandra_bind_term(c, stmt, 1, t->p, 1) ||
+	cassandra_bind_term(c, stmt, 2, t->o, 1)) {
+	cass_statement_free(stmt);
+	return 0;
+    }
+    if (c->max_buckets && id != CASSANDRA_INSERT_SPO)
+	cass_statement_bind_int32(stmt, 3, bucket);
+    if (c->quads)
+	cassandra_bind_context(c, stmt, 3, t->c);
+    return stmt;
+
+}
+
+/* Sends a write in the window. */
+static CassFuture*
+cassandra_write_send(librdf_storage_cassandra_instance* context,
+		     const cassandra_write* w)
+{
+
+    if (w->stmt)
+	return cass_session_execute(context->session, w->stmt);
+
+    return cass_session_execute_batch(context->session, w->batch);
+
+}
+
+/* Completes write i of the window, records any error, and removes it
+   from the window.  A write whose statement the server had forgotten
+   is sent again, once, after preparing its statement again. */
+static void
+cassandra_write_complete(librdf_storage_cassandra_instance* context, int i)
+{
+
+    cassandra_write* w = &context->writes[i];
+
+    if (!w->retried && cassandra_reprepare(context, w->id, w->future)) {
+	cass_future_free(w->future);
+	w->retried = 1;
+	w->future = cassandra_write_send(context, w);
+    }
+
+    if (cass_future_error_code(w->future) != CASS_OK) {
+	cassandra_report_error(w->future);
+	context->write_errors++;
+    }
+
+    cass_future_free(w->future);
+    if (w->stmt)
+	cass_statement_free(w->stmt);
+    if (w->batch)
+	cass_batch_free(w->batch);
+
+    context->writes_pending--;
+    memmove(context->writes + i, context->writes + i + 1,
+	    (context->writes_pending - i) * sizeof(cassandra_write));
+
+}
+
+/* Reaps every write which has already finished, without blocking. */
+static void
+cassandra_write_reap(librdf_storage_cassandra_instance* context)
+{
+
+    int i = 0;
+
+    while (i < context->writes_pending) {
+	if (cass_future_ready(context->writes[i].future))
+	    cassandra_write_complete(context, i);
+	else
+	    i++;
+    }
+
+}
+
+/* Sends a statement or a batch, bound from prepared statement id,
+   through the write window, which takes it over.  Only stalls, on the
+   oldest write, when the window is full. */
+static void
+cassandra_write_add(librdf_storage_cassandra_instance* context,
+		    cassandra_statement_id id, CassStatement* stmt,
+		    CassBatch* batch)
+{
+
+    cassandra_write_reap(context);
+
+    if (context->writes_pending >= context->write_window)
+	cassandra_write_complete(context, 0);
+
+    cassandra_write* w = &context->writes[context->writes_pending++];
+    w->id = id;
+    w->stmt = stmt;
+    w->batch = batch;
+    w->retried = 0;
+    w->future = cassandra_write_send(context, w);
+
+}
+
+/* Waits for every write in the window.  Returns non-zero if any write
+   since the last drain failed. */
+static int
+cassandra_write_drain(librdf_storage_cassandra_instance* context)
+{
+
+    while (context->writes_pending > 0)
+	cassandra_write_complete(context, 0);
+
+    int errors = context->write_errors;
+    context->write_errors = 0;
+
+    return (errors > 0) ? -1 : 0;
+
+}
+
+static int
+cassandra_pending_row_compare(const void* a, const void* b)
+{
+
+    const cassandra_pending_row* ra = (const cassandra_pending_row*) a;
+    const cassandra_pending_row* rb = (const cassandra_pending_row*) b;
+
+    if (ra->insert != rb->insert)
+	return (ra->insert < rb->insert) ? -1 : 1;
+
+    int c = strcmp(ra->key, rb->key);
+    if (c)
+	return c;
+
+    return ra->bucket - rb->bucket;
+
+}
+
+static size_t
+cassandra_row_bytes(const cassandra_triple* t)
+{
+    return strlen(t->s) + strlen(t->p) + strlen(t->o) +
+	(t->c ? strlen(t->c) : 0);
+}
+
+/* Sends the rows of one partition.  A lone row is sent as a plain
+   statement, which token-aware routing takes straight to a replica.
+   Otherwise the rows go out as UNLOGGED batches, which need no batchlog
+   because every row of the batch lands on the same partition. */
+static void
+cassandra_write_partition(librdf_storage_cassandra_instance* context,
+			  cassandra_pending_row* rows, int count)
+{
+
+    if (count == 1) {
+	CassStatement* stmt =
+	    cassandra_insert(context, rows[0].insert, rows[0].triple,
+			     rows[0].bucket);
+	if (stmt == 0) {
+	    context->write_errors++;
+	    return;
+	}
+	cassandra_write_add(context, rows[0].insert, stmt, 0);
+	return;
+    }
+
+    CassBatch* batch = 0;
+    size_t bytes = 0;
+    int i;
+
+    for(i = 0; i < count; i++) {
+
+	cassandra_triple* t = rows[i].triple;
+	size_t row_bytes = cassandra_row_bytes(t);
+
+	if (batch && bytes + row_bytes > context->batch_bytes) {
+	    cassandra_write_add(context, rows[0].insert, 0, batch);
+	    batch = 0;
+	}
+
+	if (batch == 0) {
+	    batch = cass_batch_new(CASS_BATCH_TYPE_UNLOGGED);
+	    cass_batch_set_is_idempotent(batch, cass_true);
+	    bytes = 0;
+	}
+
+	CassStatement* stmt =
+	    cassandra_insert(context, rows[i].insert, t, rows[i].bucket);
+	if (stmt == 0) {
+	    context->write_errors++;
+	    continue;
+	}
+	cass_batch_add_statement(batch, stmt);
+	cass_statement_free(stmt);
+
+	bytes += row_bytes;
+
+    }
+
+    if (batch)
+	cassandra_write_add(context, rows[0].insert, 0, batch);
+
+}
+
+static int
+cassandra_triple_compare(const void* a, const void* b)
+{
+
+    const cassandra_triple* x = (const cassandra_triple*) a;
+    const cassandra_triple* y = (const cassandra_triple*) b;
+    int c;
+
+    if ((c = strcmp(x->s, y->s)) != 0) return c;
+    if ((c = strcmp(x->p, y->p)) != 0) return c;
+    if ((c = strcmp(x->o, y->o)) != 0) return c;
+    return strcmp(x->c ? x->c : "", y->c ? y->c : "");
+
+}
+
+/* Drops repeats of the same triple from the pending buffer. */
+static void
+cassandra_write_dedup(librdf_storage_cassandra_instance* context)
+{
+
+    int i, n;
+
+    if (context->pending_count < 2)
+	return;
+
+    qsort(context->pending, context->pending_count, sizeof(cassandra_triple),
+	  &cassandra_triple_compare);
+
+    for(n = 1, i = 1; i < context->pending_count; i++) {
+	cassandra_triple* t = &context->pending[i];
+	if (cassandra_triple_compare(&context->pending[n - 1], t) == 0) {
+	    free(t->s);
+	    free(t->p);
+	    free(t->o);
+	    if (t->c) free(t->c);
+	} else
+	    context->pending[n++] = *t;
+    }
+
+    context->pending_count = n;
+
+}
+
+/* The hash a triple is known by in the Bloom filter. */
+static uint64_t
+cassandra_triple_hash(const char* s, const char* p, const char* o)
+{
+
+    uint64_t h = CASSANDRA_BLOOM_HASH_INIT;
+
+    h = cassandra_bloom_hash(h, s, strlen(s));
+    h = cassandra_bloom_hash(h, p, strlen(p));
+    return cassandra_bloom_hash(h, o, strlen(o));
+
+}
+
+/* Adds every triple of an s, p, o result page to the Bloom filter. */
+static int
+cassandra_bloom_add_page(librdf_storage_cassandra_instance* context,
+			 const CassResult* result)
+{
+
+    CassIterator* iter = cass_iterator_from_result(result);
+    int ret = 0;
+
+    while (cass_iterator_next(iter)) {
+
+	const CassRow* row = cass_iterator_get_row(iter);
+	uint64_t h = CASSANDRA_BLOOM_HASH_INIT;
+	int i;
+
+	for(i = 0; i < 3; i++) {
+	    const char* term;
+	    size_t len;
+	    if (cassandra_row_term(context, row, i, &term, &len) < 0) {
+		ret = -1;
+		break;
+	    }
+	    h = cassandra_bloom_hash(h, term, len);
+	}
+
+	if (i == 3)
+	    cassandra_bloom_add(context->bloom, h);
+
+    }
+
+    cass_iterator_free(iter);
+
+    return ret;
+
+}
+
+/* Returns the number of triples not already stored, looking them up a
+   wave at a time, or -1 on error.  In the quads layout a triple is
+   looked for in its own context. */
+static int
+cassandra_count_new(librdf_storage_cassandra_instance* context,
+		    const cassandra_triple* triples, int count)
+{
+
+    CassFuture* futures[CASSANDRA_RESOLVE_WAVE];
+    cassandra_statement_id id =
+	context->quads ? CASSANDRA_CONTAINS_QUAD : CASSANDRA_CONTAINS;
+    int start, i;
+    int added = 0;
+    int ret = 0;
+
+    for(start = 0; start < count; start += CASSANDRA_RESOLVE_WAVE) {
+
+	int n = count - start;
+	if (n > CASSANDRA_RESOLVE_WAVE)
+	    n = CASSANDRA_RESOLVE_WAVE;
+
+	for(i = 0; i < n; i++) {
+
+	    const cassandra_triple* t = &triples[start + i];
+	    futures[i] = 0;
+
+	    CassStatement* stmt = cassandra_bind(context, id);
+	    if (stmt == 0) {
+		ret = -1;
+		continue;
+	    }
+
+	    /* A term not in the dictionary yet makes the triple new. */
+	    int missing = cassandra_bind_term(context, stmt, 0, t->s, 0);
+	    if (!missing)
+		missing = cassandra_bind_term(context, stmt, 1, t->p, 0);
+	    if (!missing)
+		missing = cassandra_bind_term(context, stmt, 2, t->o, 0);
+	    if (context->quads)
+		cassandra_bind_context(context, stmt, 3, t->c);
+
+	    if (missing > 0)
+		added++;
+	    else if (missing < 0)
+		ret = -1;
+	    else
+		futures[i] = cass_session_execute(context->session, stmt);
+
+	    cass_statement_free(stmt);
+
+	}
+
+	for(i = 0; i < n; i++) {
+
+	    if (futures[i] == 0)
+		continue;
+
+	    if (cass_future_error_code(futures[i]) != CASS_OK) {
+		cassandra_report_error(futures[i]);
+		cassandra_reprepare(context, id, futures[i]);
+		cass_future_free(futures[i]);
+		ret = -1;
+		continue;
+	    }
+
+	    const CassResult* result = cass_future_get_result(futures[i]);
+	    if (cass_result_row_count(result) == 0)
+		added++;
+	    cass_result_free(result);
+	    cass_future_free(futures[i]);
+
+	}
+
+    }
+
+    return (ret < 0) ? -1 : added;
+
+}
+
+/* Lists a context in rdf.contexts, through the write window. */
+static void
+cassandra_context_put(librdf_storage_cassandra_instance* context,
+		      const char* c)
+{
+
+    CassStatement* stmt = cassandra_bind(context, CASSANDRA_CONTEXT_PUT);
+    if (stmt == 0) {
+	context->write_errors++;
+	return;
+    }
+
+    cassandra_bind_encoded(context, stmt, 0, c, strlen(c));
+
+    cassandra_write_add(context, CASSANDRA_CONTEXT_PUT, stmt, 0);
+
+}
+
+/* Adds to the triple count, through the write window. */
+static void
+cassandra_count_add(librdf_storage_cassandra_instance* context,
+		    int64_t delta)
+{
+
+    CassStatement* stmt = cassandra_bind(context, CASSANDRA_COUNT_ADD);
+    if (stmt == 0) {
+	context->write_errors++;
+	return;
+    }
+
+    cass_statement_bind_int64(stmt, 0, delta);
+    cass_statement_bind_int32(stmt, 1, context->count_shard);
+    context->count_shard = (context->count_shard + 1) % CASSANDRA_COUNT_SHARDS;
+
+    cassandra_write_add(context, CASSANDRA_COUNT_ADD, stmt, 0);
+
+}
+
+/* Returns the URI of a compact term which holds one in full, or 0. */
+static const char*
+cassandra_term_uri(const char* term, size_t* len)
+{
+
+    const unsigned char* t = (const unsigned char*) term;
+    const unsigned char* end = t + strlen(term);
+
+    if (t[0] != CASSANDRA_TAG_URI)
+	return 0;
+
+    const unsigned char* p = cassandra_varint_get(t + 1, end, len);
+    if (p == 0 || *len != (size_t) (end - p))
+	return 0;
+
+    return (const char*) p;
+
+}
+
+/* A namespace of the URIs about to be written, and how many use it. */
+typedef struct {
+    const char* ns;
+    size_t len;
+    int count;
+} cassandra_namespace_use;
+
+static int
+cassandra_namespace_use_compare(const void* a, const void* b)
+{
+
+    const cassandra_namespace_use* x = (const cassandra_namespace_use*) a;
+    const cassandra_namespace_use* y = (const cassandra_namespace_use*) b;
+
+    if (x->len != y->len)
+	return (x->len < y->len) ? -1 : 1;
+
+    return memcmp(x->ns, y->ns, x->len);
+
+}
+
+static int
+cassandra_namespace_use_hotter(const void* a, const void* b)
+{
+
+    const cassandra_namespace_use* x = (const cassandra_namespace_use*) a;
+    const cassandra_namespace_use* y = (const cassandra_namespace_use*) b;
+
+    return y->count - x->count;
+
+}
+
+/* Gives ids to the namespaces of buffered URIs which were encoded in
+   full, the most used first so that the hottest namespaces get ids
+   before they run out, and encodes those URIs again. */
+static int
+cassandra_namespaces_learn(librdf_storage_cassandra_instance* context)
+{
+
+    int count = context->pending_count * 3;
+    int i, n = 0;
+
+    if (context->namespace_dict == 0)
+	return 0;
+
+    cassandra_namespace_use* uses =
+	LIBRDF_MALLOC(cassandra_namespace_use*,
+		      count * sizeof(cassandra_namespace_use));
+    if (!uses) {
+	fprintf(stderr, "malloc failed\n");
+	return -1;
+    }
+
+    for(i = 0; i < count; i++) {
+	cassandra_triple* t = &context->pending[i / 3];
+	char* term = (i % 3 == 0) ? t->s : (i % 3 == 1) ? t->p : t->o;
+	size_t len;
+	const char* uri = cassandra_term_uri(term, &len);
+	size_t ns_len = uri ? cassandra_namespace_split(uri, len) : 0;
+	if (ns_len > 0) {
+	    uses[n].ns = uri;
+	    uses[n].len = ns_len;
+	    uses[n].count = 1;
+	    n++;
+	}
+    }
+
+    if (n == 0) {
+	LIBRDF_FREE(cassandra_namespace_use*, uses);
+	return 0;
+    }
+
+    qsort(uses, n, sizeof(cassandra_namespace_use),
+	  &cassandra_namespace_use_compare);
+
+    int distinct = 0;
+    for(i = 0; i < n; i++) {
+	if (distinct > 0 &&
+	    cassandra_namespace_use_compare(&uses[distinct - 1],
+					    &uses[i]) == 0)
+	    uses[distinct - 1].count++;
+	else
+	    uses[distinct++] = uses[i];
+    }
+
+    qsort(uses, distinct, sizeof(cassandra_namespace_use),
+	  &cassandra_namespace_use_hotter);
+
+    int ret = 0;
+
+    cassandra_namespace_lock(context);
+    for(i = 0; i < distinct; i++)
+	if (cassandra_namespace_claim(context, uses[i].ns, uses[i].len) < 0 &&
+	    context->namespace_count < CASSANDRA_MAX_NAMESPACES) {
+	    /* The URIs would be written in full although the namespace may
+	       yet get an id. */
+	    ret = -1;
+	    break;
+	}
+    cassandra_namespace_unlock(context);
+
+    LIBRDF_FREE(cassandra_namespace_use*, uses);
+
+    for(i = 0; i < count; i++) {
+	cassandra_triple* t = &context->pending[i / 3];
+	char** term = (i % 3 == 0) ? &t->s : (i % 3 == 1) ? &t->p : &t->o;
+	size_t len;
+	const char* uri = cassandra_term_uri(*term, &len);
+	if (uri == 0)
+	    continue;
+	cassandra_term resource = { LIBRDF_NODE_TYPE_RESOURCE, uri, 0, 0 };
+	char* encoded = term_encode(context, &resource, 0);
+	if (encoded && (unsigned char) encoded[0] == CASSANDRA_TAG_NAMESPACE) {
+	    free(*term);
+	    *term = encoded;
+	} else
+	    free(encoded);
+    }
+
+    return ret;
+
+}
+
+static int
+cassandra_term_compare(const void* a, const void* b)
+{
+    return strcmp(*(const char* const*) a, *(const char* const*) b);
+}
+
+/* Looks up, or allocates, the ids of one wave of uncached terms at once:
+   all the rdf.terms lookups go out together, then a round of rdf.ids
+   claims for every term still without an id, probing upwards until each
+   is settled.  New rdf.terms rows go through the write window. */
+static void
+cassandra_dict_prepare_wave(librdf_storage_cassandra_instance* context,
+			    const char** terms, size_t n)
+{
+
+    CassFuture* futures[CASSANDRA_RESOLVE_WAVE];
+    int64_t candidates[CASSANDRA_RESOLVE_WAVE];
+    int probes[CASSANDRA_RESOLVE_WAVE];
+    char unresolved[CASSANDRA_RESOLVE_WAVE];
+    size_t i;
+
+    for(i = 0; i < n; i++) {
+	CassStatement* stmt = cassandra_bind(context, CASSANDRA_TERM_GET_ID);
+	futures[i] = 0;
+	if (stmt == 0)
+	    continue;
+	cassandra_bind_encoded(context, stmt, 0, terms[i], strlen(terms[i]));
+	futures[i] = cass_session_execute(context->session, stmt);
+	cass_statement_free(stmt);
+    }
+
+    for(i = 0; i < n; i++) {
+
+	unresolved[i] = 0;
+	if (futures[i] == 0)
+	    continue;
+
+	if (cass_future_error_code(futures[i]) != CASS_OK) {
+	    cassandra_report_error(futures[i]);
+	    cass_future_free(futures[i]);
+	    continue;
+	}
+
+	const CassResult* result = cass_future_get_result(futures[i]);
+	const CassRow* row = cass_result_first_row(result);
+	int64_t id;
+
+	if (row &&
+	    cass_value_get_int64(cass_row_get_column(row, 0), &id) == CASS_OK)
+	    cassandra_dict_put(context->dict, terms[i], strlen(terms[i]), id);
+	else {
+	    unresolved[i] = 1;
+	    candidates[i] = cassandra_dict_hash(terms[i], strlen(terms[i]));
+	    probes[i] = 0;
+	}
+
+	cass_result_free(result);
+	cass_future_free(futures[i]);
+
+    }
+
+    for(;;) {
+
+	int issued = 0;
+
+	for(i = 0; i < n; i++) {
+	    futures[i] = 0;
+	    if (!unresolved[i])
+		continue;
+	    CassStatement* stmt = cassandra_bind(context, CASSANDRA_ID_PUT);
+	    if (stmt == 0) {
+		unresolved[i] = 0;
+		continue;
+	    }
+	    cass_statement_bind_int64(stmt, 0, candidates[i]);
+	    cassandra_bind_encoded(context, stmt, 1, terms[i],
+				   strlen(terms[i]));
+	    futures[i] = cass_session_execute(context->session, stmt);
+	    cass_statement_free(stmt);
+	    issued++;
+	}
+
+	if (issued == 0)
+	    break;
+
+	for(i = 0; i < n; i++) {
+
+	    if (futures[i] == 0)
+		continue;
+
+	    if (cass_future_error_code(futures[i]) != CASS_OK) {
+		cassandra_report_error(futures[i]);
+		cass_future_free(futures[i]);
+		unresolved[i] = 0;
+		continue;
+	    }
+
+	    size_t len = strlen(terms[i]);
+	    const CassResult* result = cass_future_get_result(futures[i]);
+	    int owned = cassandra_id_owned(context, result, terms[i], len);
+	    cass_result_free(result);
+	    cass_future_free(futures[i]);
+
+	    if (owned) {
+		unresolved[i] = 0;
+		CassStatement* stmt = cassandra_bind(context, CASSANDRA_TERM_PUT);
+		if (stmt == 0)
+		    continue;
+		cassandra_bind_encoded(context, stmt, 0, terms[i], len);
+		cass_statement_bind_int64(stmt, 1, candidates[i]);
+		cassandra_write_add(context, CASSANDRA_TERM_PUT, stmt, 0);
+		cassandra_dict_put(context->dict, terms[i], len, candidates[i]);
+	    } else if (++probes[i] >= CASSANDRA_DICT_PROBES)
+		unresolved[i] = 0;
+	    else
+		candidates[i]++;
+
+	}
+
+    }
+
+}
+
+/* Resolves the ids of every uncached term of the buffered triples before
+   they are bound, so that a flush of new terms costs a few round-trips
+   rather than three per term.  A term left unresolved, by an error or
+   the cache overflowing, falls back to cassandra_term_id. */
+static void
+cassandra_dict_prepare(librdf_storage_cassandra_instance* context)
+{
+
+    size_t count = 0, n = 0, start, i;
+    int64_t id;
+
+    const char** terms =
+	LIBRDF_MALLOC(const char**,
+		      context->pending_count * 3 * sizeof(char*));
+    if (!terms)
+	return;
+
+    for(i = 0; i < (size_t) context->pending_count; i++) {
+	cassandra_triple* t = &context->pending[i];
+	terms[count++] = t->s;
+	terms[count++] = t->p;
+	terms[count++] = t->o;
+    }
+
+    qsort(terms, count, sizeof(char*), &cassandra_term_compare);
+
+    for(i = 0; i < count; i++) {
+	if (i > 0 && strcmp(terms[i - 1], terms[i]) == 0)
+	    continue;
+	if (!cassandra_dict_get_id(context->dict, terms[i], strlen(terms[i]),
+				   &id))
+	    terms[n++] = terms[i];
+    }
+
+    for(start = 0; start < n; start += CASSANDRA_RESOLVE_WAVE)
+	cassandra_dict_prepare_wave(context, terms + start,
+				    (n - start > CASSANDRA_RESOLVE_WAVE) ?
+				    CASSANDRA_RESOLVE_WAVE : n - start);
+
+    LIBRDF_FREE(const char**, terms);
+
+}
+
+/* Adds the sampled rows written to a partition key since the last time
+   to its count in rdf.bucket_rows, through the write window. */
+static void
+cassandra_bucket_rows_add(librdf_storage_cassandra_instance* context,
+			  index_type index, const char* key)
+{
+
+    cassandra_bucket_info* info =
+	cassandra_bucket_info_get(context, index, key, 0);
+    if (info == 0 || info->unsent == 0)
+	return;
+
+    CassStatement* stmt = cassandra_bind(context, CASSANDRA_BUCKET_ROWS_ADD);
+    if (stmt == 0) {
+	context->write_errors++;
+	return;
+    }
+
+    cass_statement_bind_int64(stmt, 0, info->unsent);
+    cass_statement_bind_string(stmt, 1, cassandra_indexes[index].name);
+    cassandra_bind_encoded(context, stmt, 2, key, strlen(key));
+    info->stored += info->unsent;
+    info->unsent = 0;
+
+    cassandra_write_add(context, CASSANDRA_BUCKET_ROWS_ADD, stmt, 0);
+
+}
+
+/* Writes out the buffered triples.  Each triple becomes one row in each
+   of the three index tables; the rows are grouped by table and partition
+   key so that every request touches a single partition. */
+static int
+cassandra_write_flush(librdf_storage_cassandra_instance* context)
+{
+
+    int i, start;
+    int added = 0;
+
+    if (context->pending_count == 0)
+	return 0;
+
+    if (cassandra_namespaces_learn(context) < 0)
+	context->write_errors++;
+
+    /* Only triples which weren't stored already are counted.  Writes
+       still in flight could be adding the same triples, so they are
+       waited for first. */
+    if (context->size_mode == CASSANDRA_SIZE_COUNTER) {
+	while (context->writes_pending > 0)
+	    cassandra_write_complete(context, 0);
+	cassandra_write_dedup(context);
+	added = cassandra_count_new(context, context->pending,
+				    context->pending_count);
+	if (added < 0)
+	    context->write_errors++;
+    }
+
+    if (context->bloom)
+	for(i = 0; i < context->pending_count; i++) {
+	    cassandra_triple* t = &context->pending[i];
+	    cassandra_bloom_add(context->bloom,
+				cassandra_triple_hash(t->s, t->p, t->o));
+	}
+
+    if (context->dict)
+	cassandra_dict_prepare(context);
+
+    /* A quad in a context has a row in rdf.cspo too. */
+    int count = context->pending_count * (context->quads ? 4 : 3);
+
+    cassandra_pending_row* rows =
+	LIBRDF_MALLOC(cassandra_pending_row*,
+		      count * sizeof(cassandra_pending_row));
+    if (!rows) {
+	fprintf(stderr, "malloc failed\n");
+	return -1;
+    }
+
+    for(i = 0; i < context->pending_count; i++) {
+	cassandra_triple* t = &context->pending[i];
+	rows[i * 3].insert = CASSANDRA_INSERT_SPO;
+	rows[i * 3].key = t->s;
+	rows[i * 3].triple = t;
+	rows[i * 3 + 1].insert = CASSANDRA_INSERT_POS;
+	rows[i * 3 + 1].key = t->p;
+	rows[i * 3 + 1].triple = t;
+	rows[i * 3 + 2].insert = CASSANDRA_INSERT_OSP;
+	rows[i * 3 + 2].key = t->o;
+	rows[i * 3 + 2].triple = t;
+	rows[i * 3].bucket = 0;
+	rows[i * 3 + 1].bucket = 0;
+	rows[i * 3 + 2].bucket = 0;
+	if (context->max_buckets) {
+	    rows[i * 3 + 1].bucket =
+		cassandra_bucket_write(context, POS, t->p, t->o, t->s);
+	    rows[i * 3 + 2].bucket =
+		cassandra_bucket_write(context, OSP, t->o, t->s, t->p);
+	    /* Bucket 0 is always read, so it is a safe place for a row
+	       whose bucket couldn't be worked out. */
+	    if (rows[i * 3 + 1].bucket < 0) {
+		context->write_errors++;
+		rows[i * 3 + 1].bucket = 0;
+	    }
+	    if (rows[i * 3 + 2].bucket < 0) {
+		context->write_errors++;
+		rows[i * 3 + 2].bucket = 0;
+	    }
+	}
+    }
+
+    count = context->pending_count * 3;
+    for(i = 0; i < context->pending_count; i++) {
+	cassandra_triple* t = &context->pending[i];
+	if (t->c == 0)
+	    continue;
+	rows[count].insert = CASSANDRA_INSERT_CSPO;
+	rows[count].key = t->c;
+	rows[count].triple = t;
+	rows[count].bucket = 0;
+	count++;
+    }
+
+    qsort(rows, count, sizeof(cassandra_pending_row),
+	  &cassandra_pending_row_compare);
+
+    for(start = 0, i = 1; i <= count; i++) {
+	if (i == count ||
+	    cassandra_pending_row_compare(&rows[start], &rows[i]) != 0) {
+	    cassandra_write_partition(context, rows + start, i - start);
+	    /* Each context written is listed, once a flush. */
+	    if (rows[start].insert == CASSANDRA_INSERT_CSPO)
+		cassandra_context_put(context, rows[start].key);
+	    else if (context->max_buckets &&
+		     rows[start].insert == CASSANDRA_INSERT_POS)
+		cassandra_bucket_rows_add(context, POS, rows[start].key);
+	    else if (context->max_buckets &&
+		     rows[start].insert == CASSANDRA_INSERT_OSP)
+		cassandra_bucket_rows_add(context, OSP, rows[start].key);
+	    start = i;
+	}
+    }
+
+    LIBRDF_FREE(cassandra_pending_row*, rows);
+
+    if (added > 0)
+	cassandra_count_add(context, added);
+
+    /* Statements hold their own copies of bound values. */
+    for(i = 0; i < context->pending_count; i++) {
+	free(context->pending[i].s);
+	free(context->pending[i].p);
+	free(context->pending[i].o);
+	if (context->pending[i].c)
+	    free(context->pending[i].c);
+    }
+    context->pending_count = 0;
+
+    return 0;
+
+}
+
+/* Queues a triple, and its context or 0, for writing, taking ownership
+   of the encoded terms. */
+static int
+cassandra_write_queue(librdf_storage_cassandra_instance* context,
+		      char* s, char* p, char* o, char* c)
+{
+
+    if (context->pending_count >= context->write_buffer)
+	if (cassandra_write_flush(context) < 0) {
+	    free(s); free(p); free(o);
+	    if (c) free(c);
+	    return -1;
+	}
+
+    cassandra_triple* t = &context->pending[context->pending_count++];
+    t->s = s;
+    t->p = p;
+    t->o = o;
+    t->c = c;
+
+    return 0;
+
+}
+
+/* Deletes the rows of one triple from an index table through the write
+   window.  A row of a bucketed partition is in the bucket its hash picks
+   for whatever count the partition had when it was written, so it is
+   deleted from the bucket of each count up to the highest recorded. */
+static void
+cassandra_delete_rows(librdf_storage_cassandra_instance* context,
+		      index_type index, const cassandra_triple* triple)
+{
+
+    const char* t[3] = { triple->s, triple->p, triple->o };
+    const int* key = cassandra_indexes[index].key;
+    int buckets = cassandra_bucket_count(context, index, t[key[0]]);
+    uint64_t h = 0;
+    int count, last = -1;
+
+    /* Every bucket there could be, if the count can't be read. */
+    if (buckets < 0) {
+	context->write_errors++;
+	buckets = context->max_buckets;
+    }
+
+    if (cassandra_bucketed(context, index)) {
+	h = cassandra_bloom_hash(CASSANDRA_BLOOM_HASH_INIT, t[key[1]],
+				 strlen(t[key[1]]));
+	h = cassandra_bloom_hash(h, t[key[2]], strlen(t[key[2]]));
+    }
+
+    for(count = 1; count <= buckets; count *= 2) {
+
+	/* Each count's bucket is the last one or a new one. */
+	int bucket = (int) (h & (uint64_t) (count - 1));
+	if (bucket == last)
+	    continue;
+	last = bucket;
+
+	cassandra_statement_id id =
+	    (cassandra_statement_id) (CASSANDRA_DELETE_SPO + index);
+	CassStatement* stmt = cassandra_bind(context, id);
+	if (stmt == 0) {
+	    context->write_errors++;
+	    return;
+	}
+
+	int i;
+	for(i = 0; i < 3; i++)
+	    if (cassandra_bind_term(context, stmt, i, t[key[i]], 0)) {
+		cass_statement_free(stmt);
+		context->write_errors++;
+		return;
+	    }
+
+	if (cassandra_bucketed(context, index))
+	    cass_statement_bind_int32(stmt, 3, bucket);
+	if (context->quads)
+	    cassandra_bind_context(context, stmt, 3, triple->c);
+
+	cassandra_write_add(context, id, stmt, 0);
+
+    }
+
+}
+
+/* Deletes a quad's row from its context's rdf.cspo partition. */
+static void
+cassandra_delete_context_row(librdf_storage_cassandra_instance* context,
+			     const cassandra_triple* t)
+{
+
+    CassStatement* stmt = cassandra_bind(context, CASSANDRA_DELETE_CSPO);
+    if (stmt == 0) {
+	context->write_errors++;
+	return;
+    }
+
+    cassandra_bind_encoded(context, stmt, 0, t->s, strlen(t->s));
+    cassandra_bind_encoded(context, stmt, 1, t->p, strlen(t->p));
+    cassandra_bind_encoded(context, stmt, 2, t->o, strlen(t->o));
+    cassandra_bind_encoded(context, stmt, 3, t->c, strlen(t->c));
+
+    cassandra_write_add(context, CASSANDRA_DELETE_CSPO, stmt, 0);
+
+}
+
+/* Deletes triples from the three index tables, and quads in a context
+   from rdf.cspo.  In counter mode only those which were stored are taken
+   off the count, and writes still in flight could be storing them, so
+   they are waited for first.  A triple with a term not in the
+   dictionary was never stored. */
+static int
+cassandra_write_delete(librdf_storage_cassandra_instance* context,
+		       const cassandra_triple* triples, int count)
+{
+
+    int i, index;
+    int removed = 0;
+
+    if (count == 0)
+	return 0;
+
+    if (context->size_mode == CASSANDRA_SIZE_COUNTER) {
+	while (context->writes_pending > 0)
+	    cassandra_write_complete(context, 0);
+	int missing = cassandra_count_new(context, triples, count);
+	if (missing < 0)
+	    context->write_errors++;
+	else
+	    removed = count - missing;
+    }
+
+    for(i = 0; i < count; i++) {
+
+	const cassandra_triple* t = &triples[i];
+
+	if (context->dict) {
+	    const char* terms[3] = { t->s, t->p, t->o };
+	    int64_t id;
+	    int missing = 0;
+	    for(index = 0; index < 3 && !missing; index++)
+		missing = cassandra_term_id(context, terms[index], 0, &id);
+	    if (missing < 0)
+		context->write_errors++;
+	    if (missing)
+		continue;
+	}
+
+	for(index = SPO; index <= OSP; index++)
+	    cassandra_delete_rows(context, (index_type) index, t);
+
+	if (context->quads && t->c)
+	    cassandra_delete_context_row(context, t);
+
+    }
+
+    if (removed > 0)
+	cassandra_count_add(context, -removed);
+
+    return 0;
+
+}
+
+/* Records an add, or a removal if add is 0, of a triple in context c,
+   or 0, in the transaction's write set. */
+static int
+cassandra_transaction_put(librdf_storage_cassandra_instance* context,
+			  const char* s, const char* p, const char* o,
+			  const char* c, int add)
+{
+
+    if (cassandra_writes_put(context->transaction, s, p, o, c, add) == 0)
+	return 0;
+
+    fprintf(stderr, "Cassandra: transaction is over %lu bytes\n",
+	    (unsigned long) context->transaction_bytes);
+
+    return -1;
+
+}
+
+#ifdef HAVE_PTHREAD_H
+
+/* A parsed triple, and its context in the quads layout, copied out of
+   librdf so that the encoder threads never touch librdf objects, which
+   are not thread-safe.  The term strings follow the structure.  count
+   is 4 with a context, else 3. */
+typedef struct
+{
+    cassandra_term terms[4];
+    int count;
+} cassandra_load_record;
+
+/* State of one encoder or writer thread of a pipelined load. */
+typedef struct
+{
+    librdf_storage_cassandra_instance* context;
+    cassandra_queue* parsed;
+    cassandra_queue* encoded;
+    pthread_t thread;
+    unsigned long count;
+    int errors;
+    double finished;
+} cassandra_load_stage;
+
+static double
+cassandra_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static char*
+cassandra_load_copy(char* buf, const char* str)
+{
+    size_t len = strlen(str) + 1;
+    memcpy(buf, str, len);
+    return buf + len;
+}
+
+static cassandra_load_record*
+cassandra_load_record_new(librdf_statement* statement,
+			  librdf_node* context_node)
+{
+
+    librdf_node* nodes[4];
+    cassandra_term terms[4];
+    size_t len = sizeof(cassandra_load_record);
+    int count = context_node ? 4 : 3;
+    int i;
+
+    nodes[0] = librdf_statement_get_subject(statement);
+    nodes[1] = librdf_statement_get_predicate(statement);
+    nodes[2] = librdf_statement_get_object(statement);
+    nodes[3] = context_node;
+
+    for(i = 0; i < count; i++) {
+	if (nodes[i] == 0)
+	    return 0;
+	term_helper(nodes[i], &terms[i]);
+	if (terms[i].value == 0)
+	    return 0;
+	len += strlen(terms[i].value) + 1;
+	if (terms[i].datatype)
+	    len += strlen(terms[i].datatype) + 1;
+	if (terms[i].language)
+	    len += strlen(terms[i].language) + 1;
+    }
+
+    cassandra_load_record* rec = malloc(len);
+    if (rec == 0)
+	return 0;
+
+    char* buf = (char*) (rec + 1);
+
+    rec->count = count;
+    for(i = 0; i < count; i++) {
+	rec->terms[i].type = terms[i].type;
+	rec->terms[i].value = buf;
+	buf = cassandra_load_copy(buf, terms[i].value);
+	rec->terms[i].datatype = 0;
+	if (terms[i].datatype) {
+	    rec->terms[i].datatype = buf;
+	    buf = cassandra_load_copy(buf, terms[i].datatype);
+	}
+	rec->terms[i].language = 0;
+	if (terms[i].language) {
+	    rec->terms[i].language = buf;
+	    buf = cassandra_load_copy(buf, terms[i].language);
+	}
+    }
+
+    return rec;
+
+}
+
+/* Encoder stage: turns parsed triples into encoded terms ready to bind. */
+static void*
+cassandra_load_encoder(void* arg)
+{
+
+    cassandra_load_stage* stage = (cassandra_load_stage*) arg;
+    void* item;
+
+    while (cassandra_queue_pop(stage->parsed, &item)) {
+
+	cassandra_load_record* rec = (cassandra_load_record*) item;
+
+	cassandra_triple* t = malloc(sizeof(cassandra_triple));
+	if (t == 0) {
+	    free(rec);
+	    stage->errors++;
+	    continue;
+	}
+
+	t->s = term_encode(stage->context, &rec->terms[0], 0);
+	t->p = term_encode(stage->context, &rec->terms[1], 0);
+	t->o = term_encode(stage->context, &rec->terms[2], 0);
+	t->c = 0;
+	if (rec->count > 3)
+	    t->c = term_encode(stage->context, &rec->terms[3], 0);
+
+	int failed = (t->s == 0 || t->p == 0 || t->o == 0 ||
+		      (rec->count > 3 && t->c == 0));
+
+	free(rec);
+
+	if (failed) {
+	    free(t->s); free(t->p); free(t->o); free(t->c);
+	    free(t);
+	    stage->errors++;
+	    continue;
+	}
+
+	cassandra_queue_push(stage->encoded, t);
+	stage->count++;
+
+    }
+
+    stage->finished = cassandra_now();
+
+    return 0;
+
+}
+
+/* Writer stage: feeds the write scheduler, which drives the driver
+   asynchronously through the write window. */
+static void*
+cassandra_load_writer(void* arg)
+{
+
+    cassandra_load_stage* stage = (cassandra_load_stage*) arg;
+    void* item;
+
+    while (cassandra_queue_pop(stage->encoded, &item)) {
+
+	cassandra_triple* t = (cassandra_triple*) item;
+
+	if (cassandra_write_queue(stage->context, t->s, t->p, t->o, t->c) < 0)
+	    stage->errors++;
+	else
+	    stage->count++;
+
+	free(t);
+
+    }
+
+    if (cassandra_write_flush(stage->context) < 0)
+	stage->errors++;
+
+    if (cassandra_write_drain(stage->context) < 0)
+	stage->errors++;
+
+    stage->finished = cassandra_now();
+
+    return 0;
+
+}
+
+/* Pipelined add_statements.  The calling thread is the parser stage: it
+   pulls the stream, which is where parsing happens, and copies each
+   triple out.  A pool of encoder threads and one writer thread follow,
+   connected by bounded lock-free queues which apply backpressure. */
+static int
+cassandra_add_statements_pipelined(librdf_storage_cassandra_instance* context,
+				   librdf_stream* statement_stream)
+{
+
+    int n = context->load_threads;
+    int i, errors = 0;
+    unsigned long parsed = 0;
+
+    cassandra_queue* parsed_queue =
+	cassandra_queue_create(CASSANDRA_LOAD_QUEUE);
+    cassandra_queue* encoded_queue =
+	cassandra_queue_create(CASSANDRA_LOAD_QUEUE);
+    cassandra_load_stage* stages =
+	LIBRDF_CALLOC(cassandra_load_stage*, n + 1,
+		      sizeof(cassandra_load_stage));
+
+    if (!parsed_queue || !encoded_queue || !stages) {
+	if (parsed_queue) cassandra_queue_free(parsed_queue);
+	if (encoded_queue) cassandra_queue_free(encoded_queue);
+	if (stages) LIBRDF_FREE(cassandra_load_stage*, stages);
+	return -1;
+    }
+
+    /* Stages 0 to n-1 are the encoders, stage n is the writer. */
+    for(i = 0; i <= n; i++) {
+	stages[i].context = context;
+	stages[i].parsed = parsed_queue;
+	stages[i].encoded = encoded_queue;
+    }
+
+    double start = cassandra_now();
+
+    int started = 0;
+    for(i = 0; i < n; i++)
+	if (pthread_create(&stages[i].thread, 0, &cassandra_load_encoder,
+			   &stages[i]) == 0)
+	    started++;
+	else
+	    break;
+
+    int writer = (started > 0) &&
+	(pthread_create(&stages[n].thread, 0, &cassandra_load_writer,
+			&stages[n]) == 0);
+
+    if (writer) {
+
+	for(; !librdf_stream_end(statement_stream);
+	    librdf_stream_next(statement_stream)) {
+
+	    librdf_statement* statement =
+		librdf_stream_get_object(statement_stream);
+	    if (!statement)
+		break;
+
+	    /* Contexts are only kept by the quads layout. */
+	    librdf_node* context_node = context->quads ?
+		librdf_stream_get_context2(statement_stream) : 0;
+
+	    cassandra_load_record* rec =
+		cassandra_load_record_new(statement, context_node);
+	    if (rec == 0) {
+		errors++;
+		continue;
+	    }
+
+	    cassandra_queue_push(parsed_queue, rec);
+	    parsed++;
+
+	}
+
+    } else {
+	fprintf(stderr, "Cassandra: couldn't start load threads\n");
+	errors++;
+    }
+
+    double parse_end = cassandra_now();
+
+    cassandra_queue_close(parsed_queue);
+
+    double encode_end = parse_end;
+    unsigned long encoded = 0;
+    for(i = 0; i < started; i++) {
+	pthread_join(stages[i].thread, 0);
+	encoded += stages[i].count;
+	errors += stages[i].errors;
+	if (stages[i].finished > encode_end)
+	    encode_end = stages[i].finished;
+    }
+
+    cassandra_queue_close(encoded_queue);
+
+    if (writer) {
+	pthread_join(stages[n].thread, 0);
+	errors += stages[n].errors;
+    }
+
+    context->load_rate[0] = parsed / (parse_end - start);
+    context->load_rate[1] = encoded / (encode_end - start);
+    context->load_rate[2] =
+	writer ? stages[n].count / (stages[n].finished - start) : 0;
+
+    cassandra_queue_free(parsed_queue);
+    cassandra_queue_free(encoded_queue);
+    LIBRDF_FREE(cassandra_load_stage*, stages);
+
+    return (errors > 0) ? -1 : 0;
+
+}
+
+#endif
+
+static int execute(CassSession* session, char* query, int ignore_error)
+{
+
+    CassStatement* stmt = cass_statement_new(query, 0);
+
+    CassFuture* future = cass_session_execute(session, stmt);
+
+    cass_statement_free(stmt);
+
+    CassError rc = cass_future_error_code(future);
+ 
+    if (rc != CASS_OK) {
+	if (ignore_error) {
+	    cass_future_free(future);
+	    return 0;
+	}
+	
+	fprintf(stderr, "Cassandra error: %s\n", cass_error_desc(rc));
+	cass_future_free(future);
+	return -1;
+    }
+
+    cass_future_free(future);
+
+    return 0;
+    
+}
+  
+/* cass_statement_new for CQL written for keyspace rdf, which is run on
+   the storage's keyspace instead.  Returns 0 if out of memory. */
+static CassStatement*
+cassandra_statement_new(librdf_storage_cassandra_instance* context,
+			const char* cql, size_t count)
+{
+
+    char* query = cassandra_keyspace_cql(context->keyspace, cql);
+    if (query == 0)
+	return 0;
+
+    CassStatement* stmt = cass_statement_new(query, count);
+    free(query);
+
+    return stmt;
+
+}
+
+/* Runs DDL written for keyspace rdf on the storage's keyspace. */
+static int
+cassandra_execute_ddl(librdf_storage_cassandra_instance* context,
+		      const char* cql)
+{
+
+    char* query = cassandra_keyspace_cql(context->keyspace, cql);
+    if (query == 0)
+	return -1;
+
+    int ret = execute(context->session, query, 0);
+    free(query);
+
+    return ret;
+
+}
+
+/* Reads a setting the keyspace was created with from rdf.properties
+   into value, which has room for size bytes.  Returns 0, 1 if it isn't
+   set, or -1 on error. */
+static int
+cassandra_property_get(librdf_storage_cassandra_instance* context,
+		       const char* name, char* value, size_t size)
+{
+
+    CassStatement* stmt =
+	cassandra_statement_new(context,
+				"SELECT value FROM rdf.properties "
+				"WHERE name = ?;", 1);
+    if (stmt == 0)
+	return -1;
+    cass_statement_bind_string(stmt, 0, name);
+
+    CassFuture* future = cass_session_execute(context->session, stmt);
+    cass_statement_free(stmt);
+
+    if (cass_future_error_code(future) != CASS_OK) {
+	cassandra_report_error(future);
+	cass_future_free(future);
+	return -1;
+    }
+
+    const CassResult* result = cass_future_get_result(future);
+    cass_future_free(future);
+
+    const CassRow* row = cass_result_first_row(result);
+    const char* v;
+    size_t len;
+    int ret = 1;
+
+    if (row && cass_value_get_string(cass_row_get_column(row, 0), &v,
+				     &len) == CASS_OK && len < size) {
+	memcpy(value, v, len);
+	value[len] = 0;
+	ret = 0;
+    }
+
+    cass_result_free(result);
+
+    return ret;
+
+}
+
+/* Records a setting of a new keyspace in rdf.properties. */
+static int
+cassandra_property_put(librdf_storage_cassandra_instance* context,
+		       const char* name, const char* value)
+{
+
+    CassStatement* stmt =
+	cassandra_statement_new(context,
+				"INSERT INTO rdf.properties (name, value) "
+				"VALUES (?, ?);", 2);
+    if (stmt == 0)
+	return -1;
+    cass_statement_bind_string(stmt, 0, name);
+    cass_statement_bind_string(stmt, 1, value);
+
+    CassFuture* future = cass_session_execute(context->session, stmt);
+    cass_statement_free(stmt);
+
+    int ret = 0;
+    if (cass_future_error_code(future) != CASS_OK) {
+	cassandra_report_error(future);
+	ret = -1;
+    }
+    cass_future_free(future);
+
+    return ret;
+
+}
+
+/* Sets the storage's keyspace to the one a dataset is published in,
+   or the dataset's own name if it isn't in the catalog. */
+static int
+cassandra_dataset_keyspace(librdf_storage_cassandra_instance* context,
+			   const char* dataset)
+{
+
+    CassStatement* stmt =
+	cass_statement_new("SELECT keyspace_name FROM " CASSANDRA_CATALOG
+			   ".datasets WHERE name = ?;", 1);
+    cass_statement_bind_string(stmt, 0, dataset);
+
+    CassFuture* future = cass_session_execute(context->session, stmt);
+    cass_statement_free(stmt);
+
+    /* An invalid query is one of a catalog not yet created. */
+    CassError rc = cass_future_error_code(future);
+    if (rc != CASS_OK && rc != CASS_ERROR_SERVER_INVALID_QUERY) {
+	cassandra_report_error(future);
+	cass_future_free(future);
+	return -1;
+    }
+
+    const CassResult* result = 0;
+    if (rc == CASS_OK)
+	result = cass_future_get_result(future);
+    cass_future_free(future);
+
+    const CassRow* row = result ? cass_result_first_row(result) : 0;
+    const char* keyspace;
+    size_t len;
+    char name[64];
+
+    if (row && cass_value_get_string(cass_row_get_column(row, 0), &keyspace,
+				     &len) == CASS_OK && len < sizeof(name)) {
+	memcpy(name, keyspace, len);
+	name[len] = 0;
+    } else
+	snprintf(name, sizeof(name), "%s", dataset);
+
+    if (result)
+	cass_result_free(result);
+
+    context->keyspace = cassandra_keyspace_name(name);
+    if (context->keyspace == 0) {
+	fprintf(stderr, "Cassandra: bad keyspace %s for dataset %s\n", name,
+		dataset);
+	return -1;
+    }
+
+    return 0;
+
+}
+
+/* Publishes the storage's keyspace as a dataset, once its writes are
+   done.  Storages opening the dataset from then on use this keyspace.
+   The switch is a write of one catalog row, so none sees a mix of the
+   old keyspace and the new. */
+static int
+cassandra_dataset_publish(librdf_storage_cassandra_instance* context,
+			  const char* dataset)
+{
+
+    int ret = cassandra_write_flush(context);
+    if (cassandra_write_drain(context) < 0 || ret < 0)
+	return -1;
+
+    char query[512];
+    snprintf(query, sizeof(query),
+	     "CREATE KEYSPACE IF NOT EXISTS " CASSANDRA_CATALOG
+	     " WITH replication = %s;", context->replication);
+    if (execute(context->session, query, 0) < 0)
+	return -1;
+
+    snprintf(query, sizeof(query),
+	     "CREATE TABLE IF NOT EXISTS " CASSANDRA_CATALOG ".datasets ("
+	     "  name text primary key, keyspace_name text"
+	     ");");
+    if (execute(context->session, query, 0) < 0)
+	return -1;
+
+    CassStatement* stmt =
+	cass_statement_new("INSERT INTO " CASSANDRA_CATALOG ".datasets "
+			   "(name, keyspace_name) VALUES (?, ?);", 2);
+    cass_statement_bind_string(stmt, 0, dataset);
+    cass_statement_bind_string(stmt, 1, context->keyspace);
+
+    CassFuture* future = cass_session_execute(context->session, stmt);
+    cass_statement_free(stmt);
+
+    ret = 0;
+    if (cass_future_error_code(future) != CASS_OK) {
+	cassandra_report_error(future);
+	ret = -1;
+    }
+    cass_future_free(future);
+
+    return ret;
+
+}
+
+/* What system_schema and rdf.properties say of the keyspace. */
+typedef struct
+{
+    unsigned long tables;	/* Bits of the tables which exist */
+    int spo_blob;		/* Type of spo.s: 1 for blob, 0 for any */
+    int terms_blob;		/* other, -1 if missing; likewise terms.term */
+    int spoc_blob;		/* and spoc.s */
+    int version;		/* schema-version property, 0 if unset */
+    int counter;		/* size-counter property, -1 if unset */
+    unsigned long alter;	/* Bits of tables with other settings than
+				   the options give them */
+} cassandra_schema;
+
+/* Steps which take a keyspace's schema from each version to the next:
+   step i takes version i to i + 1.  They are run by open under the
+   schema guard, before the tables the storage's options need are
+   created, so a step only has to change tables which already exist.
+   A keyspace from before versions were recorded is at version 0. */
+typedef int (*cassandra_migration)(librdf_storage_cassandra_instance* context,
+				   const cassandra_schema* schema);
+
+/* Version 0 keyspaces have the tables of version 1, less rdf.properties,
+   which open has created by now, so there is nothing to change.  One
+   with tables but none of a layout's spo table wasn't written by this
+   storage.  A new keyspace has no tables yet. */
+static int
+cassandra_migrate_unversioned(librdf_storage_cassandra_instance* context,
+			      const cassandra_schema* schema)
+{
+
+    unsigned long tables = schema->tables &
+	~CASSANDRA_TABLE_BIT(CASSANDRA_TABLE_PROPERTIES);
+
+    if (tables && !(tables & (CASSANDRA_TABLE_BIT(CASSANDRA_TABLE_SPO) |
+			      CASSANDRA_TABLE_BIT(CASSANDRA_TABLE_SPO_IDS) |
+			      CASSANDRA_TABLE_BIT(CASSANDRA_TABLE_SPOC)))) {
+	fprintf(stderr, "Cassandra: keyspace %s has no spo table\n",
+		context->keyspace);
+	return -1;
+    }
+
+    return 0;
+
+}
+
+static const cassandra_migration cassandra_migrations[] = {
+    cassandra_migrate_unversioned
+};
+
+#define CASSANDRA_SCHEMA_VERSION \
+    ((int) (sizeof(cassandra_migrations) / sizeof(cassandra_migrations[0])))
+
+/* How long the schema guard is held before it lapses, in case its holder
+   dies, and how long open waits for another client's schema update. */
+#define CASSANDRA_SCHEMA_LOCK_TTL 60
+#define CASSANDRA_SCHEMA_WAIT (2 * CASSANDRA_SCHEMA_LOCK_TTL)
+
+/* Reads which tables the keyspace has, the types of the columns its
+   term encoding is told from, and its schema version, in one query of
+   system_schema and one of rdf.properties. */
+static int
+cassandra_schema_read(librdf_storage_cassandra_instance* context,
+		      cassandra_schema* schema)
+{
+
+    schema->tables = 0;
+    schema->spo_blob = -1;
+    schema->spoc_blob = -1;
+    schema->terms_blob = -1;
+    schema->version = 0;
+    schema->counter = -1;
+
+    CassStatement* stmt =
+	cassandra_statement_new(context,
+				"SELECT table_name, column_name, type "
+				"FROM system_schema.columns "
+				"WHERE keyspace_name = 'rdf';", 0);
+    if (stmt == 0)
+	return -1;
+
+    CassFuture* future = cass_session_execute(context->session, stmt);
+    cass_statement_free(stmt);
+
+    if (cass_future_error_code(future) != CASS_OK) {
+	cassandra_report_error(future);
+	cass_future_free(future);
+	return -1;
+    }
+
+    const CassResult* result = cass_future_get_result(future);
+    cass_future_free(future);
+
+    CassIterator* rows = cass_iterator_from_result(result);
+
+    while (cass_iterator_next(rows)) {
+
+	const CassRow* row = cass_iterator_get_row(rows);
+	const char* table;
+	const char* column;
+	const char* type;
+	size_t table_len, column_len, type_len;
+
+	if (cass_value_get_string(cass_row_get_column(row, 0), &table,
+				  &table_len) != CASS_OK ||
+	    cass_value_get_string(cass_row_get_column(row, 1), &column,
+				  &column_len) != CASS_OK ||
+	    cass_value_get_string(cass_row_get_column(row, 2), &type,
+				  &type_len) != CASS_OK)
+	    continue;
+
+	int t;
+	for(t = 0; t < CASSANDRA_NUM_TABLES; t++)
+	    if (strlen(cassandra_tables[t][0]) == table_len &&
+		memcmp(cassandra_tables[t][0], table, table_len) == 0)
+		break;
+	if (t == CASSANDRA_NUM_TABLES)
+	    continue;
+
+	schema->tables |= CASSANDRA_TABLE_BIT(t);
+
+	int blob = (type_len == 4 && memcmp(type, "blob", 4) == 0);
+	if (t == CASSANDRA_TABLE_SPO && column_len == 1 && column[0] == 's')
+	    schema->spo_blob = blob;
+	if (t == CASSANDRA_TABLE_SPOC && column_len == 1 && column[0] == 's')
+	    schema->spoc_blob = blob;
+	if (t == CASSANDRA_TABLE_TERMS && column_len == 4 &&
+	    memcmp(column, "term", 4) == 0)
+	    schema->terms_blob = blob;
+
+    }
+
+    cass_iterator_free(rows);
+    cass_result_free(result);
+
+    if (schema->tables & CASSANDRA_TABLE_BIT(CASSANDRA_TABLE_PROPERTIES)) {
+	char value[32];
+	int found = cassandra_property_get(context, "schema-version", value,
+					   sizeof(value));
+	if (found < 0)
+	    return -1;
+	if (found == 0)
+	    schema->version = atoi(value);
+    }
+
+    return 0;
+
+}
+
+/* The storage's layout, as recorded in rdf.properties. */
+static const char*
+cassandra_layout_name(librdf_storage_cassandra_instance* context)
+{
+    if (context->dict)
+	return "dictionary";
+    return context->quads ? "quads" : "plain";
+}
+
+/* Checks the storage's layout and bucketing against the keyspace's, as
+   a storage with others would read and write other tables.  They are
+   recorded in rdf.properties, or told from the tables of a keyspace
+   from before they were.  Returns 0 if they agree or the keyspace has
+   no layout yet, or -1. */
+static int
+cassandra_schema_layout(librdf_storage_cassandra_instance* context,
+			const cassandra_schema* schema)
+{
+
+    const char* layout = cassandra_layout_name(context);
+    int bucketed = (context->max_buckets > 0);
+    char value[32];
+    int found = 1;
+
+    if (schema->tables & CASSANDRA_TABLE_BIT(CASSANDRA_TABLE_PROPERTIES)) {
+	found = cassandra_property_get(context, "layout", value,
+				       sizeof(value));
+	if (found < 0)
+	    return -1;
+    }
+
+    if (found == 0) {
+
+	if (strcmp(value, layout)) {
+	    fprintf(stderr, "Cassandra: keyspace has the %s layout\n", value);
+	    return -1;
+	}
+
+	found = cassandra_property_get(context, "bucketed", value,
+				       sizeof(value));
+	if (found < 0)
+	    return -1;
+	if (found == 0 && (atoi(value) > 0) != bucketed) {
+	    fprintf(stderr, "Cassandra: keyspace is %sbucketed\n",
+		    bucketed ? "not " : "");
+	    return -1;
+	}
+
+	return 0;
+
+    }
+
+    unsigned long plain = CASSANDRA_TABLE_BIT(CASSANDRA_TABLE_SPO);
+    unsigned long dict = CASSANDRA_TABLE_BIT(CASSANDRA_TABLE_SPO_IDS);
+    unsigned long quads = CASSANDRA_TABLE_BIT(CASSANDRA_TABLE_SPOC);
+    unsigned long own = context->dict ? dict : context->quads ? quads : plain;
+
+    if (!(schema->tables & (plain | dict | quads)))
+	return 0;
+
+    if (!(schema->tables & own)) {
+	fprintf(stderr, "Cassandra: keyspace has another layout than %s\n",
+		layout);
+	return -1;
+    }
+
+    /* The quads layout is never bucketed. */
+    unsigned long buckets = context->dict ?
+	CASSANDRA_TABLE_BIT(CASSANDRA_TABLE_POS_IDS_BUCKETS) :
+	CASSANDRA_TABLE_BIT(CASSANDRA_TABLE_POS_BUCKETS);
+    if (!context->quads && ((schema->tables & buckets) != 0) != bucketed) {
+	fprintf(stderr, "Cassandra: keyspace is %sbucketed\n",
+		bucketed ? "not " : "");
+	return -1;
+    }
+
+    return 0;
+
+}
+
+/* Returns 1 if the layout's terms are stored in the compact encoding, 0
+   if in text, or -1 if the layout has no tables yet. */
+static int
+cassandra_schema_encoding(librdf_storage_cassandra_instance* context,
+			  const cassandra_schema* schema)
+{
+
+    if (context->dict)
+	return schema->terms_blob;
+
+    return context->quads ? schema->spoc_blob : schema->spo_blob;
+
+}
+
+/* Checks the storage's layout and settles its encoding, namespaces and
+   literal encodings with what the keyspace already has, and works out the tables its
+   options need.  Returns 1 if the schema must be created or migrated
+   first, 0 if not, or -1 on error. */
+static int
+cassandra_schema_settle(librdf_storage_cassandra_instance* context,
+			cassandra_schema* schema,
+			unsigned long* needed, int* namespaces)
+{
+
+    if (schema->version > CASSANDRA_SCHEMA_VERSION) {
+	fprintf(stderr, "Cassandra: keyspace schema version %d is newer than "
+		"%d\n", schema->version, CASSANDRA_SCHEMA_VERSION);
+	return -1;
+    }
+
+    if (cassandra_schema_layout(context, schema) < 0)
+	return -1;
+
+    /* An existing keyspace keeps the encoding it was created with, read
+       from the type of the column terms are first written to.  A new one
+       is compact unless the text encoding is asked for. */
+    int encoding = cassandra_schema_encoding(context, schema);
+    if (encoding >= 0 && context->encoding >= 0 &&
+	encoding != context->encoding) {
+	fprintf(stderr, "Cassandra: keyspace holds terms in the %s "
+		"encoding\n", encoding ? "compact" : "text");
+	return -1;
+    }
+    context->compact = (encoding >= 0) ? encoding :
+	(context->encoding != 0);
+
+    /* Likewise a keyspace has a namespace dictionary or not from the
+       start, as URIs already written in full would no longer be found
+       once their namespace had an id. */
+    *namespaces =
+	(schema->tables & CASSANDRA_TABLE_BIT(CASSANDRA_TABLE_NAMESPACES)) != 0;
+    if (!*namespaces && context->namespaces) {
+	if (encoding >= 0)
+	    fprintf(stderr, "Cassandra: namespaces can only be used by a new "
+		    "keyspace\n");
+	else if (!context->compact)
+	    fprintf(stderr, "Cassandra: namespaces need the compact "
+		    "encoding\n");
+	else
+	    *namespaces = 1;
+    }
+
+    /* Literals are compressed or not from the start too, as a literal
+       written otherwise wouldn't be found.  A new keyspace records its
+       setting when it is created. */
+    if (encoding >= 0) {
+	size_t compress = 0;
+	char value[32];
+	if (schema->tables & CASSANDRA_TABLE_BIT(CASSANDRA_TABLE_PROPERTIES)) {
+	    int found = cassandra_property_get(context, "compress-literals",
+					       value, sizeof(value));
+	    if (found < 0)
+		return -1;
+	    if (found == 0)
+		compress = (size_t) strtoul(value, 0, 10);
+	}
+	if (context->compress_literals &&
+	    context->compress_literals != compress)
+	    fprintf(stderr, "Cassandra: keyspace compresses literals of %lu "
+		    "bytes or more, 0 for none\n", (unsigned long) compress);
+	context->compress_literals = compress;
+    } else if (context->compress_literals && !context->compact) {
+	fprintf(stderr, "Cassandra: compress-literals needs the compact "
+		"encoding\n");
+	context->compress_literals = 0;
+    }
+
+    /* And literals are sortable or not from the start, as a find for a
+       literal in the other encoding misses it.  A keyspace from before
+       the setting was recorded takes what the options ask for. */
+    context->sortable = (context->sortable_option > 0);
+    if (encoding >= 0 &&
+	(schema->tables & CASSANDRA_TABLE_BIT(CASSANDRA_TABLE_PROPERTIES))) {
+	char value[32];
+	int found = cassandra_property_get(context, "sortable-literals",
+					   value, sizeof(value));
+	if (found < 0)
+	    return -1;
+	if (found == 0) {
+	    int sortable = (atoi(value) > 0);
+	    if (context->sortable_option >= 0 &&
+		context->sortable_option != sortable) {
+		fprintf(stderr, "Cassandra: keyspace has sortable-literals "
+			"set to %d\n", sortable);
+		return -1;
+	    }
+	    context->sortable = sortable;
+	}
+    }
+
+    /* Whether writers keep the triple count in rdf.counts is the
+       keyspace's as well, as one which didn't would leave it wrong.  A
+       keyspace which hasn't recorded it is migrated to record it, and
+       to start the count if it is to be kept.  Whether size() then
+       estimates or scans is up to each storage. */
+    schema->counter = -1;
+    if (encoding >= 0 &&
+	(schema->tables & CASSANDRA_TABLE_BIT(CASSANDRA_TABLE_PROPERTIES))) {
+	char value[32];
+	int found = cassandra_property_get(context, "size-counter", value,
+					   sizeof(value));
+	if (found < 0)
+	    return -1;
+	if (found == 0)
+	    schema->counter = (atoi(value) > 0);
+    }
+    int counter = (schema->counter >= 0) ? schema->counter :
+	(context->size_option == CASSANDRA_SIZE_COUNTER);
+    if (context->size_option >= 0 &&
+	(context->size_option == CASSANDRA_SIZE_COUNTER) != counter) {
+	fprintf(stderr, "Cassandra: keyspace %s a triple counter\n",
+		counter ? "keeps" : "doesn't keep");
+	return -1;
+    }
+    context->size_mode = (context->size_option >= 0) ? context->size_option :
+	counter ? CASSANDRA_SIZE_COUNTER : CASSANDRA_SIZE_ESTIMATE;
+    if (context->bloom && context->size_mode == CASSANDRA_SIZE_COUNTER) {
+	fprintf(stderr, "Cassandra: bloom-filter can't be used with "
+		"size=counter\n");
+	return -1;
+    }
+
+    *needed = CASSANDRA_TABLE_BIT(CASSANDRA_TABLE_PROPERTIES) |
+	CASSANDRA_TABLE_BIT(CASSANDRA_TABLE_COUNTS);
+
+    if (*namespaces)
+	*needed |= CASSANDRA_TABLE_BIT(CASSANDRA_TABLE_NAMESPACES);
+
+    if (context->dict)
+	*needed |= CASSANDRA_TABLE_BIT(CASSANDRA_TABLE_TERMS) |
+	    CASSANDRA_TABLE_BIT(CASSANDRA_TABLE_IDS) |
+	    CASSANDRA_TABLE_BIT(CASSANDRA_TABLE_SPO_IDS) |
+	    CASSANDRA_TABLE_BIT(CASSANDRA_TABLE_POS_IDS) |
+	    CASSANDRA_TABLE_BIT(CASSANDRA_TABLE_OSP_IDS);
+    else if (context->quads)
+	*needed |= CASSANDRA_TABLE_BIT(CASSANDRA_TABLE_SPOC) |
+	    CASSANDRA_TABLE_BIT(CASSANDRA_TABLE_POSC) |
+	    CASSANDRA_TABLE_BIT(CASSANDRA_TABLE_OSPC) |
+	    CASSANDRA_TABLE_BIT(CASSANDRA_TABLE_CSPO) |
+	    CASSANDRA_TABLE_BIT(CASSANDRA_TABLE_CONTEXTS);
+    else
+	*needed |= CASSANDRA_TABLE_BIT(CASSANDRA_TABLE_SPO) |
+	    CASSANDRA_TABLE_BIT(CASSANDRA_TABLE_POS) |
+	    CASSANDRA_TABLE_BIT(CASSANDRA_TABLE_OSP);
+
+    /* Bucketed pos and osp partitions, and the bucket counts of the
+       keys which have been split. */
+    if (context->max_buckets && context->dict)
+	*needed |= CASSANDRA_TABLE_BIT(CASSANDRA_TABLE_POS_IDS_BUCKETS) |
+	    CASSANDRA_TABLE_BIT(CASSANDRA_TABLE_OSP_IDS_BUCKETS);
+    else if (context->max_buckets)
+	*needed |= CASSANDRA_TABLE_BIT(CASSANDRA_TABLE_POS_BUCKETS) |
+	    CASSANDRA_TABLE_BIT(CASSANDRA_TABLE_OSP_BUCKETS);
+    if (context->max_buckets)
+	*needed |= CASSANDRA_TABLE_BIT(CASSANDRA_TABLE_BUCKETS) |
+	    CASSANDRA_TABLE_BIT(CASSANDRA_TABLE_BUCKET_ROWS);
+
+    /* Existing tables are altered when settings are given for them
+       other than those last recorded. */
+    schema->alter = 0;
+    int t;
+    for(t = 0; t < CASSANDRA_NUM_TABLES; t++) {
+
+	if (context->table_options[t] == 0 ||
+	    !(*needed & schema->tables & CASSANDRA_TABLE_BIT(t)))
+	    continue;
+
+	char name[64];
+	char value[512];
+	int found = 1;
+	snprintf(name, sizeof(name), "table-options.%s",
+		 cassandra_tables[t][0]);
+	if (schema->tables & CASSANDRA_TABLE_BIT(CASSANDRA_TABLE_PROPERTIES))
+	    found = cassandra_property_get(context, name, value,
+					   sizeof(value));
+	if (found < 0)
+	    return -1;
+	if (found > 0 || strcmp(value, context->table_options[t]))
+	    schema->alter |= CASSANDRA_TABLE_BIT(t);
+
+    }
+
+    return ((schema->tables & *needed) != *needed || schema->alter ||
+	    schema->counter < 0 ||
+	    schema->version != CASSANDRA_SCHEMA_VERSION);
+
+}
+
+/* Takes the schema guard, a lease on a row of rdf.properties which
+   lapses after CASSANDRA_SCHEMA_LOCK_TTL seconds.  Returns 1 if taken,
+   0 if another client holds it, or -1 on error. */
+static int
+cassandra_schema_lock(librdf_storage_cassandra_instance* context,
+		      const char* owner)
+{
+
+    char query[160];
+    snprintf(query, sizeof(query),
+	     "INSERT INTO rdf.properties (name, value) "
+	     "VALUES ('schema-lock', ?) IF NOT EXISTS USING TTL %d;",
+	     CASSANDRA_SCHEMA_LOCK_TTL);
+
+    CassStatement* stmt = cassandra_statement_new(context, query, 1);
+    if (stmt == 0)
+	return -1;
+    cass_statement_bind_string(stmt, 0, owner);
+
+    CassFuture* future = cass_session_execute(context->session, stmt);
+    cass_statement_free(stmt);
+
+    if (cass_future_error_code(future) != CASS_OK) {
+	cassandra_report_error(future);
+	cass_future_free(future);
+	return -1;
+    }
+
+    const CassResult* result = cass_future_get_result(future);
+    cass_future_free(future);
+
+    const CassRow* row = cass_result_first_row(result);
+    cass_bool_t applied = cass_false;
+    if (row)
+	cass_value_get_bool(cass_row_get_column(row, 0), &applied);
+
+    cass_result_free(result);
+
+    return applied ? 1 : 0;
+
+}
+
+static void
+cassandra_schema_unlock(librdf_storage_cassandra_instance* context,
+			const char* owner)
+{
+
+    CassStatement* stmt =
+	cassandra_statement_new(context,
+				"DELETE FROM rdf.properties "
+				"WHERE name = 'schema-lock' IF value = ?;", 1);
+    if (stmt == 0)
+	return;
+    cass_statement_bind_string(stmt, 0, owner);
+
+    /* If this fails the guard lapses anyway. */
+    CassFuture* future = cass_session_execute(context->session, stmt);
+    cass_statement_free(stmt);
+
+    if (cass_future_error_code(future) != CASS_OK)
+	cassandra_report_error(future);
+    cass_future_free(future);
+
+}
+
+/* Runs one of the storage's statements unprepared, as it may be before
+   the schema is settled, and sums the first column of its rows: a
+   count, or the shards of the counter.  Returns 0 or -1. */
+static int
+cassandra_count_query(librdf_storage_cassandra_instance* context,
+		      cassandra_statement_id id, int64_t* sum)
+{
+
+    CassStatement* stmt =
+	cassandra_statement_new(context, context->statements[id], 0);
+    if (stmt == 0)
+	return -1;
+
+    CassFuture* future = cass_session_execute(context->session, stmt);
+    cass_statement_free(stmt);
+
+    if (cass_future_error_code(future) != CASS_OK) {
+	cassandra_report_error(future);
+	cass_future_free(future);
+	return -1;
+    }
+
+    const CassResult* result = cass_future_get_result(future);
+    cass_future_free(future);
+
+    *sum = 0;
+    CassIterator* iter = cass_iterator_from_result(result);
+    while (cass_iterator_next(iter)) {
+	int64_t value = 0;
+	cass_value_get_int64(cass_row_get_column(cass_iterator_get_row(iter),
+						 0), &value);
+	*sum += value;
+    }
+    cass_iterator_free(iter);
+
+    cass_result_free(result);
+
+    return 0;
+
+}
+
+/* Starts the triple counter of a keyspace which hasn't kept it, from
+   the triples it holds, by a full count of the spo table.  Whatever
+   the counter held is made up too.  Called with the schema guard
+   held; triples written meanwhile by clients not counting them are
+   missed. */
+static int
+cassandra_count_start(librdf_storage_cassandra_instance* context)
+{
+
+    int64_t stored, counted;
+
+    if (cassandra_count_query(context, CASSANDRA_COUNT, &stored) < 0 ||
+	cassandra_count_query(context, CASSANDRA_COUNT_READ, &counted) < 0)
+	return -1;
+
+    if (stored == counted)
+	return 0;
+
+    CassStatement* stmt =
+	cassandra_statement_new(context,
+				context->statements[CASSANDRA_COUNT_ADD], 2);
+    if (stmt == 0)
+	return -1;
+    cass_statement_bind_int64(stmt, 0, stored - counted);
+    cass_statement_bind_int32(stmt, 1, 0);
+
+    CassFuture* future = cass_session_execute(context->session, stmt);
+    cass_statement_free(stmt);
+
+    int ret = 0;
+    if (cass_future_error_code(future) != CASS_OK) {
+	cassandra_report_error(future);
+	ret = -1;
+    }
+    cass_future_free(future);
+
+    return ret;
+
+}
+
+/* Migrates the keyspace to CASSANDRA_SCHEMA_VERSION and creates the
+   tables in needed which it lacks.  Called with the schema guard held
+   and the schema just read. */
+static int
+cassandra_schema_migrate(librdf_storage_cassandra_instance* context,
+			 const cassandra_schema* schema, unsigned long needed)
+{
+
+    int version;
+    for(version = schema->version; version < CASSANDRA_SCHEMA_VERSION;
+	version++)
+	if (cassandra_migrations[version](context, schema) < 0) {
+	    fprintf(stderr, "Cassandra: couldn't migrate the keyspace from "
+		    "schema version %d\n", version);
+	    return -1;
+	}
+
+    char value[32];
+
+    /* Recorded before the tables which make the keyspace an existing
+       one are created, for other clients to find. */
+    int encoding = cassandra_schema_encoding(context, schema);
+    if (encoding < 0 && context->compress_literals) {
+	snprintf(value, sizeof(value), "%lu",
+		 (unsigned long) context->compress_literals);
+	if (cassandra_property_put(context, "compress-literals", value) < 0)
+	    return -1;
+    }
+    if (encoding < 0 &&
+	(cassandra_property_put(context, "sortable-literals",
+				context->sortable ? "1" : "0") < 0 ||
+	 cassandra_property_put(context, "layout",
+				cassandra_layout_name(context)) < 0 ||
+	 cassandra_property_put(context, "bucketed",
+				context->max_buckets ? "1" : "0") < 0))
+	return -1;
+
+    const char* type = context->compact ? "blob" : "text";
+    char query[1024];
+
+    int t;
+    for(t = 0; t < CASSANDRA_NUM_TABLES; t++) {
+
+	unsigned long bit = CASSANDRA_TABLE_BIT(t);
+	const char* options = context->table_options[t];
+
+	if (needed & ~schema->tables & bit) {
+	    int len = snprintf(query, sizeof(query), cassandra_tables[t][1],
+			       type, type, type, type);
+	    if (options)
+		snprintf(query + len - 1, sizeof(query) - len + 1,
+			 " WITH %s;", options);
+	} else if (schema->alter & bit)
+	    snprintf(query, sizeof(query), "ALTER TABLE rdf.%s WITH %s;",
+		     cassandra_tables[t][0], options);
+	else
+	    continue;
+
+	if (cassandra_execute_ddl(context, query) < 0)
+	    return -1;
+
+	if (options) {
+	    char name[64];
+	    snprintf(name, sizeof(name), "table-options.%s",
+		     cassandra_tables[t][0]);
+	    if (cassandra_property_put(context, name, options) < 0)
+		return -1;
+	}
+
+    }
+
+    if (schema->counter < 0) {
+	if (context->size_mode == CASSANDRA_SIZE_COUNTER &&
+	    cassandra_count_start(context) < 0)
+	    return -1;
+	if (cassandra_property_put(context, "size-counter",
+				   (context->size_mode ==
+				    CASSANDRA_SIZE_COUNTER) ? "1" : "0") < 0)
+	    return -1;
+    }
+
+    /* Written last, as the sign to waiting clients that all is done. */
+    snprintf(value, sizeof(value), "%d", CASSANDRA_SCHEMA_VERSION);
+    return cassandra_property_put(context, "schema-version", value);
+
+}
+
+/* Brings the keyspace's schema up to date for the storage's options.
+   The keyspace and rdf.properties are created by whichever client gets
+   there first.  Beyond that, one client at a time creates and migrates
+   tables, behind the schema guard, while others wait for it and read
+   the schema again.  The driver waits for schema agreement after each
+   statement. */
+static int
+cassandra_schema_update(librdf_storage_cassandra_instance* context,
+			cassandra_schema* schema, unsigned long* needed,
+			int* namespaces)
+{
+
+    /* The replication and table settings only apply to what is
+       created here. */
+    if (schema->tables == 0) {
+	char query[512];
+	snprintf(query, sizeof(query),
+		 "CREATE KEYSPACE IF NOT EXISTS rdf WITH replication = %s;",
+		 context->replication);
+	if (cassandra_execute_ddl(context, query) < 0)
+	    return -1;
+    }
+
+    if (!(schema->tables & CASSANDRA_TABLE_BIT(CASSANDRA_TABLE_PROPERTIES))) {
+	if (cassandra_execute_ddl(context,
+				  cassandra_tables[CASSANDRA_TABLE_PROPERTIES][1])
+	    < 0)
+	    return -1;
+    }
+
+    /* Tells this open's guard apart from any other client's. */
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    char owner[64];
+    snprintf(owner, sizeof(owner), "%lx.%lx.%lx", (unsigned long) now.tv_sec,
+	     (unsigned long) now.tv_nsec, (unsigned long) (uintptr_t) context);
+
+    time_t start = time(0);
+
+    for(;;) {
+
+	int locked = cassandra_schema_lock(context, owner);
+	if (locked < 0)
+	    return -1;
+
+	/* Read again, as another client may have finished meanwhile. */
+	int update = -1;
+	if (cassandra_schema_read(context, schema) == 0)
+	    update = cassandra_schema_settle(context, schema, needed,
+					     namespaces);
+
+	if (locked) {
+	    if (update > 0)
+		update = cassandra_schema_migrate(context, schema, *needed);
+	    cassandra_schema_unlock(context, owner);
+	    return (update < 0) ? -1 : 0;
+	}
+
+	if (update <= 0)
+	    return update;
+
+	if (time(0) - start > CASSANDRA_SCHEMA_WAIT) {
+	    fprintf(stderr, "Cassandra: gave up waiting for another client "
+		    "to update the schema\n");
+	    return -1;
+	}
+
+	struct timespec pause = { 0, 250000000 };
+	nanosleep(&pause, 0);
+
+    }
+
+}
+
+static int
+librdf_storage_cassandra_open(librdf_storage* storage, librdf_model* model)
+{
+
+    librdf_storage_cassandra_instance* context;
+
+    context = (librdf_storage_cassandra_instance*)storage->instance;
+
+    /* The storage keeps nothing of the model it is opened for. */
+    (void) model;
+
+    /* Schema changes are only made when the keyspace lacks something
+       this storage needs. */
+    cassandra_schema schema;
+    unsigned long needed;
+    int namespaces;
+
+    if (cassandra_schema_read(context, &schema) < 0)
+	return -1;
+
+    int update = cassandra_schema_settle(context, &schema, &needed,
+					 &namespaces);
+    if (update < 0)
+	return -1;
+
+    if (update > 0 &&
+	cassandra_schema_update(context, &schema, &needed, &namespaces) < 0)
+	return -1;
+
+    if (namespaces) {
+	context->namespace_dict =
+	    cassandra_dict_create(CASSANDRA_MAX_NAMESPACES);
+	if (context->namespace_dict == 0)
+	    return -1;
+    } else {
+	context->statements[CASSANDRA_NAMESPACES_ALL] = 0;
+	context->statements[CASSANDRA_NAMESPACE_PUT] = 0;
+	context->statements[CASSANDRA_NAMESPACE_GET] = 0;
+    }
+
+    if (cassandra_prepare_all(context) < 0)
+	return -1;
+
+    if (context->max_buckets && cassandra_buckets_load(context) < 0)
+	return -1;
+
+    if (context->namespace_dict && cassandra_namespaces_load(context) < 0)
+	return -1;
+
+    return 0;
+
+}
+
+
+/**
+ * librdf_storage_cassandra_close:
+ * @storage: the storage
+ *
+ * Close the cassandra storage.
+ * 
+ * Return value: non 0 on failure
+ **/
+static int
+librdf_storage_cassandra_close(librdf_storage* storage)
+{
+
+    librdf_storage_cassandra_instance* context;
+    context = (librdf_storage_cassandra_instance*)storage->instance;
+
+    /* The session is kept for other instances, and released when the
+       storage is freed. */
+    cassandra_free_prepared(context);
+
+    return 0;
+
+}
+
+/* Estimates a table's rows and partitions from the server's partition
+   size estimates.  The coordinator only holds estimates for its own token
+   ranges, so these are scaled up to the whole ring. */
+static int
+cassandra_table_estimate(librdf_storage_cassandra_instance* context,
+			 index_type index, int64_t* rows, int64_t* partitions)
+{
+
+    char table[20];
+    cassandra_table_name(context, index, table);
+
+    CassStatement* stmt = cassandra_bind(context, CASSANDRA_ESTIMATE);
+    if (stmt == 0)
+	return -1;
+    cass_statement_bind_string(stmt, 0, table);
+
+    const CassResult* result =
+	cassandra_dict_execute(context, CASSANDRA_ESTIMATE, stmt);
+    if (result == 0)
+	return -1;
+
+    double bytes = 0;
+    double count = 0;
+    double ring = 0;
+
+    CassIterator* iter = cass_iterator_from_result(result);
+    while (cass_iterator_next(iter)) {
+
+	const CassRow* row = cass_iterator_get_row(iter);
+	const char* start;
+	const char* end;
+	size_t len;
+	int64_t n = 0;
+	int64_t mean = 0;
+	char buf[32];
+
+	cass_value_get_string(cass_row_get_column(row, 0), &start, &len);
+	snprintf(buf, sizeof(buf), "%.*s", (int) len, start);
+	int64_t lower = strtoll(buf, 0, 10);
+	cass_value_get_string(cass_row_get_column(row, 1), &end, &len);
+	snprintf(buf, sizeof(buf), "%.*s", (int) len, end);
+	int64_t upper = strtoll(buf, 0, 10);
+
+	cass_value_get_int64(cass_row_get_column(row, 2), &n);
+	cass_value_get_int64(cass_row_get_column(row, 3), &mean);
+
+	/* Ranges may wrap around the end of the ring. */
+	ring += (double) ((uint64_t) upper - (uint64_t) lower);
+	bytes += (double) n * (double) mean;
+	count += (double) n;
+
+    }
+    cass_iterator_free(iter);
+
+    cass_result_free(result);
+
+    double scale = (ring > 0) ? 18446744073709551616.0 / ring : 0;
+
+    *rows = (int64_t) (bytes * scale / CASSANDRA_ESTIMATE_ROW_BYTES);
+    *partitions = (int64_t) (count * scale);
+
+    return 0;
+
+}
+
+/* Returns the number of triples stored, or -1 on error. */
+static int64_t
+cassandra_size_stored(librdf_storage_cassandra_instance* context)
+{
+
+    int64_t count = 0;
+
+    if (context->size_mode == CASSANDRA_SIZE_ESTIMATE) {
+	int64_t partitions;
+	if (cassandra_table_estimate(context, SPO, &count, &partitions) < 0)
+	    return -1;
+	return count;
+    }
+
+    cassandra_statement_id id = CASSANDRA_COUNT;
+    if (context->size_mode == CASSANDRA_SIZE_COUNTER)
+	id = CASSANDRA_COUNT_READ;
+
+    CassStatement* stmt = cassandra_bind(context, id);
+    if (stmt == 0)
+	return -1;
+
+    CassFuture* future = cassandra_execute(context, id, stmt);
+
+    cass_statement_free(stmt);
+
+    if (cass_future_error_code(future) != CASS_OK) {
+	cassandra_report_error(future);
+	cass_future_free(future);
+	return -1;
+    }
+
+    const CassResult* result = cass_future_get_result(future);
+
+    cass_future_free(future);
+
+    /* Counter shards are summed. */
+    CassIterator* iter = cass_iterator_from_result(result);
+    while (cass_iterator_next(iter)) {
+	int64_t value = 0;
+	cass_value_get_int64(cass_row_get_column(cass_iterator_get_row(iter),
+						 0), &value);
+	count += value;
+    }
+    cass_iterator_free(iter);
+
+    cass_result_free(result);
+
+    return count;
+
+}
+
+/* Returns how much the transaction changes the number of triples
+   stored: its adds which aren't stored, less its removals which are. */
+static int64_t
+cassandra_transaction_delta(librdf_storage_cassandra_instance* context)
+{
+
+    int count = cassandra_writes_count(context->transaction);
+    int adds = 0, removes = 0;
+    int i;
+
+    if (count == 0)
+	return 0;
+
+    /* Adds from the front, removals from the back. */
+    cassandra_triple* triples =
+	LIBRDF_MALLOC(cassandra_triple*, count * sizeof(cassandra_triple));
+    if (!triples)
+	return 0;
+
+    for(i = 0; i < count; i++) {
+	const char* s;
+	const char* p;
+	const char* o;
+	const char* c;
+	int add = cassandra_writes_at(context->transaction, i, &s, &p, &o,
+				      &c);
+	cassandra_triple* t =
+	    add ? &triples[adds++] : &triples[count - ++removes];
+	t->s = (char*) s;
+	t->p = (char*) p;
+	t->o = (char*) o;
+	t->c = (char*) c;
+    }
+
+    int added = cassandra_count_new(context, triples, adds);
+    int missing = cassandra_count_new(context, triples + adds, removes);
+
+    LIBRDF_FREE(cassandra_triple*, triples);
+
+    if (added < 0 || missing < 0)
+	return 0;
+
+    return (int64_t) added - (removes - missing);
+
+}
+
+static int
+librdf_storage_cassandra_size(librdf_storage* storage)
+{
+    
+    librdf_storage_cassandra_instance* context;
+    context = (librdf_storage_cassandra_instance*)storage->instance;
+
+    int64_t count = cassandra_size_stored(context);
+    if (count < 0)
+	return 0;
+
+    if (context->transaction)
+	count += cassandra_transaction_delta(context);
+
+    if (count < 0)
+	return 0;
+
+    if (count > INT_MAX)
+	return INT_MAX;
+
+    return (int) count;
+	
+}
+
+static int
+librdf_storage_cassandra_add_statement(librdf_storage* storage, 
+                                    librdf_statement* statement)
+{
+    return librdf_storage_cassandra_context_add_statement(storage, NULL, statement);
+}
+
+
+static int
+librdf_storage_cassandra_add_statements(librdf_storage* storage,
+                                     librdf_stream* statement_stream)
+{
+
+
+    librdf_storage_cassandra_instance* context;
+    context = (librdf_storage_cassandra_instance*)storage->instance;
+
+#ifdef HAVE_PTHREAD_H
+    if (context->load_threads > 0 && context->transaction == 0)
+	return cassandra_add_statements_pipelined(context, statement_stream);
+#endif
+
+    int ret = 0;
+
+    for(; !librdf_stream_end(statement_stream);
+	librdf_stream_next(statement_stream)) {
+
+	librdf_statement* statement;
+	librdf_node* context_node;
+
+	statement = librdf_stream_get_object(statement_stream);
+	context_node = librdf_stream_get_context2(statement_stream);
+
+	if(!statement) {
+	    break;
+	}
+
+	char* s;
+	char* p;
+	char* o;
+	char* c;
+	statement_helper(storage, statement, context_node, &s, &p, &o, &c, 0);
+
+	if (context->transaction) {
+	    ret = cassandra_transaction_put(context, s, p, o, c, 1);
+	    free(s);
+	    free(p);
+	    free(o);
+	    free(c);
+	    if (ret < 0)
+		break;
+	    continue;
+	}
+
+	if (cassandra_write_queue(context, s, p, o, c) < 0) {
+	    ret = -1;
+	    break;
+	}
+
+    }
+
+    if (context->transaction)
+	return ret;
+
+    if (cassandra_write_flush(context) < 0)
+	ret = -1;
+
+    if (cassandra_write_drain(context) < 0)
+	ret = -1;
+
+    return ret;
+
+}
+
+
+static int
+librdf_storage_cassandra_remove_statement(librdf_storage* storage,
+                                       librdf_statement* statement)
+{
+    return librdf_storage_cassandra_context_remove_statement(storage, NULL, 
+							  statement);
+}
+
+static int
+librdf_storage_cassandra_contains_statement(librdf_storage* storage, 
+                                         librdf_statement* statement)
+{
+    return librdf_storage_cassandra_context_contains_statement(storage, NULL,
+							    statement);
+}
+
+
+/* Looks up one triple by its spo primary key, unless the Bloom filter
+   can rule it out first.  In the quads layout, c picks one context,
+   else the triple may be in any. */
+static int
+cassandra_contains(librdf_storage_cassandra_instance* context,
+		   const char* s, const char* p, const char* o, const char* c)
+{
+
+    if (context->bloom && context->bloom_ready &&
+	!cassandra_bloom_check(context->bloom, cassandra_triple_hash(s, p, o)))
+	return 0;
+
+    cassandra_statement_id id = c ? CASSANDRA_CONTAINS_QUAD :
+	CASSANDRA_CONTAINS;
+
+    CassStatement* stmt = cassandra_bind(context, id);
+    if (stmt == 0)
+	return -1;
+
+    if (c)
+	cassandra_bind_context(context, stmt, 3, c);
+
+    /* A term missing from the dictionary can't be in any triple. */
+    int missing = cassandra_bind_term(context, stmt, 0, s, 0);
+    if (!missing)
+	missing = cassandra_bind_term(context, stmt, 1, p, 0);
+    if (!missing)
+	missing = cassandra_bind_term(context, stmt, 2, o, 0);
+    if (missing) {
+	cass_statement_free(stmt);
+	return (missing > 0) ? 0 : -1;
+    }
+
+    const CassResult* result = cassandra_dict_execute(context, id, stmt);
+    if (result == 0)
+	return -1;
+
+    int found = (cass_result_row_count(result) > 0);
+
+    cass_result_free(result);
+
+    return found;
+
+}
+
+static int
+librdf_storage_cassandra_context_contains_statement(librdf_storage* storage,
+                                                 librdf_node* context_node,
+                                                 librdf_statement* statement)
+{
+
+    librdf_storage_cassandra_instance* context;
+    context = (librdf_storage_cassandra_instance*)storage->instance;
+
+    char* s;
+    char* p;
+    char* o;
+    char* c;
+
+    statement_helper(storage, statement, context_node, &s, &p, &o, &c, 1);
+
+    /* A partial statement is matched by finding it, and so is a triple
+       in any context while a transaction may have written it in
+       several. */
+    if (!s || !p || !o || (context->quads && context->transaction && !c)) {
+	if (s) free(s);
+	if (p) free(p);
+	if (o) free(o);
+	if (c) free(c);
+	librdf_stream* stream =
+	    librdf_storage_cassandra_find_statements(storage, statement);
+	if (stream == 0)
+	    return -1;
+	int found = !librdf_stream_end(stream);
+	librdf_free_stream(stream);
+	return found;
+    }
+
+    /* The transaction's writes come before what is stored. */
+    int ret = -1;
+    if (context->transaction)
+	ret = cassandra_writes_get(context->transaction, s, p, o, c);
+    if (ret < 0)
+	ret = cassandra_contains(context, s, p, o, c);
+
+    free(s);
+    free(p);
+    free(o);
+    free(c);
+
+    return ret;
+
+}
+
+typedef struct {
+    
+    librdf_storage *storage;
+    librdf_storage_cassandra_instance* cassandra_context;
+
+    librdf_statement *statement;
+    librdf_node* context;
+
+    cassandra_statement_id id;
+    CassStatement* stmt;
+    const CassResult* result;
+    CassIterator* iter;
+
+    /* Pages received ahead of the one being read, oldest first, in a
+       ring of prefetch entries.  Each page request needs the paging
+       state of the page before, so there is at most one request in
+       flight, and last is the newest page received.  The ring has room
+       for at least one page even when prefetching is off. */
+    const CassResult** pages;
+    int pages_size;
+    int prefetch;
+    int pages_head;
+    int pages_count;
+    CassFuture* fetching;
+    const CassResult* last;
+
+    int more_pages;
+    int at_end;
+
+    /* A find with no terms bound feeds every row to the Bloom filter,
+       which becomes usable if the stream is read to the end. */
+    int full_scan;
+    int failed;
+
+} cassandra_results_stream;
+
+/* Makes the node of a URI written as a namespace id and the rest of the
+   URI.  An id this client doesn't know was given out since it last read
+   rdf.namespaces, so it reads them again. */
+static librdf_node*
+cassandra_namespace_node(librdf_storage_cassandra_instance* context,
+			 size_t id, const unsigned char* rest, size_t len)
+{
+
+    char buf[CASSANDRA_TERM_BUFFER];
+    char* uri = buf;
+    const char* ns;
+    size_t ns_len = 0;
+
+    cassandra_namespace_lock(context);
+
+    ns = cassandra_dict_get_term(context->namespace_dict, id, &ns_len);
+    if (ns == 0 && cassandra_namespaces_load(context) == 0)
+	ns = cassandra_dict_get_term(context->namespace_dict, id, &ns_len);
+
+    if (ns && ns_len + len > sizeof(buf))
+	uri = malloc(ns_len + len);
+    if (ns && uri) {
+	memcpy(uri, ns, ns_len);
+	memcpy(uri + ns_len, rest, len);
+    }
+
+    cassandra_namespace_unlock(context);
+
+    librdf_node* node = 0;
+
+    if (ns == 0)
+	fprintf(stderr, "Cassandra: unknown namespace id %d\n", (int) id);
+    else if (uri)
+	node = librdf_new_node_from_counted_uri_string(context->storage->world,
+						       (unsigned char*) uri,
+						       ns_len + len);
+
+    if (uri != buf)
+	free(uri);
+
+    return node;
+
+}
+
+/* Decompresses the len bytes of a compressed literal's text into a new
+   buffer of text_len bytes, or returns 0 if they are not valid. */
+static unsigned char*
+cassandra_literal_inflate(const unsigned char* p, size_t len,
+			  size_t text_len)
+{
+
+    /* No block expands by more than 255 times. */
+    if (text_len / 256 > len)
+	return 0;
+
+    unsigned char* packed = malloc(len ? len : 1);
+    unsigned char* text = malloc(text_len ? text_len : 1);
+
+    size_t packed_len = (packed && text) ?
+	cassandra_unescape(p, len, packed) : 0;
+
+    if (packed_len == 0 ||
+	cassandra_lz_decompress(packed, packed_len, text, text_len) < 0) {
+	free(packed);
+	free(text);
+	return 0;
+    }
+
+    free(packed);
+
+    return text;
+
+}
+
+/* Decodes a term of the compact encoding, in place, but for compressed
+   text, which is only decompressed here as the node is made. */
+static
+librdf_node* node_decode_compact(librdf_storage_cassandra_instance* context,
+				 const unsigned char* t, size_t len)
+{
+
+    librdf_world* world = context->storage->world;
+    const unsigned char* end = t + len;
+    const unsigned char* p = t + 1;
+    const unsigned char* lang = 0;
+    size_t text_len, lang_len = 0, n;
+    librdf_uri* dt = 0;
+    librdf_uri* named = 0;
+    unsigned char tag = t[0];
+
+    /* A compressed literal is tagged with its own tag as well. */
+    int compressed = (tag == CASSANDRA_TAG_COMPRESSED);
+    if (compressed) {
+	tag = (len > 1) ? t[1] : 0;
+	if (tag != CASSANDRA_TAG_PLAIN && tag != CASSANDRA_TAG_LANGUAGE &&
+	    tag != CASSANDRA_TAG_TYPED)
+	    tag = 0;
+	p++;
+    }
+
+    /* A sortable literal's key is only for ordering. */
+    if (tag >= CASSANDRA_TAG_INTEGER && tag <= CASSANDRA_TAG_DATETIME)
+	p += CASSANDRA_SORT_KEY;
+
+    p = (p < end) ? cassandra_varint_get(p, end, &text_len) : 0;
+
+    switch(tag) {
+
+    case CASSANDRA_TAG_URI:
+    case CASSANDRA_TAG_BLANK:
+    case CASSANDRA_TAG_PLAIN:
+	break;
+
+    case CASSANDRA_TAG_NAMESPACE:
+	if (p && context->namespace_dict)
+	    p = cassandra_varint_get(p, end, &n);
+	else
+	    p = 0;
+	break;
+
+    case CASSANDRA_TAG_LANGUAGE:
+	if (p)
+	    p = cassandra_varint_get(p, end, &lang_len);
+	if (p && lang_len <= (size_t) (end - p)) {
+	    lang = p;
+	    p += lang_len;
+	} else
+	    p = 0;
+	break;
+
+    case CASSANDRA_TAG_TYPED:
+	if (p)
+	    p = cassandra_varint_get(p, end, &n);
+	if (p && n > 0 && n <= CASSANDRA_NUM_DATATYPES)
+	    dt = context->datatypes[n - 1];
+	else if (p && n == 0) {
+	    size_t dt_len;
+	    p = cassandra_varint_get(p, end, &dt_len);
+	    if (p && dt_len <= (size_t) (end - p))
+		dt = named = librdf_new_uri2(world, p, dt_len);
+	    p = dt ? p + dt_len : 0;
+	} else
+	    p = 0;
+	break;
+
+    case CASSANDRA_TAG_INTEGER:
+	dt = context->datatypes[CASSANDRA_XSD_INTEGER];
+	break;
+
+    case CASSANDRA_TAG_FLOAT:
+	dt = context->datatypes[CASSANDRA_XSD_FLOAT];
+	break;
+
+    case CASSANDRA_TAG_DATETIME:
+	dt = context->datatypes[CASSANDRA_XSD_DATETIME];
+	break;
+
+    default:
+	p = 0;
+
+    }
+
+    unsigned char* text = 0;
+    if (p && compressed) {
+	text = cassandra_literal_inflate(p, end - p, text_len);
+	p = text;
+    }
+
+    if (p == 0 || (!compressed && text_len != (size_t) (end - p))) {
+	if (named)
+	    librdf_free_uri(named);
+	fprintf(stderr, "node_constructor_helper called on invalid term\n");
+	return 0;
+    }
+
+    librdf_node* node;
+
+    if (t[0] == CASSANDRA_TAG_NAMESPACE)
+	node = cassandra_namespace_node(context, n, p, text_len);
+    else if (t[0] == CASSANDRA_TAG_URI)
+	node = librdf_new_node_from_counted_uri_string(world, p, text_len);
+    else if (t[0] == CASSANDRA_TAG_BLANK)
+	node = librdf_new_node_from_counted_blank_identifier(world, p,
+							     text_len);
+    else
+	node = librdf_new_node_from_typed_counted_literal(world, p, text_len,
+							  (const char*) lang,
+							  lang_len, dt);
+
+    /* The node holds its own reference to the datatype. */
+    if (named)
+	librdf_free_uri(named);
+
+    free(text);
+
+    return node;
+
+}
+
+/* Decodes a term as stored by term_encode, in either encoding.  t is
+   len bytes, and need not be NUL-terminated. */
+static
+librdf_node* node_decode(librdf_storage_cassandra_instance* context,
+			 const char* t, size_t len)
+{
+
+    librdf_world* world = context->storage->world;
+    const unsigned char* v = (const unsigned char*) t + 2;
+    librdf_uri* dt = 0;
+
+    if (len > 0 && CASSANDRA_TAG_VERSION(t[0]) == 1)
+	return node_decode_compact(context, (const unsigned char*) t, len);
+
+    if ((len < 2) || (t[1] != ':')) {
+	fprintf(stderr, "node_constructor_helper called on invalid term\n");
+	return 0;
+    }
+
+    /* A sortable encoding's key comes before the text. */
+    if (t[0] == 'I' || t[0] == 'F' || t[0] == 'D') {
+	if ((len < CASSANDRA_SORT_PREFIX) ||
+	    (t[CASSANDRA_SORT_PREFIX - 1] != ':')) {
+	    fprintf(stderr, "node_constructor_helper called on invalid term\n");
+	    return 0;
+	}
+	v += CASSANDRA_SORT_PREFIX - 2;
+	len -= CASSANDRA_SORT_PREFIX - 2;
+    }
+
+    switch (t[0]) {
+    case 'u':
+	return librdf_new_node_from_counted_uri_string(world, v, len - 2);
+    case 'b':
+	return librdf_new_node_from_counted_blank_identifier(world, v,
+							     len - 2);
+    case 'i':
+    case 'I':
+	dt = context->datatypes[CASSANDRA_XSD_INTEGER];
+	break;
+    case 'f':
+    case 'F':
+	dt = context->datatypes[CASSANDRA_XSD_FLOAT];
+	break;
+    case 'd':
+    case 'D':
+	dt = context->datatypes[CASSANDRA_XSD_DATETIME];
+	break;
+    }
+
+    return librdf_new_node_from_typed_counted_literal(world, v, len - 2,
+						      0, 0, dt);
+
+}
+
+/* Returns a new node for an encoded term, shared with earlier results
+   through the node cache.  Result pages repeat the same terms heavily,
+   so most rows are served by copying a cached node. */
+static
+librdf_node* node_constructor_helper(librdf_storage_cassandra_instance* context,
+				     const char* t, size_t len)
+{
+
+    if (context->nodes == 0)
+	return node_decode(context, t, len);
+
+    librdf_node* node = cassandra_cache_get(context->nodes, t, len);
+    if (node)
+	return librdf_new_node_from_node(node);
+
+    node = node_decode(context, t, len);
+    if (node == 0)
+	return 0;
+
+    if (cassandra_cache_put(context->nodes, t, len, node,
+			    len + CASSANDRA_NODE_COST))
+	return node;
+
+    return librdf_new_node_from_node(node);
+
+}
+
+/* Builds the statement held in an s, p, o result row. */
+static librdf_statement*
+cassandra_row_statement(librdf_storage_cassandra_instance* context,
+			const CassRow* row)
+{
+
+    const char* s;
+    size_t s_len;
+    const char* p;
+    size_t p_len;
+    const char* o;
+    size_t o_len;
+
+    /* Each node is built before the next term is fetched, as a fetch
+       can evict the previous term from the dictionary cache. */
+    librdf_node* sn = 0, * pn = 0, * on = 0;
+    if (cassandra_row_term(context, row, 0, &s, &s_len) == 0)
+	sn = node_constructor_helper(context, s, s_len);
+    if (cassandra_row_term(context, row, 1, &p, &p_len) == 0)
+	pn = node_constructor_helper(context, p, p_len);
+    if (cassandra_row_term(context, row, 2, &o, &o_len) == 0)
+	on = node_constructor_helper(context, o, o_len);
+
+    if (sn == 0 || pn == 0 || on == 0) {
+	if (sn) librdf_free_node(sn);
+	if (pn) librdf_free_node(pn);
+	if (on) librdf_free_node(on);
+	return 0;
+    }
+
+    return librdf_new_statement_from_nodes(context->storage->world,
+					   sn, pn, on);
+
+}
+
+/* Builds the context node of a result row in the quads layout, whose
+   fourth column is c, or returns 0 for a triple in no context. */
+static librdf_node*
+cassandra_row_context(librdf_storage_cassandra_instance* context,
+		      const CassRow* row)
+{
+
+    const char* c;
+    size_t c_len;
+
+    if (!context->quads)
+	return 0;
+
+    if (cassandra_row_term(context, row, 3, &c, &c_len) < 0 || c_len == 0)
+	return 0;
+
+    return node_constructor_helper(context, c, c_len);
+
+}
+
+/* Requests the page after the newest one received, if there is one and
+   there is room to hold it.  Force requests it even if prefetching is
+   off, for a reader who has run out of rows. */
+static int
+cassandra_results_stream_fetch(cassandra_results_stream* scontext, int force)
+{
+
+    if (scontext->fetching || !scontext->more_pages)
+	return 0;
+
+    if (!force && scontext->pages_count >= scontext->prefetch)
+	return 0;
+
+    CassError rc = cass_statement_set_paging_state(scontext->stmt,
+						   scontext->last);
+    if (rc != CASS_OK) {
+	fprintf(stderr, "Cassandra: %s\n", cass_error_desc(rc));
+	return -1;
+    }
+
+    scontext->fetching =
+	cass_session_execute(scontext->cassandra_context->session,
+			     scontext->stmt);
+
+    /* Nothing more can be learnt until this page arrives. */
+    scontext->more_pages = 0;
+
+    return 0;
+
+}
+
+/* Collects the page in flight if it has arrived, or waits for it if
+   wait is set, and requests the next one straight away. */
+static int
+cassandra_results_stream_poll(cassandra_results_stream* scontext, int wait)
+{
+
+    CassFuture* future = scontext->fetching;
+
+    if (future == 0)
+	return 0;
+
+    if (!wait && !cass_future_ready(future))
+	return 0;
+
+    scontext->fetching = 0;
+
+    if (cassandra_reprepare(scontext->cassandra_context, scontext->id,
+			    future)) {
+	cass_future_free(future);
+	future = cass_session_execute(scontext->cassandra_context->session,
+				      scontext->stmt);
+    }
+
+    if (cass_future_error_code(future) != CASS_OK) {
+	cassandra_report_error(future);
+	cass_future_free(future);
+	return -1;
+    }
+
+    const CassResult* result = cass_future_get_result(future);
+
+    cass_future_free(future);
+
+    if (cassandra_resolve_page(scontext->cassandra_context, result) < 0) {
+	cass_result_free(result);
+	return -1;
+    }
+
+    int slot = (scontext->pages_head + scontext->pages_count) %
+	scontext->pages_size;
+    scontext->pages[slot] = result;
+    scontext->pages_count++;
+
+    scontext->last = result;
+    scontext->more_pages = cass_result_has_more_pages(result);
+
+    return cassandra_results_stream_fetch(scontext, 0);
+
+}
+
+/* When the current page is used up, moves on to the next page with any
+   rows, waiting for it if it hasn't arrived. */
+static int
+cassandra_results_stream_next_page(cassandra_results_stream* scontext)
+{
+
+    while (scontext->at_end) {
+
+	if (scontext->pages_count == 0) {
+	    if (cassandra_results_stream_fetch(scontext, 1) < 0)
+		return -1;
+	    if (scontext->fetching == 0) {
+		if (scontext->full_scan && !scontext->failed)
+		    scontext->cassandra_context->bloom_ready = 1;
+		return 0;
+	    }
+	    if (cassandra_results_stream_poll(scontext, 1) < 0)
+		return -1;
+	}
+
+	cass_iterator_free(scontext->iter);
+	cass_result_free(scontext->result);
+
+	scontext->result = scontext->pages[scontext->pages_head];
+	scontext->pages_head = (scontext->pages_head + 1) % scontext->pages_size;
+	scontext->pages_count--;
+
+	if (scontext->full_scan &&
+	    cassandra_bloom_add_page(scontext->cassandra_context,
+				     scontext->result) < 0)
+	    return -1;
+
+	scontext->iter = cass_iterator_from_result(scontext->result);
+	scontext->at_end = !cass_iterator_next(scontext->iter);
+
+	/* A slot has come free. */
+	if (cassandra_results_stream_fetch(scontext, 0) < 0)
+	    return -1;
+
+    }
+
+    return 0;
+
+}
+
+static int
+cassandra_results_stream_end_of_stream(void* context)
+{
+
+    cassandra_results_stream* scontext;
+    scontext = (cassandra_results_stream*)context;
+
+    if (cassandra_results_stream_next_page(scontext) < 0) {
+	scontext->failed = 1;
+	return 1;
+    }
+
+    return (scontext->at_end);
+
+}
+
+
+static int
+cassandra_results_stream_next_statement(void* context)
+{
+
+    cassandra_results_stream* scontext;
+    scontext = (cassandra_results_stream*)context;
+
+    if (scontext->at_end)
+	return 1;
+
+    scontext->at_end = !cass_iterator_next(scontext->iter);
+
+    if (cassandra_results_stream_next_page(scontext) < 0) {
+	scontext->failed = 1;
+	return 1;
+    }
+
+    /* Keep the next page coming while the caller works through this
+       one. */
+    if (cassandra_results_stream_poll(scontext, 0) < 0)
+	return 1;
+
+    return (scontext->at_end);
+
+}
+
+
+static void*
+cassandra_results_stream_get_statement(void* context, int flags)
+{
+
+    cassandra_results_stream* scontext;
+    const CassRow* row;
+	
+    scontext = (cassandra_results_stream*)context;
+
+    switch(flags) {
+
+    case LIBRDF_ITERATOR_GET_METHOD_GET_OBJECT:
+
+	row = cass_iterator_get_row(scontext->iter);
+
+	if (scontext->statement) {
+	    librdf_free_statement(scontext->statement);
+	    scontext->statement = 0;
+	}
+
+	scontext->statement =
+	    cassandra_row_statement(scontext->cassandra_context, row);
+
+	return scontext->statement;
+
+    case LIBRDF_ITERATOR_GET_METHOD_GET_CONTEXT:
+
+	if (scontext->context)
+	    librdf_free_node(scontext->context);
+
+	scontext->context =
+	    cassandra_row_context(scontext->cassandra_context,
+				  cass_iterator_get_row(scontext->iter));
+
+	return scontext->context;
+
+    default:
+	librdf_log(scontext->storage->world,
+		   0, LIBRDF_LOG_ERROR, LIBRDF_FROM_STORAGE, NULL,
+		   "Unknown iterator method flag %d", flags);
+	return NULL;
+    }
+    
+}
+
+static void
+cassandra_results_stream_finished(void* context)
+{
+
+    cassandra_results_stream* scontext;
+    scontext = (cassandra_results_stream*)context;
+
+    if (scontext->fetching) {
+	cass_future_wait(scontext->fetching);
+	cass_future_free(scontext->fetching);
+    }
+
+    while (scontext->pages_count > 0) {
+	cass_result_free(scontext->pages[scontext->pages_head]);
+	scontext->pages_head = (scontext->pages_head + 1) % scontext->pages_size;
+	scontext->pages_count--;
+    }
+
+    if (scontext->pages)
+	LIBRDF_FREE(const CassResult**, scontext->pages);
+
+    if (scontext->iter)
+	cass_iterator_free(scontext->iter);
+
+    if (scontext->result)
+	cass_result_free(scontext->result);
+
+    if (scontext->stmt)
+	cass_statement_free(scontext->stmt);
+	
+    if(scontext->storage)
+	librdf_storage_remove_reference(scontext->storage);
+
+    if(scontext->statement)
+	librdf_free_statement(scontext->statement);
+
+    if(scontext->context)
+	librdf_free_node(scontext->context);
+
+    LIBRDF_FREE(librdf_storage_cassandra_find_statements_stream_context, scontext);
+
+}
+
+/* Many queries read at once and merged into one stream: the token
+   ranges of a parallel full scan, the object slices of a range find, or
+   the patterns of a batched lookup.
+   Each part is read by its own paged query, up to parallelism of them at
+   once, each with one page request in flight.  Completed requests are
+   passed to the reader through a queue, so pages are read in whatever
+   order they arrive. */
+typedef struct cassandra_scan_stream_str cassandra_scan_stream;
+
+#define CASSANDRA_SCAN_TOKENS -1
+#define CASSANDRA_SCAN_SLICES -2
+
+typedef struct {
+    cassandra_scan_stream* scan;
+    int index;			/* Pattern index, for a lookup */
+    cass_int64_t lower;		/* Token range, exclusive */
+    cass_int64_t upper;		/* Inclusive */
+    char* terms[3];		/* Pattern terms, for a lookup, or the
+				   predicate and slice bounds */
+    int bucket;			/* Bucket of a bucketed partition */
+    CassStatement* stmt;
+    CassFuture* future;
+} cassandra_scan_part;
+
+struct cassandra_scan_stream_str {
+
+    librdf_storage *storage;
+    librdf_storage_cassandra_instance* cassandra_context;
+
+    librdf_statement *statement;
+
+    /* The find pattern shared by a lookup's parts, or
+       CASSANDRA_SCAN_TOKENS or CASSANDRA_SCAN_SLICES, and the statement
+       the parts are read with. */
+    int pattern;
+    cassandra_statement_id id;
+
+    cassandra_scan_part* parts;
+    int parts_count;
+    int parts_size;
+    int parts_started;
+    int parallelism;
+
+    /* Parts whose request has completed, pushed by the driver's
+       callbacks, and the number of requests still to arrive there. */
+    cassandra_queue* done;
+    int in_flight;
+
+    const CassResult* result;
+    CassIterator* iter;
+    int at_end;
+
+    /* Whether statements are tagged with their pattern's index, and the
+       index of the current page and its node, which is the row's context
+       when untagged.  In the quads layout a batched lookup's statements
+       keep their context, and the index is only had from
+       librdf_storage_cassandra_batch_index. */
+    int tagged;
+    int tag;
+    librdf_node* tag_node;
+
+    /* For a batched lookup, its stream and the next open one. */
+    librdf_stream* stream;
+    cassandra_scan_stream* next_batch;
+
+    int failed;
+
+};
+
+/* Called by the driver when a part's page arrives.  The future is the
+   part's own, which the reader collects from the part. */
+static void
+cassandra_scan_done(CassFuture* future, void* data)
+{
+    cassandra_scan_part* part = (cassandra_scan_part*) data;
+    (void) future;
+    cassandra_queue_push(part->scan->done, part);
+}
+
+/* Sends a part's query, first moving it on to the page after last if
+   that is given. */
+static int
+cassandra_scan_request(cassandra_scan_stream* scontext,
+		       cassandra_scan_part* part,
+		       const CassResult* last)
+{
+
+    if (last) {
+	CassError rc = cass_statement_set_paging_state(part->stmt, last);
+	if (rc != CASS_OK) {
+	    fprintf(stderr, "Cassandra: %s\n", cass_error_desc(rc));
+	    return -1;
+	}
+    }
+
+    part->future =
+	cass_session_execute(scontext->cassandra_context->session,
+			     part->stmt);
+    scontext->in_flight++;
+    cass_future_set_callback(part->future, &cassandra_scan_done, part);
+
+    return 0;
+
+}
+
+/* Starts reading the next part not yet started, if there is one. */
+static int
+cassandra_scan_start(cassandra_scan_stream* scontext)
+{
+
+    librdf_storage_cassandra_instance* context = scontext->cassandra_context;
+
+    if (scontext->parts_started == scontext->parts_count)
+	return 0;
+
+    cassandra_scan_part* part = &scontext->parts[scontext->parts_started];
+
+    if (scontext->pattern == CASSANDRA_SCAN_TOKENS) {
+	part->stmt = cassandra_bind(scontext->cassandra_context,
+				    CASSANDRA_SCAN);
+	if (part->stmt == 0)
+	    return -1;
+	cass_statement_bind_int64(part->stmt, 0, part->lower);
+	cass_statement_bind_int64(part->stmt, 1, part->upper);
+    } else if (scontext->pattern == CASSANDRA_SCAN_SLICES) {
+	int k = 0;
+	part->stmt = cassandra_bind(scontext->cassandra_context,
+				    CASSANDRA_RANGE);
+	if (part->stmt == 0)
+	    return -1;
+	cassandra_bind_term(context, part->stmt, k++, part->terms[1], 0);
+	if (cassandra_bucketed(context, POS))
+	    cass_statement_bind_int32(part->stmt, k++, part->bucket);
+	cassandra_bind_encoded(context, part->stmt, k, part->terms[0],
+			       strlen(part->terms[0]));
+	cassandra_bind_encoded(context, part->stmt, k + 1, part->terms[2],
+			       strlen(part->terms[2]));
+    } else {
+	part->stmt = cassandra_query(scontext->cassandra_context,
+				     scontext->pattern, part->terms[0],
+				     part->terms[1], part->terms[2],
+				     part->bucket);
+	if (part->stmt == 0)
+	    return -1;
+    }
+
+    cass_statement_set_paging_size(part->stmt, CASSANDRA_PAGE_SIZE);
+
+    scontext->parts_started++;
+
+    return cassandra_scan_request(scontext, part, 0);
+
+}
+
+/* When the current page is used up, moves on to the next page with any
+   rows from whichever part delivers one first. */
+static int
+cassandra_scan_next_page(cassandra_scan_stream* scontext)
+{
+
+    librdf_storage_cassandra_instance* context = scontext->cassandra_context;
+    int full_scan = (scontext->pattern == CASSANDRA_SCAN_TOKENS &&
+		     context->bloom);
+
+    while (scontext->at_end) {
+
+	if (scontext->iter) {
+	    cass_iterator_free(scontext->iter);
+	    scontext->iter = 0;
+	}
+	if (scontext->result) {
+	    cass_result_free(scontext->result);
+	    scontext->result = 0;
+	}
+
+	/* Every row of a full scan has been through the Bloom filter. */
+	if (scontext->in_flight == 0) {
+	    if (full_scan && !scontext->failed)
+		context->bloom_ready = 1;
+	    return 0;
+	}
+
+	void* item;
+	cassandra_queue_pop(scontext->done, &item);
+	scontext->in_flight--;
+
+	cassandra_scan_part* part = (cassandra_scan_part*) item;
+	CassFuture* future = part->future;
+	part->future = 0;
+
+	if (cassandra_reprepare(context, scontext->id, future)) {
+	    cass_future_free(future);
+	    if (cassandra_scan_request(scontext, part, 0) < 0)
+		return -1;
+	    continue;
+	}
+
+	if (cass_future_error_code(future) != CASS_OK) {
+	    cassandra_report_error(future);
+	    cass_future_free(future);
+	    return -1;
+	}
+
+	const CassResult* result = cass_future_get_result(future);
+	cass_future_free(future);
+
+	scontext->result = result;
+	scontext->tag = part->index;
+
+	if (cassandra_resolve_page(context, result) < 0)
+	    return -1;
+
+	if (full_scan && cassandra_bloom_add_page(context, result) < 0)
+	    return -1;
+
+	/* Keep the part busy while this page is read, or give its place
+	   to the next part. */
+	if (cass_result_has_more_pages(result)) {
+	    if (cassandra_scan_request(scontext, part, result) < 0)
+		return -1;
+	} else {
+	    cass_statement_free(part->stmt);
+	    part->stmt = 0;
+	    if (cassandra_scan_start(scontext) < 0)
+		return -1;
+	}
+
+	scontext->iter = cass_iterator_from_result(result);
+	scontext->at_end = !cass_iterator_next(scontext->iter);
+
+    }
+
+    return 0;
+
+}
+
+static int
+cassandra_scan_stream_end_of_stream(void* context)
+{
+
+    cassandra_scan_stream* scontext = (cassandra_scan_stream*)context;
+
+    if (cassandra_scan_next_page(scontext) < 0) {
+	scontext->failed = 1;
+	return 1;
+    }
+
+    return (scontext->at_end);
+
+}
+
+static int
+cassandra_scan_stream_next_statement(void* context)
+{
+
+    cassandra_scan_stream* scontext = (cassandra_scan_stream*)context;
+
+    if (scontext->at_end)
+	return 1;
+
+    scontext->at_end = !cass_iterator_next(scontext->iter);
+
+    if (cassandra_scan_next_page(scontext) < 0) {
+	scontext->failed = 1;
+	return 1;
+    }
+
+    return (scontext->at_end);
+
+}
+
+static void*
+cassandra_scan_stream_get_statement(void* context, int flags)
+{
+
+    cassandra_scan_stream* scontext = (cassandra_scan_stream*)context;
+    char buf[32];
+
+    switch(flags) {
+
+    case LIBRDF_ITERATOR_GET_METHOD_GET_OBJECT:
+
+	if (scontext->statement) {
+	    librdf_free_statement(scontext->statement);
+	    scontext->statement = 0;
+	}
+
+	scontext->statement =
+	    cassandra_row_statement(scontext->cassandra_context,
+				    cass_iterator_get_row(scontext->iter));
+
+	return scontext->statement;
+
+    case LIBRDF_ITERATOR_GET_METHOD_GET_CONTEXT:
+
+	if (scontext->tag_node)
+	    librdf_free_node(scontext->tag_node);
+
+	/* A batched lookup tags each statement with its pattern's
+	   index, in place of its context, unless it has one. */
+	if (!scontext->tagged || scontext->cassandra_context->quads) {
+	    scontext->tag_node =
+		cassandra_row_context(scontext->cassandra_context,
+				      cass_iterator_get_row(scontext->iter));
+	    return scontext->tag_node;
+	}
+
+	sprintf(buf, "%d", scontext->tag);
+	scontext->tag_node =
+	    librdf_new_node_from_typed_literal(scontext->storage->world,
+					       (const unsigned char*)buf,
+					       NULL, NULL);
+
+	return scontext->tag_node;
+
+    default:
+	librdf_log(scontext->storage->world,
+		   0, LIBRDF_LOG_ERROR, LIBRDF_FROM_STORAGE, NULL,
+		   "Unknown iterator method flag %d", flags);
+	return NULL;
+    }
+
+}
+
+static void
+cassandra_scan_stream_finished(void* context)
+{
+
+    cassandra_scan_stream* scontext = (cassandra_scan_stream*)context;
+
+    cassandra_scan_stream** b = &scontext->cassandra_context->batches;
+    while (*b && *b != scontext)
+	b = &(*b)->next_batch;
+    if (*b)
+	*b = scontext->next_batch;
+
+    /* The driver pushes to the queue after waking anyone waiting on a
+       future, so the queue is what has to be drained before it goes. */
+    while (scontext->in_flight > 0) {
+	void* item;
+	cassandra_queue_pop(scontext->done, &item);
+	cass_future_free(((cassandra_scan_part*) item)->future);
+	scontext->in_flight--;
+    }
+
+    if (scontext->parts) {
+	int i, j;
+	for(i = 0; i < scontext->parts_count; i++) {
+	    if (scontext->parts[i].stmt)
+		cass_statement_free(scontext->parts[i].stmt);
+	    for(j = 0; j < 3; j++)
+		if (scontext->parts[i].terms[j])
+		    free(scontext->parts[i].terms[j]);
+	}
+	LIBRDF_FREE(cassandra_scan_part*, scontext->parts);
+    }
+
+    if (scontext->done)
+	cassandra_queue_free(scontext->done);
+
+    if (scontext->iter)
+	cass_iterator_free(scontext->iter);
+
+    if (scontext->result)
+	cass_result_free(scontext->result);
+
+    if(scontext->storage)
+	librdf_storage_remove_reference(scontext->storage);
+
+    if(scontext->statement)
+	librdf_free_statement(scontext->statement);
+
+    if(scontext->tag_node)
+	librdf_free_node(scontext->tag_node);
+
+    LIBRDF_FREE(cassandra_scan_stream, scontext);
+
+}
+
+/* Allocates a stream of count parts, read parallelism at a time. */
+static cassandra_scan_stream*
+cassandra_scan_stream_alloc(librdf_storage* storage, int count,
+			    int parallelism)
+{
+
+    cassandra_scan_stream* scontext;
+
+    scontext = LIBRDF_CALLOC(cassandra_scan_stream*, 1, sizeof(*scontext));
+    if (!scontext)
+	return NULL;
+
+    scontext->storage = storage;
+    librdf_storage_add_reference(scontext->storage);
+
+    scontext->cassandra_context =
+	(librdf_storage_cassandra_instance*)storage->instance;
+
+    scontext->pattern = CASSANDRA_SCAN_TOKENS;
+    scontext->id = CASSANDRA_SCAN;
+    scontext->parallelism = parallelism;
+
+    /* Room for at least one part keeps the allocation non-empty. */
+    scontext->parts_size = (count > 0) ? count : 1;
+    scontext->parts = LIBRDF_CALLOC(cassandra_scan_part*,
+				    scontext->parts_size,
+				    sizeof(cassandra_scan_part));
+    scontext->done = cassandra_queue_create(parallelism);
+    if (!scontext->parts || !scontext->done) {
+	cassandra_scan_stream_finished((void*)scontext);
+	return NULL;
+    }
+
+    int i;
+    for(i = 0; i < count; i++)
+	scontext->parts[i].scan = scontext;
+
+    return scontext;
+
+}
+
+/* Adds a part to a stream not yet begun, growing the parts if they are
+   all used. */
+static cassandra_scan_part*
+cassandra_scan_part_add(cassandra_scan_stream* scontext)
+{
+
+    if (scontext->parts_count == scontext->parts_size) {
+
+	int size = scontext->parts_size * 2;
+	cassandra_scan_part* parts =
+	    LIBRDF_CALLOC(cassandra_scan_part*, size,
+			  sizeof(cassandra_scan_part));
+	if (parts == 0) {
+	    fprintf(stderr, "malloc failed\n");
+	    return 0;
+	}
+
+	memcpy(parts, scontext->parts,
+	       scontext->parts_count * sizeof(cassandra_scan_part));
+	LIBRDF_FREE(cassandra_scan_part*, scontext->parts);
+	scontext->parts = parts;
+	scontext->parts_size = size;
+
+    }
+
+    cassandra_scan_part* part = &scontext->parts[scontext->parts_count++];
+    part->scan = scontext;
+
+    return part;
+
+}
+
+/* Adds the parts reading one pattern of a lookup: one for each bucket
+   of its partition.  The terms are copied. */
+static int
+cassandra_scan_lookup(cassandra_scan_stream* scontext, int index,
+		      char* terms[3])
+{
+
+    librdf_storage_cassandra_instance* context = scontext->cassandra_context;
+    const cassandra_plan* plan = &context->plans[scontext->pattern];
+    int buckets = 1;
+    int b, j;
+
+    if (plan->bound > 0) {
+	buckets =
+	    cassandra_bucket_count(context, plan->index,
+				   terms[cassandra_indexes[plan->index].key[0]]);
+	if (buckets < 0)
+	    return -1;
+    }
+
+    for(b = 0; b < buckets; b++) {
+
+	cassandra_scan_part* part = cassandra_scan_part_add(scontext);
+	if (part == 0)
+	    return -1;
+
+	part->index = index;
+	part->bucket = b;
+	for(j = 0; j < 3; j++)
+	    if (terms[j]) {
+		part->terms[j] = strdup(terms[j]);
+		if (part->terms[j] == 0)
+		    return -1;
+	    }
+
+    }
+
+    return 0;
+
+}
+
+/* Starts the first parts and wraps the stream. */
+static librdf_stream*
+cassandra_scan_stream_begin(cassandra_scan_stream* scontext)
+{
+
+    librdf_stream* stream;
+    int i;
+
+    for(i = 0; i < scontext->parallelism; i++)
+	if (cassandra_scan_start(scontext) < 0) {
+	    cassandra_scan_stream_finished((void*)scontext);
+	    return NULL;
+	}
+
+    scontext->at_end = 1;
+    if (cassandra_scan_next_page(scontext) < 0) {
+	cassandra_scan_stream_finished((void*)scontext);
+	return NULL;
+    }
+
+    stream =
+	librdf_new_stream(scontext->storage->world,
+			  (void*)scontext,
+			  &cassandra_scan_stream_end_of_stream,
+			  &cassandra_scan_stream_next_statement,
+			  &cassandra_scan_stream_get_statement,
+			  &cassandra_scan_stream_finished);
+    if(!stream) {
+	cassandra_scan_stream_finished((void*)scontext);
+	return NULL;
+    }
+
+    return stream;
+
+}
+
+/* Allocates a parallel token range scan of every statement.  The
+   Murmur3 partitioner's tokens are (INT64_MIN, INT64_MAX], which is
+   split into scan_ranges equal parts. */
+static cassandra_scan_stream*
+cassandra_scan_stream_ranges(librdf_storage* storage)
+{
+
+    librdf_storage_cassandra_instance* context;
+    cassandra_scan_stream* scontext;
+
+    context = (librdf_storage_cassandra_instance*)storage->instance;
+
+    scontext = cassandra_scan_stream_alloc(storage, context->scan_ranges,
+					   context->scan_parallelism);
+    if (!scontext)
+	return NULL;
+
+    scontext->parts_count = context->scan_ranges;
+
+    uint64_t width = UINT64_MAX / (uint64_t) scontext->parts_count;
+    int i;
+    for(i = 0; i < scontext->parts_count; i++) {
+	cassandra_scan_part* part = &scontext->parts[i];
+	part->lower = (cass_int64_t) ((uint64_t) INT64_MIN + i * width);
+	part->upper = (i == scontext->parts_count - 1) ? INT64_MAX :
+	    (cass_int64_t) ((uint64_t) INT64_MIN + (i + 1) * width);
+    }
+
+    return scontext;
+
+}
+
+/* Returns a stream of every statement, read by a parallel token range
+   scan. */
+static librdf_stream*
+cassandra_scan_stream_new(librdf_storage* storage)
+{
+
+    cassandra_scan_stream* scontext = cassandra_scan_stream_ranges(storage);
+    if (!scontext)
+	return NULL;
+
+    return cassandra_scan_stream_begin(scontext);
+
+}
+
+/* Whether a lookup of the pattern terms t can't match anything: one of
+   them is missing from the dictionary, or the whole triple is ruled out
+   by the Bloom filter.  Returns 1 if so, 0 if not, or -1 on failure. */
+static int
+cassandra_lookup_empty(librdf_storage_cassandra_instance* context,
+		       char* t[3])
+{
+
+    int missing = 0;
+    int j;
+
+    for(j = 0; j < 3; j++) {
+	int64_t id;
+	if (t[j] && context->dict && !missing)
+	    missing = cassandra_term_id(context, t[j], 0, &id);
+    }
+
+    if (t[0] && t[1] && t[2] && !missing && context->bloom &&
+	context->bloom_ready &&
+	!cassandra_bloom_check(context->bloom,
+			       cassandra_triple_hash(t[0], t[1], t[2])))
+	missing = 1;
+
+    return missing;
+
+}
+
+/**
+ * librdf_storage_cassandra_find_statements_batch:
+ * @storage: a Cassandra storage
+ * @patterns: statements to match, all with the same parts bound
+ * @count: number of patterns
+ *
+ * Finds the matches of many patterns at once, as for a bind join.  Up
+ * to lookup-parallelism of the patterns' queries run concurrently.
+ * librdf_storage_cassandra_batch_index gives the index of the pattern
+ * each statement in the stream matched.  Outside the quads layout, the
+ * context node of each statement is that index as an integer literal
+ * as well.
+ * 
+ * Return value: a #librdf_stream or NULL on failure
+ **/
+librdf_stream*
+librdf_storage_cassandra_find_statements_batch(librdf_storage* storage,
+					       librdf_statement** patterns,
+					       int count)
+{
+
+    librdf_storage_cassandra_instance* context;
+    cassandra_scan_stream* scontext;
+    int i;
+
+    if (strcmp(storage->factory->name, "cassandra")) {
+	fprintf(stderr, "Cassandra: batch find on another storage\n");
+	return NULL;
+    }
+
+    if (count <= 0)
+	return librdf_new_empty_stream(storage->world);
+
+    context = (librdf_storage_cassandra_instance*)storage->instance;
+
+    scontext = cassandra_scan_stream_alloc(storage, count,
+					   context->lookup_parallelism);
+    if (!scontext)
+	return NULL;
+
+    scontext->tagged = 1;
+
+    for(i = 0; i < count; i++) {
+
+	char* t[3];
+	char* c;
+	int j;
+
+	statement_helper(storage, patterns[i], 0, &t[0], &t[1], &t[2], &c, 1);
+
+	int pattern = (t[0] ? 1 : 0) + (t[1] ? 2 : 0) + (t[2] ? 4 : 0);
+	if (i == 0)
+	    scontext->pattern = pattern;
+
+	/* Patterns which can't match anything are left out. */
+	int missing = cassandra_lookup_empty(context, t);
+
+	if (pattern != scontext->pattern || missing) {
+	    for(j = 0; j < 3; j++)
+		if (t[j]) free(t[j]);
+	    if (pattern == scontext->pattern && missing > 0)
+		continue;
+	    if (pattern != scontext->pattern)
+		fprintf(stderr, "Cassandra: batch patterns differ in shape\n");
+	    cassandra_scan_stream_finished((void*)scontext);
+	    return NULL;
+	}
+
+	int rc = cassandra_scan_lookup(scontext, i, t);
+
+	for(j = 0; j < 3; j++)
+	    if (t[j]) free(t[j]);
+
+	if (rc < 0) {
+	    cassandra_scan_stream_finished((void*)scontext);
+	    return NULL;
+	}
+
+    }
+
+    if (scontext->pattern >= 0) {
+	scontext->id = (cassandra_statement_id) scontext->pattern;
+	context->last_pattern = scontext->pattern;
+    }
+
+    librdf_stream* stream = cassandra_scan_stream_begin(scontext);
+    if (stream) {
+	scontext->stream = stream;
+	scontext->next_batch = context->batches;
+	context->batches = scontext;
+    }
+
+    return stream;
+
+}
+
+/**
+ * librdf_storage_cassandra_batch_index:
+ * @storage: a Cassandra storage
+ * @stream: a stream from librdf_storage_cassandra_find_statements_batch
+ *
+ * Gives the index of the pattern matched by the statement the stream of
+ * a batched find is at.
+ * 
+ * Return value: the pattern's index, or -1 if the stream is not an open
+ * batched find of the storage or is at its end
+ **/
+int
+librdf_storage_cassandra_batch_index(librdf_storage* storage,
+				     librdf_stream* stream)
+{
+
+    librdf_storage_cassandra_instance* context;
+    cassandra_scan_stream* scontext;
+
+    if (strcmp(storage->factory->name, "cassandra"))
+	return -1;
+
+    context = (librdf_storage_cassandra_instance*)storage->instance;
+
+    for(scontext = context->batches; scontext;
+	scontext = scontext->next_batch)
+	if (scontext->stream == stream)
+	    return scontext->at_end ? -1 : scontext->tag;
+
+    return -1;
+
+}
+
+/* A bound of a range find: an integer ('i'), another number ('f'), or a
+   dateTime in microseconds ('d'). */
+typedef struct {
+    char type;
+    int64_t i;
+    double f;
+    int inclusive;
+} cassandra_range_bound;
+
+/* Reads a range find bound from a typed literal's datatype URI and
+   text. */
+static int
+cassandra_range_bound_read(const char* datatype, const char* value,
+			   int inclusive, cassandra_range_bound* b)
+{
+
+    const char* xsd = "http://www.w3.org/2001/XMLSchema#";
+    char* end;
+
+    if (datatype == 0 || strncmp(datatype, xsd, strlen(xsd)) || !*value)
+	return -1;
+
+    datatype += strlen(xsd);
+    b->inclusive = (inclusive != 0);
+
+    if (!strcmp(datatype, "integer")) {
+	errno = 0;
+	b->i = strtoll(value, &end, 10);
+	b->type = 'i';
+	return (*end || errno) ? -1 : 0;
+    }
+
+    if (!strcmp(datatype, "float") || !strcmp(datatype, "double") ||
+	!strcmp(datatype, "decimal")) {
+	b->f = strtod(value, &end);
+	b->type = 'f';
+	return (*end || b->f != b->f) ? -1 : 0;
+    }
+
+    if (!strcmp(datatype, "dateTime")) {
+	b->type = 'd';
+	return cassandra_parse_datetime(value, &b->i);
+    }
+
+    return -1;
+
+}
+
+/* Writes the key bounding a slice of sortable type 'I', 'F' or 'D' in
+   the storage's encoding: the type's prefix, followed by sort key k if
+   bounded.  With after set the key is past every term with sort key k,
+   rather than before them. */
+static void
+cassandra_range_prefix(librdf_storage_cassandra_instance* context,
+		       char type, int bounded, uint64_t k, int after,
+		       char* key)
+{
+
+    if (!context->compact) {
+	if (bounded)
+	    sprintf(key, "%c:%016llx%c", type, (unsigned long long) k,
+		    after ? ';' : ':');
+	else
+	    sprintf(key, "%c%c", type, after ? ';' : ':');
+	return;
+    }
+
+    unsigned char tag = (type == 'I') ? CASSANDRA_TAG_INTEGER :
+	(type == 'F') ? CASSANDRA_TAG_FLOAT : CASSANDRA_TAG_DATETIME;
+
+    /* The next key up, or the next tag up past the largest key. */
+    if (bounded && after && k == UINT64_MAX)
+	bounded = 0;
+    else if (bounded && after) {
+	k++;
+	after = 0;
+    }
+
+    key[0] = after ? tag + 1 : tag;
+    if (bounded)
+	cassandra_sort_key_put((unsigned char*) key + 1, k);
+    key[bounded ? 1 + CASSANDRA_SORT_KEY : 1] = 0;
+
+}
+
+/* Writes the key bounding one end of a slice of sortable type 'I', 'F'
+   or 'D', given its bound or NULL.  Matching terms are >= the lower key
+   and < the upper key.  Returns 1 if no term of the type can match. */
+static int
+cassandra_range_key(librdf_storage_cassandra_instance* context, char type,
+		    const cassandra_range_bound* b, int upper, char* key)
+{
+
+    uint64_t k = 0;
+
+    if (b == 0) {
+	cassandra_range_prefix(context, type, 0, 0, upper, key);
+	return 0;
+    }
+
+    int inclusive = b->inclusive;
+
+    switch(type) {
+
+    case 'D':
+	k = cassandra_integer_key(b->i);
+	break;
+
+    case 'F':
+	k = cassandra_double_key((b->type == 'i') ? (double) b->i : b->f);
+	break;
+
+    case 'I':
+	if (b->type == 'i') {
+	    k = cassandra_integer_key(b->i);
+	    break;
+	}
+
+	/* A fractional bound moves to the nearest integer inside the
+	   range. */
+	double x = b->f;
+	if (x >= 9.2e18 || x <= -9.2e18) {
+	    if (upper == (x > 0)) {
+		cassandra_range_prefix(context, type, 0, 0, upper, key);
+		return 0;
+	    }
+	    return 1;
+	}
+	int64_t n = (int64_t) x;
+	if (upper) {
+	    if (x < n) n--;
+	    if (!inclusive && n == x) n--;
+	} else {
+	    if (x > n) n++;
+	    if (!inclusive && n == x) n++;
+	}
+	k = cassandra_integer_key(n);
+	inclusive = 1;
+	break;
+
+    }
+
+    cassandra_range_prefix(context, type, 1, k, upper == inclusive, key);
+
+    return 0;
+
+}
+
+/* Adds a part reading the slice [lo, hi) of predicate p from each of
+   buckets buckets. */
+static int
+cassandra_range_parts_add(cassandra_scan_stream* scontext, int buckets,
+			  const char* lo, const char* p, const char* hi)
+{
+
+    int i;
+
+    for(i = 0; i < buckets; i++) {
+	cassandra_scan_part* part = cassandra_scan_part_add(scontext);
+	if (part == 0)
+	    return -1;
+	part->bucket = i;
+	part->terms[0] = strdup(lo);
+	part->terms[1] = strdup(p);
+	part->terms[2] = strdup(hi);
+	if (!part->terms[0] || !part->terms[1] || !part->terms[2])
+	    return -1;
+    }
+
+    return 0;
+
+}
+
+/* Keys below and above every encoded term: each starts with a letter,
+   or with a compact tag. */
+#define CASSANDRA_RANGE_FIRST "\001"
+#define CASSANDRA_RANGE_LAST "\177"
+
+/* Allocates a range find of objects of predicate p, an encoded term: a
+   slice of rdf.pos for each sortable type the bounds can match.  With
+   rest set, the slices outside the sortable types are read too, holding
+   the literals of other types, such as xsd:decimal, and those not
+   encoded as sortable, which a SPARQL comparison may still match. */
+static cassandra_scan_stream*
+cassandra_range_stream_alloc(librdf_storage* storage, const char* p,
+			     const cassandra_range_bound* lower,
+			     const cassandra_range_bound* upper, int rest)
+{
+
+    librdf_storage_cassandra_instance* context;
+    cassandra_scan_stream* scontext;
+    const cassandra_range_bound* b = lower ? lower : upper;
+    char lo[CASSANDRA_SORT_PREFIX + 1];
+    char hi[CASSANDRA_SORT_PREFIX + 1];
+    char sorted[3][2][3];
+    int i, j;
+
+    context = (librdf_storage_cassandra_instance*)storage->instance;
+
+    if (!context->sortable || context->dict) {
+	fprintf(stderr, "Cassandra: range finds need sortable-literals "
+		"and the plain layout\n");
+	return NULL;
+    }
+
+    if (b == 0 ||
+	(lower && upper && (lower->type == 'd') != (upper->type == 'd'))) {
+	fprintf(stderr, "Cassandra: range bounds are not of one type\n");
+	return NULL;
+    }
+
+    /* Numbers are found among both integers and floats. */
+    const char* types = (b->type == 'd') ? "D" : "IF";
+
+    /* Each slice is read from every bucket of the predicate. */
+    int buckets = cassandra_bucket_count(context, POS, p);
+    if (buckets < 0)
+	return NULL;
+
+    scontext = cassandra_scan_stream_alloc(storage, (strlen(types) +
+						     (rest ? 4 : 0)) * buckets,
+					   context->lookup_parallelism);
+    if (!scontext)
+	return NULL;
+
+    scontext->pattern = CASSANDRA_SCAN_SLICES;
+    scontext->id = CASSANDRA_RANGE;
+
+    for(; *types; types++) {
+
+	if (cassandra_range_key(context, *types, lower, 0, lo) ||
+	    cassandra_range_key(context, *types, upper, 1, hi) ||
+	    strcmp(lo, hi) >= 0)
+	    continue;
+
+	if (cassandra_range_parts_add(scontext, buckets, lo, p, hi) < 0) {
+	    cassandra_scan_stream_finished((void*)scontext);
+	    return NULL;
+	}
+
+    }
+
+    if (!rest)
+	return scontext;
+
+    /* The gaps around the three sortable types' slices, in key order. */
+    for(i = 0; i < 3; i++) {
+	cassandra_range_prefix(context, "IFD"[i], 0, 0, 0, sorted[i][0]);
+	cassandra_range_prefix(context, "IFD"[i], 0, 0, 1, sorted[i][1]);
+	for(j = i; j > 0 && strcmp(sorted[j - 1][0], sorted[j][0]) > 0; j--) {
+	    char swap[2][3];
+	    memcpy(swap, sorted[j], sizeof(swap));
+	    memcpy(sorted[j], sorted[j - 1], sizeof(swap));
+	    memcpy(sorted[j - 1], swap, sizeof(swap));
+	}
+    }
+
+    for(i = 0; i <= 3; i++) {
+	const char* from = (i == 0) ? CASSANDRA_RANGE_FIRST : sorted[i - 1][1];
+	const char* to = (i == 3) ? CASSANDRA_RANGE_LAST : sorted[i][0];
+	if (strcmp(from, to) < 0 &&
+	    cassandra_range_parts_add(scontext, buckets, from, p, to) < 0) {
+	    cassandra_scan_stream_finished((void*)scontext);
+	    return NULL;
+	}
+    }
+
+    return scontext;
+
+}
+
+/* Reads a range find bound from a literal node. */
+static int
+cassandra_range_bound_node(librdf_node* node, int inclusive,
+			   cassandra_range_bound* b)
+{
+
+    cassandra_term term;
+
+    term_helper(node, &term);
+
+    if (term.type != LIBRDF_NODE_TYPE_LITERAL ||
+	cassandra_range_bound_read(term.datatype, term.value, inclusive,
+				   b) < 0) {
+	fprintf(stderr, "Cassandra: range bound is not a number or "
+		"dateTime\n");
+	return -1;
+    }
+
+    return 0;
+
+}
+
+/**
+ * librdf_storage_cassandra_find_range:
+ * @storage: a Cassandra storage
+ * @predicate: predicate of the statements to find
+ * @lower: lowest object, or NULL
+ * @lower_inclusive: non-zero if @lower itself matches
+ * @upper: highest object, or NULL
+ * @upper_inclusive: non-zero if @upper itself matches
+ *
+ * Finds the statements with @predicate whose object lies between @lower
+ * and @upper, as slices of the pos index.  The bounds are numeric
+ * literals, matching integer and float objects, or xsd:dateTime
+ * literals.  Only objects written with the sortable-literals option
+ * are found.
+ * 
+ * Return value: a #librdf_stream or NULL on failure
+ **/
+librdf_stream*
+librdf_storage_cassandra_find_range(librdf_storage* storage,
+				    librdf_node* predicate,
+				    librdf_node* lower, int lower_inclusive,
+				    librdf_node* upper, int upper_inclusive)
+{
+
+    cassandra_range_bound lo, hi;
+    cassandra_scan_stream* scontext;
+
+    if (strcmp(storage->factory->name, "cassandra")) {
+	fprintf(stderr, "Cassandra: range find on another storage\n");
+	return NULL;
+    }
+
+    if ((lower && cassandra_range_bound_node(lower, lower_inclusive,
+					     &lo) < 0) ||
+	(upper && cassandra_range_bound_node(upper, upper_inclusive,
+					     &hi) < 0))
+	return NULL;
+
+    char* p = node_helper(storage, predicate, 1);
+    if (p == 0)
+	return NULL;
+
+    scontext = cassandra_range_stream_alloc(storage, p, lower ? &lo : 0,
+					    upper ? &hi : 0, 0);
+    free(p);
+    if (!scontext)
+	return NULL;
+
+    return cassandra_scan_stream_begin(scontext);
+
+}
+
+static librdf_stream*
+librdf_storage_cassandra_serialise(librdf_storage* storage)
+{
+
+    librdf_statement* stmt = 
+	    librdf_new_statement_from_nodes(storage->world,
+					    0, 0, 0);
+
+    librdf_stream* strm = librdf_storage_cassandra_find_statements(storage,
+								   stmt);
+
+    librdf_free_statement(stmt);
+
+    return strm;
+
+}
+
+
+static cassandra_results_stream*
+cassandra_results_stream_alloc(librdf_storage* storage)
+{
+
+    librdf_storage_cassandra_instance* context;
+    cassandra_results_stream* scontext;
+
+    context = (librdf_storage_cassandra_instance*)storage->instance;
+
+    scontext =
+	LIBRDF_CALLOC(cassandra_results_stream*, 1, sizeof(*scontext));
+    if(!scontext)
+	return NULL;
+
+    scontext->storage = storage;
+    librdf_storage_add_reference(scontext->storage);
+
+    scontext->cassandra_context = context;
+
+    scontext->prefetch = context->prefetch;
+    scontext->pages_size = (context->prefetch > 0) ? context->prefetch : 1;
+    scontext->pages = LIBRDF_CALLOC(const CassResult**, scontext->pages_size,
+				    sizeof(const CassResult*));
+    if (!scontext->pages) {
+	cassandra_results_stream_finished((void*)scontext);
+	return NULL;
+    }
+
+    return scontext;
+
+}
+
+/* Runs the statement of the stream's id, and returns the stream of its
+   rows, taking over the statement. */
+static librdf_stream*
+cassandra_results_stream_start(cassandra_results_stream* scontext,
+			       CassStatement* stmt)
+{
+
+    librdf_storage_cassandra_instance* context = scontext->cassandra_context;
+    librdf_stream* stream;
+
+    cass_statement_set_paging_size(stmt, CASSANDRA_PAGE_SIZE);
+    scontext->stmt = stmt;
+
+    CassFuture* future = cassandra_execute(context, scontext->id, stmt);
+
+    if (cass_future_error_code(future) != CASS_OK) {
+	cassandra_report_error(future);
+	cass_future_free(future);
+	cassandra_results_stream_finished((void*)scontext);
+	return 0;
+    }
+
+    const CassResult* result = cass_future_get_result(future);
+
+    cass_future_free(future);
+
+    scontext->result = result;
+
+    if (cassandra_resolve_page(context, result) < 0) {
+	cassandra_results_stream_finished((void*)scontext);
+	return 0;
+    }
+
+    if (scontext->full_scan && cassandra_bloom_add_page(context, result) < 0) {
+	cassandra_results_stream_finished((void*)scontext);
+	return 0;
+    }
+
+    CassIterator* iter = cass_iterator_from_result(result);
+    scontext->iter = iter;
+
+    scontext->last = result;
+    scontext->more_pages = cass_result_has_more_pages(result);
+
+    scontext->at_end = !cass_iterator_next(scontext->iter);
+
+    /* Start on the next page while this one is read. */
+    if (cassandra_results_stream_fetch(scontext, 0) < 0) {
+	cassandra_results_stream_finished((void*)scontext);
+	return 0;
+    }
+
+    stream =
+	librdf_new_stream(scontext->storage->world,
+			  (void*)scontext,
+			  &cassandra_results_stream_end_of_stream,
+			  &cassandra_results_stream_next_statement,
+			  &cassandra_results_stream_get_statement,
+			  &cassandra_results_stream_finished);
+    if(!stream) {
+	cassandra_results_stream_finished((void*)scontext);
+	return NULL;
+    }
+  
+    return stream;
+
+}
+
+/* Finds the stored triples matching a statement. */
+static librdf_stream*
+cassandra_find_stored(librdf_storage* storage, librdf_statement* statement)
+{
+  
+    librdf_storage_cassandra_instance* context;
+    cassandra_results_stream* scontext;
+    char* s;
+    char* p;
+    char* o;
+    char* c;
+    
+    context = (librdf_storage_cassandra_instance*)storage->instance;
+
+    scontext = cassandra_results_stream_alloc(storage);
+    if(!scontext)
+	return NULL;
+
+    statement_helper(storage, statement, 0, &s, &p, &o, &c, 1);
+
+    /* The pattern of bound terms picks the plan. */
+    int num = 0;
+    if (o) num += 4;
+    if (p) num += 2;
+    if (s) num++;
+
+    context->last_pattern = num;
+
+#ifdef DEBUG
+    fprintf(stderr, "Query: ");
+    if (s)
+      fprintf(stderr, "s=%s ", s);
+    if (p)
+      fprintf(stderr, "p=%s ", p);
+    if (o)
+      fprintf(stderr, "o=%s ", o);
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Plan: %s\n", context->queries[num]);
+#endif
+
+    if (num == 0 && context->scan_parallelism > 1) {
+	cassandra_results_stream_finished((void*)scontext);
+	return cassandra_scan_stream_new(storage);
+    }
+
+    /* The find queries are in pattern order. */
+    scontext->id = (cassandra_statement_id) num;
+
+    scontext->full_scan = (num == 0 && context->bloom);
+
+    /* A term missing from the dictionary can't match anything. */
+    if (context->dict) {
+	int64_t id;
+	int missing = 0;
+	if (s && !missing) missing = cassandra_term_id(context, s, 0, &id);
+	if (p && !missing) missing = cassandra_term_id(context, p, 0, &id);
+	if (o && !missing) missing = cassandra_term_id(context, o, 0, &id);
+	if (missing) {
+	    if (s) free(s);
+	    if (p) free(p);
+	    if (o) free(o);
+	    cassandra_results_stream_finished((void*)scontext);
+	    return (missing > 0) ? librdf_new_empty_stream(storage->world) : 0;
+	}
+    }
+
+    /* A partition split into buckets is read a bucket at a time, all at
+       once. */
+    const cassandra_plan* plan = &context->plans[num];
+    if (plan->bound > 0 && cassandra_bucketed(context, plan->index)) {
+
+	char* t[3] = { s, p, o };
+	int buckets =
+	    cassandra_bucket_count(context, plan->index,
+				   t[cassandra_indexes[plan->index].key[0]]);
+
+	if (buckets != 1) {
+
+	    cassandra_scan_stream* lookup = 0;
+
+	    cassandra_results_stream_finished((void*)scontext);
+
+	    if (buckets > 1)
+		lookup = cassandra_scan_stream_alloc(storage, buckets,
+						     context->lookup_parallelism);
+	    if (lookup) {
+		lookup->pattern = num;
+		lookup->id = (cassandra_statement_id) num;
+		if (cassandra_scan_lookup(lookup, 0, t) < 0) {
+		    cassandra_scan_stream_finished((void*)lookup);
+		    lookup = 0;
+		}
+	    }
+
+	    if (s) free(s);
+	    if (p) free(p);
+	    if (o) free(o);
+
+	    return lookup ? cassandra_scan_stream_begin(lookup) : 0;
+
+	}
+
+    }
+
+    CassStatement* stmt = cassandra_query(context, num, s, p, o, 0);
+
+    if (s) free(s);
+    if (p) free(p);
+    if (o) free(o);
+
+    if (stmt == 0) {
+	cassandra_results_stream_finished((void*)scontext);
+	return 0;
+    }
+
+    return cassandra_results_stream_start(scontext, stmt);
+    
+}
+
+/* A find_statements stream inside a transaction.  Stored triples which
+   the transaction has written are left out, and then those it has added
+   are read from its write set, as it was when the find began.  Only the
+   writes matching the pattern, and the context if there is one, are
+   copied. */
+typedef struct {
+    librdf_storage* storage;
+    librdf_storage_cassandra_instance* cassandra_context;
+    librdf_stream* stored;	/* 0 once read to the end */
+    cassandra_writes* writes;
+    int next;			/* Next entry of writes to read */
+    librdf_statement* statement;	/* Current added statement */
+    librdf_node* context;	/* Its context, or 0 */
+    int at_end;
+} cassandra_overlay_stream;
+
+/* Moves on to a stored triple the transaction hasn't written, or else
+   the next triple it added. */
+static void
+cassandra_overlay_stream_settle(cassandra_overlay_stream* scontext)
+{
+
+    librdf_storage_cassandra_instance* context = scontext->cassandra_context;
+    const char* s;
+    const char* p;
+    const char* o;
+    const char* c;
+
+    while (scontext->stored) {
+
+	if (librdf_stream_end(scontext->stored)) {
+	    librdf_free_stream(scontext->stored);
+	    scontext->stored = 0;
+	    break;
+	}
+
+	char* ts;
+	char* tp;
+	char* to;
+	char* tc;
+	statement_helper(scontext->storage,
+			 librdf_stream_get_object(scontext->stored),
+			 librdf_stream_get_context2(scontext->stored),
+			 &ts, &tp, &to, &tc, 0);
+	int written = (ts && tp && to) ?
+	    cassandra_writes_get(scontext->writes, ts, tp, to, tc) : -1;
+	if (ts) free(ts);
+	if (tp) free(tp);
+	if (to) free(to);
+	if (tc) free(tc);
+
+	if (written < 0)
+	    return;
+
+	librdf_stream_next(scontext->stored);
+
+    }
+
+    if (scontext->statement) {
+	librdf_free_statement(scontext->statement);
+	scontext->statement = 0;
+    }
+
+    if (scontext->context) {
+	librdf_free_node(scontext->context);
+	scontext->context = 0;
+    }
+
+    while (scontext->next < cassandra_writes_count(scontext->writes)) {
+
+	if (!cassandra_writes_at(scontext->writes, scontext->next++,
+				 &s, &p, &o, &c))
+	    continue;
+
+	librdf_node* sn = node_constructor_helper(context, s, strlen(s));
+	librdf_node* pn = node_constructor_helper(context, p, strlen(p));
+	librdf_node* on = node_constructor_helper(context, o, strlen(o));
+	if (sn == 0 || pn == 0 || on == 0) {
+	    if (sn) librdf_free_node(sn);
+	    if (pn) librdf_free_node(pn);
+	    if (on) librdf_free_node(on);
+	    continue;
+	}
+
+	scontext->statement =
+	    librdf_new_statement_from_nodes(context->storage->world,
+					    sn, pn, on);
+	if (scontext->statement == 0)
+	    continue;
+
+	if (c)
+	    scontext->context = node_constructor_helper(context, c,
+							strlen(c));
+	return;
+
+    }
+
+    scontext->at_end = 1;
+
+}
+
+static int
+cassandra_overlay_stream_end_of_stream(void* context)
+{
+
+    cassandra_overlay_stream* scontext = (cassandra_overlay_stream*) context;
+
+    return scontext->at_end;
+
+}
+
+static int
+cassandra_overlay_stream_next_statement(void* context)
+{
+
+    cassandra_overlay_stream* scontext = (cassandra_overlay_stream*) context;
+
     if (scontext->at_end)
+	return 1;
+
+    if (scontext->stored)
+	librdf_stream_next(scontext->stored);
+
+    cassandra_overlay_stream_settle(scontext);
+
+    return scontext->at_end;
+
+}
+
+static void*
+cassandra_overlay_stream_get_statement(void* context, int flags)
+{
+
+    cassandra_overlay_stream* scontext = (cassandra_overlay_stream*) context;
+
+    switch(flags) {
+
+    case LIBRDF_ITERATOR_GET_METHOD_GET_OBJECT:
+	if (scontext->stored)
+	    return librdf_stream_get_object(scontext->stored);
+	return scontext->statement;
+
+    case LIBRDF_ITERATOR_GET_METHOD_GET_CONTEXT:
+	if (scontext->stored)
+	    return librdf_stream_get_context2(scontext->stored);
+	return scontext->context;
+
+    default:
+	librdf_log(scontext->storage->world,
+		   0, LIBRDF_LOG_ERROR, LIBRDF_FROM_STORAGE, NULL,
+		   "Unknown iterator method flag %d", flags);
+	return NULL;
+    }
+
+}
+
+static void
+cassandra_overlay_stream_finished(void* context)
+{
+
+    cassandra_overlay_stream* scontext = (cassandra_overlay_stream*) context;
+
+    if (scontext->stored)
+	librdf_free_stream(scontext->stored);
+
+    if (scontext->writes)
+	cassandra_writes_free(scontext->writes);
+
+    if (scontext->statement)
+	librdf_free_statement(scontext->statement);
+
+    if (scontext->context)
+	librdf_free_node(scontext->context);
+
+    if (scontext->storage)
+	librdf_storage_remove_reference(scontext->storage);
+
+    LIBRDF_FREE(cassandra_overlay_stream, scontext);
+
+}
+
+/* Returns a stream of the matches of a statement, in a context if one
+   is given, as the transaction leaves them, taking over the stream of
+   stored matches. */
+static librdf_stream*
+cassandra_overlay_stream_new(librdf_storage* storage, librdf_stream* stored,
+			     librdf_statement* statement,
+			     librdf_node* context_node)
+{
+
+    librdf_storage_cassandra_instance* context;
+    cassandra_overlay_stream* scontext;
+    librdf_stream* stream;
+    char* t[3];
+    char* c;
+    int i, j;
+
+    context = (librdf_storage_cassandra_instance*)storage->instance;
+
+    scontext =
+	LIBRDF_CALLOC(cassandra_overlay_stream*, 1, sizeof(*scontext));
+    if (!scontext) {
+	librdf_free_stream(stored);
+	return NULL;
+    }
+
+    scontext->storage = storage;
+    librdf_storage_add_reference(scontext->storage);
+
+    scontext->cassandra_context = context;
+    scontext->stored = stored;
+
+    scontext->writes = cassandra_writes_create(0);
+    if (scontext->writes == 0) {
+	cassandra_overlay_stream_finished((void*)scontext);
+	return NULL;
+    }
+
+    statement_helper(storage, statement, context_node, &t[0], &t[1], &t[2],
+		     &c, 1);
+
+    int failed = 0;
+    for(i = 0; i < cassandra_writes_count(context->transaction); i++) {
+	const char* w[4];
+	int add = cassandra_writes_at(context->transaction, i,
+				      &w[0], &w[1], &w[2], &w[3]);
+	for(j = 0; j < 3; j++)
+	    if (t[j] && strcmp(t[j], w[j]))
+		break;
+	if (j < 3 || (c && (w[3] == 0 || strcmp(c, w[3]))))
+	    continue;
+	if (cassandra_writes_put(scontext->writes, w[0], w[1], w[2], w[3],
+				 add) < 0)
+	    failed = 1;
+    }
+
+    for(j = 0; j < 3; j++)
+	if (t[j]) free(t[j]);
+    if (c) free(c);
+
+    if (failed) {
+	cassandra_overlay_stream_finished((void*)scontext);
+	return NULL;
+    }
+
+    cassandra_overlay_stream_settle(scontext);
+
+    stream =
+	librdf_new_stream(storage->world,
+			  (void*)scontext,
+			  &cassandra_overlay_stream_end_of_stream,
+			  &cassandra_overlay_stream_next_statement,
+			  &cassandra_overlay_stream_get_statement,
+			  &cassandra_overlay_stream_finished);
+    if(!stream) {
+	cassandra_overlay_stream_finished((void*)scontext);
+	return NULL;
+    }
+
+    return stream;
+
+}
+
+/**
+ * librdf_storage_cassandra_find_statements:
+ * @storage: the storage
+ * @statement: the statement to match
+ *
+ * .
+ * 
+ * Return a stream of statements matching the given statement (or
+ * all statements if NULL).  Parts (subject, predicate, object) of the
+ * statement can be empty in which case any statement part will match that.
+ * Uses #librdf_statement_match to do the matching.
+ * 
+ * Return value: a #librdf_stream or NULL on failure
+ **/
+static librdf_stream*
+librdf_storage_cassandra_find_statements(librdf_storage* storage,
+					 librdf_statement* statement)
+{
+
+    librdf_storage_cassandra_instance* context;
+    context = (librdf_storage_cassandra_instance*)storage->instance;
+
+    librdf_stream* stream = cassandra_find_stored(storage, statement);
+
+    if (stream == 0 || context->transaction == 0)
+	return stream;
+
+    return cassandra_overlay_stream_new(storage, stream, statement, 0);
+
+}
+
+/**
+ * librdf_storage_cassandra_context_add_statement:
+ * @storage: #librdf_storage object
+ * @context_node: #librdf_node object
+ * @statement: #librdf_statement statement to add
+ *
+ * Add a statement to a storage context.
+ * 
+ * Return value: non 0 on failure
+ **/
+static int
+librdf_storage_cassandra_context_add_statement(librdf_storage* storage,
+                                            librdf_node* context_node,
+                                            librdf_statement* statement) 
+{
+
+    char* s;
+    char* p;
+    char* o;
+    char* c;
+
+    statement_helper(storage, statement, context_node, &s, &p, &o, &c, 0);
+
+    librdf_storage_cassandra_instance* context; 
+    context = (librdf_storage_cassandra_instance*)storage->instance;
+
+    if (context->transaction) {
+	int ret = cassandra_transaction_put(context, s, p, o, c, 1);
+	free(s);
+	free(p);
+	free(o);
+	free(c);
+	return ret;
+    }
+
+    if (cassandra_write_queue(context, s, p, o, c) < 0)
+	return -1;
+
+    if (cassandra_write_flush(context) < 0)
+	return -1;
+
+    return cassandra_write_drain(context);
+
+}
+
+
+/**
+ * librdf_storage_cassandra_context_remove_statement:
+ * @storage: #librdf_storage object
+ * @context_node: #librdf_node object
+ * @statement: #librdf_statement statement to remove
+ *
+ * Remove a statement from a storage context.
+ * 
+ * Return value: non 0 on failure
+ **/
+static int
+librdf_storage_cassandra_context_remove_statement(librdf_storage* storage, 
+                                               librdf_node* context_node,
+                                               librdf_statement* statement) 
+{
+
+    librdf_storage_cassandra_instance* context; 
+    context = (librdf_storage_cassandra_instance*)storage->instance;
+
+    char* s;
+    char* p;
+    char* o;
+    char* c;
+
+    statement_helper(storage, statement, context_node, &s, &p, &o, &c, 1);
+
+    if (!s || !p || !o) {
+	if (s) free(s);
+	if (p) free(p);
+	if (o) free(o);
+	if (c) free(c);
+	return -1;
+    }
+
+    int ret = 0;
+
+    if (context->transaction) {
+	ret = cassandra_transaction_put(context, s, p, o, c, 0);
+    } else {
+	cassandra_triple triple = { s, p, o, c };
+	if (cassandra_write_delete(context, &triple, 1) < 0)
+	    ret = -1;
+	if (cassandra_write_drain(context) < 0)
+	    ret = -1;
+    }
+
+    free(s);
+    free(p);
+    free(o);
+    free(c);
+
+    return ret;
+
+}
+
+
+/* Records the removal of each statement of a stream in the
+   transaction's write set, and frees the stream. */
+static int
+cassandra_transaction_remove(librdf_storage* storage, librdf_stream* stream)
+{
+
+    librdf_storage_cassandra_instance* context;
+    context = (librdf_storage_cassandra_instance*)storage->instance;
+
+    int ret = 0;
+
+    for(; ret == 0 && !librdf_stream_end(stream);
+	librdf_stream_next(stream)) {
+
+	char* s;
+	char* p;
+	char* o;
+	char* c;
+	statement_helper(storage, librdf_stream_get_object(stream),
+			 librdf_stream_get_context2(stream), &s, &p, &o, &c, 1);
+
+	if (s && p && o)
+	    ret = cassandra_transaction_put(context, s, p, o, c, 0);
+	else
+	    ret = -1;
+
+	if (s) free(s);
+	if (p) free(p);
+	if (o) free(o);
+	if (c) free(c);
+
+    }
+
+    librdf_free_stream(stream);
+
+    return ret;
+
+}
+
+/* Deletes the rows of each stored statement of a stream, and frees the
+   stream.  The rows of the index table skip, or -1 for none, and of
+   rdf.cspo, unless context_rows is set, are left for the caller to
+   delete a partition or range at a time.  Returns the number of
+   statements, or -1 on error. */
+static int
+cassandra_delete_matches(librdf_storage* storage, librdf_stream* stream,
+			 int skip, int context_rows)
+{
+
+    librdf_storage_cassandra_instance* context;
+    context = (librdf_storage_cassandra_instance*)storage->instance;
+
+    int count = 0;
+    int index;
+
+    for(; !librdf_stream_end(stream); librdf_stream_next(stream)) {
+
+	cassandra_triple t;
+	statement_helper(storage, librdf_stream_get_object(stream),
+			 librdf_stream_get_context2(stream),
+			 &t.s, &t.p, &t.o, &t.c, 1);
+
+	if (t.s && t.p && t.o) {
+	    for(index = SPO; index <= OSP; index++)
+		if (index != skip)
+		    cassandra_delete_rows(context, (index_type) index, &t);
+	    if (context_rows && context->quads && t.c)
+		cassandra_delete_context_row(context, &t);
+	    count++;
+	} else
+	    context->write_errors++;
+
+	if (t.s) free(t.s);
+	if (t.p) free(t.p);
+	if (t.o) free(t.o);
+	if (t.c) free(t.c);
+
+    }
+
+    librdf_free_stream(stream);
+
+    return count;
+
+}
+
+/* Runs a delete bound to an encoded context through the write window. */
+static void
+cassandra_context_delete(librdf_storage_cassandra_instance* context,
+			 cassandra_statement_id id, const char* c)
+{
+
+    CassStatement* stmt = cassandra_bind(context, id);
+    if (stmt == 0) {
+	context->write_errors++;
+	return;
+    }
+
+    cassandra_bind_encoded(context, stmt, 0, c, strlen(c));
+
+    cassandra_write_add(context, id, stmt, 0);
+
+}
+
+/**
+ * librdf_storage_cassandra_context_remove_statements:
+ * @storage: #librdf_storage object
+ * @context_node: #librdf_node object
+ *
+ * Remove every statement of a storage context.  Its rdf.cspo partition
+ * goes with one partition delete, and the rows of the index tables are
+ * deleted one by one.
+ * 
+ * Return value: non 0 on failure
+ **/
+static  int
+librdf_storage_cassandra_context_remove_statements(librdf_storage* storage, 
+                                                librdf_node* context_node)
+{
+
+    librdf_storage_cassandra_instance* context;
+    context = (librdf_storage_cassandra_instance*)storage->instance;
+
+    if (!context->quads) {
+	fprintf(stderr, "Cassandra: contexts need the quads layout\n");
+	return -1;
+    }
+
+    librdf_stream* stream =
+	librdf_storage_cassandra_context_serialise(storage, context_node);
+    if (stream == 0)
+	return -1;
+
+    if (context->transaction)
+	return cassandra_transaction_remove(storage, stream);
+
+    char* c = node_helper(storage, context_node, 1);
+    if (c == 0) {
+	librdf_free_stream(stream);
+	return -1;
+    }
+
+    /* Writes in flight could be adding to the context. */
+    int ret = cassandra_write_drain(context);
+
+    int removed = cassandra_delete_matches(storage, stream, -1, 0);
+
+    cassandra_context_delete(context, CASSANDRA_CONTEXT_CLEAR, c);
+    cassandra_context_delete(context, CASSANDRA_CONTEXT_DROP, c);
+
+    if (removed > 0 && context->size_mode == CASSANDRA_SIZE_COUNTER)
+	cassandra_count_add(context, -removed);
+
+    free(c);
+
+    if (cassandra_write_drain(context) < 0)
+	ret = -1;
+
+    return ret;
+
+}
+
+/**
+ * librdf_storage_cassandra_remove_statements:
+ * @storage: #librdf_storage object
+ * @pattern: #librdf_statement pattern to match
+ *
+ * Remove every statement matching a pattern, in any context.  The index
+ * table a find of the pattern reads loses the matches with a partition
+ * or range delete, a bucket at a time if it is bucketed.  The other
+ * index tables, and rdf.cspo, lose them a row at a time.
+ * 
+ * Return value: non 0 on failure
+ **/
+int
+librdf_storage_cassandra_remove_statements(librdf_storage* storage,
+					   librdf_statement* pattern)
+{
+
+    librdf_storage_cassandra_instance* context;
+    char* s;
+    char* p;
+    char* o;
+    char* c;
+
+    if (strcmp(storage->factory->name, "cassandra")) {
+	fprintf(stderr, "Cassandra: pattern remove on another storage\n");
+	return -1;
+    }
+
+    context = (librdf_storage_cassandra_instance*)storage->instance;
+
+    if (context->transaction) {
+	librdf_stream* stream =
+	    librdf_storage_cassandra_find_statements(storage, pattern);
+	if (stream == 0)
+	    return -1;
+	return cassandra_transaction_remove(storage, stream);
+    }
+
+    statement_helper(storage, pattern, 0, &s, &p, &o, &c, 1);
+
+    int num = 0;
+    if (o) num += 4;
+    if (p) num += 2;
+    if (s) num++;
+
+    if (num == 0) {
+	fprintf(stderr, "Cassandra: pattern remove needs a bound term\n");
+	return -1;
+    }
+
+    const cassandra_plan* plan = &context->plans[num];
+    char* t[3] = { s, p, o };
+    int ret = 0;
+    int b;
+
+    /* Writes in flight could be adding matches. */
+    if (cassandra_write_drain(context) < 0)
+	ret = -1;
+
+    int removed = -1;
+    librdf_stream* stream = cassandra_find_stored(storage, pattern);
+    if (stream)
+	removed = cassandra_delete_matches(storage, stream, plan->index, 1);
+
+    int buckets = 0;
+    if (removed > 0)
+	buckets = cassandra_bucket_count(context, plan->index,
+					 t[cassandra_indexes[plan->index].key[0]]);
+
+    /* Every bucket there could be, if the count can't be read. */
+    if (buckets < 0) {
+	context->write_errors++;
+	buckets = context->max_buckets;
+    }
+
+    for(b = 0; b < buckets; b++) {
+	cassandra_statement_id id =
+	    (cassandra_statement_id) (CASSANDRA_REMOVE_ + num);
+	CassStatement* stmt =
+	    cassandra_bind_pattern(context, id, num, s, p, o, b);
+	if (stmt == 0) {
+	    context->write_errors++;
+	    break;
+	}
+	cassandra_write_add(context, id, stmt, 0);
+    }
+
+    if (removed < 0)
+	ret = -1;
+    else if (removed > 0 && context->size_mode == CASSANDRA_SIZE_COUNTER)
+	cassandra_count_add(context, -removed);
+
+    if (s) free(s);
+    if (p) free(p);
+    if (o) free(o);
+
+    if (cassandra_write_drain(context) < 0)
+	ret = -1;
+
+    return ret;
+
+}
+
+/**
+ * librdf_storage_cassandra_context_serialise:
+ * @storage: #librdf_storage object
+ * @context_node: #librdf_node object
+ *
+ * Cassandra all statements in a storage context.
+ * 
+ * Return value: #librdf_stream of statements or NULL on failure or context is empty
+ **/
+static librdf_stream*
+librdf_storage_cassandra_context_serialise(librdf_storage* storage,
+                                        librdf_node* context_node) 
+{
+
+    librdf_storage_cassandra_instance* context;
+    context = (librdf_storage_cassandra_instance*)storage->instance;
+
+    if (!context->quads) {
+	fprintf(stderr, "Cassandra: contexts need the quads layout\n");
+	return 0;
+    }
+
+    char* c = node_helper(storage, context_node, 1);
+    if (c == 0)
+	return 0;
+
+    CassStatement* stmt = cassandra_bind(context, CASSANDRA_CONTEXT_READ);
+    if (stmt == 0) {
+	free(c);
+	return 0;
+    }
+
+    cassandra_bind_context(context, stmt, 0, c);
+    free(c);
+
+    cassandra_results_stream* scontext =
+	cassandra_results_stream_alloc(storage);
+    if (!scontext) {
+	cass_statement_free(stmt);
+	return 0;
+    }
+
+    scontext->id = CASSANDRA_CONTEXT_READ;
+
+    librdf_stream* stream = cassandra_results_stream_start(scontext, stmt);
+
+    if (stream == 0 || context->transaction == 0)
+	return stream;
+
+    /* Every triple of the context is a match. */
+    librdf_statement* all = librdf_new_statement(storage->world);
+    if (all == 0) {
+	librdf_free_stream(stream);
+	return 0;
+    }
+
+    stream = cassandra_overlay_stream_new(storage, stream, all, context_node);
+
+    librdf_free_statement(all);
+
+    return stream;
+
+}
+
+/* An iterator over rdf.contexts, read a page at a time. */
+typedef struct {
+    librdf_storage* storage;
+    librdf_storage_cassandra_instance* cassandra_context;
+    CassStatement* stmt;
+    const CassResult* result;
+    CassIterator* iter;
+    librdf_node* node;		/* Current context */
+    int at_end;
+} cassandra_contexts_iterator;
+
+/* Moves on to the next context, reading the next page when this one is
+   used up. */
+static int
+cassandra_contexts_iterator_advance(cassandra_contexts_iterator* icontext)
+{
+
+    librdf_storage_cassandra_instance* context = icontext->cassandra_context;
+
+    if (icontext->node) {
+	librdf_free_node(icontext->node);
+	icontext->node = 0;
+    }
+
+    while (1) {
+
+	if (icontext->iter && cass_iterator_next(icontext->iter)) {
+	    const CassRow* row = cass_iterator_get_row(icontext->iter);
+	    const char* c;
+	    size_t c_len;
+	    if (cassandra_row_term(context, row, 0, &c, &c_len) < 0)
+		continue;
+	    icontext->node = node_constructor_helper(context, c, c_len);
+	    if (icontext->node)
+		return 0;
+	    continue;
+	}
+
+	int first = (icontext->result == 0);
+
+	if (icontext->iter) {
+	    cass_iterator_free(icontext->iter);
+	    icontext->iter = 0;
+	}
+
+	if (icontext->result) {
+	    int more = cass_result_has_more_pages(icontext->result);
+	    if (more &&
+		cass_statement_set_paging_state(icontext->stmt,
+						icontext->result) != CASS_OK)
+		more = 0;
+	    cass_result_free(icontext->result);
+	    icontext->result = 0;
+	    if (!more)
+		break;
+	}
+
+	CassFuture* future =
+	    cassandra_execute(context, CASSANDRA_CONTEXTS_ALL, icontext->stmt);
+	if (cass_future_error_code(future) != CASS_OK) {
+	    cassandra_report_error(future);
+	    cass_future_free(future);
+	    icontext->at_end = 1;
+	    return first ? -1 : 0;
+	}
+
+	icontext->result = cass_future_get_result(future);
+	cass_future_free(future);
+
+	icontext->iter = cass_iterator_from_result(icontext->result);
+
+    }
+
+    icontext->at_end = 1;
+
+    return 0;
+
+}
+
+static int
+cassandra_contexts_iterator_is_end(void* context)
+{
+
+    cassandra_contexts_iterator* icontext =
+	(cassandra_contexts_iterator*) context;
+
+    return icontext->at_end;
+
+}
+
+static int
+cassandra_contexts_iterator_next_method(void* context)
+{
+
+    cassandra_contexts_iterator* icontext =
+	(cassandra_contexts_iterator*) context;
+
+    if (icontext->at_end)
+	return 1;
+
+    cassandra_contexts_iterator_advance(icontext);
+
+    return icontext->at_end;
+
+}
+
+static void*
+cassandra_contexts_iterator_get_method(void* context, int flags)
+{
+
+    cassandra_contexts_iterator* icontext =
+	(cassandra_contexts_iterator*) context;
+
+    switch(flags) {
+
+    case LIBRDF_ITERATOR_GET_METHOD_GET_OBJECT:
+	return icontext->node;
+
+    case LIBRDF_ITERATOR_GET_METHOD_GET_CONTEXT:
+	return NULL;
+
+    default:
+	librdf_log(icontext->storage->world,
+		   0, LIBRDF_LOG_ERROR, LIBRDF_FROM_STORAGE, NULL,
+		   "Unknown iterator method flag %d", flags);
+	return NULL;
+    }
+
+}
+
+static void
+cassandra_contexts_iterator_finished(void* context)
+{
+
+    cassandra_contexts_iterator* icontext =
+	(cassandra_contexts_iterator*) context;
+
+    if (icontext->node)
+	librdf_free_node(icontext->node);
+
+    if (icontext->iter)
+	cass_iterator_free(icontext->iter);
+
+    if (icontext->result)
+	cass_result_free(icontext->result);
+
+    if (icontext->stmt)
+	cass_statement_free(icontext->stmt);
+
+    if (icontext->storage)
+	librdf_storage_remove_reference(icontext->storage);
+
+    LIBRDF_FREE(cassandra_contexts_iterator, icontext);
+
+}
+
+/**
+ * librdf_storage_cassandra_context_get_contexts:
+ * @storage: #librdf_storage object
+ *
+ * Cassandra all context nodes in a storage.
+ * 
+ * Return value: #librdf_iterator of context_nodes or NULL on failure or no contexts
+ **/
+static librdf_iterator*
+librdf_storage_cassandra_get_contexts(librdf_storage* storage) 
+{
+
+    librdf_storage_cassandra_instance* context;
+    cassandra_contexts_iterator* icontext;
+    librdf_iterator* iterator;
+
+    context = (librdf_storage_cassandra_instance*)storage->instance;
+
+    if (!context->quads) {
+	fprintf(stderr, "Cassandra: contexts need the quads layout\n");
+	return 0;
+    }
+
+    icontext =
+	LIBRDF_CALLOC(cassandra_contexts_iterator*, 1, sizeof(*icontext));
+    if (!icontext)
+	return NULL;
+
+    icontext->storage = storage;
+    librdf_storage_add_reference(icontext->storage);
+
+    icontext->cassandra_context = context;
+
+    icontext->stmt = cassandra_bind(context, CASSANDRA_CONTEXTS_ALL);
+    if (icontext->stmt == 0) {
+	cassandra_contexts_iterator_finished((void*)icontext);
+	return NULL;
+    }
+
+    cass_statement_set_paging_size(icontext->stmt, CASSANDRA_PAGE_SIZE);
+
+    if (cassandra_contexts_iterator_advance(icontext) < 0) {
+	cassandra_contexts_iterator_finished((void*)icontext);
+	return NULL;
+    }
+
+    iterator =
+	librdf_new_iterator(storage->world,
+			    (void*)icontext,
+			    &cassandra_contexts_iterator_is_end,
+			    &cassandra_contexts_iterator_next_method,
+			    &cassandra_contexts_iterator_get_method,
+			    &cassandra_contexts_iterator_finished);
+    if (!iterator) {
+	cassandra_contexts_iterator_finished((void*)icontext);
+	return NULL;
+    }
+
+    return iterator;
+
+}
+
+/* The value of a counter feature, as a literal. */
+static librdf_node*
+cassandra_counter_node(librdf_storage* storage, unsigned long value)
+{
+
+    char buf[32];
+    sprintf(buf, "%lu", value);
+
+    return librdf_new_node_from_typed_literal(storage->world,
+					      (const unsigned char*)buf,
+					      NULL, NULL);
+
+}
+
+/* Describes the plan of the latest find: the table read, its key
+   columns restricted by the pattern, and an estimate of the rows
+   returned.  A partition slice is estimated as an average partition. */
+static librdf_node*
+cassandra_explain_node(librdf_storage* storage)
+{
+
+    librdf_storage_cassandra_instance* context;
+    context = (librdf_storage_cassandra_instance*)storage->instance;
+
+    if (context->last_pattern < 0)
+	return NULL;
+
+    const cassandra_plan* plan = &context->plans[context->last_pattern];
+    int64_t rows = 1;
+    int64_t partitions;
+    int k;
+
+    if (plan->bound == 0)
+	rows = librdf_storage_cassandra_size(storage);
+    else if (plan->bound < 3) {
+	if (cassandra_table_estimate(context, plan->index, &rows,
+				     &partitions) < 0)
+	    return NULL;
+	rows = (partitions > 0) ? rows / partitions : 0;
+    }
+
+    char table[20];
+    cassandra_table_name(context, plan->index, table);
+
+    char buf[200];
+    int len = sprintf(buf, "table=%s.%s key=", context->keyspace, table);
+    for(k = 0; k < plan->bound; k++) {
+	len += sprintf(buf + len, "%s%c", k ? "," : "",
+		       "spo"[cassandra_indexes[plan->index].key[k]]);
+	if (k == 0 && cassandra_bucketed(context, plan->index))
+	    len += sprintf(buf + len, ",b");
+    }
+    if (plan->bound == 0)
+	len += sprintf(buf + len, "none");
+    if (plan->bound == 0 && context->scan_parallelism > 1)
+	len += sprintf(buf + len, " token-ranges=%d", context->scan_ranges);
+    sprintf(buf + len, " estimated-rows=%lld", (long long) rows);
+
+    return librdf_new_node_from_typed_literal(storage->world,
+					      (const unsigned char*)buf,
+					      NULL, NULL);
+
+}
+
+/**
+ * librdf_storage_cassandra_get_feature:
+ * @storage: #librdf_storage object
+ * @feature: #librdf_uri feature property
+ *
+ * Get the value of a storage feature.
+ * 
+ * Return value: #librdf_node feature value or NULL if no such feature
+ * exists or the value is empty.
+ **/
+static librdf_node*
+librdf_storage_cassandra_get_feature(librdf_storage* storage, librdf_uri* feature)
+{
+    librdf_storage_cassandra_instance* scontext;
+    unsigned char *uri_string;
+
+    scontext = (librdf_storage_cassandra_instance*)storage->instance;
+
+    if(!feature)
+	return NULL;
+
+    uri_string = librdf_uri_as_string(feature);
+    if(!uri_string)
+	return NULL;
+
+    /* Only the quads layout keeps contexts. */
+    if(!strcmp((const char*)uri_string, LIBRDF_MODEL_FEATURE_CONTEXTS)) {
+	return librdf_new_node_from_typed_literal(storage->world,
+						  (const unsigned char*)
+						  (scontext->quads ? "1" : "0"),
+						  NULL, NULL);
+    }
+
+    if(!strcmp((const char*)uri_string, CASSANDRA_FEATURE_PREPARE_MISSES))
+	return cassandra_counter_node(storage, scontext->prepare_misses);
+
+    if(!strcmp((const char*)uri_string, CASSANDRA_FEATURE_REPREPARES))
+	return cassandra_counter_node(storage, scontext->reprepares);
+
+    if(!strcmp((const char*)uri_string, CASSANDRA_FEATURE_LOAD_STATS)) {
+	char buf[100];
+	sprintf(buf, "parse=%.0f encode=%.0f write=%.0f",
+		scontext->load_rate[0], scontext->load_rate[1],
+		scontext->load_rate[2]);
+	return librdf_new_node_from_typed_literal(storage->world,
+						  (const unsigned char*)buf,
+						  NULL, NULL);
+    }
+
+    if(!strcmp((const char*)uri_string, CASSANDRA_FEATURE_EXPLAIN))
+	return cassandra_explain_node(storage);
+
+    return NULL;
+}
+
+/**
+ * librdf_storage_cassandra_set_feature:
+ * @storage: #librdf_storage object
+ * @feature: #librdf_uri feature property
+ * @value: #librdf_node feature property value
+ *
+ * Set the value of a storage feature.
+ * 
+ * Return value: non 0 on failure (negative if no such feature)
+ **/
+static int
+librdf_storage_cassandra_set_feature(librdf_storage* storage,
+				     librdf_uri* feature, librdf_node* value)
+{
+    librdf_storage_cassandra_instance* scontext;
+    unsigned char *uri_string;
+
+    scontext = (librdf_storage_cassandra_instance*)storage->instance;
+
+    if(!feature)
+	return -1;
+
+    uri_string = librdf_uri_as_string(feature);
+    if(!uri_string)
+	return -1;
+
+    if(!strcmp((const char*)uri_string, CASSANDRA_FEATURE_PUBLISH)) {
+	unsigned char* dataset = 0;
+	if (value && librdf_node_is_literal(value))
+	    dataset = librdf_node_get_literal_value(value);
+	if (dataset == 0 || *dataset == 0)
+	    return 1;
+	return cassandra_dataset_publish(scontext, (const char*) dataset) ?
+	    1 : 0;
+    }
+
+    return -1;
+}
+
+
+/**
+ * librdf_storage_cassandra_transaction_start:
+ * @storage: #librdf_storage object
+ *
+ * Start a new transaction unless one is already active.
+ * 
+ * Return value: 0 if transaction successfully started, non-0 on error
+ * (including a transaction already active)
+ **/
+static int
+librdf_storage_cassandra_transaction_start(librdf_storage *storage)
+{
+
+    librdf_storage_cassandra_instance* context;
+
+    context = (librdf_storage_cassandra_instance*)storage->instance;
+
+    if (context->transaction)
+	return -1;
+
+    context->transaction = cassandra_writes_create(context->transaction_bytes);
+    if (context->transaction == 0)
+	return -1;
+
+    return 0;
+
+}
+
+
+/**
+ * librdf_storage_cassandra_transaction_commit:
+ * @storage: #librdf_storage object
+ *
+ * Commit an active transaction.
+ * 
+ * Return value: 0 if transaction successfully committed, non-0 on error
+ * (including no transaction active)
+ **/
+static int
+librdf_storage_cassandra_transaction_commit(librdf_storage *storage)
+{
+
+    librdf_storage_cassandra_instance* context;
+
+    context = (librdf_storage_cassandra_instance*)storage->instance;
+
+    cassandra_writes* writes = context->transaction;
+    if (writes == 0)
+	return -1;
+
+    context->transaction = 0;
+
+    /* A triple is either added or removed, so the adds go through the
+       write scheduler and the removals after, all in the write window
+       together. */
+    int count = cassandra_writes_count(writes);
+    int removes = 0;
+    int ret = 0;
+    int i;
+
+    cassandra_triple* removed =
+	LIBRDF_MALLOC(cassandra_triple*,
+		      (count ? count : 1) * sizeof(cassandra_triple));
+    if (!removed) {
+	cassandra_writes_free(writes);
+	return -1;
+    }
+
+    for(i = 0; i < count && ret == 0; i++) {
+
+	const char* s;
+	const char* p;
+	const char* o;
+	const char* c;
+
+	if (!cassandra_writes_at(writes, i, &s, &p, &o, &c)) {
+	    removed[removes].s = (char*) s;
+	    removed[removes].p = (char*) p;
+	    removed[removes].o = (char*) o;
+	    removed[removes].c = (char*) c;
+	    removes++;
+	    continue;
+	}
+
+	char* sc = strdup(s);
+	char* pc = strdup(p);
+	char* oc = strdup(o);
+	char* cc = c ? strdup(c) : 0;
+	if (!sc || !pc || !oc || (c && !cc)) {
+	    if (sc) free(sc);
+	    if (pc) free(pc);
+	    if (oc) free(oc);
+	    if (cc) free(cc);
+	    ret = -1;
+	    break;
+	}
+
+	if (cassandra_write_queue(context, sc, pc, oc, cc) < 0)
+	    ret = -1;
+
+    }
+
+    if (cassandra_write_flush(context) < 0)
+	ret = -1;
+
+    if (ret == 0 && cassandra_write_delete(context, removed, removes) < 0)
+	ret = -1;
+
+    if (cassandra_write_drain(context) < 0)
+	ret = -1;
+
+    LIBRDF_FREE(cassandra_triple*, removed);
+    cassandra_writes_free(writes);
+
+    return ret;
+
+}
+
+
+/**
+ * librdf_storage_cassandra_transaction_rollback:
+ * @storage: #librdf_storage object
+ *
+ * Roll back an active transaction.
+ * 
+ * Return value: 0 if transaction successfully rolled back, non-0 on error
+ * (including no transaction active)
+ **/
+static int
+librdf_storage_cassandra_transaction_rollback(librdf_storage *storage)
+{
+
+    librdf_storage_cassandra_instance* context;
+
+    context = (librdf_storage_cassandra_instance*)storage->instance;
+
+    if (context->transaction == 0)
+	return -1;
+
+    cassandra_writes_free(context->transaction);
+
+    context->transaction = 0;
+
+    return 0;
+
+}
+
+/* SPARQL queries whose WHERE clause is a basic graph pattern with
+   filters are evaluated here rather than by rasqal, which would run one
+   find_statements per pattern per binding.  The patterns are joined one
+   at a time, most selective first, against a table of partial
+   solutions: by a concurrent lookup per distinct binding of the shared
+   variables while the table is small (a bind join), otherwise by one
+   query whose rows are matched through a hash of the table (a hash
+   join). */
+
+/* librdf's rasqal query context, which is private to librdf.  The
+   parsed query is read from it, and the results are left in it for
+   librdf's query results functions.  Its layout is that of the librdf
+   version below, so queries are only evaluated here when built against
+   and running in that version. */
+#define CASSANDRA_RASQAL_CONTEXT_VERSION 10017
+
+#if defined(LIBRDF_VERSION_DECIMAL) && \
+    LIBRDF_VERSION_DECIMAL == CASSANDRA_RASQAL_CONTEXT_VERSION
+#define CASSANDRA_RASQAL_CONTEXT 1
+#endif
+
+typedef struct {
+    librdf_query* query;
+    librdf_model* model;
+    rasqal_query* rq;
+    rasqal_query_results* results;
+    char* language;
+    unsigned char* query_string;
+    librdf_uri* uri;
+    int errors;
+    int warnings;
+} cassandra_rasqal_context;
+
+/* A triple pattern.  Each position holds an encoded constant or the
+   index of a variable. */
+typedef struct {
+    char* terms[3];
+    int vars[3];		/* Variable index, or -1 */
+} cassandra_bgp_triple;
+
+/* An interned term. */
+typedef struct cassandra_bgp_term_str {
+    struct cassandra_bgp_term_str* next;
+    char text[1];
+} cassandra_bgp_term;
+
+/* A table of solutions, each of width terms, 0 for an unbound
+   variable. */
+typedef struct {
+    const char** rows;
+    size_t count;
+    size_t size;
+} cassandra_bgp_rows;
+
+/* The solutions sharing the same terms at a join's shared positions,
+   chained through a hash table. */
+typedef struct {
+    const char* key[3];
+    size_t first;
+    int next;
+} cassandra_bgp_group;
+
+typedef struct cassandra_bgp_str {
+
+    librdf_storage* storage;
+    librdf_storage_cassandra_instance* context;
+    rasqal_query* rq;
+
+    rasqal_variable* vars[CASSANDRA_BGP_MAX_VARIABLES];
+    int vars_count;
+    int bound[CASSANDRA_BGP_MAX_VARIABLES];
+
+    cassandra_bgp_triple triples[CASSANDRA_BGP_MAX_TRIPLES];
+    int triples_count;
+    int joined[CASSANDRA_BGP_MAX_TRIPLES];
+
+    rasqal_expression* filters[CASSANDRA_BGP_MAX_FILTERS];
+    int filters_count;
+
+    /* Whether a variable is projected or filtered on, so that its terms
+       are decoded. */
+    int used[CASSANDRA_BGP_MAX_VARIABLES];
+
+    cassandra_bgp_rows solutions;
+
+    /* Every term seen, interned so that rows compare terms by
+       address. */
+    cassandra_bgp_term** terms;
+    size_t terms_size;
+    size_t terms_count;
+
+    /* The current join's groups of solutions, and its hash table of
+       them. */
+    cassandra_bgp_group* groups;
+    int groups_count;
+    size_t* next_row;
+    int* buckets;
+    size_t buckets_size;
+
+} cassandra_bgp;
+
+static void
+cassandra_bgp_free(cassandra_bgp* bgp)
+{
+
+    int i, j;
+    size_t k;
+
+    for(i = 0; i < bgp->triples_count; i++)
+	for(j = 0; j < 3; j++)
+	    if (bgp->triples[i].terms[j])
+		free(bgp->triples[i].terms[j]);
+
+    for(k = 0; k < bgp->terms_size; k++)
+	while (bgp->terms[k]) {
+	    cassandra_bgp_term* next = bgp->terms[k]->next;
+	    free(bgp->terms[k]);
+	    bgp->terms[k] = next;
+	}
+
+    if (bgp->terms)
+	free(bgp->terms);
+    if (bgp->solutions.rows)
+	free(bgp->solutions.rows);
+    if (bgp->groups)
+	free(bgp->groups);
+    if (bgp->next_row)
+	free(bgp->next_row);
+    if (bgp->buckets)
+	free(bgp->buckets);
+
+    LIBRDF_FREE(cassandra_bgp*, bgp);
+
+}
+
+/* Returns the interned copy of the len byte term t. */
+static const char*
+cassandra_bgp_intern(cassandra_bgp* bgp, const char* t, size_t len)
+{
+
+    size_t i;
+
+    if (bgp->terms_count >= bgp->terms_size) {
+
+	size_t size = bgp->terms_size ? bgp->terms_size * 2 : 1024;
+	cassandra_bgp_term** terms = calloc(size, sizeof(*terms));
+	if (terms == 0)
+	    return 0;
+
+	for(i = 0; i < bgp->terms_size; i++)
+	    while (bgp->terms[i]) {
+		cassandra_bgp_term* term = bgp->terms[i];
+		uint64_t h = cassandra_bloom_hash(CASSANDRA_BLOOM_HASH_INIT,
+						  term->text,
+						  strlen(term->text));
+		bgp->terms[i] = term->next;
+		term->next = terms[h & (size - 1)];
+		terms[h & (size - 1)] = term;
+	    }
+
+	if (bgp->terms)
+	    free(bgp->terms);
+	bgp->terms = terms;
+	bgp->terms_size = size;
+
+    }
+
+    uint64_t h = cassandra_bloom_hash(CASSANDRA_BLOOM_HASH_INIT, t, len);
+    cassandra_bgp_term** bucket = &bgp->terms[h & (bgp->terms_size - 1)];
+
+    cassandra_bgp_term* term;
+    for(term = *bucket; term; term = term->next)
+	if (strncmp(term->text, t, len) == 0 && term->text[len] == 0)
+	    return term->text;
+
+    term = malloc(sizeof(cassandra_bgp_term) + len);
+    if (term == 0)
+	return 0;
+
+    memcpy(term->text, t, len);
+    term->text[len] = 0;
+    term->next = *bucket;
+    *bucket = term;
+    bgp->terms_count++;
+
+    return term->text;
+
+}
+
+/* Appends a row of width terms. */
+static int
+cassandra_bgp_rows_add(cassandra_bgp_rows* rows, int width,
+		       const char** row)
+{
+
+    if (rows->count >= CASSANDRA_BGP_MAX_ROWS) {
+	fprintf(stderr, "Cassandra: query has too many solutions\n");
 	return -1;
+    }
 
-    scontext->at_end = !cass_iterator_next(scontext->iter);
+    if (rows->count == rows->size) {
+	size_t size = rows->size ? rows->size * 2 : 256;
+	const char** r = realloc(rows->rows, size * (width ? width : 1) *
+				 sizeof(const char*));
+	if (r == 0)
+	    return -1;
+	rows->rows = r;
+	rows->size = size;
+    }
+
+    if (width)
+	memcpy(&rows->rows[rows->count * width], row,
+	       width * sizeof(const char*));
+    rows->count++;
 
     return 0;
 
 }
 
-
-static void*
-cassandra_results_stream_get_statement(void* context, int flags)
+/* Reads a query term into a triple pattern position.  Blank nodes and
+   other terms which can't be matched against the store are refused. */
+static int
+cassandra_bgp_term_add(cassandra_bgp* bgp, rasqal_literal* l,
+		       cassandra_bgp_triple* t, int pos)
 {
 
-    cassandra_results_stream* scontext;
-    const char* s;
-    size_t s_len;
-    const char* p;
-    size_t p_len;
-    const char* o;
-    size_t o_len;
-    const CassRow* row;
-	
-    scontext = (cassandra_results_stream*)context;
+    cassandra_term term;
+    raptor_uri* dt;
+    int i;
 
-    switch(flags) {
+    t->terms[pos] = 0;
+    t->vars[pos] = -1;
 
-    case LIBRDF_ITERATOR_GET_METHOD_GET_OBJECT:
+    switch(l->type) {
 
-	row = cass_iterator_get_row(scontext->iter);
+    case RASQAL_LITERAL_VARIABLE:
+	for(i = 0; i < bgp->vars_count; i++)
+	    if (bgp->vars[i] == l->value.variable)
+		break;
+	if (i == CASSANDRA_BGP_MAX_VARIABLES)
+	    return -1;
+	if (i == bgp->vars_count)
+	    bgp->vars[bgp->vars_count++] = l->value.variable;
+	t->vars[pos] = i;
+	return 0;
 
-	cass_value_get_string(cass_row_get_column(row, 0), &s, &s_len);
-	cass_value_get_string(cass_row_get_column(row, 1), &p, &p_len);
-	cass_value_get_string(cass_row_get_column(row, 2), &o, &o_len);
+    case RASQAL_LITERAL_URI:
+	term.type = LIBRDF_NODE_TYPE_RESOURCE;
+	term.value = (const char*) rasqal_literal_as_string(l);
+	term.datatype = 0;
+	term.language = 0;
+	break;
 
-	if (scontext->statement) {
-	    librdf_free_statement(scontext->statement);
-	    scontext->statement = 0;
-	}
+    case RASQAL_LITERAL_UNKNOWN:
+    case RASQAL_LITERAL_BLANK:
+    case RASQAL_LITERAL_QNAME:
+    case RASQAL_LITERAL_PATTERN:
+	return -1;
 
-	librdf_node* sn, * pn, * on;
-	sn = node_constructor_helper(scontext->storage->world, s, s_len);
-	pn = node_constructor_helper(scontext->storage->world, p, p_len);
-	on = node_constructor_helper(scontext->storage->world, o, o_len);
+    default:
+	dt = rasqal_literal_datatype(l);
+	term.type = LIBRDF_NODE_TYPE_LITERAL;
+	term.value = (const char*) rasqal_literal_as_string(l);
+	term.datatype = dt ? (const char*) raptor_uri_as_string(dt) : 0;
+	term.language = l->language;
+	break;
 
-	if (sn == 0 || pn == 0 || on == 0) {
-	    if (sn) librdf_free_node(sn);
-	    if (pn) librdf_free_node(pn);
-	    if (on) librdf_free_node(on);
-	    return 0;
-	}
+    }
 
-	scontext->statement =
-	    librdf_new_statement_from_nodes(scontext->storage->world,
-					    sn, pn, on);
+    if (term.value == 0)
+	return -1;
 
-	return scontext->statement;
+    t->terms[pos] = term_encode(bgp->context, &term, 1);
 
-    case LIBRDF_ITERATOR_GET_METHOD_GET_CONTEXT:
-	return scontext->context;
+    return t->terms[pos] ? 0 : -1;
+
+}
+
+/* Reads the triples and filters of a graph pattern, which may only be
+   a basic graph pattern, a filter, or a group of them.  A filter only
+   applies within its group, so filters are only taken from the top
+   group, where they apply to every triple; nested is set below it. */
+static int
+cassandra_bgp_collect(cassandra_bgp* bgp, rasqal_graph_pattern* gp,
+		      int nested)
+{
+
+    rasqal_expression* filter = rasqal_graph_pattern_get_filter_expression(gp);
+    rasqal_graph_pattern* sub;
+    rasqal_triple* triple;
+    int i;
+
+    if (filter) {
+	if (nested || bgp->filters_count == CASSANDRA_BGP_MAX_FILTERS)
+	    return -1;
+	bgp->filters[bgp->filters_count++] = filter;
+    }
+
+    switch(rasqal_graph_pattern_get_operator(gp)) {
+
+    case RASQAL_GRAPH_PATTERN_OPERATOR_BASIC:
+	for(i = 0; (triple = rasqal_graph_pattern_get_triple(gp, i)); i++) {
+	    if (triple->origin ||
+		bgp->triples_count == CASSANDRA_BGP_MAX_TRIPLES)
+		return -1;
+	    cassandra_bgp_triple* t = &bgp->triples[bgp->triples_count++];
+	    if (cassandra_bgp_term_add(bgp, triple->subject, t, 0) < 0 ||
+		cassandra_bgp_term_add(bgp, triple->predicate, t, 1) < 0 ||
+		cassandra_bgp_term_add(bgp, triple->object, t, 2) < 0)
+		return -1;
+	}
+	return 0;
+
+    case RASQAL_GRAPH_PATTERN_OPERATOR_GROUP:
+	for(i = 0; (sub = rasqal_graph_pattern_get_sub_graph_pattern(gp, i));
+	    i++)
+	    if (cassandra_bgp_collect(bgp, sub, nested ||
+				      rasqal_graph_pattern_get_operator(sub) ==
+				      RASQAL_GRAPH_PATTERN_OPERATOR_GROUP) < 0)
+		return -1;
+	return 0;
+
+    case RASQAL_GRAPH_PATTERN_OPERATOR_FILTER:
+	return 0;
 
     default:
-	librdf_log(scontext->storage->world,
-		   0, LIBRDF_LOG_ERROR, LIBRDF_FROM_STORAGE, NULL,
-		   "Unknown iterator method flag %d", flags);
-	return NULL;
+	return -1;
+
     }
-    
+
 }
 
-static void
-cassandra_results_stream_finished(void* context)
+/* Reads a query into a new BGP, or returns NULL if the query is not a
+   plain SELECT of a basic graph pattern with filters. */
+static cassandra_bgp*
+cassandra_bgp_new(librdf_storage* storage, librdf_query* query)
 {
 
-    cassandra_results_stream* scontext;
-    scontext = (cassandra_results_stream*)context;
+    librdf_storage_cassandra_instance* context;
+    cassandra_rasqal_context* qcontext;
+    rasqal_query* rq;
+    cassandra_bgp* bgp;
+    int i;
 
-    if (scontext->iter)
-	cass_iterator_free(scontext->iter);
+    context = (librdf_storage_cassandra_instance*)storage->instance;
 
-    if (scontext->result)
-	cass_result_free(scontext->result);
+    if (!context->query_pushdown || !query->factory ||
+	strncmp(query->factory->name, "sparql", 6))
+	return NULL;
 
-    if (scontext->stmt)
-	cass_statement_free(scontext->stmt);
-	
-    if(scontext->storage)
-	librdf_storage_remove_reference(scontext->storage);
+#ifdef CASSANDRA_RASQAL_CONTEXT
+    if (librdf_version_decimal != CASSANDRA_RASQAL_CONTEXT_VERSION)
+	return NULL;
+#else
+    return NULL;
+#endif
 
-    if(scontext->statement)
-	librdf_free_statement(scontext->statement);
+    /* The context is only trusted to be librdf's rasqal context if it
+       points back at the query. */
+    qcontext = (cassandra_rasqal_context*) query->context;
+    if (qcontext == 0 || qcontext->query != query)
+	return NULL;
+    rq = qcontext->rq;
+    if (rq == 0)
+	return NULL;
 
-    if(scontext->context)
-	librdf_free_node(scontext->context);
+    if (rasqal_query_get_verb(rq) != RASQAL_QUERY_VERB_SELECT ||
+	rasqal_query_get_distinct(rq) ||
+	rasqal_query_get_data_graph(rq, 0) ||
+	rasqal_query_get_order_condition(rq, 0) ||
+	rasqal_query_get_group_condition(rq, 0) ||
+	rasqal_query_get_having_condition(rq, 0) ||
+	!rasqal_query_get_query_graph_pattern(rq))
+	return NULL;
 
-    LIBRDF_FREE(librdf_storage_cassandra_find_statements_stream_context, scontext);
+    /* Only plain variables are projected. */
+    raptor_sequence* projection = rasqal_query_get_bound_variable_sequence(rq);
+    for(i = 0; projection && i < raptor_sequence_size(projection); i++) {
+	rasqal_variable* v =
+	    (rasqal_variable*) raptor_sequence_get_at(projection, i);
+	if (v->expression)
+	    return NULL;
+    }
+
+    bgp = LIBRDF_CALLOC(cassandra_bgp*, 1, sizeof(*bgp));
+    if (!bgp)
+	return NULL;
+
+    bgp->storage = storage;
+    bgp->context = context;
+    bgp->rq = rq;
+
+    if (cassandra_bgp_collect(bgp, rasqal_query_get_query_graph_pattern(rq),
+			      0) < 0 ||
+	bgp->triples_count == 0) {
+	cassandra_bgp_free(bgp);
+	return NULL;
+    }
+
+    return bgp;
 
 }
 
-static librdf_stream*
-librdf_storage_cassandra_serialise(librdf_storage* storage)
+/* Picks the next pattern to join: the one with the most selective
+   fixed positions, preferring patterns connected to those already
+   joined.  A fixed subject narrows a pattern most and a fixed predicate
+   least, as stores hold few distinct predicates. */
+static int
+cassandra_bgp_next(cassandra_bgp* bgp)
 {
 
-    librdf_statement* stmt = 
-	    librdf_new_statement_from_nodes(storage->world,
-					    0, 0, 0);
+    static const int weight[3] = { 4, 1, 2 };
+    int best = -1, best_score = 0;
+    int any_joined = 0;
+    int i, j;
 
-    librdf_stream* strm = librdf_storage_cassandra_find_statements(storage,
-								   stmt);
+    for(i = 0; i < bgp->triples_count; i++)
+	if (bgp->joined[i])
+	    any_joined = 1;
 
-    librdf_free_statement(stmt);
+    for(i = 0; i < bgp->triples_count; i++) {
 
-    return strm;
+	if (bgp->joined[i])
+	    continue;
+
+	cassandra_bgp_triple* t = &bgp->triples[i];
+	int score = 0, connected = 0;
+
+	for(j = 0; j < 3; j++) {
+	    if (t->terms[j])
+		score += weight[j];
+	    if (t->vars[j] >= 0 && bgp->bound[t->vars[j]]) {
+		score += weight[j];
+		connected = 1;
+	    }
+	}
+
+	/* A pattern sharing nothing is a cross product. */
+	if (any_joined && !connected)
+	    score -= 100;
+
+	if (best < 0 || score > best_score) {
+	    best = i;
+	    best_score = score;
+	}
+
+    }
+
+    return best;
 
 }
 
+static uint64_t
+cassandra_bgp_key_hash(const char* const* key, int shared)
+{
 
-/**
- * librdf_storage_cassandra_find_statements:
- * @storage: the storage
- * @statement: the statement to match
- *
- * .
- * 
- * Return a stream of statements matching the given statement (or
- * all statements if NULL).  Parts (subject, predicate, object) of the
- * statement can be empty in which case any statement part will match that.
- * Uses #librdf_statement_match to do the matching.
- * 
- * Return value: a #librdf_stream or NULL on failure
- **/
-static librdf_stream*
-librdf_storage_cassandra_find_statements(librdf_storage* storage,
-					 librdf_statement* statement)
+    uint64_t h = CASSANDRA_BLOOM_HASH_INIT;
+    int j;
+
+    for(j = 0; j < 3; j++)
+	if (shared & (1 << j))
+	    h = cassandra_bloom_hash(h, (const char*) &key[j], sizeof(key[j]));
+
+    return h;
+
+}
+
+/* Returns the group of solutions holding key at the shared positions,
+   or -1. */
+static int
+cassandra_bgp_group_find(cassandra_bgp* bgp, const char* const* key,
+			 int shared)
 {
-  
-    librdf_storage_cassandra_instance* context;
-    cassandra_results_stream* scontext;
-    librdf_stream* stream;
-    char* s;
-    char* p;
-    char* o;
-    char* c;
-    
-    context = (librdf_storage_cassandra_instance*)storage->instance;
 
-    scontext =
-	LIBRDF_CALLOC(cassandra_results_stream*, 1, sizeof(*scontext));
-    if(!scontext)
-	return NULL;
+    uint64_t h = cassandra_bgp_key_hash(key, shared);
+    int g;
+    int j;
+
+    for(g = bgp->buckets[h & (bgp->buckets_size - 1)]; g >= 0;
+	g = bgp->groups[g].next) {
+	for(j = 0; j < 3; j++)
+	    if ((shared & (1 << j)) && bgp->groups[g].key[j] != key[j])
+		break;
+	if (j == 3)
+	    return g;
+    }
 
-    scontext->storage = storage;
-    librdf_storage_add_reference(scontext->storage);
+    return -1;
 
-    scontext->cassandra_context = context;
+}
 
-    statement_helper(storage, statement, 0, &s, &p, &o, &c);
+/* Groups the solutions by their terms at the shared positions of
+   triple pattern t. */
+static int
+cassandra_bgp_group_rows(cassandra_bgp* bgp, cassandra_bgp_triple* t,
+			 int shared)
+{
 
-#ifdef DEBUG
-    fprintf(stderr, "Query: ");
-    if (s)
-      fprintf(stderr, "s=%s ", s);
-    if (p)
-      fprintf(stderr, "p=%s ", p);
-    if (o)
-      fprintf(stderr, "o=%s ", o);
-    fprintf(stderr, "\n");
-#endif
-    
-    typedef CassStatement* (*query_function)(const char* s, const char* p,
-					     const char* o);
-
-    query_function functions[8] = {
-	&cassandra_query_,	/* ??? */
-	&cassandra_query_s,	/* S?? */
-	&cassandra_query_p,	/* ?P? */
-	&cassandra_query_sp,	/* SP? */
-	&cassandra_query_o,	/* ??O */
-	&cassandra_query_so,	/* S?O */
-	&cassandra_query_po,	/* ?PO */
-	&cassandra_query_spo	/* SPO */
-    };
+    size_t count = bgp->solutions.count;
+    size_t size = 1;
+    size_t r;
+    int j;
 
-    /* This creates an index into the function table, depending on input
-       terms. */
-    int num = 0;
-    if (o) num += 4;
-    if (p) num += 2;
-    if (s) num++;
+    while (size < 2 * count)
+	size *= 2;
 
-    index_type tp;
-    
-    query_function fn = functions[num];
+    if (bgp->groups) free(bgp->groups);
+    if (bgp->next_row) free(bgp->next_row);
+    if (bgp->buckets) free(bgp->buckets);
 
-    CassStatement* stmt = (*fn)(s, p, o);
-    cass_statement_set_paging_size(stmt, 1000);
+    bgp->groups = malloc(count * sizeof(cassandra_bgp_group));
+    bgp->next_row = malloc(count * sizeof(size_t));
+    bgp->buckets = malloc(size * sizeof(int));
+    bgp->buckets_size = size;
+    bgp->groups_count = 0;
+    if (!bgp->groups || !bgp->next_row || !bgp->buckets)
+	return -1;
 
-    if (s) free(s);
-    if (p) free(p);
-    if (o) free(o);
+    memset(bgp->buckets, 0xff, size * sizeof(int));
 
-    CassFuture* future = cass_session_execute(context->session, stmt);
+    /* Rows are added in reverse so that each group lists its rows in
+       their original order. */
+    for(r = count; r-- > 0; ) {
 
-    CassError rc = cass_future_error_code(future);
+	const char** row = &bgp->solutions.rows[r * bgp->vars_count];
+	const char* key[3] = { 0, 0, 0 };
+	for(j = 0; j < 3; j++)
+	    if (shared & (1 << j))
+		key[j] = row[t->vars[j]];
+
+	int g = cassandra_bgp_group_find(bgp, key, shared);
+
+	if (g < 0) {
+	    uint64_t h = cassandra_bgp_key_hash(key, shared);
+	    g = bgp->groups_count++;
+	    memcpy(bgp->groups[g].key, key, sizeof(key));
+	    bgp->groups[g].first = (size_t) -1;
+	    bgp->groups[g].next = bgp->buckets[h & (size - 1)];
+	    bgp->buckets[h & (size - 1)] = g;
+	}
+
+	bgp->next_row[r] = bgp->groups[g].first;
+	bgp->groups[g].first = r;
 
-    if (rc != CASS_OK) {
-	fprintf(stderr, "Cassandra: %s\n", cass_error_desc(rc));
-	const char* msg;
-	size_t msg_len;
-	cass_future_error_message(future, &msg, &msg_len);
-	fprintf(stderr, "Cassandra: %*s\n", msg_len, msg);
-	cass_future_free(future);
-	return 0;
     }
 
-    const CassResult* result = cass_future_get_result(future);
+    return 0;
 
-    cass_future_free(future);
+}
 
-    CassIterator* iter = cass_iterator_from_result(result);
-    
-    scontext->stmt = stmt;
-    scontext->result = result;
-    scontext->iter = iter;
+/* Extends each solution of a group with a matching triple, adding those
+   which agree with it to out. */
+static int
+cassandra_bgp_extend(cassandra_bgp* bgp, cassandra_bgp_rows* out,
+		     cassandra_bgp_triple* t, int g,
+		     const char* const* terms)
+{
 
-    scontext->more_pages = cass_result_has_more_pages(result);
+    const char* row[CASSANDRA_BGP_MAX_VARIABLES];
+    size_t r;
+    int j;
 
-    scontext->at_end = !cass_iterator_next(scontext->iter);
+    for(r = bgp->groups[g].first; r != (size_t) -1; r = bgp->next_row[r]) {
+
+	if (bgp->vars_count)
+	    memcpy(row, &bgp->solutions.rows[r * bgp->vars_count],
+		   bgp->vars_count * sizeof(const char*));
+
+	/* A variable may repeat within the pattern. */
+	for(j = 0; j < 3; j++) {
+	    int v = t->vars[j];
+	    if (v < 0)
+		continue;
+	    if (row[v] && row[v] != terms[j])
+		break;
+	    row[v] = terms[j];
+	}
+
+	if (j == 3 && cassandra_bgp_rows_add(out, bgp->vars_count, row) < 0)
+	    return -1;
 
-    stream =
-	librdf_new_stream(storage->world,
-			  (void*)scontext,
-			  &cassandra_results_stream_end_of_stream,
-			  &cassandra_results_stream_next_statement,
-			  &cassandra_results_stream_get_statement,
-			  &cassandra_results_stream_finished);
-    if(!stream) {
-	cassandra_results_stream_finished((void*)scontext);
-	return NULL;
     }
-  
-    return stream;
-    
+
+    return 0;
+
 }
 
-/**
- * librdf_storage_cassandra_context_add_statement:
- * @storage: #librdf_storage object
- * @context_node: #librdf_node object
- * @statement: #librdf_statement statement to add
- *
- * Add a statement to a storage context.
- * 
- * Return value: non 0 on failure
- **/
-static int
-librdf_storage_cassandra_context_add_statement(librdf_storage* storage,
-                                            librdf_node* context_node,
-                                            librdf_statement* statement) 
+/* Reads every row of a scan, extending the solutions they match. */
+static int
+cassandra_bgp_fetch(cassandra_bgp* bgp, cassandra_scan_stream* scontext,
+		    cassandra_bgp_triple* t, int shared,
+		    cassandra_bgp_rows* out)
 {
 
-    char* s;
-    char* p;
-    char* o;
-    char* c;
+    librdf_storage_cassandra_instance* context = bgp->context;
+    int i, j;
 
-    statement_helper(storage, statement, context_node, &s, &p, &o, &c);
+    for(i = 0; i < scontext->parallelism; i++)
+	if (cassandra_scan_start(scontext) < 0)
+	    return -1;
 
-    librdf_storage_cassandra_instance* context; 
-    context = (librdf_storage_cassandra_instance*)storage->instance;
+    scontext->at_end = 1;
 
-    char* query =
-	"BEGIN BATCH "
-	"  INSERT INTO rdf.spo (s, p, o) VALUES (?, ?, ?);" 
-	"  INSERT INTO rdf.pos (s, p, o) VALUES (?, ?, ?);"
-	"  INSERT INTO rdf.osp (s, p, o) VALUES (?, ?, ?);"
-	"APPLY BATCH;";
-    CassStatement* stmt = cass_statement_new(query, 9);
-    cass_statement_bind_string(stmt, 0, s);
-    cass_statement_bind_string(stmt, 1, p);
-    cass_statement_bind_string(stmt, 2, o);
-    cass_statement_bind_string(stmt, 3, s);
-    cass_statement_bind_string(stmt, 4, p);
-    cass_statement_bind_string(stmt, 5, o);
-    cass_statement_bind_string(stmt, 6, s);
-    cass_statement_bind_string(stmt, 7, p);
-    cass_statement_bind_string(stmt, 8, o);
+    while (1) {
 
-    if (s) free(s);
-    if (p) free(p);
-    if (o) free(o);
+	if (cassandra_scan_next_page(scontext) < 0)
+	    return -1;
 
-    CassFuture* future = cass_session_execute(context->session, stmt);
-    cass_statement_free(stmt);
+	if (scontext->at_end)
+	    return 0;
 
-    CassError rc = cass_future_error_code(future);
+	const CassRow* row = cass_iterator_get_row(scontext->iter);
+	const char* terms[3];
 
-    if (rc != CASS_OK) {
-	fprintf(stderr, "Cassandra: %s\n", cass_error_desc(rc));
-	const char* msg;
-	size_t msg_len;
-	cass_future_error_message(future, &msg, &msg_len);
-	fprintf(stderr, "Cassandra: %*s\n", msg_len, msg);
-	cass_future_free(future);
-	return -1;
+	/* Each term is interned before the next is fetched, as a fetch
+	   can evict the previous term from the dictionary cache. */
+	for(j = 0; j < 3; j++) {
+	    const char* term;
+	    size_t len;
+	    if (cassandra_row_term(context, row, j, &term, &len) < 0)
+		return -1;
+	    terms[j] = cassandra_bgp_intern(bgp, term, len);
+	    if (terms[j] == 0)
+		return -1;
+	}
 
-    }
-    
-    cass_future_free(future);
+	int g = cassandra_bgp_group_find(bgp, terms, shared);
+	if (g >= 0 && cassandra_bgp_extend(bgp, out, t, g, terms) < 0)
+	    return -1;
 
-    return 0;
+	scontext->at_end = !cass_iterator_next(scontext->iter);
 
-}
+    }
 
+}
 
-/**
- * librdf_storage_cassandra_context_remove_statement:
- * @storage: #librdf_storage object
- * @context_node: #librdf_node object
- * @statement: #librdf_statement statement to remove
- *
- * Remove a statement from a storage context.
- * 
- * Return value: non 0 on failure
- **/
+/* Whether expression e is variable v of the BGP. */
 static int
-librdf_storage_cassandra_context_remove_statement(librdf_storage* storage, 
-                                               librdf_node* context_node,
-                                               librdf_statement* statement) 
+cassandra_bgp_is_var(cassandra_bgp* bgp, rasqal_expression* e, int v)
 {
+    return e->op == RASQAL_EXPR_LITERAL &&
+	e->literal->type == RASQAL_LITERAL_VARIABLE &&
+	e->literal->value.variable == bgp->vars[v];
+}
 
-#ifdef BROKEN
-    librdf_storage_cassandra_instance* context; 
-    context = (librdf_storage_cassandra_instance*)storage->instance;
+/* Finds bounds which filter e puts on variable v, from comparisons of v
+   with a constant which must hold: at the top of the filter, or under
+   &&.  bounds[0] is the lower bound and bounds[1] the upper, each used
+   if its has flag is set.  The filters are still applied to the
+   solutions, so bounds only have to let every match through. */
+static void
+cassandra_bgp_bounds(cassandra_bgp* bgp, rasqal_expression* e, int v,
+		     cassandra_range_bound* bounds, int* has)
+{
 
-    char* s;
-    char* p;
-    char* o;
-    char* c;
+    rasqal_expression* var = e->arg1;
+    rasqal_expression* constant = e->arg2;
+    rasqal_op op = e->op;
 
-    statement_helper(storage, statement, context_node, &s, &p, &o, &c);
+    if (op == RASQAL_EXPR_AND) {
+	cassandra_bgp_bounds(bgp, e->arg1, v, bounds, has);
+	cassandra_bgp_bounds(bgp, e->arg2, v, bounds, has);
+	return;
+    }
 
-    int are_spo, filter;
-    char* path;
-    
-    cassandra_query* qry = cassandra_query_spo(s, p, o, &are_spo, &filter, &path);
+    if (op != RASQAL_EXPR_EQ && op != RASQAL_EXPR_LT &&
+	op != RASQAL_EXPR_GT && op != RASQAL_EXPR_LE &&
+	op != RASQAL_EXPR_GE)
+	return;
 
-    cassandra_results* res = cassandra_find(context->comms, path, qry);
-    if (res == 0) {
-        free(s); free(p); free(o); free(c);
-	cassandra_query_free(qry);
-	fprintf(stderr, "Query execute failed.\n");
-	exit(1);
+    /* Put the variable on the left. */
+    if (!cassandra_bgp_is_var(bgp, var, v)) {
+	var = e->arg2;
+	constant = e->arg1;
+	if (op == RASQAL_EXPR_LT) op = RASQAL_EXPR_GT;
+	else if (op == RASQAL_EXPR_GT) op = RASQAL_EXPR_LT;
+	else if (op == RASQAL_EXPR_LE) op = RASQAL_EXPR_GE;
+	else if (op == RASQAL_EXPR_GE) op = RASQAL_EXPR_LE;
     }
 
-    cassandra_query_free(qry);
+    if (!cassandra_bgp_is_var(bgp, var, v) ||
+	constant->op != RASQAL_EXPR_LITERAL)
+	return;
 
-    if (json_object_array_length(res) < 1) {
-	free(s); free(p); free(o); free(c);
-	cassandra_results_free(res);
-	return -1;
-    }
+    raptor_uri* dt = rasqal_literal_datatype(constant->literal);
+    const char* value =
+	(const char*) rasqal_literal_as_string(constant->literal);
+    cassandra_range_bound b;
+    if (dt == 0 || value == 0 ||
+	cassandra_range_bound_read((const char*) raptor_uri_as_string(dt),
+				   value, op != RASQAL_EXPR_LT &&
+				   op != RASQAL_EXPR_GT, &b) < 0)
+	return;
 
-    json_object* obj = json_object_array_get_idx(res, 0);
-    if (obj == 0) {
-	free(s); free(p); free(o); free(c);
-	cassandra_results_free(res);
-	return -1;
+    if (!has[0] && op != RASQAL_EXPR_LT && op != RASQAL_EXPR_LE) {
+	bounds[0] = b;
+	has[0] = 1;
     }
-
-    if (!json_object_object_get_ex(obj, "properties", &obj)) {
-	free(s); free(p); free(o); free(c);
-	cassandra_results_free(res);
-	return -1;
+    if (!has[1] && op != RASQAL_EXPR_GT && op != RASQAL_EXPR_GE) {
+	bounds[1] = b;
+	has[1] = 1;
     }
 
-    if (!json_object_object_get_ex(obj, "name", &obj)) {
-	free(s); free(p); free(o); free(c);
-	cassandra_results_free(res);
-	return -1;
-    }
+}
 
-    if (!json_object_object_get_ex(obj,
-				   "cassandra.function.simple.types.FreqMap",
-				   &obj)) {
-	free(s); free(p); free(o); free(c);
-	cassandra_results_free(res);
-	return -1;
+/* Joins triple pattern i into the solutions. */
+static int
+cassandra_bgp_join(cassandra_bgp* bgp, int i)
+{
+
+    librdf_storage_cassandra_instance* context = bgp->context;
+    cassandra_bgp_triple* t = &bgp->triples[i];
+    cassandra_scan_stream* scontext;
+    cassandra_bgp_rows out = { 0, 0, 0 };
+    int fixed = 0, shared = 0;
+    int g, j;
+
+    for(j = 0; j < 3; j++) {
+	if (t->terms[j])
+	    fixed |= 1 << j;
+	if (t->vars[j] >= 0 && bgp->bound[t->vars[j]])
+	    shared |= 1 << j;
     }
-      
-    if (!json_object_object_get_ex(obj, p, &obj)) {
-	free(s); free(p); free(o); free(c);
-	cassandra_results_free(res);
+
+    if (cassandra_bgp_group_rows(bgp, t, shared) < 0)
 	return -1;
-    }
 
-    /* This is the value in the freq map. */
-    int weight = json_object_get_int(obj);
+    /* Each group's terms fill the shared positions of one lookup, while
+       the groups are few enough. */
+    int bind = shared && bgp->groups_count <= context->bind_join_limit;
+
+    /* A pattern with only its predicate fixed reads just the objects
+       the filters allow, when literals are sortable, and the objects
+       without a sortable encoding, which the filters then check. */
+    cassandra_range_bound bounds[2];
+    int has[2] = { 0, 0 };
+    if (!bind && fixed == 2 && t->vars[2] >= 0 && context->sortable &&
+	!context->dict)
+	for(g = 0; g < bgp->filters_count; g++)
+	    cassandra_bgp_bounds(bgp, bgp->filters[g], t->vars[2],
+				 bounds, has);
+    if (has[0] && has[1] &&
+	(bounds[0].type == 'd') != (bounds[1].type == 'd'))
+	has[1] = 0;
+
+    if (has[0] || has[1]) {
+
+	scontext = cassandra_range_stream_alloc(bgp->storage, t->terms[1],
+						has[0] ? &bounds[0] : 0,
+						has[1] ? &bounds[1] : 0, 1);
+	if (!scontext)
+	    return -1;
+
+    } else if (!bind && fixed == 0 && context->scan_parallelism > 1) {
 
-    cassandra_results_free(res);
+	scontext = cassandra_scan_stream_ranges(bgp->storage);
+	if (!scontext)
+	    return -1;
 
-    cassandra_elements* elts = cassandra_elements_create();
+    } else {
 
-    /* Create S,O -> P */
-    cassandra_add_edge_object(elts, p, s, o, "@r", -weight);
+	scontext = cassandra_scan_stream_alloc(bgp->storage,
+					       bind ? bgp->groups_count : 1,
+					       context->lookup_parallelism);
+	if (!scontext)
+	    return -1;
 
-    /* Create S,P -> O */
-    cassandra_add_edge_object(elts, o, s, p, "@n", -weight);
+	scontext->pattern = fixed | (bind ? shared : 0);
+	scontext->id = (cassandra_statement_id) scontext->pattern;
+	context->last_pattern = scontext->pattern;
 
-    free(s); free(p); free(o); free(c);
+	for(g = 0; g < (bind ? bgp->groups_count : 1); g++) {
 
-    int ret = cassandra_add_elements(context->comms, elts);
+	    char* terms[3];
+	    int missing = 0;
 
-    cassandra_elements_free(elts);
+	    for(j = 0; j < 3; j++) {
+		terms[j] = 0;
+		if (fixed & (1 << j))
+		    terms[j] = strdup(t->terms[j]);
+		else if (bind && (shared & (1 << j)))
+		    terms[j] = strdup(bgp->groups[g].key[j]);
+		if ((scontext->pattern & (1 << j)) && terms[j] == 0)
+		    missing = -1;
+	    }
 
-    if (ret < 0)
+	    /* Lookups which can't match anything are left out. */
+	    if (missing == 0)
+		missing = cassandra_lookup_empty(context, terms);
+
+	    if (missing) {
+		for(j = 0; j < 3; j++)
+		    if (terms[j]) free(terms[j]);
+		if (missing > 0)
+		    continue;
+		cassandra_scan_stream_finished((void*)scontext);
+		return -1;
+	    }
+
+	    int rc = cassandra_scan_lookup(scontext, g, terms);
+
+	    for(j = 0; j < 3; j++)
+		if (terms[j]) free(terms[j]);
+
+	    if (rc < 0) {
+		cassandra_scan_stream_finished((void*)scontext);
+		return -1;
+	    }
+
+	}
+
+    }
+
+    int rc = cassandra_bgp_fetch(bgp, scontext, t, shared, &out);
+
+    cassandra_scan_stream_finished((void*)scontext);
+
+    if (rc < 0) {
+	if (out.rows)
+	    free(out.rows);
 	return -1;
+    }
 
-    return 0;
+    if (bgp->solutions.rows)
+	free(bgp->solutions.rows);
+    bgp->solutions = out;
+
+    bgp->joined[i] = 1;
+    for(j = 0; j < 3; j++)
+	if (t->vars[j] >= 0)
+	    bgp->bound[t->vars[j]] = 1;
 
+#ifdef DEBUG
+    fprintf(stderr, "Join: pattern %d %s%s groups=%d solutions=%lu\n", i,
+	    bind ? "bind" : "hash", (has[0] || has[1]) ? " range" : "",
+	    bgp->groups_count,
+	    (unsigned long) bgp->solutions.count);
 #endif
-}
 
+    return 0;
 
-static  int
-librdf_storage_cassandra_context_remove_statements(librdf_storage* storage, 
-                                                librdf_node* context_node)
+}
+
+/* Returns the rasqal literal of an encoded term. */
+static rasqal_literal*
+cassandra_bgp_value(cassandra_bgp* bgp, const char* term)
 {
 
-    //FIXME: Not implemented.
+    librdf_node* node =
+	node_constructor_helper(bgp->context, term, strlen(term));
+    if (node == 0)
+	return 0;
 
-    return -1;
+    rasqal_literal* l = redland_node_to_rasqal_literal(bgp->storage->world,
+						       node);
+    librdf_free_node(node);
+
+    return l;
 
 }
 
-/**
- * librdf_storage_cassandra_context_serialise:
- * @storage: #librdf_storage object
- * @context_node: #librdf_node object
- *
- * Cassandra all statements in a storage context.
- * 
- * Return value: #librdf_stream of statements or NULL on failure or context is empty
- **/
-static librdf_stream*
-librdf_storage_cassandra_context_serialise(librdf_storage* storage,
-                                        librdf_node* context_node) 
+/* Marks the variables a filter expression refers to as used. */
+static int
+cassandra_bgp_mark_used(void* user_data, rasqal_expression* e)
 {
 
-    //FIXME: Not implemented.
+    cassandra_bgp* bgp = (cassandra_bgp*) user_data;
+    int v;
+
+    for(v = 0; v < bgp->vars_count; v++)
+	if (cassandra_bgp_is_var(bgp, e, v))
+	    bgp->used[v] = 1;
 
     return 0;
 
 }
 
-/**
- * librdf_storage_cassandra_context_get_contexts:
- * @storage: #librdf_storage object
- *
- * Cassandra all context nodes in a storage.
- * 
- * Return value: #librdf_iterator of context_nodes or NULL on failure or no contexts
- **/
-static librdf_iterator*
-librdf_storage_cassandra_get_contexts(librdf_storage* storage) 
+/* Binds the query's variables to a solution and tests it against the
+   filters.  Returns 1 if it passes, 0 if not, or -1 on failure. */
+static int
+cassandra_bgp_filter(cassandra_bgp* bgp, rasqal_evaluation_context* eval,
+		     const char** row)
 {
-    // FIXME: Not implemented.
 
-    return 0;
+    int i;
+
+    for(i = 0; i < bgp->vars_count; i++) {
+	rasqal_literal* l = 0;
+	if (row[i] && bgp->used[i]) {
+	    l = cassandra_bgp_value(bgp, row[i]);
+	    if (l == 0)
+		return -1;
+	}
+	rasqal_variable_set_value(bgp->vars[i], l);
+    }
+
+    /* A filter which raises an error rejects the solution. */
+    for(i = 0; i < bgp->filters_count; i++) {
+	int error = 0;
+	rasqal_literal* l =
+	    rasqal_expression_evaluate2(bgp->filters[i], eval, &error);
+	int pass = 0;
+	if (l && !error)
+	    pass = rasqal_literal_as_boolean(l, &error) && !error;
+	if (l)
+	    rasqal_free_literal(l);
+	if (!pass)
+	    return 0;
+    }
+
+    return 1;
 
 }
 
-/**
- * librdf_storage_cassandra_get_feature:
- * @storage: #librdf_storage object
- * @feature: #librdf_uri feature property
- *
- * Get the value of a storage feature.
- * 
- * Return value: #librdf_node feature value or NULL if no such feature
- * exists or the value is empty.
- **/
-static librdf_node*
-librdf_storage_cassandra_get_feature(librdf_storage* storage, librdf_uri* feature)
+/* Builds the query results from the solutions, applying the filters,
+   offset and limit. */
+static rasqal_query_results*
+cassandra_bgp_results(cassandra_bgp* bgp)
 {
-    /* librdf_storage_cassandra_instance* scontext; */
-    unsigned char *uri_string;
 
-    /* scontext = (librdf_storage_cassandra_instance*)storage->instance; */
-
-    if(!feature)
+    rasqal_world* world = librdf_world_get_rasqal(bgp->storage->world);
+    raptor_sequence* projection =
+	rasqal_query_get_bound_variable_sequence(bgp->rq);
+    int size = projection ? raptor_sequence_size(projection) : 0;
+    int limit = rasqal_query_get_limit(bgp->rq);
+    int offset = rasqal_query_get_offset(bgp->rq);
+    int count = 0, skipped = 0;
+    int failed = 0;
+    size_t r;
+    int i;
+
+    rasqal_query_results* results =
+	rasqal_new_query_results2(world, bgp->rq,
+				  RASQAL_QUERY_RESULTS_BINDINGS);
+    rasqal_evaluation_context* eval =
+	rasqal_new_evaluation_context(world, NULL, 0);
+    if (!results || !eval) {
+	if (results)
+	    rasqal_free_query_results(results);
+	if (eval)
+	    rasqal_free_evaluation_context(eval);
 	return NULL;
+    }
 
-    uri_string = librdf_uri_as_string(feature);
-    if(!uri_string)
-	return NULL;
+    for(i = 0; i < size; i++)
+	rasqal_variable_set_value((rasqal_variable*)
+				  raptor_sequence_get_at(projection, i), 0);
+
+    /* Only the terms of used variables are decoded, so literals which are
+       never looked at are never decompressed. */
+    for(i = 0; i < bgp->vars_count; i++) {
+	int j;
+	bgp->used[i] = 0;
+	for(j = 0; j < size; j++)
+	    if (raptor_sequence_get_at(projection, j) == bgp->vars[i])
+		bgp->used[i] = 1;
+    }
+    for(i = 0; i < bgp->filters_count; i++)
+	rasqal_expression_visit(bgp->filters[i], &cassandra_bgp_mark_used, bgp);
+
+    for(r = 0; r < bgp->solutions.count; r++) {
+
+	if (limit >= 0 && count >= limit)
+	    break;
+
+	int pass = cassandra_bgp_filter(bgp, eval,
+					&bgp->solutions.rows[r *
+							     bgp->vars_count]);
+	if (pass < 0) {
+	    failed = 1;
+	    break;
+	}
+	if (pass == 0)
+	    continue;
+
+	if (skipped < offset) {
+	    skipped++;
+	    continue;
+	}
+
+	rasqal_row* row = rasqal_new_row_for_size(world, size);
+	if (row == 0) {
+	    failed = 1;
+	    break;
+	}
+
+	for(i = 0; i < size; i++) {
+	    rasqal_variable* v =
+		(rasqal_variable*) raptor_sequence_get_at(projection, i);
+	    if (v->value)
+		rasqal_row_set_value_at(row, i, v->value);
+	}
+
+	rasqal_query_results_add_row(results, row);
+	count++;
 
-    // FIXME: This is a lie.  Contexts not implemented. :-/
-    if(!strcmp((const char*)uri_string, LIBRDF_MODEL_FEATURE_CONTEXTS)) {
-	return librdf_new_node_from_typed_literal(storage->world,
-						  (const unsigned char*)"1",
-						  NULL, NULL);
     }
 
-    return NULL;
-}
+    for(i = 0; i < bgp->vars_count; i++)
+	rasqal_variable_set_value(bgp->vars[i], 0);
 
+    rasqal_free_evaluation_context(eval);
+
+    if (failed) {
+	rasqal_free_query_results(results);
+	return NULL;
+    }
+
+    return results;
+
+}
 
-/**
- * librdf_storage_cassandra_transaction_start:
- * @storage: #librdf_storage object
- *
- * Start a new transaction unless one is already active.
- * 
- * Return value: 0 if transaction successfully started, non-0 on error
- * (including a transaction already active)
- **/
 static int
-librdf_storage_cassandra_transaction_start(librdf_storage *storage)
+librdf_storage_cassandra_supports_query(librdf_storage* storage,
+					librdf_query* query)
 {
-#ifdef BROKEN
 
     librdf_storage_cassandra_instance* context;
-
     context = (librdf_storage_cassandra_instance*)storage->instance;
 
-    /* If already have a trasaction, silently do nothing. */
+    /* Joins read stored triples only, so a transaction's writes are seen
+       through rasqal's finds. */
     if (context->transaction)
 	return 0;
 
-    context->transaction = cassandra_elements_create();
-    if (context->transaction == 0)
-	return -1;
+    /* librdf executes a query straight after asking, so the BGP is kept
+       for query_execute rather than read again. */
+    if (context->query_bgp) {
+	cassandra_bgp_free(context->query_bgp);
+	context->query_bgp = 0;
+	context->query_bgp_query = 0;
+    }
 
-    return 0;
-#endif
+    cassandra_bgp* bgp = cassandra_bgp_new(storage, query);
 
-}
+    if (bgp == 0)
+	return 0;
 
+    context->query_bgp = bgp;
+    context->query_bgp_query = query;
 
-/**
- * librdf_storage_cassandra_transaction_commit:
- * @storage: #librdf_storage object
- *
- * Commit an active transaction.
- * 
- * Return value: 0 if transaction successfully committed, non-0 on error
- * (including no transaction active)
- **/
-static int
-librdf_storage_cassandra_transaction_commit(librdf_storage *storage)
+    return 1;
+
+}
+
+static librdf_query_results*
+librdf_storage_cassandra_query_execute(librdf_storage* storage,
+				       librdf_query* query)
 {
 
-#ifdef BROKEN
     librdf_storage_cassandra_instance* context;
+    cassandra_rasqal_context* qcontext;
+    librdf_query_results* query_results;
+    rasqal_query_results* results;
+    cassandra_bgp* bgp;
+    int i;
 
     context = (librdf_storage_cassandra_instance*)storage->instance;
 
-    if (context->transaction == 0)
-	return -1;
-
-    int ret = cassandra_add_elements(context->comms, context->transaction);
-
-    cassandra_elements_free(context->transaction);
+    if (context->query_bgp && context->query_bgp_query == query) {
+	bgp = context->query_bgp;
+	context->query_bgp = 0;
+	context->query_bgp_query = 0;
+    } else
+	bgp = cassandra_bgp_new(storage, query);
+    if (bgp == 0)
+	return NULL;
 
-    context->transaction = 0;
+    /* Joins start from the single empty solution. */
+    const char* empty[CASSANDRA_BGP_MAX_VARIABLES] = { 0 };
+    if (cassandra_bgp_rows_add(&bgp->solutions, bgp->vars_count,
+			       empty) < 0) {
+	cassandra_bgp_free(bgp);
+	return NULL;
+    }
 
-    if (ret < 0) return -1;
+    for(i = 0; i < bgp->triples_count; i++) {
 
-    return 0;
+	if (bgp->solutions.count == 0)
+	    break;
 
-#endif
-}
+	if (cassandra_bgp_join(bgp, cassandra_bgp_next(bgp)) < 0) {
+	    cassandra_bgp_free(bgp);
+	    return NULL;
+	}
 
+    }
 
-/**
- * librdf_storage_cassandra_transaction_rollback:
- * @storage: #librdf_storage object
- *
- * Roll back an active transaction.
- * 
- * Return value: 0 if transaction successfully committed, non-0 on error
- * (including no transaction active)
- **/
-static int
-librdf_storage_cassandra_transaction_rollback(librdf_storage *storage)
-{
-#ifdef BROKEN
+    results = cassandra_bgp_results(bgp);
 
-    librdf_storage_cassandra_instance* context;
+    cassandra_bgp_free(bgp);
 
-    context = (librdf_storage_cassandra_instance*)storage->instance;
+    if (results == 0)
+	return NULL;
 
-    if (context->transaction)
-	return -1;
+    query_results = LIBRDF_CALLOC(librdf_query_results*, 1,
+				  sizeof(*query_results));
+    if (!query_results) {
+	rasqal_free_query_results(results);
+	return NULL;
+    }
 
-    cassandra_elements_free(context->transaction);
+    qcontext = (cassandra_rasqal_context*) query->context;
+    if (qcontext->results)
+	rasqal_free_query_results(qcontext->results);
+    qcontext->results = results;
+    if (!qcontext->model)
+	qcontext->model = storage->model;
 
-    context->transaction = 0;
+    query_results->query = query;
+    librdf_query_add_query_result(query, query_results);
 
-    return 0;
-#endif
+    return query_results;
 
 }
 
@@ -1515,9 +10906,12 @@ librdf_storage_cassandra_register_factory(librdf_storage_factory *factory)
     factory->context_serialise        = librdf_storage_cassandra_context_serialise;
     factory->get_contexts             = librdf_storage_cassandra_get_contexts;
     factory->get_feature              = librdf_storage_cassandra_get_feature;
+    factory->set_feature              = librdf_storage_cassandra_set_feature;
     factory->transaction_start        = librdf_storage_cassandra_transaction_start;
     factory->transaction_commit       = librdf_storage_cassandra_transaction_commit;
     factory->transaction_rollback     = librdf_storage_cassandra_transaction_rollback;
+    factory->supports_query           = librdf_storage_cassandra_supports_query;
+    factory->query_execute            = librdf_storage_cassandra_query_execute;
 }
 
 #ifdef MODULAR_LIBRDF
@@ -0,0 +1,100 @@
+
+#include <cassandra_bloom.h>
+#include <stdlib.h>
+
+/* 10 bits per item and 7 probes give a false positive rate just under
+   1%. */
+#define CASSANDRA_BLOOM_BITS_PER_ITEM 10
+#define CASSANDRA_BLOOM_PROBES 7
+
+struct cassandra_bloom_str {
+    uint64_t* bits;
+    uint64_t size;		/* In bits */
+};
+
+cassandra_bloom* cassandra_bloom_create(size_t items)
+{
+
+    cassandra_bloom* b = malloc(sizeof(cassandra_bloom));
+    if (b == 0)
+	return 0;
+
+    b->size = (uint64_t) items * CASSANDRA_BLOOM_BITS_PER_ITEM;
+    if (b->size < 64)
+	b->size = 64;
+
+    b->bits = calloc((b->size + 63) / 64, sizeof(uint64_t));
+    if (b->bits == 0) {
+	free(b);
+	return 0;
+    }
+
+    return b;
+
+}
+
+void cassandra_bloom_free(cassandra_bloom* b)
+{
+    free(b->bits);
+    free(b);
+}
+
+/* The probes are h1 + i * h2 (Kirsch and Mitzenmacher), with h2 taken
+   from a remix of the hash so the two are independent. */
+static uint64_t cassandra_bloom_second(uint64_t h)
+{
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h | 1;
+}
+
+void cassandra_bloom_add(cassandra_bloom* b, uint64_t hash)
+{
+
+    uint64_t h2 = cassandra_bloom_second(hash);
+    int i;
+
+    for(i = 0; i < CASSANDRA_BLOOM_PROBES; i++) {
+	uint64_t bit = (hash + i * h2) % b->size;
+	b->bits[bit / 64] |= 1ULL << (bit % 64);
+    }
+
+}
+
+int cassandra_bloom_check(cassandra_bloom* b, uint64_t hash)
+{
+
+    uint64_t h2 = cassandra_bloom_second(hash);
+    int i;
+
+    for(i = 0; i < CASSANDRA_BLOOM_PROBES; i++) {
+	uint64_t bit = (hash + i * h2) % b->size;
+	if (!(b->bits[bit / 64] & (1ULL << (bit % 64))))
+	    return 0;
+    }
+
+    return 1;
+
+}
+
+/* FNV-1a. */
+uint64_t cassandra_bloom_hash(uint64_t h, const char* data, size_t len)
+{
+
+    size_t i;
+
+    for(i = 0; i < len; i++) {
+	h ^= (unsigned char) data[i];
+	h *= 1099511628211ULL;
+    }
+
+    h ^= len;
+    h *= 1099511628211ULL;
+
+    return h;
+
+}
+
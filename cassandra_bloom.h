@@ -0,0 +1,32 @@
+#ifndef CASSANDRA_BLOOM_H
+
+#define CASSANDRA_BLOOM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Bloom filter over 64-bit hashes.  A miss means the item was never
+   added; a hit means it probably was. */
+
+struct cassandra_bloom_str;
+typedef struct cassandra_bloom_str cassandra_bloom;
+
+/* Sized for about a 1% false positive rate at the given number of
+   items. */
+cassandra_bloom* cassandra_bloom_create(size_t items);
+void cassandra_bloom_free(cassandra_bloom*);
+
+void cassandra_bloom_add(cassandra_bloom*, uint64_t hash);
+
+/* Returns 0 if the hash was definitely never added. */
+int cassandra_bloom_check(cassandra_bloom*, uint64_t hash);
+
+/* Hashes len bytes of data, continuing from hash h.  Start from
+   CASSANDRA_BLOOM_HASH_INIT.  The length is mixed in, so hashing a
+   sequence of strings doesn't depend on where one ends and the next
+   begins. */
+#define CASSANDRA_BLOOM_HASH_INIT 14695981039346656037ULL
+uint64_t cassandra_bloom_hash(uint64_t h, const char* data, size_t len);
+
+#endif
+
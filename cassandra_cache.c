@@ -0,0 +1,203 @@
+
+#include <cassandra_cache.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct cassandra_cache_entry_str {
+    uint64_t hash;
+    void* value;
+    size_t cost;
+    size_t len;
+    struct cassandra_cache_entry_str* chain;
+    struct cassandra_cache_entry_str* prev;
+    struct cassandra_cache_entry_str* next;
+    char key[];
+} cassandra_cache_entry;
+
+struct cassandra_cache_str {
+    cassandra_cache_entry** buckets;
+    size_t mask;
+    size_t count;
+    size_t bytes;
+    size_t max_bytes;
+    cassandra_cache_free_fn free_fn;
+    cassandra_cache_entry* head;
+    cassandra_cache_entry* tail;
+};
+
+/* FNV-1a. */
+static uint64_t cassandra_cache_hash(const char* key, size_t len)
+{
+
+    uint64_t h = 14695981039346656037ULL;
+    size_t i;
+
+    for(i = 0; i < len; i++) {
+	h ^= (unsigned char) key[i];
+	h *= 1099511628211ULL;
+    }
+
+    return h;
+
+}
+
+cassandra_cache* cassandra_cache_create(size_t max_bytes,
+					cassandra_cache_free_fn free_fn)
+{
+
+    cassandra_cache* c = calloc(1, sizeof(cassandra_cache));
+    if (c == 0)
+	return 0;
+
+    c->mask = 255;
+    c->buckets = calloc(c->mask + 1, sizeof(cassandra_cache_entry*));
+    if (c->buckets == 0) {
+	free(c);
+	return 0;
+    }
+
+    c->max_bytes = max_bytes;
+    c->free_fn = free_fn;
+
+    return c;
+
+}
+
+void cassandra_cache_free(cassandra_cache* c)
+{
+
+    cassandra_cache_entry* e = c->head;
+
+    while (e) {
+	cassandra_cache_entry* next = e->next;
+	(*c->free_fn)(e->value);
+	free(e);
+	e = next;
+    }
+
+    free(c->buckets);
+    free(c);
+
+}
+
+static void cassandra_cache_unlink(cassandra_cache* c,
+				   cassandra_cache_entry* e)
+{
+    if (e->prev) e->prev->next = e->next; else c->head = e->next;
+    if (e->next) e->next->prev = e->prev; else c->tail = e->prev;
+}
+
+static void cassandra_cache_push_front(cassandra_cache* c,
+				       cassandra_cache_entry* e)
+{
+    e->prev = 0;
+    e->next = c->head;
+    if (c->head) c->head->prev = e;
+    c->head = e;
+    if (c->tail == 0) c->tail = e;
+}
+
+static size_t cassandra_cache_entry_bytes(cassandra_cache_entry* e)
+{
+    return sizeof(cassandra_cache_entry) + e->len + e->cost;
+}
+
+static void cassandra_cache_evict(cassandra_cache* c)
+{
+
+    cassandra_cache_entry* e = c->tail;
+    cassandra_cache_entry** pp;
+
+    cassandra_cache_unlink(c, e);
+
+    for(pp = &c->buckets[e->hash & c->mask]; *pp != e; pp = &(*pp)->chain);
+    *pp = e->chain;
+
+    c->bytes -= cassandra_cache_entry_bytes(e);
+    c->count--;
+
+    (*c->free_fn)(e->value);
+    free(e);
+
+}
+
+/* Doubles the bucket array, keeping chains short as the cache fills. */
+static void cassandra_cache_grow(cassandra_cache* c)
+{
+
+    size_t size = (c->mask + 1) * 2;
+    cassandra_cache_entry** buckets =
+	calloc(size, sizeof(cassandra_cache_entry*));
+    if (buckets == 0)
+	return;
+
+    cassandra_cache_entry* e;
+    for(e = c->head; e; e = e->next) {
+	e->chain = buckets[e->hash & (size - 1)];
+	buckets[e->hash & (size - 1)] = e;
+    }
+
+    free(c->buckets);
+    c->buckets = buckets;
+    c->mask = size - 1;
+
+}
+
+void* cassandra_cache_get(cassandra_cache* c, const char* key, size_t len)
+{
+
+    uint64_t hash = cassandra_cache_hash(key, len);
+    cassandra_cache_entry* e;
+
+    for(e = c->buckets[hash & c->mask]; e; e = e->chain)
+	if (e->hash == hash && e->len == len &&
+	    memcmp(e->key, key, len) == 0) {
+	    if (c->head != e) {
+		cassandra_cache_unlink(c, e);
+		cassandra_cache_push_front(c, e);
+	    }
+	    return e->value;
+	}
+
+    return 0;
+
+}
+
+int cassandra_cache_put(cassandra_cache* c, const char* key, size_t len,
+			void* value, size_t cost)
+{
+
+    cassandra_cache_entry* e = malloc(sizeof(cassandra_cache_entry) + len);
+    if (e == 0)
+	return -1;
+
+    e->hash = cassandra_cache_hash(key, len);
+    e->value = value;
+    e->cost = cost;
+    e->len = len;
+    memcpy(e->key, key, len);
+
+    size_t bytes = cassandra_cache_entry_bytes(e);
+    if (bytes > c->max_bytes) {
+	free(e);
+	return -1;
+    }
+
+    while (c->bytes + bytes > c->max_bytes)
+	cassandra_cache_evict(c);
+
+    if (c->count >= c->mask + 1)
+	cassandra_cache_grow(c);
+
+    e->chain = c->buckets[e->hash & c->mask];
+    c->buckets[e->hash & c->mask] = e;
+    cassandra_cache_push_front(c, e);
+
+    c->bytes += bytes;
+    c->count++;
+
+    return 0;
+
+}
+
@@ -0,0 +1,31 @@
+#ifndef CASSANDRA_CACHE_H
+
+#define CASSANDRA_CACHE_H
+
+#include <stddef.h>
+
+/* LRU cache from byte-string keys to values, bounded by an estimate of
+   the memory it holds.  The cache owns its values, and frees them with
+   the function given when they are evicted. */
+
+struct cassandra_cache_str;
+typedef struct cassandra_cache_str cassandra_cache;
+
+typedef void (*cassandra_cache_free_fn)(void* value);
+
+cassandra_cache* cassandra_cache_create(size_t max_bytes,
+					cassandra_cache_free_fn free_fn);
+void cassandra_cache_free(cassandra_cache*);
+
+/* Returns the cached value, or 0. */
+void* cassandra_cache_get(cassandra_cache*, const char* key, size_t len);
+
+/* Adds a value, whose memory is estimated as cost bytes on top of the
+   key.  Evicts least recently used entries to stay within the limit.
+   Returns non-zero on failure, in which case the value is not owned by
+   the cache. */
+int cassandra_cache_put(cassandra_cache*, const char* key, size_t len,
+			void* value, size_t cost);
+
+#endif
+
@@ -0,0 +1,234 @@
+
+#include <cassandra_dict.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct cassandra_dict_entry_str {
+    char* term;
+    size_t len;
+    int64_t id;
+    uint64_t hash;
+
+    /* Hash chains, by term and by id. */
+    struct cassandra_dict_entry_str* term_next;
+    struct cassandra_dict_entry_str* id_next;
+
+    /* LRU list, most recently used first. */
+    struct cassandra_dict_entry_str* prev;
+    struct cassandra_dict_entry_str* next;
+} cassandra_dict_entry;
+
+struct cassandra_dict_str {
+    cassandra_dict_entry** by_term;
+    cassandra_dict_entry** by_id;
+    size_t mask;
+    size_t capacity;
+    size_t count;
+    cassandra_dict_entry* head;
+    cassandra_dict_entry* tail;
+};
+
+/* FNV-1a. */
+static uint64_t cassandra_dict_fnv(const char* term, size_t len)
+{
+
+    uint64_t h = 14695981039346656037ULL;
+    size_t i;
+
+    for(i = 0; i < len; i++) {
+	h ^= (unsigned char) term[i];
+	h *= 1099511628211ULL;
+    }
+
+    return h;
+
+}
+
+static size_t cassandra_dict_id_slot(cassandra_dict* d, int64_t id)
+{
+    uint64_t h = (uint64_t) id * 11400714819323198485ULL;
+    return (size_t) (h >> 32) & d->mask;
+}
+
+int64_t cassandra_dict_hash(const char* term, size_t len)
+{
+    return (int64_t) cassandra_dict_fnv(term, len);
+}
+
+cassandra_dict* cassandra_dict_create(size_t capacity)
+{
+
+    size_t buckets = 16;
+    while (buckets < capacity) buckets <<= 1;
+
+    cassandra_dict* d = calloc(1, sizeof(cassandra_dict));
+    if (d == 0)
+	return 0;
+
+    d->by_term = calloc(buckets, sizeof(cassandra_dict_entry*));
+    d->by_id = calloc(buckets, sizeof(cassandra_dict_entry*));
+    if (d->by_term == 0 || d->by_id == 0) {
+	free(d->by_term);
+	free(d->by_id);
+	free(d);
+	return 0;
+    }
+
+    d->mask = buckets - 1;
+    d->capacity = capacity;
+
+    return d;
+
+}
+
+void cassandra_dict_free(cassandra_dict* d)
+{
+
+    cassandra_dict_entry* e = d->head;
+
+    while (e) {
+	cassandra_dict_entry* next = e->next;
+	free(e->term);
+	free(e);
+	e = next;
+    }
+
+    free(d->by_term);
+    free(d->by_id);
+    free(d);
+
+}
+
+static void cassandra_dict_unlink(cassandra_dict* d, cassandra_dict_entry* e)
+{
+
+    if (e->prev) e->prev->next = e->next; else d->head = e->next;
+    if (e->next) e->next->prev = e->prev; else d->tail = e->prev;
+
+    e->prev = e->next = 0;
+
+}
+
+static void cassandra_dict_push_front(cassandra_dict* d,
+				      cassandra_dict_entry* e)
+{
+
+    e->prev = 0;
+    e->next = d->head;
+    if (d->head) d->head->prev = e;
+    d->head = e;
+    if (d->tail == 0) d->tail = e;
+
+}
+
+static void cassandra_dict_touch(cassandra_dict* d, cassandra_dict_entry* e)
+{
+
+    if (d->head == e)
+	return;
+
+    cassandra_dict_unlink(d, e);
+    cassandra_dict_push_front(d, e);
+
+}
+
+static void cassandra_dict_evict(cassandra_dict* d)
+{
+
+    cassandra_dict_entry* e = d->tail;
+    cassandra_dict_entry** pp;
+
+    cassandra_dict_unlink(d, e);
+
+    for(pp = &d->by_term[e->hash & d->mask]; *pp != e; pp = &(*pp)->term_next);
+    *pp = e->term_next;
+
+    for(pp = &d->by_id[cassandra_dict_id_slot(d, e->id)]; *pp != e;
+	pp = &(*pp)->id_next);
+    *pp = e->id_next;
+
+    free(e->term);
+    free(e);
+
+    d->count--;
+
+}
+
+int cassandra_dict_get_id(cassandra_dict* d, const char* term, size_t len,
+			  int64_t* id)
+{
+
+    uint64_t hash = cassandra_dict_fnv(term, len);
+    cassandra_dict_entry* e;
+
+    for(e = d->by_term[hash & d->mask]; e; e = e->term_next)
+	if (e->hash == hash && e->len == len &&
+	    memcmp(e->term, term, len) == 0) {
+	    cassandra_dict_touch(d, e);
+	    *id = e->id;
+	    return 1;
+	}
+
+    return 0;
+
+}
+
+const char* cassandra_dict_get_term(cassandra_dict* d, int64_t id,
+				    size_t* len)
+{
+
+    cassandra_dict_entry* e;
+
+    for(e = d->by_id[cassandra_dict_id_slot(d, id)]; e; e = e->id_next)
+	if (e->id == id) {
+	    cassandra_dict_touch(d, e);
+	    *len = e->len;
+	    return e->term;
+	}
+
+    return 0;
+
+}
+
+int cassandra_dict_put(cassandra_dict* d, const char* term, size_t len,
+		       int64_t id)
+{
+
+    size_t existing;
+    if (cassandra_dict_get_term(d, id, &existing))
+	return 0;
+
+    if (d->count >= d->capacity)
+	cassandra_dict_evict(d);
+
+    cassandra_dict_entry* e = malloc(sizeof(cassandra_dict_entry));
+    if (e == 0)
+	return -1;
+
+    e->term = malloc(len + 1);
+    if (e->term == 0) {
+	free(e);
+	return -1;
+    }
+
+    memcpy(e->term, term, len);
+    e->term[len] = 0;
+    e->len = len;
+    e->id = id;
+    e->hash = cassandra_dict_fnv(term, len);
+
+    size_t slot = e->hash & d->mask;
+    e->term_next = d->by_term[slot];
+    d->by_term[slot] = e;
+
+    slot = cassandra_dict_id_slot(d, id);
+    e->id_next = d->by_id[slot];
+    d->by_id[slot] = e;
+
+    cassandra_dict_push_front(d, e);
+    d->count++;
+
+    return 0;
+
+}
+
@@ -0,0 +1,36 @@
+#ifndef CASSANDRA_DICT_H
+
+#define CASSANDRA_DICT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Client-side LRU cache of the term <-> id dictionary used by the
+   dictionary-encoded layout.  Each entry can be found by term or by id;
+   a hit either way makes it most recently used. */
+
+struct cassandra_dict_str;
+typedef struct cassandra_dict_str cassandra_dict;
+
+cassandra_dict* cassandra_dict_create(size_t capacity);
+void cassandra_dict_free(cassandra_dict*);
+
+/* Returns 1 and the id if the term is cached. */
+int cassandra_dict_get_id(cassandra_dict*, const char* term, size_t len,
+			  int64_t* id);
+
+/* Returns the cached term for an id, or 0.  The term stays valid until
+   the next cassandra_dict_put. */
+const char* cassandra_dict_get_term(cassandra_dict*, int64_t id,
+				    size_t* len);
+
+/* Adds a term and its id, evicting the least recently used entry if the
+   cache is full.  Returns non-zero on failure. */
+int cassandra_dict_put(cassandra_dict*, const char* term, size_t len,
+		       int64_t id);
+
+/* The id a new term is first offered, before collision probing. */
+int64_t cassandra_dict_hash(const char* term, size_t len);
+
+#endif
+
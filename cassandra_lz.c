@@ -0,0 +1,206 @@
+
+#include <cassandra_lz.h>
+#include <stdint.h>
+#include <string.h>
+
+/* A block is a run of sequences.  Each is a token byte, whose high
+   nibble is the number of literal bytes and low nibble the match length
+   less CASSANDRA_LZ_MIN_MATCH; the literals; a two byte little-endian
+   offset back to the match; and the match.  A nibble of 15 is continued
+   in bytes which are added to it, up to and including the first which
+   isn't 255.  The last sequence has literals only. */
+#define CASSANDRA_LZ_MIN_MATCH 4
+#define CASSANDRA_LZ_MAX_OFFSET 65535
+#define CASSANDRA_LZ_HASH_BITS 12
+
+static uint32_t cassandra_lz_read32(const unsigned char* p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static size_t cassandra_lz_hash(uint32_t v)
+{
+    return (v * 2654435761U) >> (32 - CASSANDRA_LZ_HASH_BITS);
+}
+
+static unsigned char* cassandra_lz_put_length(unsigned char* out,
+					      unsigned char* end, size_t n)
+{
+
+    while (n >= 255) {
+	if (out >= end)
+	    return 0;
+	*out++ = 255;
+	n -= 255;
+    }
+
+    if (out >= end)
+	return 0;
+    *out++ = (unsigned char) n;
+
+    return out;
+
+}
+
+/* Writes a sequence, or the last one if match is 0. */
+static unsigned char* cassandra_lz_sequence(unsigned char* out,
+					    unsigned char* end,
+					    const unsigned char* literals,
+					    size_t literals_len,
+					    size_t offset, size_t match)
+{
+
+    if (out >= end)
+	return 0;
+
+    unsigned char* token = out++;
+    *token = (unsigned char) ((literals_len >= 15 ? 15 : literals_len) << 4);
+
+    if (literals_len >= 15) {
+	out = cassandra_lz_put_length(out, end, literals_len - 15);
+	if (out == 0)
+	    return 0;
+    }
+
+    if ((size_t) (end - out) < literals_len)
+	return 0;
+    memcpy(out, literals, literals_len);
+    out += literals_len;
+
+    if (match == 0)
+	return out;
+
+    if (end - out < 2)
+	return 0;
+    *out++ = offset & 0xff;
+    *out++ = offset >> 8;
+
+    match -= CASSANDRA_LZ_MIN_MATCH;
+    *token |= (unsigned char) (match >= 15 ? 15 : match);
+    if (match >= 15)
+	out = cassandra_lz_put_length(out, end, match - 15);
+
+    return out;
+
+}
+
+size_t cassandra_lz_compress(const unsigned char* src, size_t len,
+			     unsigned char* dst, size_t size)
+{
+
+    /* Position + 1 of the last 4 bytes seen with each hash, or 0. */
+    size_t table[1 << CASSANDRA_LZ_HASH_BITS];
+    memset(table, 0, sizeof(table));
+
+    const unsigned char* anchor = src;
+    unsigned char* out = dst;
+    unsigned char* end = dst + size;
+    size_t i = 0;
+
+    while (i + CASSANDRA_LZ_MIN_MATCH <= len) {
+
+	uint32_t v = cassandra_lz_read32(src + i);
+	size_t h = cassandra_lz_hash(v);
+	size_t candidate = table[h];
+	table[h] = i + 1;
+
+	if (candidate == 0 || i + 1 - candidate > CASSANDRA_LZ_MAX_OFFSET ||
+	    cassandra_lz_read32(src + candidate - 1) != v) {
+	    i++;
+	    continue;
+	}
+
+	size_t ref = candidate - 1;
+	size_t match = CASSANDRA_LZ_MIN_MATCH;
+	while (i + match < len && src[ref + match] == src[i + match])
+	    match++;
+
+	out = cassandra_lz_sequence(out, end, anchor, src + i - anchor,
+				    i - ref, match);
+	if (out == 0)
+	    return 0;
+
+	i += match;
+	anchor = src + i;
+
+    }
+
+    out = cassandra_lz_sequence(out, end, anchor, src + len - anchor, 0, 0);
+
+    return out ? (size_t) (out - dst) : 0;
+
+}
+
+static int cassandra_lz_get_length(const unsigned char** in,
+				   const unsigned char* end, size_t* n)
+{
+
+    unsigned char b;
+
+    do {
+	if (*in >= end)
+	    return -1;
+	b = *(*in)++;
+	*n += b;
+    } while (b == 255);
+
+    return 0;
+
+}
+
+int cassandra_lz_decompress(const unsigned char* src, size_t len,
+			    unsigned char* dst, size_t size)
+{
+
+    const unsigned char* in = src;
+    const unsigned char* in_end = src + len;
+    unsigned char* out = dst;
+    unsigned char* out_end = dst + size;
+
+    while (in < in_end) {
+
+	unsigned char token = *in++;
+
+	size_t literals = token >> 4;
+	if (literals == 15 && cassandra_lz_get_length(&in, in_end,
+						      &literals) < 0)
+	    return -1;
+
+	if ((size_t) (in_end - in) < literals ||
+	    (size_t) (out_end - out) < literals)
+	    return -1;
+	memcpy(out, in, literals);
+	in += literals;
+	out += literals;
+
+	/* Only the last sequence ends the block. */
+	if (in == in_end)
+	    return (out == out_end) ? 0 : -1;
+
+	if (in_end - in < 2)
+	    return -1;
+	size_t offset = in[0] | (in[1] << 8);
+	in += 2;
+	if (offset == 0 || offset > (size_t) (out - dst))
+	    return -1;
+
+	size_t match = token & 15;
+	if (match == 15 && cassandra_lz_get_length(&in, in_end, &match) < 0)
+	    return -1;
+	match += CASSANDRA_LZ_MIN_MATCH;
+	if ((size_t) (out_end - out) < match)
+	    return -1;
+
+	/* The match may overlap the bytes it produces. */
+	const unsigned char* from = out - offset;
+	while (match-- > 0)
+	    *out++ = *from++;
+
+    }
+
+    return -1;
+
+}
+
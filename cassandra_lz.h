@@ -0,0 +1,22 @@
+#ifndef CASSANDRA_LZ_H
+
+#define CASSANDRA_LZ_H
+
+#include <stddef.h>
+
+/* LZ77 block compression of large literals, in the style of LZ4.  The
+   output depends only on the input, so every client compresses a
+   literal to the same bytes and compressed terms compare equal. */
+
+/* Compresses len bytes of src into dst, which has room for size bytes.
+   Returns the compressed length, or 0 if it doesn't fit. */
+size_t cassandra_lz_compress(const unsigned char* src, size_t len,
+			     unsigned char* dst, size_t size);
+
+/* Decompresses len bytes of src into exactly size bytes of dst.
+   Returns 0, or -1 if src is not a block of that size. */
+int cassandra_lz_decompress(const unsigned char* src, size_t len,
+			    unsigned char* dst, size_t size);
+
+#endif
+
@@ -0,0 +1,178 @@
+
+#include <cassandra_queue.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <sched.h>
+#include <time.h>
+
+/* This is Dmitry Vyukov's bounded MPMC queue: each cell carries a
+   sequence number which says whether it is ready to be written or read
+   on the current lap of the ring. */
+
+typedef struct {
+    atomic_size_t sequence;
+    void* item;
+} cassandra_queue_cell;
+
+struct cassandra_queue_str {
+    cassandra_queue_cell* cells;
+    size_t mask;
+    atomic_size_t enqueue_pos;
+    atomic_size_t dequeue_pos;
+    atomic_int closed;
+};
+
+/* Spin briefly, then yield, then sleep, so a stalled stage doesn't burn
+   a core. */
+static void cassandra_queue_backoff(int* spins)
+{
+
+    if (++(*spins) < 64)
+	return;
+
+    if (*spins < 128) {
+	sched_yield();
+	return;
+    }
+
+    struct timespec ts = { 0, 50000 };
+    nanosleep(&ts, 0);
+
+}
+
+cassandra_queue* cassandra_queue_create(size_t size)
+{
+
+    size_t cap = 2;
+    while (cap < size) cap <<= 1;
+
+    cassandra_queue* q = malloc(sizeof(cassandra_queue));
+    if (q == 0)
+	return 0;
+
+    q->cells = malloc(cap * sizeof(cassandra_queue_cell));
+    if (q->cells == 0) {
+	free(q);
+	return 0;
+    }
+
+    size_t i;
+    for(i = 0; i < cap; i++)
+	atomic_init(&q->cells[i].sequence, i);
+
+    q->mask = cap - 1;
+    atomic_init(&q->enqueue_pos, 0);
+    atomic_init(&q->dequeue_pos, 0);
+    atomic_init(&q->closed, 0);
+
+    return q;
+
+}
+
+void cassandra_queue_free(cassandra_queue* q)
+{
+    free(q->cells);
+    free(q);
+}
+
+static int cassandra_queue_try_push(cassandra_queue* q, void* item)
+{
+
+    size_t pos = atomic_load_explicit(&q->enqueue_pos, memory_order_relaxed);
+
+    for(;;) {
+
+	cassandra_queue_cell* cell = &q->cells[pos & q->mask];
+	size_t seq = atomic_load_explicit(&cell->sequence,
+					  memory_order_acquire);
+	intptr_t diff = (intptr_t) seq - (intptr_t) pos;
+
+	if (diff == 0) {
+	    if (atomic_compare_exchange_weak_explicit(&q->enqueue_pos,
+						      &pos, pos + 1,
+						      memory_order_relaxed,
+						      memory_order_relaxed)) {
+		cell->item = item;
+		atomic_store_explicit(&cell->sequence, pos + 1,
+				      memory_order_release);
+		return 1;
+	    }
+	} else if (diff < 0)
+	    return 0;
+	else
+	    pos = atomic_load_explicit(&q->enqueue_pos,
+				       memory_order_relaxed);
+
+    }
+
+}
+
+void cassandra_queue_push(cassandra_queue* q, void* item)
+{
+
+    int spins = 0;
+
+    while (!cassandra_queue_try_push(q, item))
+	cassandra_queue_backoff(&spins);
+
+}
+
+int cassandra_queue_try_pop(cassandra_queue* q, void** item)
+{
+
+    size_t pos = atomic_load_explicit(&q->dequeue_pos, memory_order_relaxed);
+
+    for(;;) {
+
+	cassandra_queue_cell* cell = &q->cells[pos & q->mask];
+	size_t seq = atomic_load_explicit(&cell->sequence,
+					  memory_order_acquire);
+	intptr_t diff = (intptr_t) seq - (intptr_t) (pos + 1);
+
+	if (diff == 0) {
+	    if (atomic_compare_exchange_weak_explicit(&q->dequeue_pos,
+						      &pos, pos + 1,
+						      memory_order_relaxed,
+						      memory_order_relaxed)) {
+		*item = cell->item;
+		atomic_store_explicit(&cell->sequence, pos + q->mask + 1,
+				      memory_order_release);
+		return 1;
+	    }
+	} else if (diff < 0)
+	    return 0;
+	else
+	    pos = atomic_load_explicit(&q->dequeue_pos,
+				       memory_order_relaxed);
+
+    }
+
+}
+
+int cassandra_queue_pop(cassandra_queue* q, void** item)
+{
+
+    int spins = 0;
+
+    for(;;) {
+
+	if (cassandra_queue_try_pop(q, item))
+	    return 1;
+
+	/* Closed is only set after the last push, so check for a straggler
+	   once more before giving up. */
+	if (atomic_load_explicit(&q->closed, memory_order_acquire))
+	    return cassandra_queue_try_pop(q, item);
+
+	cassandra_queue_backoff(&spins);
+
+    }
+
+}
+
+void cassandra_queue_close(cassandra_queue* q)
+{
+    atomic_store_explicit(&q->closed, 1, memory_order_release);
+}
+
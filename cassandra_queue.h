@@ -0,0 +1,31 @@
+#ifndef CASSANDRA_QUEUE_H
+
+#define CASSANDRA_QUEUE_H
+
+#include <stddef.h>
+
+/* Bounded lock-free multi-producer, multi-consumer queue of pointers.
+   Pushing to a full queue waits until a consumer makes room, which is
+   how pipeline stages apply backpressure to the stage before them. */
+
+struct cassandra_queue_str;
+typedef struct cassandra_queue_str cassandra_queue;
+
+/* Size is rounded up to a power of two. */
+cassandra_queue* cassandra_queue_create(size_t size);
+void cassandra_queue_free(cassandra_queue*);
+
+/* Waits while the queue is full. */
+void cassandra_queue_push(cassandra_queue*, void* item);
+
+/* Returns 1 and an item, or 0 if nothing is queued right now. */
+int cassandra_queue_try_pop(cassandra_queue*, void** item);
+
+/* Waits for an item.  Returns 0 once the queue is closed and empty. */
+int cassandra_queue_pop(cassandra_queue*, void** item);
+
+/* No more items will be pushed. */
+void cassandra_queue_close(cassandra_queue*);
+
+#endif
+
@@ -0,0 +1,237 @@
+
+#include <cassandra_writes.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* The terms of an entry are held in one block, s, p, o and c each
+   NUL-terminated.  No context is held as an empty c. */
+typedef struct {
+    char* s;
+    char* p;
+    char* o;
+    char* c;
+    uint64_t hash;
+    int add;
+} cassandra_writes_entry;
+
+/* Entries are kept in the order first written, and found through an
+   open addressing table of entry index + 1, or 0 for a free slot, which
+   is kept at most half full. */
+struct cassandra_writes_str {
+    cassandra_writes_entry* entries;
+    int count;
+    int size;
+    int* slots;
+    size_t mask;
+    size_t bytes;
+    size_t max_bytes;
+};
+
+/* What an entry costs beyond its terms: the entry, and its share of the
+   table. */
+#define CASSANDRA_WRITES_ENTRY_COST \
+    (sizeof(cassandra_writes_entry) + 2 * sizeof(int))
+
+/* FNV-1a over the four terms and their terminators. */
+static uint64_t cassandra_writes_hash(const char* s, const char* p,
+				      const char* o, const char* c)
+{
+
+    const char* terms[4] = { s, p, o, c };
+    uint64_t h = 14695981039346656037ULL;
+    int i;
+
+    for(i = 0; i < 4; i++) {
+	const unsigned char* t = (const unsigned char*) terms[i];
+	do {
+	    h ^= *t;
+	    h *= 1099511628211ULL;
+	} while (*t++);
+    }
+
+    return h;
+
+}
+
+/* Returns the slot holding the triple, or the free slot it would go
+   in. */
+static size_t cassandra_writes_slot(cassandra_writes* w, uint64_t hash,
+				    const char* s, const char* p,
+				    const char* o, const char* c)
+{
+
+    size_t i = (size_t) (hash >> 32) & w->mask;
+
+    while (w->slots[i]) {
+	cassandra_writes_entry* e = &w->entries[w->slots[i] - 1];
+	if (e->hash == hash && !strcmp(e->s, s) && !strcmp(e->p, p) &&
+	    !strcmp(e->o, o) && !strcmp(e->c, c))
+	    break;
+	i = (i + 1) & w->mask;
+    }
+
+    return i;
+
+}
+
+static int cassandra_writes_grow(cassandra_writes* w)
+{
+
+    if (w->count >= w->size) {
+	int size = w->size ? w->size * 2 : 64;
+	cassandra_writes_entry* entries =
+	    realloc(w->entries, size * sizeof(cassandra_writes_entry));
+	if (entries == 0)
+	    return -1;
+	w->entries = entries;
+	w->size = size;
+    }
+
+    if ((size_t) (w->count + 1) * 2 <= w->mask + 1)
+	return 0;
+
+    size_t buckets = (w->mask + 1) * 2;
+    int* slots = calloc(buckets, sizeof(int));
+    if (slots == 0)
+	return -1;
+
+    free(w->slots);
+    w->slots = slots;
+    w->mask = buckets - 1;
+
+    int i;
+    for(i = 0; i < w->count; i++) {
+	cassandra_writes_entry* e = &w->entries[i];
+	w->slots[cassandra_writes_slot(w, e->hash, e->s, e->p, e->o,
+				       e->c)] = i + 1;
+    }
+
+    return 0;
+
+}
+
+cassandra_writes* cassandra_writes_create(size_t max_bytes)
+{
+
+    size_t buckets = 64;
+
+    cassandra_writes* w = calloc(1, sizeof(cassandra_writes));
+    if (w == 0)
+	return 0;
+
+    w->slots = calloc(buckets, sizeof(int));
+    if (w->slots == 0) {
+	free(w);
+	return 0;
+    }
+
+    w->mask = buckets - 1;
+    w->bytes = sizeof(cassandra_writes);
+    w->max_bytes = max_bytes;
+
+    return w;
+
+}
+
+void cassandra_writes_free(cassandra_writes* w)
+{
+
+    int i;
+
+    for(i = 0; i < w->count; i++)
+	free(w->entries[i].s);
+
+    free(w->entries);
+    free(w->slots);
+    free(w);
+
+}
+
+int cassandra_writes_put(cassandra_writes* w, const char* s, const char* p,
+			 const char* o, const char* c, int add)
+{
+
+    if (c == 0)
+	c = "";
+
+    uint64_t hash = cassandra_writes_hash(s, p, o, c);
+    size_t i = cassandra_writes_slot(w, hash, s, p, o, c);
+
+    if (w->slots[i]) {
+	w->entries[w->slots[i] - 1].add = add;
+	return 0;
+    }
+
+    size_t s_len = strlen(s) + 1;
+    size_t p_len = strlen(p) + 1;
+    size_t o_len = strlen(o) + 1;
+    size_t c_len = strlen(c) + 1;
+    size_t len = s_len + p_len + o_len + c_len;
+    size_t cost = len + CASSANDRA_WRITES_ENTRY_COST;
+
+    if (w->max_bytes && w->bytes + cost > w->max_bytes)
+	return -1;
+
+    if (cassandra_writes_grow(w) < 0)
+	return -1;
+
+    char* terms = malloc(len);
+    if (terms == 0)
+	return -1;
+
+    cassandra_writes_entry* e = &w->entries[w->count];
+    e->s = memcpy(terms, s, s_len);
+    e->p = memcpy(terms + s_len, p, p_len);
+    e->o = memcpy(terms + s_len + p_len, o, o_len);
+    e->c = memcpy(terms + s_len + p_len + o_len, c, c_len);
+    e->hash = hash;
+    e->add = add;
+
+    /* The table may have been rebuilt. */
+    w->slots[cassandra_writes_slot(w, hash, s, p, o, c)] = ++w->count;
+    w->bytes += cost;
+
+    return 0;
+
+}
+
+int cassandra_writes_get(cassandra_writes* w, const char* s, const char* p,
+			 const char* o, const char* c)
+{
+
+    if (c == 0)
+	c = "";
+
+    size_t i = cassandra_writes_slot(w, cassandra_writes_hash(s, p, o, c),
+				     s, p, o, c);
+
+    return w->slots[i] ? w->entries[w->slots[i] - 1].add : -1;
+
+}
+
+int cassandra_writes_count(cassandra_writes* w)
+{
+    return w->count;
+}
+
+int cassandra_writes_at(cassandra_writes* w, int i, const char** s,
+			const char** p, const char** o, const char** c)
+{
+
+    cassandra_writes_entry* e = &w->entries[i];
+
+    *s = e->s;
+    *p = e->p;
+    *o = e->o;
+    *c = e->c[0] ? e->c : 0;
+
+    return e->add;
+
+}
+
+size_t cassandra_writes_bytes(cassandra_writes* w)
+{
+    return w->bytes;
+}
+
@@ -0,0 +1,44 @@
+#ifndef CASSANDRA_WRITES_H
+
+#define CASSANDRA_WRITES_H
+
+#include <stddef.h>
+
+/* The write set of a transaction: the triples added and removed since it
+   started, as encoded terms, in the order first written.  A triple is
+   held once, with the last write to it, so adding and then removing a
+   triple leaves only the removal.  Each triple may have a context term
+   c, which is 0 for none; the same triple in another context is another
+   entry. */
+
+struct cassandra_writes_str;
+typedef struct cassandra_writes_str cassandra_writes;
+
+/* A set holding at most max_bytes of terms and bookkeeping, or no limit
+   if max_bytes is 0. */
+cassandra_writes* cassandra_writes_create(size_t max_bytes);
+void cassandra_writes_free(cassandra_writes*);
+
+/* Records an add, or a removal if add is 0, copying the terms.  Returns
+   non-zero on failure, or if the set would go over its limit. */
+int cassandra_writes_put(cassandra_writes*, const char* s, const char* p,
+			 const char* o, const char* c, int add);
+
+/* Returns 1 if the triple was last added, 0 if it was last removed, or
+   -1 if it hasn't been written. */
+int cassandra_writes_get(cassandra_writes*, const char* s, const char* p,
+			 const char* o, const char* c);
+
+/* The number of triples written. */
+int cassandra_writes_count(cassandra_writes*);
+
+/* Gets the ith triple written, and returns 1 if it was last added, or
+   0 if it was last removed.  The terms belong to the set. */
+int cassandra_writes_at(cassandra_writes*, int i, const char** s,
+			const char** p, const char** o, const char** c);
+
+/* Bytes the set holds. */
+size_t cassandra_writes_bytes(cassandra_writes*);
+
+#endif
+
@@ -0,0 +1,46 @@
+#ifndef RDF_STORAGE_CASSANDRA_H
+
+#define RDF_STORAGE_CASSANDRA_H
+
+#include <redland.h>
+
+/* Entry points of the Cassandra storage beyond the librdf storage API.
+   They take a storage created with the "cassandra" storage name. */
+
+/* Finds the matches of many patterns with the same parts bound, running
+   their queries concurrently.  Outside the quads layout, the context
+   node of each statement in the stream is an integer literal: the
+   index of the pattern it matched.  In the quads layout it is the
+   statement's context. */
+librdf_stream*
+librdf_storage_cassandra_find_statements_batch(librdf_storage* storage,
+					       librdf_statement** patterns,
+					       int count);
+
+/* Returns the index of the pattern matched by the current statement of
+   a stream from librdf_storage_cassandra_find_statements_batch, in any
+   layout, or -1 if the stream isn't one or is at its end. */
+int
+librdf_storage_cassandra_batch_index(librdf_storage* storage,
+				     librdf_stream* stream);
+
+/* Finds the statements with a predicate whose object lies between two
+   bounds, either of which may be NULL.  The bounds are numeric or
+   xsd:dateTime literals.  Needs the sortable-literals option, and
+   finds only objects written with it. */
+librdf_stream*
+librdf_storage_cassandra_find_range(librdf_storage* storage,
+				    librdf_node* predicate,
+				    librdf_node* lower, int lower_inclusive,
+				    librdf_node* upper, int upper_inclusive);
+
+/* Removes every statement matching a pattern, in any context.  The
+   pattern must have a part bound.  The index table a find of the
+   pattern reads loses the matches with partition or range deletes, and
+   the other tables row by row.  Returns non-zero on failure. */
+int
+librdf_storage_cassandra_remove_statements(librdf_storage* storage,
+					   librdf_statement* pattern);
+
+#endif
+
@@ -0,0 +1,1074 @@
+/* Unit tests of the storage's internals which need no Cassandra: its
+   term encodings, compression and query planning, and the client-side
+   structures it keeps.  The internals are static, so the storage is
+   compiled in here.  Run with make check; prints the failed checks, and
+   exits non-zero if there were any. */
+
+#include "cassandra.c"
+
+static int failures = 0;
+
+#define CHECK(cond)							\
+    do {								\
+	if (!(cond)) {							\
+	    fprintf(stderr, "%s:%d: failed: %s\n", __FILE__, __LINE__,	\
+		    #cond);						\
+	    failures++;							\
+	}								\
+    } while (0)
+
+#define TEST_XSD "http://www.w3.org/2001/XMLSchema#"
+
+/* Returns 1 if none of len bytes is zero. */
+static int
+test_no_zero(const unsigned char* p, size_t len)
+{
+    return memchr(p, 0, len) == 0;
+}
+
+static void
+test_varint(void)
+{
+
+    static const size_t values[] = {
+	0, 1, 126, 127, 128, 255, 16382, 16383, 16384, 2097151,
+	(size_t) 1 << 32, ((size_t) 1 << 62) - 1
+    };
+    unsigned char buf[16];
+    size_t i, n;
+
+    for(i = 0; i < sizeof(values) / sizeof(values[0]); i++) {
+
+	size_t len = cassandra_varint_put(buf, values[i]);
+
+	CHECK(len == cassandra_varint_size(values[i]));
+	CHECK(test_no_zero(buf, len));
+	CHECK(cassandra_varint_get(buf, buf + len, &n) == buf + len);
+	CHECK(n == values[i]);
+
+	/* A varint cut short is refused. */
+	if (len > 1)
+	    CHECK(cassandra_varint_get(buf, buf + len - 1, &n) == 0);
+
+    }
+
+    /* 126 is the largest in one byte, which holds n + 1. */
+    CHECK(cassandra_varint_size(126) == 1);
+    CHECK(cassandra_varint_size(127) == 2);
+
+    /* Zero is never written, so it is invalid. */
+    buf[0] = 0;
+    CHECK(cassandra_varint_get(buf, buf + 1, &n) == 0);
+
+}
+
+static void
+test_escape(void)
+{
+
+    static const unsigned char src[] = { 0, 1, 2, 'a', 0xff, 1, 0, 0x80 };
+    static const unsigned char bad[] = { 'a', 1, 3 };
+    static const unsigned char cut[] = { 'a', 1 };
+    unsigned char escaped[2 * sizeof(src)];
+    unsigned char back[2 * sizeof(src)];
+
+    size_t len = cassandra_escape(src, sizeof(src), 0);
+    CHECK(len == sizeof(src) + 4);
+    CHECK(cassandra_escape(src, sizeof(src), escaped) == len);
+    CHECK(test_no_zero(escaped, len));
+
+    CHECK(cassandra_unescape(escaped, len, back) == sizeof(src));
+    CHECK(memcmp(back, src, sizeof(src)) == 0);
+
+    /* 1 only starts 1 1 or 1 2. */
+    CHECK(cassandra_unescape(bad, sizeof(bad), back) == 0);
+    CHECK(cassandra_unescape(cut, sizeof(cut), back) == 0);
+
+}
+
+/* Compresses and decompresses len bytes, checking the round trip and
+   that sizes other than the original are refused. */
+static void
+test_lz_round_trip(const unsigned char* src, size_t len)
+{
+
+    size_t size = len + len / 255 + 16;
+    unsigned char* packed = malloc(size);
+    unsigned char* back = malloc(len + 1);
+
+    size_t packed_len = cassandra_lz_compress(src, len, packed, size);
+    CHECK(packed_len > 0);
+
+    if (packed_len > 0) {
+	CHECK(cassandra_lz_decompress(packed, packed_len, back, len) == 0);
+	CHECK(memcmp(back, src, len) == 0);
+	if (len > 0)
+	    CHECK(cassandra_lz_decompress(packed, packed_len, back,
+					  len - 1) < 0);
+	CHECK(cassandra_lz_decompress(packed, packed_len, back, len + 1) < 0);
+	if (packed_len > 1)
+	    CHECK(cassandra_lz_decompress(packed, packed_len - 1, back,
+					  len) < 0);
+    }
+
+    free(packed);
+    free(back);
+
+}
+
+static void
+test_lz(void)
+{
+
+    size_t len = 200000;
+    unsigned char* src = malloc(len);
+    unsigned char packed[64];
+    size_t i;
+
+    test_lz_round_trip((const unsigned char*) "", 0);
+    test_lz_round_trip((const unsigned char*) "abc", 3);
+
+    /* Text with matches near and far, past the furthest offset. */
+    for(i = 0; i < len; i++)
+	src[i] = "The quick brown fox "[i % 20] + (i / 70000);
+    test_lz_round_trip(src, len);
+    CHECK(cassandra_lz_compress(src, len, packed, 0) == 0);
+
+    /* Runs, whose matches overlap the bytes they produce. */
+    memset(src, 'x', 1000);
+    test_lz_round_trip(src, 1000);
+    CHECK(cassandra_lz_compress(src, 1000, packed, sizeof(packed)) > 0);
+
+    /* Noise, which doesn't compress but still round-trips. */
+    uint64_t x = 88172645463325252ULL;
+    for(i = 0; i < 5000; i++) {
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+	src[i] = (unsigned char) x;
+    }
+    test_lz_round_trip(src, 5000);
+    CHECK(cassandra_lz_compress(src, 5000, packed, sizeof(packed)) == 0);
+
+    free(src);
+
+}
+
+/* A long literal is compressed, still free of zero bytes, and decodes
+   to itself. */
+static void
+test_compressed(librdf_storage_cassandra_instance* context)
+{
+
+    librdf_world* world = context->storage->world;
+    char* text = malloc(3001);
+    size_t i;
+
+    for(i = 0; i < 3000; i++)
+	text[i] = "\001abc\002defg"[i % 9];
+    text[3000] = 0;
+
+    cassandra_term term = { LIBRDF_NODE_TYPE_LITERAL, text, 0, "en" };
+    size_t len = cassandra_term_encode(&term, 0, 1, -1, 0, 0, 0);
+    char* t = malloc(len + 1);
+    cassandra_term_encode(&term, 0, 1, -1, 0, t, len + 1);
+    cassandra_term_compress(&t, len, 3000);
+    CHECK((unsigned char) t[0] == CASSANDRA_TAG_COMPRESSED);
+    CHECK(strlen(t) < len);
+
+    librdf_node* expected =
+	librdf_new_node_from_typed_literal(world, (const unsigned char*) text,
+					   "en", 0);
+    librdf_node* decoded = node_decode(context, t, strlen(t));
+    CHECK(decoded && librdf_node_equals(expected, decoded));
+    if (decoded)
+	librdf_free_node(decoded);
+    librdf_free_node(expected);
+
+    /* A short one is left as it is. */
+    term.value = "short";
+    len = cassandra_term_encode(&term, 0, 1, -1, 0, 0, 0);
+    char* s = malloc(len + 1);
+    cassandra_term_encode(&term, 0, 1, -1, 0, s, len + 1);
+    cassandra_term_compress(&s, len, 5);
+    CHECK((unsigned char) s[0] == CASSANDRA_TAG_LANGUAGE);
+
+    free(s);
+    free(t);
+    free(text);
+
+}
+
+/* The parts of a term to encode, and whether the text encoding keeps
+   all of it. */
+typedef struct {
+    librdf_node_type type;
+    const char* value;
+    const char* datatype;
+    const char* language;
+    int text;
+} test_term;
+
+static librdf_node*
+test_term_node(librdf_world* world, const test_term* t)
+{
+
+    if (t->type == LIBRDF_NODE_TYPE_RESOURCE)
+	return librdf_new_node_from_uri_string(world, (const unsigned char*)
+					       t->value);
+
+    if (t->type == LIBRDF_NODE_TYPE_BLANK)
+	return librdf_new_node_from_blank_identifier(world,
+						     (const unsigned char*)
+						     t->value);
+
+    librdf_uri* dt = t->datatype ?
+	librdf_new_uri(world, (const unsigned char*) t->datatype) : 0;
+    librdf_node* node =
+	librdf_new_node_from_typed_literal(world, (const unsigned char*)
+					   t->value, t->language, dt);
+    if (dt)
+	librdf_free_uri(dt);
+
+    return node;
+
+}
+
+/* Encodes a term, first into a buffer too small for it, and decodes
+   it again.  Returns the encoding, which the caller frees. */
+static char*
+test_encode(librdf_storage_cassandra_instance* context, const test_term* t,
+	    int sortable, int compact, int ns, size_t ns_len)
+{
+
+    cassandra_term term = { t->type, t->value, t->datatype, t->language };
+    char small[4];
+
+    size_t len = cassandra_term_encode(&term, sortable, compact, ns, ns_len,
+				       small, sizeof(small));
+    CHECK(len >= sizeof(small));
+
+    char* buf = malloc(len + 1);
+    CHECK(cassandra_term_encode(&term, sortable, compact, ns, ns_len, buf,
+				len + 1) == len);
+    CHECK(strlen(buf) == len);
+
+    librdf_world* world = context->storage->world;
+    librdf_node* expected = test_term_node(world, t);
+    librdf_node* decoded = node_decode(context, buf, len);
+
+    CHECK(decoded != 0);
+    if (decoded) {
+	CHECK(librdf_node_equals(expected, decoded));
+	librdf_free_node(decoded);
+    }
+    librdf_free_node(expected);
+
+    return buf;
+
+}
+
+static void
+test_terms(librdf_storage_cassandra_instance* context)
+{
+
+    static const test_term terms[] = {
+	{ LIBRDF_NODE_TYPE_RESOURCE, "http://example.org/a#b", 0, 0, 1 },
+	{ LIBRDF_NODE_TYPE_BLANK, "b0", 0, 0, 1 },
+	{ LIBRDF_NODE_TYPE_LITERAL, "hello", 0, 0, 1 },
+	{ LIBRDF_NODE_TYPE_LITERAL, "\001\002\377", 0, 0, 1 },
+	{ LIBRDF_NODE_TYPE_LITERAL, "bonjour", 0, "fr", 0 },
+	{ LIBRDF_NODE_TYPE_LITERAL, "42", TEST_XSD "integer", 0, 1 },
+	{ LIBRDF_NODE_TYPE_LITERAL, "-9223372036854775808",
+	  TEST_XSD "integer", 0, 1 },
+	{ LIBRDF_NODE_TYPE_LITERAL, "abc", TEST_XSD "integer", 0, 1 },
+	{ LIBRDF_NODE_TYPE_LITERAL, "-1.5e3", TEST_XSD "float", 0, 1 },
+	{ LIBRDF_NODE_TYPE_LITERAL, "2020-02-29T23:59:59Z",
+	  TEST_XSD "dateTime", 0, 1 },
+	{ LIBRDF_NODE_TYPE_LITERAL, "x", TEST_XSD "boolean", 0, 0 },
+	{ LIBRDF_NODE_TYPE_LITERAL, "x", "http://example.org/dt", 0, 0 }
+    };
+    size_t i;
+    int sortable, compact;
+
+    for(i = 0; i < sizeof(terms) / sizeof(terms[0]); i++)
+	for(compact = 0; compact <= 1; compact++)
+	    for(sortable = 0; sortable <= 1; sortable++)
+		if (compact || terms[i].text)
+		    free(test_encode(context, &terms[i], sortable, compact,
+				     -1, 0));
+
+    /* A term which doesn't decode. */
+    static const char bad[] = { CASSANDRA_TAG_URI, 10, 'a', 0 };
+    CHECK(node_decode(context, bad, 3) == 0);
+
+}
+
+/* A URI in a known namespace is written as the namespace's id and the
+   rest of the URI. */
+static void
+test_namespace_terms(librdf_storage_cassandra_instance* context)
+{
+
+    static const test_term uri = {
+	LIBRDF_NODE_TYPE_RESOURCE, "http://example.org/a#b", 0, 0, 1
+    };
+    const char* ns = "http://example.org/a#";
+
+    context->namespace_dict = cassandra_dict_create(16);
+    cassandra_dict_put(context->namespace_dict, ns, strlen(ns), 300);
+
+    CHECK(cassandra_namespace_split(uri.value, strlen(uri.value)) ==
+	  strlen(ns));
+
+    char* t = test_encode(context, &uri, 0, 1, 300, strlen(ns));
+    CHECK((unsigned char) t[0] == CASSANDRA_TAG_NAMESPACE);
+    CHECK(strlen(t) < strlen(uri.value));
+    free(t);
+
+    cassandra_dict_free(context->namespace_dict);
+    context->namespace_dict = 0;
+
+}
+
+/* A range find for a SPARQL filter also reads the objects without a
+   sortable encoding, such as decimals, which the filter may match. */
+static void
+test_range_rest(librdf_storage_cassandra_instance* context)
+{
+
+    static const struct {
+	const char* value;
+	const char* datatype;
+	int sorted;		/* Found by the sortable slices */
+	int rest;		/* Found by the rest */
+    } objects[] = {
+	{ "31", TEST_XSD "integer", 1, 0 },
+	{ "30.5", TEST_XSD "float", 1, 0 },
+	{ "29", TEST_XSD "integer", 0, 0 },
+	{ "30.5", TEST_XSD "decimal", 0, 1 },
+	{ "31", TEST_XSD "int", 0, 1 },
+	{ "3.1e1", TEST_XSD "double", 0, 1 },
+	{ "abc", TEST_XSD "integer", 0, 1 },
+	{ "2020-02-29T23:59:59Z", TEST_XSD "dateTime", 0, 0 },
+	{ "http://example.org/a#b", 0, 0, 1 }
+    };
+    cassandra_range_bound lower = { 'i', 30, 0, 0 };
+    int compact, rest, i, j;
+
+    context->sortable = 1;
+    context->lookup_parallelism = 4;
+
+    for(compact = 0; compact <= 1; compact++)
+	for(rest = 0; rest <= 1; rest++) {
+
+	    context->compact = compact;
+	    cassandra_scan_stream* scontext =
+		cassandra_range_stream_alloc(context->storage, "p", &lower, 0,
+					     rest);
+	    CHECK(scontext != 0);
+	    if (scontext == 0)
+		continue;
+
+	    for(i = 0; i < (int) (sizeof(objects) / sizeof(objects[0])); i++) {
+
+		cassandra_term term = {
+		    objects[i].datatype ? LIBRDF_NODE_TYPE_LITERAL :
+		    LIBRDF_NODE_TYPE_RESOURCE, objects[i].value,
+		    objects[i].datatype, 0
+		};
+		char t[64];
+		int in = 0;
+
+		cassandra_term_encode(&term, 1, compact, -1, 0, t, sizeof(t));
+		for(j = 0; j < scontext->parts_count; j++)
+		    if (strcmp(scontext->parts[j].terms[0], t) <= 0 &&
+			strcmp(t, scontext->parts[j].terms[2]) < 0)
+			in++;
+
+		CHECK(in == (objects[i].sorted || (rest && objects[i].rest)));
+
+	    }
+
+	    cassandra_scan_stream_finished((void*) scontext);
+
+	}
+
+    context->compact = 0;
+    context->sortable = 0;
+    context->lookup_parallelism = 0;
+
+}
+
+/* Whether a dateTime parses, and to micros if it does. */
+static int
+test_datetime(const char* value, int64_t micros)
+{
+
+    int64_t v;
+
+    return cassandra_parse_datetime(value, &v) == 0 && v == micros;
+
+}
+
+static void
+test_datetimes(void)
+{
+
+    static const char* bad[] = {
+	"", "2020", "2020-01-01", "2020-01-01T00:00", "2020-01-01T00:00:00.",
+	"2020-1-01T00:00:00Z", "2020-01-01T0:00:00Z", "20-01-01T00:00:00Z",
+	" 2020-01-01T00:00:00Z", "+2020-01-01T00:00:00Z",
+	"2020-01-01T00:00:00ZZ", "2020-01-01T00:00:00Z ",
+	"2020-01-01T00:00:00+01", "2020-01-01T00:00:00+1:00",
+	"2020-01-01T00:00:00+01:0", "2020-01-01T00:00:00+0100",
+	"2020-01-01T00:00:00+ 1:00", "2020-01-01T00:00:00+-1:00",
+	"2020-01-01T00:00:00+01:00x", "2020-01-01T00:00:00+15:00",
+	"2020-01-01T00:00:00+14:30", "2020-01-01T00:00:00+01:60",
+	"2020-13-01T00:00:00Z", "2020-01-01T24:00:01Z",
+	"2020-01-01T24:00:00.5Z", "02020-01-01T00:00:00Z",
+	"100000-01-01T00:00:00Z", "2147483647-01-01T00:00:00Z"
+    };
+    int64_t v;
+    int i;
+
+    CHECK(test_datetime("1970-01-01T00:00:00Z", 0));
+    CHECK(test_datetime("1970-01-01T00:00:01", 1000000));
+    CHECK(test_datetime("1970-01-01T00:00:00.5Z", 500000));
+    CHECK(test_datetime("1970-01-01T00:00:00.000001Z", 1));
+    CHECK(test_datetime("1970-01-01T00:00:00.1234567Z", 123456));
+    CHECK(test_datetime("1969-12-31T23:59:59.5Z", -500000));
+    CHECK(test_datetime("1970-01-01T24:00:00Z", 86400000000LL));
+
+    /* Offsets are taken off, to UTC. */
+    CHECK(test_datetime("1970-01-01T01:30:00+01:30", 0));
+    CHECK(test_datetime("1969-12-31T22:00:00-02:00", 0));
+    CHECK(test_datetime("1970-01-01T00:00:00.25+14:00",
+			-14 * 3600000000LL + 250000));
+    CHECK(test_datetime("1970-01-01T00:00:00-14:00", 14 * 3600000000LL));
+
+    /* Five digit years, either side of the epoch. */
+    CHECK(cassandra_parse_datetime("99999-12-31T23:59:59Z", &v) == 0 &&
+	  v > 0);
+    CHECK(cassandra_parse_datetime("-99999-01-01T00:00:00Z", &v) == 0 &&
+	  v < 0);
+
+    for(i = 0; i < (int) (sizeof(bad) / sizeof(bad[0])); i++)
+	CHECK(cassandra_parse_datetime(bad[i], &v) < 0);
+
+}
+
+/* Sortable encodings of increasing values of a type compare in order,
+   as bytes. */
+static void
+test_sort_order(const char* datatype, const char** values, int count)
+{
+
+    char* last[2] = { 0, 0 };
+    int i, compact;
+
+    for(i = 0; i < count; i++)
+	for(compact = 0; compact <= 1; compact++) {
+	    cassandra_term term = { LIBRDF_NODE_TYPE_LITERAL, values[i],
+				    datatype, 0 };
+	    size_t len = cassandra_term_encode(&term, 1, compact, -1, 0, 0, 0);
+	    char* t = malloc(len + 1);
+	    cassandra_term_encode(&term, 1, compact, -1, 0, t, len + 1);
+	    if (last[compact])
+		CHECK(strcmp(last[compact], t) < 0);
+	    free(last[compact]);
+	    last[compact] = t;
+	}
+
+    free(last[0]);
+    free(last[1]);
+
+}
+
+static void
+test_sortable(void)
+{
+
+    static const char* integers[] = {
+	"-9223372036854775808", "-1000000", "-2", "-1", "0", "1", "2",
+	"127", "128", "1000000", "9223372036854775807"
+    };
+    static const char* floats[] = {
+	"-1e300", "-1.5", "-1e-300", "0", "1e-300", "0.5", "2", "1e300"
+    };
+    static const char* datetimes[] = {
+	"1969-12-31T23:59:59Z", "1970-01-01T00:00:00Z",
+	"2020-02-29T23:59:59Z", "2020-03-01T00:00:00Z"
+    };
+
+    test_sort_order(TEST_XSD "integer", integers,
+		    sizeof(integers) / sizeof(integers[0]));
+    test_sort_order(TEST_XSD "float", floats,
+		    sizeof(floats) / sizeof(floats[0]));
+    test_sort_order(TEST_XSD "dateTime", datetimes,
+		    sizeof(datetimes) / sizeof(datetimes[0]));
+
+}
+
+/* Whether number v of a slice's type is within a range find's
+   bounds. */
+static int
+test_range_match(double v, const cassandra_range_bound* lower,
+		 const cassandra_range_bound* upper)
+{
+
+    if (lower) {
+	double b = (lower->type == 'f') ? lower->f : (double) lower->i;
+	if (v < b || (v == b && !lower->inclusive))
+	    return 0;
+    }
+
+    if (upper) {
+	double b = (upper->type == 'f') ? upper->f : (double) upper->i;
+	if (v > b || (v == b && !upper->inclusive))
+	    return 0;
+    }
+
+    return 1;
+
+}
+
+/* Checks that the keys of the slice of type, for the given bounds, take
+   in exactly the values within them. */
+static void
+test_range_slice(librdf_storage_cassandra_instance* context, char type,
+		 const cassandra_range_bound* lower,
+		 const cassandra_range_bound* upper)
+{
+
+    static const char* integers[] = {
+	"-9223372036854775808", "-31", "-30", "-29", "-1", "0", "1", "29",
+	"30", "31", "9223372036854775807"
+    };
+    static const char* floats[] = {
+	"-1e300", "-30.5", "-30", "-29.5", "0", "29.5", "30", "30.5", "31",
+	"1e300"
+    };
+    const char** values = (type == 'I') ? integers : floats;
+    int count = (type == 'I') ?
+	(int) (sizeof(integers) / sizeof(integers[0])) :
+	(int) (sizeof(floats) / sizeof(floats[0]));
+    char lo[CASSANDRA_SORT_PREFIX + 1];
+    char hi[CASSANDRA_SORT_PREFIX + 1];
+    int i;
+
+    int none = cassandra_range_key(context, type, lower, 0, lo) ||
+	cassandra_range_key(context, type, upper, 1, hi);
+
+    for(i = 0; i < count; i++) {
+
+	cassandra_term term = { LIBRDF_NODE_TYPE_LITERAL, values[i],
+				(type == 'I') ? TEST_XSD "integer" :
+				TEST_XSD "float", 0 };
+	char t[64];
+	cassandra_term_encode(&term, 1, context->compact, -1, 0, t,
+			      sizeof(t));
+
+	int in = !none && strcmp(lo, t) <= 0 && strcmp(t, hi) < 0;
+	CHECK(in == test_range_match(strtod(values[i], 0), lower, upper));
+
+    }
+
+}
+
+static void
+test_range_keys(librdf_storage_cassandra_instance* context)
+{
+
+    /* Integer, fractional and out of range bounds, each inclusive and
+       exclusive. */
+    static const cassandra_range_bound bounds[] = {
+	{ 'i', 30, 0, 1 }, { 'i', 30, 0, 0 }, { 'i', -30, 0, 0 },
+	{ 'f', 0, 30.5, 1 }, { 'f', 0, 30.5, 0 }, { 'f', 0, 30, 0 },
+	{ 'f', 0, 30, 1 }, { 'f', 0, -29.5, 1 }, { 'f', 0, -29.5, 0 },
+	{ 'f', 0, 1e19, 1 }, { 'f', 0, -1e19, 1 }
+    };
+    int n = (int) (sizeof(bounds) / sizeof(bounds[0]));
+    int compact, l, u;
+    const char* type;
+
+    for(compact = 0; compact <= 1; compact++) {
+	context->compact = compact;
+	for(type = "IF"; *type; type++)
+	    for(l = -1; l < n; l++)
+		for(u = -1; u < n; u++)
+		    test_range_slice(context, *type, (l < 0) ? 0 : &bounds[l],
+				     (u < 0) ? 0 : &bounds[u]);
+    }
+
+    context->compact = 0;
+
+}
+
+/* Rows of one partition of one table are brought together, and so
+   written together. */
+static void
+test_partition_rows(void)
+{
+
+    cassandra_triple t[3] = {
+	{ "s1", "p", "o1", 0 }, { "s2", "p", "o1", 0 }, { "s1", "q", "o2", 0 }
+    };
+    cassandra_pending_row rows[9];
+    int i, j;
+
+    for(i = 0; i < 3; i++) {
+	rows[i * 3].insert = CASSANDRA_INSERT_SPO;
+	rows[i * 3].key = t[i].s;
+	rows[i * 3 + 1].insert = CASSANDRA_INSERT_POS;
+	rows[i * 3 + 1].key = t[i].p;
+	rows[i * 3 + 2].insert = CASSANDRA_INSERT_OSP;
+	rows[i * 3 + 2].key = t[i].o;
+	for(j = 0; j < 3; j++) {
+	    rows[i * 3 + j].triple = &t[i];
+	    rows[i * 3 + j].bucket = 0;
+	}
+    }
+
+    /* In another bucket is another partition. */
+    rows[4].bucket = 1;
+
+    qsort(rows, 9, sizeof(cassandra_pending_row),
+	  &cassandra_pending_row_compare);
+
+    int groups = 1;
+    for(i = 1; i < 9; i++) {
+	int c = cassandra_pending_row_compare(&rows[i - 1], &rows[i]);
+	CHECK(c <= 0);
+	if (c)
+	    groups++;
+	/* A partition's rows are never split by another's. */
+	for(j = 0; j < i - 1; j++)
+	    if (cassandra_pending_row_compare(&rows[j], &rows[i]) == 0)
+		CHECK(cassandra_pending_row_compare(&rows[j],
+						    &rows[i - 1]) == 0);
+    }
+
+    /* s1 and s2 of spo, p in two buckets and q of pos, o1 and o2 of
+       osp. */
+    CHECK(groups == 7);
+    CHECK(rows[0].insert == CASSANDRA_INSERT_SPO &&
+	  !strcmp(rows[0].key, "s1") && !strcmp(rows[1].key, "s1"));
+
+}
+
+/* Each pattern is read from the index whose key starts with its bound
+   positions, with all of them bound. */
+static void
+test_plans(void)
+{
+
+    static const struct {
+	int pattern;
+	index_type index;
+    } expected[8] = {
+	{ 0, SPO }, { 1, SPO }, { 2, POS }, { 3, SPO },
+	{ 4, OSP }, { 5, OSP }, { 6, POS }, { 7, SPO }
+    };
+    int i, k;
+
+    for(i = 0; i < 8; i++) {
+
+	cassandra_plan plan;
+	CHECK(cassandra_plan_pattern(expected[i].pattern, &plan) == 0);
+	CHECK(plan.index == expected[i].index);
+	CHECK(plan.bound == ((i & 1) != 0) + ((i & 2) != 0) + ((i & 4) != 0));
+
+	for(k = 0; k < plan.bound; k++)
+	    CHECK(i & (1 << cassandra_indexes[plan.index].key[k]));
+
+    }
+
+}
+
+/* Writes the find queries of a layout, checks two of them, and frees
+   them. */
+static void
+test_plan_queries(librdf_storage_cassandra_instance* context,
+		  const char* po, const char* so, const char* remove_po)
+{
+
+    int i;
+
+    CHECK(cassandra_plan_queries(context) == 0);
+
+    CHECK(!strcmp(context->queries[6], po));
+    CHECK(!strcmp(context->queries[5], so));
+    CHECK(!strcmp(context->removes[6], remove_po));
+    CHECK(context->removes[0] == 0);
+
+    for(i = 0; i < 8; i++) {
+	free(context->queries[i]);
+	if (context->removes[i])
+	    free(context->removes[i]);
+	context->queries[i] = context->removes[i] = 0;
+	context->statements[CASSANDRA_QUERY_ + i] = 0;
+	context->statements[CASSANDRA_REMOVE_ + i] = 0;
+    }
+
+}
+
+static void
+test_queries(librdf_storage_cassandra_instance* context)
+{
+
+    test_plan_queries(context,
+		      "SELECT s, p, o FROM rdf.pos WHERE p = ? AND o = ?;",
+		      "SELECT s, p, o FROM rdf.osp WHERE o = ? AND s = ?;",
+		      "DELETE FROM rdf.pos WHERE p = ? AND o = ?;");
+
+    /* A bucketed partition is read a bucket at a time. */
+    context->max_buckets = 4;
+    test_plan_queries(context,
+		      "SELECT s, p, o FROM rdf.pos_buckets "
+		      "WHERE p = ? AND b = ? AND o = ?;",
+		      "SELECT s, p, o FROM rdf.osp_buckets "
+		      "WHERE o = ? AND b = ? AND s = ?;",
+		      "DELETE FROM rdf.pos_buckets "
+		      "WHERE p = ? AND b = ? AND o = ?;");
+    context->max_buckets = 0;
+
+    context->quads = 1;
+    test_plan_queries(context,
+		      "SELECT s, p, o, c FROM rdf.posc WHERE p = ? AND o = ?;",
+		      "SELECT s, p, o, c FROM rdf.ospc WHERE o = ? AND s = ?;",
+		      "DELETE FROM rdf.posc WHERE p = ? AND o = ?;");
+    context->quads = 0;
+
+}
+
+static void
+test_writes(void)
+{
+
+    cassandra_writes* w = cassandra_writes_create(0);
+    const char *s, *p, *o, *c;
+    char o_buf[32];
+    int i;
+
+    /* A triple is held once, with its last write. */
+    CHECK(cassandra_writes_put(w, "s", "p", "o", 0, 1) == 0);
+    CHECK(cassandra_writes_put(w, "s", "p", "o", 0, 1) == 0);
+    CHECK(cassandra_writes_count(w) == 1);
+    CHECK(cassandra_writes_get(w, "s", "p", "o", 0) == 1);
+    CHECK(cassandra_writes_put(w, "s", "p", "o", 0, 0) == 0);
+    CHECK(cassandra_writes_count(w) == 1);
+    CHECK(cassandra_writes_get(w, "s", "p", "o", 0) == 0);
+
+    /* In another context it is another triple. */
+    CHECK(cassandra_writes_put(w, "s", "p", "o", "g", 1) == 0);
+    CHECK(cassandra_writes_count(w) == 2);
+    CHECK(cassandra_writes_get(w, "s", "p", "o", "g") == 1);
+    CHECK(cassandra_writes_get(w, "s", "p", "x", 0) == -1);
+
+    /* Terms don't run into each other. */
+    CHECK(cassandra_writes_get(w, "sp", "", "o", 0) == -1);
+
+    /* In the order first written. */
+    CHECK(cassandra_writes_at(w, 0, &s, &p, &o, &c) == 0);
+    CHECK(!strcmp(s, "s") && !strcmp(p, "p") && !strcmp(o, "o") && !c);
+    CHECK(cassandra_writes_at(w, 1, &s, &p, &o, &c) == 1);
+    CHECK(c && !strcmp(c, "g"));
+
+    /* Enough to rebuild the table. */
+    for(i = 0; i < 10000; i++) {
+	sprintf(o_buf, "o%d", i);
+	CHECK(cassandra_writes_put(w, "s", "p", o_buf, 0, i & 1) == 0);
+    }
+    CHECK(cassandra_writes_count(w) == 10002);
+    CHECK(cassandra_writes_get(w, "s", "p", "o4321", 0) == 1);
+    CHECK(cassandra_writes_get(w, "s", "p", "o", 0) == 0);
+
+    cassandra_writes_free(w);
+
+    /* The memory cap refuses new triples, but not rewrites of held
+       ones. */
+    w = cassandra_writes_create(2000);
+    for(i = 0; i < 1000; i++) {
+	sprintf(o_buf, "o%d", i);
+	if (cassandra_writes_put(w, "s", "p", o_buf, 0, 1) < 0)
+	    break;
+    }
+    CHECK(i > 0 && i < 1000);
+    CHECK(cassandra_writes_bytes(w) <= 2000);
+    CHECK(cassandra_writes_count(w) == i);
+    CHECK(cassandra_writes_put(w, "s", "p", "o0", 0, 0) == 0);
+    CHECK(cassandra_writes_get(w, "s", "p", "o0", 0) == 0);
+    cassandra_writes_free(w);
+
+}
+
+static int test_freed = 0;
+
+static void
+test_cache_free(void* value)
+{
+    test_freed++;
+    free(value);
+}
+
+static void
+test_cache(void)
+{
+
+    cassandra_cache* c = cassandra_cache_create(3000, &test_cache_free);
+
+    CHECK(cassandra_cache_put(c, "a", 1, strdup("a"), 900) == 0);
+    CHECK(cassandra_cache_put(c, "b", 1, strdup("b"), 900) == 0);
+    CHECK(cassandra_cache_put(c, "c", 1, strdup("c"), 900) == 0);
+    CHECK(test_freed == 0);
+
+    /* a is used, so b is the least recently used. */
+    CHECK(cassandra_cache_get(c, "a", 1) != 0);
+    CHECK(cassandra_cache_put(c, "d", 1, strdup("d"), 900) == 0);
+    CHECK(test_freed == 1);
+    CHECK(cassandra_cache_get(c, "b", 1) == 0);
+    CHECK(!strcmp(cassandra_cache_get(c, "a", 1), "a"));
+    CHECK(cassandra_cache_get(c, "c", 1) != 0);
+    CHECK(cassandra_cache_get(c, "d", 1) != 0);
+
+    /* A value too big for the cache is refused, and left to the
+       caller. */
+    char* big = strdup("e");
+    CHECK(cassandra_cache_put(c, "e", 1, big, 5000) != 0);
+    CHECK(test_freed == 1);
+    free(big);
+
+    /* Keys are bytes, not strings. */
+    CHECK(cassandra_cache_put(c, "x\0y", 3, strdup("xy"), 1) == 0);
+    CHECK(cassandra_cache_get(c, "x", 1) == 0);
+    CHECK(cassandra_cache_get(c, "x\0y", 3) != 0);
+
+    cassandra_cache_free(c);
+    CHECK(test_freed == 5);
+
+}
+
+static void
+test_dict(void)
+{
+
+    cassandra_dict* d = cassandra_dict_create(2);
+    int64_t id;
+    size_t len;
+
+    CHECK(cassandra_dict_put(d, "t1", 2, 1) == 0);
+    CHECK(cassandra_dict_put(d, "t2", 2, 2) == 0);
+
+    /* t1 is used by term, so t2 is evicted. */
+    CHECK(cassandra_dict_get_id(d, "t1", 2, &id) && id == 1);
+    CHECK(cassandra_dict_put(d, "t3", 2, 3) == 0);
+    CHECK(!cassandra_dict_get_id(d, "t2", 2, &id));
+    CHECK(cassandra_dict_get_term(d, 2, &len) == 0);
+
+    /* And t1, used by id, outlives t3. */
+    const char* t = cassandra_dict_get_term(d, 1, &len);
+    CHECK(t && len == 2 && !memcmp(t, "t1", 2));
+    CHECK(cassandra_dict_put(d, "t4", 2, 4) == 0);
+    CHECK(!cassandra_dict_get_id(d, "t3", 2, &id));
+    CHECK(cassandra_dict_get_id(d, "t1", 2, &id) && id == 1);
+    CHECK(cassandra_dict_get_id(d, "t4", 2, &id) && id == 4);
+
+    cassandra_dict_free(d);
+
+    /* A term is first offered the same id by every client. */
+    CHECK(cassandra_dict_hash("term", 4) == cassandra_dict_hash("term", 4));
+    CHECK(cassandra_dict_hash("term", 4) != cassandra_dict_hash("terms", 5));
+
+}
+
+#ifdef HAVE_PTHREAD_H
+
+#define TEST_QUEUE_ITEMS 100000
+
+static void*
+test_queue_producer(void* arg)
+{
+
+    cassandra_queue* q = (cassandra_queue*) arg;
+    uintptr_t i;
+
+    for(i = 1; i <= TEST_QUEUE_ITEMS; i++)
+	cassandra_queue_push(q, (void*) i);
+
+    return 0;
+
+}
+
+static void*
+test_queue_consumer(void* arg)
+{
+
+    cassandra_queue* q = (cassandra_queue*) arg;
+    uint64_t* sum = malloc(sizeof(uint64_t));
+    void* item;
+
+    *sum = 0;
+    while (cassandra_queue_pop(q, &item))
+	*sum += (uintptr_t) item;
+
+    return sum;
+
+}
+
+#endif
+
+static void
+test_queue(void)
+{
+
+    cassandra_queue* q = cassandra_queue_create(3);
+    void* item;
+    uintptr_t i;
+
+    /* Rounded up to 4, which are taken without waiting. */
+    for(i = 1; i <= 4; i++)
+	cassandra_queue_push(q, (void*) i);
+
+    for(i = 1; i <= 4; i++)
+	CHECK(cassandra_queue_try_pop(q, &item) && (uintptr_t) item == i);
+    CHECK(!cassandra_queue_try_pop(q, &item));
+
+    cassandra_queue_push(q, (void*) 5);
+    cassandra_queue_close(q);
+    CHECK(cassandra_queue_pop(q, &item) && (uintptr_t) item == 5);
+    CHECK(!cassandra_queue_pop(q, &item));
+
+    cassandra_queue_free(q);
+
+#ifdef HAVE_PTHREAD_H
+
+    /* Two producers and two consumers through a small queue. */
+    pthread_t threads[4];
+    uint64_t total = 0;
+
+    q = cassandra_queue_create(8);
+    pthread_create(&threads[0], 0, &test_queue_producer, q);
+    pthread_create(&threads[1], 0, &test_queue_producer, q);
+    pthread_create(&threads[2], 0, &test_queue_consumer, q);
+    pthread_create(&threads[3], 0, &test_queue_consumer, q);
+
+    pthread_join(threads[0], 0);
+    pthread_join(threads[1], 0);
+    cassandra_queue_close(q);
+
+    for(i = 2; i < 4; i++) {
+	void* sum;
+	pthread_join(threads[i], &sum);
+	total += *(uint64_t*) sum;
+	free(sum);
+    }
+
+    CHECK(total == (uint64_t) TEST_QUEUE_ITEMS * (TEST_QUEUE_ITEMS + 1));
+
+    cassandra_queue_free(q);
+
+#endif
+
+}
+
+static void
+test_bloom(void)
+{
+
+    cassandra_bloom* b = cassandra_bloom_create(1000);
+    char buf[32];
+    int i, hits = 0;
+
+    for(i = 0; i < 1000; i++) {
+	sprintf(buf, "t%d", i);
+	cassandra_bloom_add(b, cassandra_bloom_hash(CASSANDRA_BLOOM_HASH_INIT,
+						    buf, strlen(buf)));
+    }
+
+    /* No false negatives. */
+    for(i = 0; i < 1000; i++) {
+	sprintf(buf, "t%d", i);
+	CHECK(cassandra_bloom_check(b, cassandra_bloom_hash(
+					CASSANDRA_BLOOM_HASH_INIT, buf,
+					strlen(buf))));
+    }
+
+    /* About 1% false positives. */
+    for(i = 0; i < 10000; i++) {
+	sprintf(buf, "u%d", i);
+	hits += cassandra_bloom_check(b, cassandra_bloom_hash(
+					  CASSANDRA_BLOOM_HASH_INIT, buf,
+					  strlen(buf)));
+    }
+    CHECK(hits < 300);
+
+    /* The length is mixed in, so where strings split doesn't matter. */
+    uint64_t ab = cassandra_bloom_hash(cassandra_bloom_hash(
+					   CASSANDRA_BLOOM_HASH_INIT, "a", 1),
+				       "b", 1);
+    uint64_t a_b = cassandra_bloom_hash(cassandra_bloom_hash(
+					    CASSANDRA_BLOOM_HASH_INIT, "ab", 2),
+					"", 0);
+    CHECK(ab != a_b);
+
+    cassandra_bloom_free(b);
+
+}
+
+int
+main(int argc, char** argv)
+{
+
+    librdf_world* world = librdf_new_world();
+    librdf_world_open(world);
+
+    /* Just enough of a storage to encode and decode terms. */
+    librdf_storage storage;
+    librdf_storage_cassandra_instance context;
+    int i;
+
+    memset(&storage, 0, sizeof(storage));
+    memset(&context, 0, sizeof(context));
+    storage.world = world;
+    storage.instance = &context;
+    context.storage = &storage;
+#ifdef HAVE_PTHREAD_H
+    pthread_mutex_init(&context.namespace_lock, 0);
+#endif
+    for(i = 0; i < CASSANDRA_NUM_DATATYPES; i++)
+	context.datatypes[i] =
+	    librdf_new_uri(world, (const unsigned char*) cassandra_datatypes[i]);
+
+    test_varint();
+    test_escape();
+    test_lz();
+    test_compressed(&context);
+    test_terms(&context);
+    test_namespace_terms(&context);
+    test_datetimes();
+    test_sortable();
+    test_range_keys(&context);
+    test_range_rest(&context);
+    test_partition_rows();
+    test_plans();
+    test_queries(&context);
+    test_writes();
+    test_cache();
+    test_dict();
+    test_queue();
+    test_bloom();
+
+    for(i = 0; i < CASSANDRA_NUM_DATATYPES; i++)
+	librdf_free_uri(context.datatypes[i]);
+    librdf_free_world(world);
+
+    if (failures) {
+	fprintf(stderr, "%d checks failed\n", failures);
+	return 1;
+    }
+
+    printf("All tests passed.\n");
+    return 0;
+
+}